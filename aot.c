@@ -0,0 +1,166 @@
+#include <string.h>
+#include "aot.h"
+
+/* The millisecond counter period, the timer one is a multiple of it */
+#define TICK_CYCLES (SISA_CPU_CLK_FREQ / 1000)
+
+int sisa_aot_itlb_check(const struct sisa_context *sisa, uint16_t vaddr)
+{
+	uint8_t vpn = vaddr >> SISA_PAGE_SHIFT;
+	int i;
+
+	/* Same lookup as the interpreter's fetch, without raising anything */
+	for (i = 0; i < SISA_NUM_TLB_ENTRIES; i++) {
+		if (sisa->itlb.entries[i].vpn == vpn) {
+			return sisa->itlb.entries[i].v && sisa->itlb.entries[i].pfn == vpn &&
+			       !(sisa->itlb.entries[i].p &&
+				 sisa->cpu.regfile.system.psw.m == SISA_CPU_MODE_USER);
+		}
+	}
+
+	return 0;
+}
+
+void sisa_aot_load(struct sisa_context *sisa, const struct sisa_aot_program *prog)
+{
+	unsigned int i;
+
+	for (i = 0; i < prog->num_segments; i++)
+		sisa_load_binary(sisa, prog->segments[i].addr, (void *)prog->segments[i].data,
+				 prog->segments[i].size);
+
+	sisa_tlb_set_enabled(sisa, prog->tlb_enabled);
+	sisa_set_pc(sisa, prog->entry_pc);
+}
+
+/* Whether anything is in use the translated code doesn't do, besides the code watch */
+static int aot_hooked(const struct sisa_context *sisa, int watch_id)
+{
+	int i;
+
+	if (sisa_stats_enabled() || sisa->coverage || sisa->breakpoint_num ||
+	    sisa->icache || sisa->dcache || sisa->cost || sisa->heatmap)
+		return 1;
+
+	for (i = 0; i < SISA_MAX_WRITE_WATCHES; i++) {
+		if (i != watch_id && sisa->write_watches[i].cb)
+			return 1;
+	}
+
+	return 0;
+}
+
+static int aot_code_matches(const struct sisa_context *sisa, const struct sisa_aot_program *prog)
+{
+	unsigned int i;
+
+	for (i = 0; i < prog->num_code; i++) {
+		if (memcmp(sisa->memory + prog->code[i].addr, prog->code[i].data,
+			   prog->code[i].size) != 0)
+			return 0;
+	}
+
+	return 1;
+}
+
+struct aot_code_watch {
+	const struct sisa_aot_program *prog;
+	int written;
+};
+
+/* Catches the stores the translated code doesn't see: the interpreter's and the embedder's */
+static void aot_code_written(struct sisa_context *sisa, uint16_t paddr, unsigned int size,
+			     void *arg)
+{
+	struct aot_code_watch *watch = arg;
+	const struct sisa_aot_range *range;
+	unsigned int i;
+
+	for (i = 0; i < watch->prog->num_code; i++) {
+		range = &watch->prog->code[i];
+		if (paddr < range->addr + range->size && paddr + size > range->addr)
+			watch->written = 1;
+	}
+}
+
+static uint16_t aot_code_pages(const struct sisa_aot_program *prog)
+{
+	uint16_t pages = 0;
+	unsigned int i, page;
+
+	for (i = 0; i < prog->num_code; i++) {
+		for (page = prog->code[i].addr >> SISA_PAGE_SHIFT;
+		     page <= (prog->code[i].addr + prog->code[i].size - 1u) >> SISA_PAGE_SHIFT; page++)
+			pages |= 1 << page;
+	}
+
+	return pages;
+}
+
+enum sisa_stop_reason sisa_aot_run(struct sisa_context *sisa, const struct sisa_aot_program *prog,
+				   uint64_t max_cycles)
+{
+	const uint64_t end = sisa->cpu.cycles + max_cycles;
+	struct aot_code_watch watch = { prog, 0 };
+	enum sisa_stop_reason reason;
+	int watch_id = -1;
+	uint64_t limit;
+
+	sisa->stop_requested = 0;
+
+	/* Checked once, the watch catches the changes from here on */
+	if (!aot_code_matches(sisa, prog))
+		watch.written = 1;
+	else if ((watch_id = sisa_write_watch_add(sisa, aot_code_pages(prog), aot_code_written,
+						  &watch)) < 0)
+		watch.written = 1;
+
+	while (sisa->cpu.cycles < end) {
+		if (sisa->cpu.halted) {
+			reason = SISA_STOP_HALT;
+			goto out;
+		}
+
+		/* Callbacks can add breakpoints and watches at any point */
+		if (!watch.written && sisa->cpu.status == SISA_CPU_STATUS_FETCH &&
+		    !aot_hooked(sisa, watch_id)) {
+			/* Blocks must end before the cycle that ticks */
+			limit = (sisa->cpu.cycles / TICK_CYCLES + 1) * TICK_CYCLES - 1;
+			if (limit > end)
+				limit = end;
+
+			if (prog->run(sisa, limit) == SISA_AOT_EXIT_CODE_WRITTEN)
+				watch.written = 1;
+
+			if (sisa->stop_requested) {
+				reason = SISA_STOP_CALLBACK;
+				goto out;
+			}
+
+			if (sisa->cpu.cycles >= end)
+				break;
+		}
+
+		sisa_step_cycle(sisa);
+
+		if (sisa->stop_requested) {
+			reason = SISA_STOP_CALLBACK;
+			goto out;
+		}
+
+		if (sisa->breakpoint_num && sisa_breakpoint_reached(sisa)) {
+			if (!sisa->callbacks.breakpoint ||
+			    sisa->callbacks.breakpoint(sisa, sisa->cpu.pc, sisa->callbacks.arg)) {
+				reason = SISA_STOP_BREAKPOINT;
+				goto out;
+			}
+		}
+	}
+
+	reason = sisa->cpu.halted ? SISA_STOP_HALT : SISA_STOP_CYCLES;
+
+out:
+	sisa_write_watch_remove(sisa, watch_id);
+
+	return reason;
+}
@@ -0,0 +1,98 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <stdint.h>
+#include "sisa.h"
+#include "image.h"
+
+/*
+ * Ahead-of-time translated programs, generated by sisa-aot. The generated
+ * C file defines a struct sisa_aot_program and is compiled against this
+ * header and linked with libsisa.
+ *
+ * The translated code only runs from instruction boundaries and only when
+ * it behaves exactly like the interpreter would: it gives up before timer
+ * and millisecond counter ticks, pending interrupts, the end of the cycle
+ * budget, ITLB mappings that are not the identity and any instruction it
+ * doesn't translate, and the interpreter carries on from there. It also
+ * returns right after an OUT whose callback called sisa_request_stop(),
+ * so the run stops on the same cycle the interpreter would.
+ * sisa_aot_run() interprets while stats, coverage, breakpoints, write
+ * watches, caches, cost models or heatmaps are in use, checked every
+ * time it could enter translated code, so callbacks can add and remove
+ * them. A code image that doesn't match the
+ * translated one is interpreted for the whole run, and so is the rest of
+ * the run after a store to the translated code, made by the translated
+ * code itself, the interpreter or anything calling sisa_memory_written().
+ * The latter ones are caught with a write watch, so the interpreted
+ * cycles in between run the instrumented interpreter.
+ */
+enum sisa_aot_exit {
+	SISA_AOT_EXIT_FALLBACK,
+	SISA_AOT_EXIT_CODE_WRITTEN,
+};
+
+/* Memory the translation was made from, checked before running it */
+struct sisa_aot_range {
+	uint16_t addr;
+	uint16_t size;
+	const uint8_t *data;
+};
+
+struct sisa_aot_program {
+	/* Runs translated blocks from cpu.pc, never past limit cycles */
+	enum sisa_aot_exit (*run)(struct sisa_context *sisa, uint64_t limit);
+	const struct sisa_aot_range *code;
+	unsigned int num_code;
+	/* The whole image the program was translated from */
+	const struct sisa_image_segment *segments;
+	unsigned int num_segments;
+	uint16_t entry_pc;
+	int tlb_enabled;
+	unsigned int num_blocks;
+};
+
+/* Copies the program image into memory and sets the PC and TLB enable */
+void sisa_aot_load(struct sisa_context *sisa, const struct sisa_aot_program *prog);
+
+/* Same as sisa_run(), running translated code where possible */
+enum sisa_stop_reason sisa_aot_run(struct sisa_context *sisa, const struct sisa_aot_program *prog,
+				   uint64_t max_cycles);
+
+/* Helpers for the generated code */
+int sisa_aot_itlb_check(const struct sisa_context *sisa, uint16_t vaddr);
+
+static inline int sisa_aot_dtlb(struct sisa_context *sisa, uint16_t vaddr, uint16_t *paddr,
+				int word_access, int write)
+{
+	if (!sisa->tlb_enabled) {
+		*paddr = vaddr;
+		return 1;
+	}
+
+	return sisa_dtlb_access(sisa, vaddr, paddr, word_access, write);
+}
+
+/* Whether instructions from first to last can be fetched without going through the ITLB */
+static inline int sisa_aot_itlb_identity(const struct sisa_context *sisa, uint16_t first,
+					 uint16_t last)
+{
+	return !sisa->tlb_enabled ||
+	       (sisa_aot_itlb_check(sisa, first) && sisa_aot_itlb_check(sisa, last));
+}
+
+static inline uint16_t sisa_aot_sha(uint16_t a, uint16_t b)
+{
+	int shift = (b & 0x10) ? (int)(b & 0x1F) - 32 : (int)(b & 0x1F);
+
+	return shift > 0 ? (int16_t)a << shift : (int16_t)a >> -shift;
+}
+
+static inline uint16_t sisa_aot_shl(uint16_t a, uint16_t b)
+{
+	int shift = (b & 0x10) ? (int)(b & 0x1F) - 32 : (int)(b & 0x1F);
+
+	return shift > 0 ? a << shift : a >> -shift;
+}
+
+#endif
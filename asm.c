@@ -0,0 +1,885 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <errno.h>
+#include "asm.h"
+
+#define MAX_LINE     1024
+#define MAX_OPERANDS 4
+
+enum operand_format {
+	FMT_NONE,	/* EI */
+	FMT_D_A_B,	/* ADD Rd, Ra, Rb */
+	FMT_D_A,	/* NOT Rd, Ra and JAL Rd, Ra */
+	FMT_D_A_IMM6,	/* ADDI Rd, Ra, imm */
+	FMT_D_MEM,	/* LD Rd, off(Ra) */
+	FMT_MEM_B,	/* ST off(Ra), Rb */
+	FMT_D_IMM8,	/* MOVI Rd, imm */
+	FMT_B_BRANCH,	/* BZ Rb, target */
+	FMT_D_PORT,	/* IN Rd, port */
+	FMT_PORT_B,	/* OUT port, Rb */
+	FMT_B_A,	/* JZ Rb, Ra */
+	FMT_A,		/* JMP Ra */
+	FMT_D,		/* GETIID Rd */
+	FMT_D_S,	/* RDS Rd, Sa */
+	FMT_S_A,	/* WRS Sd, Ra */
+	FMT_A_B,	/* WRPI Ra, Rb */
+	FMT_LI,		/* LI Rd, imm16 */
+};
+
+struct mnemonic {
+	const char *name;
+	uint16_t base;
+	enum operand_format format;
+	/* LD/ST offsets are in words */
+	int shift;
+};
+
+#define OP(opcode)          ((opcode) << 12)
+#define AL(f)               (OP(SISA_OPCODE_ARIT_LOGIC) | (f) << 3)
+#define CMP(f)              (OP(SISA_OPCODE_COMPARE) | (f) << 3)
+#define MD(f)               (OP(SISA_OPCODE_MULT_DIV) | (f) << 3)
+#define F8(opcode, f)       (OP(opcode) | (f) << 8)
+#define AJ(f)               (OP(SISA_OPCODE_ABSOLUTE_JUMP) | (f))
+#define SPECIAL(f)          (OP(SISA_OPCODE_SPECIAL) | (f))
+
+static const struct mnemonic mnemonics[] = {
+	{ "AND",    AL(SISA_INSTR_ARIT_LOGIC_F_AND),  FMT_D_A_B },
+	{ "OR",     AL(SISA_INSTR_ARIT_LOGIC_F_OR),   FMT_D_A_B },
+	{ "XOR",    AL(SISA_INSTR_ARIT_LOGIC_F_XOR),  FMT_D_A_B },
+	{ "NOT",    AL(SISA_INSTR_ARIT_LOGIC_F_NOT),  FMT_D_A },
+	{ "ADD",    AL(SISA_INSTR_ARIT_LOGIC_F_ADD),  FMT_D_A_B },
+	{ "SUB",    AL(SISA_INSTR_ARIT_LOGIC_F_SUB),  FMT_D_A_B },
+	{ "SHA",    AL(SISA_INSTR_ARIT_LOGIC_F_SHA),  FMT_D_A_B },
+	{ "SHL",    AL(SISA_INSTR_ARIT_LOGIC_F_SHL),  FMT_D_A_B },
+	{ "CMPLT",  CMP(SISA_INSTR_COMPARE_F_CMPLT),  FMT_D_A_B },
+	{ "CMPLE",  CMP(SISA_INSTR_COMPARE_F_CMPLE),  FMT_D_A_B },
+	{ "CMPEQ",  CMP(SISA_INSTR_COMPARE_F_CMPEQ),  FMT_D_A_B },
+	{ "CMPLTU", CMP(SISA_INSTR_COMPARE_F_CMPLTU), FMT_D_A_B },
+	{ "CMPLEU", CMP(SISA_INSTR_COMPARE_F_CMPLEU), FMT_D_A_B },
+	{ "ADDI",   OP(SISA_OPCODE_ADDI),             FMT_D_A_IMM6 },
+	{ "LD",     OP(SISA_OPCODE_LOAD),             FMT_D_MEM, 1 },
+	{ "ST",     OP(SISA_OPCODE_STORE),            FMT_MEM_B, 1 },
+	{ "LDB",    OP(SISA_OPCODE_LOAD_BYTE),        FMT_D_MEM },
+	{ "STB",    OP(SISA_OPCODE_STORE_BYTE),       FMT_MEM_B },
+	{ "MOVI",   F8(SISA_OPCODE_MOV, SISA_INSTR_MOV_F_MOVI),   FMT_D_IMM8 },
+	{ "MOVHI",  F8(SISA_OPCODE_MOV, SISA_INSTR_MOV_F_MOVHI),  FMT_D_IMM8 },
+	{ "BZ",     F8(SISA_OPCODE_RELATIVE_JUMP, SISA_INSTR_RELATIVE_JUMP_F_BZ),  FMT_B_BRANCH },
+	{ "BNZ",    F8(SISA_OPCODE_RELATIVE_JUMP, SISA_INSTR_RELATIVE_JUMP_F_BNZ), FMT_B_BRANCH },
+	{ "IN",     F8(SISA_OPCODE_IN_OUT, SISA_INSTR_IN_OUT_F_IN),   FMT_D_PORT },
+	{ "OUT",    F8(SISA_OPCODE_IN_OUT, SISA_INSTR_IN_OUT_F_OUT),  FMT_PORT_B },
+	{ "MUL",    MD(SISA_INSTR_MULT_DIV_F_MUL),    FMT_D_A_B },
+	{ "MULH",   MD(SISA_INSTR_MULT_DIV_F_MULH),   FMT_D_A_B },
+	{ "MULHU",  MD(SISA_INSTR_MULT_DIV_F_MULHU),  FMT_D_A_B },
+	{ "DIV",    MD(SISA_INSTR_MULT_DIV_F_DIV),    FMT_D_A_B },
+	{ "DIVU",   MD(SISA_INSTR_MULT_DIV_F_DIVU),   FMT_D_A_B },
+	{ "JZ",     AJ(SISA_INSTR_ABSOLUTE_JUMP_F_JZ),    FMT_B_A },
+	{ "JNZ",    AJ(SISA_INSTR_ABSOLUTE_JUMP_F_JNZ),   FMT_B_A },
+	{ "JMP",    AJ(SISA_INSTR_ABSOLUTE_JUMP_F_JMP),   FMT_A },
+	{ "JAL",    AJ(SISA_INSTR_ABSOLUTE_JUMP_F_JAL),   FMT_D_A },
+	{ "CALLS",  AJ(SISA_INSTR_ABSOLUTE_JUMP_F_CALLS), FMT_A },
+	{ "EI",     SPECIAL(SISA_INSTR_SPECIAL_F_EI),     FMT_NONE },
+	{ "DI",     SPECIAL(SISA_INSTR_SPECIAL_F_DI),     FMT_NONE },
+	{ "RETI",   SPECIAL(SISA_INSTR_SPECIAL_F_RETI),   FMT_NONE },
+	{ "GETIID", SPECIAL(SISA_INSTR_SPECIAL_F_GETIID), FMT_D },
+	{ "RDS",    SPECIAL(SISA_INSTR_SPECIAL_F_RDS),    FMT_D_S },
+	{ "WRS",    SPECIAL(SISA_INSTR_SPECIAL_F_WRS),    FMT_S_A },
+	{ "WRPI",   SPECIAL(SISA_INSTR_SPECIAL_F_WRPI),   FMT_A_B },
+	{ "WRVI",   SPECIAL(SISA_INSTR_SPECIAL_F_WRVI),   FMT_A_B },
+	{ "WRPD",   SPECIAL(SISA_INSTR_SPECIAL_F_WRPD),   FMT_A_B },
+	{ "WRVD",   SPECIAL(SISA_INSTR_SPECIAL_F_WRVD),   FMT_A_B },
+	{ "FLUSH",  SPECIAL(SISA_INSTR_SPECIAL_F_FLUSH),  FMT_NONE },
+	/* All ones, like the hardware's HALT */
+	{ "HALT",   0xFFFF,                               FMT_NONE },
+	{ "LI",     0,                                    FMT_LI },
+};
+
+#define NUM_MNEMONICS (sizeof(mnemonics) / sizeof(mnemonics[0]))
+
+static int asm_error(struct sisa_asm *as, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(as->error, sizeof(as->error), fmt, ap);
+	va_end(ap);
+
+	return 0;
+}
+
+void sisa_asm_init(struct sisa_asm *as, uint16_t text_origin, uint16_t data_origin)
+{
+	memset(as, 0, sizeof(*as));
+	as->sections[SISA_ASM_SECTION_TEXT].origin = text_origin;
+	as->sections[SISA_ASM_SECTION_DATA].origin = data_origin;
+}
+
+void sisa_asm_destroy(struct sisa_asm *as)
+{
+	free(as->symbols);
+	as->symbols = NULL;
+	as->num_symbols = 0;
+	as->max_symbols = 0;
+}
+
+static struct sisa_asm_symbol *symbol_find(const struct sisa_asm *as, const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < as->num_symbols; i++) {
+		if (strcmp(as->symbols[i].name, name) == 0)
+			return &as->symbols[i];
+	}
+
+	return NULL;
+}
+
+int sisa_asm_lookup(const struct sisa_asm *as, const char *name, uint16_t *value)
+{
+	const struct sisa_asm_symbol *sym = symbol_find(as, name);
+
+	if (!sym)
+		return 0;
+
+	*value = sym->value;
+
+	return 1;
+}
+
+static int symbol_define(struct sisa_asm *as, const char *name, uint16_t value)
+{
+	struct sisa_asm_symbol *symbols;
+
+	if (strlen(name) >= SISA_ASM_MAX_NAME)
+		return asm_error(as, "symbol name too long: '%s'", name);
+
+	if (symbol_find(as, name))
+		return asm_error(as, "symbol '%s' already defined", name);
+
+	if (as->num_symbols == as->max_symbols) {
+		as->max_symbols = as->max_symbols ? 2 * as->max_symbols : 64;
+		symbols = realloc(as->symbols, as->max_symbols * sizeof(*symbols));
+		if (!symbols)
+			return asm_error(as, "out of memory");
+		as->symbols = symbols;
+	}
+
+	strcpy(as->symbols[as->num_symbols].name, name);
+	as->symbols[as->num_symbols].value = value;
+	as->num_symbols++;
+
+	return 1;
+}
+
+static int is_ident_start(char c)
+{
+	return isalpha((unsigned char)c) || c == '_' || c == '.' || c == '$';
+}
+
+static int is_ident(char c)
+{
+	return isalnum((unsigned char)c) || c == '_' || c == '.' || c == '$';
+}
+
+static const char *skip_spaces(const char *p)
+{
+	while (*p == ' ' || *p == '\t')
+		p++;
+
+	return p;
+}
+
+/* Copies an identifier out of p, returns the end or NULL if there is none */
+static const char *parse_ident(const char *p, char *name, size_t size)
+{
+	size_t len = 0;
+
+	if (!is_ident_start(*p))
+		return NULL;
+
+	while (is_ident(p[len]))
+		len++;
+
+	if (len >= size)
+		len = size - 1;
+
+	memcpy(name, p, len);
+	name[len] = '\0';
+
+	while (is_ident(*p))
+		p++;
+
+	return p;
+}
+
+static int parse_char(struct sisa_asm *as, const char **p, int *c)
+{
+	if (**p == '\\') {
+		(*p)++;
+		switch (*(*p)++) {
+		case 'n':  *c = '\n'; break;
+		case 't':  *c = '\t'; break;
+		case 'r':  *c = '\r'; break;
+		case '0':  *c = '\0'; break;
+		case '\\': *c = '\\'; break;
+		case '\'': *c = '\''; break;
+		case '"':  *c = '"';  break;
+		default:
+			return asm_error(as, "invalid escape sequence");
+		}
+	} else if (**p == '\0') {
+		return asm_error(as, "unterminated literal");
+	} else {
+		*c = (unsigned char)*(*p)++;
+	}
+
+	return 1;
+}
+
+static int parse_expr(struct sisa_asm *as, const char **p, int32_t *value);
+
+static int parse_primary(struct sisa_asm *as, const char **p, int32_t *value)
+{
+	char name[SISA_ASM_MAX_NAME];
+	const struct sisa_asm_symbol *sym;
+	const char *end;
+	int c, is_lo;
+
+	*p = skip_spaces(*p);
+
+	if (**p == '-' || **p == '~' || **p == '+') {
+		c = *(*p)++;
+		if (!parse_primary(as, p, value))
+			return 0;
+		if (c == '-')
+			*value = -*value;
+		else if (c == '~')
+			*value = ~*value;
+		return 1;
+	}
+
+	if (**p == '(') {
+		(*p)++;
+		if (!parse_expr(as, p, value))
+			return 0;
+		*p = skip_spaces(*p);
+		if (*(*p)++ != ')')
+			return asm_error(as, "missing ')'");
+		return 1;
+	}
+
+	if (isdigit((unsigned char)**p)) {
+		if ((*p)[0] == '0' && ((*p)[1] == 'b' || (*p)[1] == 'B'))
+			*value = strtol(*p + 2, (char **)&end, 2);
+		else
+			*value = strtol(*p, (char **)&end, 0);
+		if (is_ident(*end))
+			return asm_error(as, "invalid number");
+		*p = end;
+		return 1;
+	}
+
+	if (**p == '\'') {
+		(*p)++;
+		if (!parse_char(as, p, &c))
+			return 0;
+		if (*(*p)++ != '\'')
+			return asm_error(as, "unterminated character constant");
+		*value = c;
+		return 1;
+	}
+
+	if (**p == '.' && !is_ident((*p)[1])) {
+		(*p)++;
+		*value = as->sections[as->section].pc;
+		return 1;
+	}
+
+	if (!(end = parse_ident(*p, name, sizeof(name))))
+		return asm_error(as, "expected an expression");
+	*p = end;
+
+	/* lo(x) and hi(x) */
+	if ((is_lo = strcasecmp(name, "lo") == 0) || strcasecmp(name, "hi") == 0) {
+		*p = skip_spaces(*p);
+		if (**p == '(') {
+			if (!parse_primary(as, p, value))
+				return 0;
+			*value = is_lo ? *value & 0xFF : (*value >> 8) & 0xFF;
+			return 1;
+		}
+	}
+
+	if (!(sym = symbol_find(as, name))) {
+		if (as->pass == 2)
+			return asm_error(as, "undefined symbol '%s'", name);
+		as->undefined = 1;
+		*value = 0;
+		return 1;
+	}
+
+	*value = sym->value;
+
+	return 1;
+}
+
+static int parse_term(struct sisa_asm *as, const char **p, int32_t *value)
+{
+	int32_t rhs;
+	char op;
+
+	if (!parse_primary(as, p, value))
+		return 0;
+
+	while (*(*p = skip_spaces(*p)) == '*' || **p == '/') {
+		op = *(*p)++;
+		if (!parse_primary(as, p, &rhs))
+			return 0;
+		if (op == '*') {
+			*value *= rhs;
+		} else if (rhs == 0) {
+			if (as->pass == 2)
+				return asm_error(as, "division by zero");
+			*value = 0;
+		} else {
+			*value /= rhs;
+		}
+	}
+
+	return 1;
+}
+
+static int parse_expr(struct sisa_asm *as, const char **p, int32_t *value)
+{
+	int32_t rhs;
+	char op;
+
+	if (!parse_term(as, p, value))
+		return 0;
+
+	while (*(*p = skip_spaces(*p)) == '+' || **p == '-') {
+		op = *(*p)++;
+		if (!parse_term(as, p, &rhs))
+			return 0;
+		*value = op == '+' ? *value + rhs : *value - rhs;
+	}
+
+	return 1;
+}
+
+/* Evaluates a whole operand, which must be nothing but an expression */
+static int eval(struct sisa_asm *as, const char *str, int32_t *value)
+{
+	if (!parse_expr(as, &str, value))
+		return 0;
+
+	if (*skip_spaces(str) != '\0')
+		return asm_error(as, "junk after expression: '%s'", str);
+
+	return 1;
+}
+
+/* Like eval(), but the value must be known in the first pass */
+static int eval_now(struct sisa_asm *as, const char *str, int32_t *value)
+{
+	as->undefined = 0;
+
+	if (!eval(as, str, value))
+		return 0;
+
+	if (as->undefined)
+		return asm_error(as, "expression uses a symbol defined later: '%s'", str);
+
+	return 1;
+}
+
+static int eval_range(struct sisa_asm *as, const char *str, int32_t min, int32_t max,
+		      int32_t *value)
+{
+	if (!eval(as, str, value))
+		return 0;
+
+	if (as->pass == 2 && (*value < min || *value > max))
+		return asm_error(as, "value %d out of range [%d, %d]", *value, min, max);
+
+	return 1;
+}
+
+static int parse_reg(struct sisa_asm *as, const char *str, char prefix, int *reg)
+{
+	str = skip_spaces(str);
+
+	if (toupper((unsigned char)str[0]) != prefix || str[1] < '0' || str[1] > '7' ||
+	    *skip_spaces(str + 2) != '\0')
+		return asm_error(as, "expected a register %c0-%c7, got '%s'", prefix, prefix, str);
+
+	*reg = str[1] - '0';
+
+	return 1;
+}
+
+/* off(Ra), off being optional */
+static int parse_mem(struct sisa_asm *as, char *str, int shift, int *reg, int32_t *offset)
+{
+	char *open = strrchr(str, '(');
+	char *close = strrchr(str, ')');
+	int32_t min = -32 << shift, max = 31 << shift;
+
+	if (!open || !close || close < open || *skip_spaces(close + 1) != '\0')
+		return asm_error(as, "expected a memory operand 'offset(Rn)', got '%s'", str);
+
+	*close = '\0';
+	*open = '\0';
+
+	if (!parse_reg(as, open + 1, 'R', reg))
+		return 0;
+
+	if (*skip_spaces(str) == '\0') {
+		*offset = 0;
+		return 1;
+	}
+
+	if (!eval_range(as, str, min, max, offset))
+		return 0;
+
+	if (as->pass == 2 && (*offset & ((1 << shift) - 1)))
+		return asm_error(as, "offset %d is not word aligned", *offset);
+
+	*offset = (*offset >> shift) & 0x3F;
+
+	return 1;
+}
+
+static int emit_byte(struct sisa_asm *as, uint8_t byte)
+{
+	struct sisa_asm_section *sec = &as->sections[as->section];
+
+	if (sec->pc >= SISA_MEMORY_SIZE)
+		return asm_error(as, "location counter past the end of memory");
+
+	if (as->pass == 2) {
+		as->memory[sec->pc] = byte;
+		if (sec->pc < sec->start)
+			sec->start = sec->pc;
+		if (sec->pc + 1 > sec->end)
+			sec->end = sec->pc + 1;
+	}
+
+	sec->pc++;
+
+	return 1;
+}
+
+static int emit_word(struct sisa_asm *as, uint16_t word)
+{
+	/* Little endian, like the guest */
+	return emit_byte(as, word & 0xFF) && emit_byte(as, word >> 8);
+}
+
+static int assemble_instr(struct sisa_asm *as, const struct mnemonic *m, char **ops, int num)
+{
+	static const int num_operands[] = {
+		[FMT_NONE] = 0, [FMT_D_A_B] = 3, [FMT_D_A] = 2, [FMT_D_A_IMM6] = 3,
+		[FMT_D_MEM] = 2, [FMT_MEM_B] = 2, [FMT_D_IMM8] = 2, [FMT_B_BRANCH] = 2,
+		[FMT_D_PORT] = 2, [FMT_PORT_B] = 2, [FMT_B_A] = 2, [FMT_A] = 1,
+		[FMT_D] = 1, [FMT_D_S] = 2, [FMT_S_A] = 2, [FMT_A_B] = 2, [FMT_LI] = 2,
+	};
+	uint16_t pc = as->sections[as->section].pc;
+	uint16_t instr = m->base;
+	int r1 = 0, r2 = 0, r3 = 0;
+	int32_t imm = 0;
+
+	if (num != num_operands[m->format])
+		return asm_error(as, "%s takes %d operands", m->name, num_operands[m->format]);
+
+	if (pc & 1)
+		return asm_error(as, "instruction at odd address 0x%04X", pc);
+
+	switch (m->format) {
+	case FMT_NONE:
+		break;
+	case FMT_D_A_B:
+		if (!parse_reg(as, ops[0], 'R', &r1) || !parse_reg(as, ops[1], 'R', &r2) ||
+		    !parse_reg(as, ops[2], 'R', &r3))
+			return 0;
+		instr |= r1 << 9 | r2 << 6 | r3;
+		break;
+	case FMT_D_A:
+		if (!parse_reg(as, ops[0], 'R', &r1) || !parse_reg(as, ops[1], 'R', &r2))
+			return 0;
+		instr |= r1 << 9 | r2 << 6;
+		break;
+	case FMT_D_A_IMM6:
+		if (!parse_reg(as, ops[0], 'R', &r1) || !parse_reg(as, ops[1], 'R', &r2) ||
+		    !eval_range(as, ops[2], -32, 31, &imm))
+			return 0;
+		instr |= r1 << 9 | r2 << 6 | (imm & 0x3F);
+		break;
+	case FMT_D_MEM:
+		if (!parse_reg(as, ops[0], 'R', &r1) || !parse_mem(as, ops[1], m->shift, &r2, &imm))
+			return 0;
+		instr |= r1 << 9 | r2 << 6 | imm;
+		break;
+	case FMT_MEM_B:
+		if (!parse_mem(as, ops[0], m->shift, &r2, &imm) || !parse_reg(as, ops[1], 'R', &r1))
+			return 0;
+		instr |= r1 << 9 | r2 << 6 | imm;
+		break;
+	case FMT_D_IMM8:
+		if (!parse_reg(as, ops[0], 'R', &r1) || !eval_range(as, ops[1], -128, 255, &imm))
+			return 0;
+		instr |= r1 << 9 | (imm & 0xFF);
+		break;
+	case FMT_B_BRANCH:
+		if (!parse_reg(as, ops[0], 'R', &r1) || !eval(as, ops[1], &imm))
+			return 0;
+		/* Relative to the next instruction, in words */
+		imm = (int32_t)(uint16_t)imm - (pc + 2);
+		if (as->pass == 2 && ((imm & 1) || imm < -256 || imm > 254))
+			return asm_error(as, "branch target out of range or unaligned");
+		instr |= r1 << 9 | ((imm >> 1) & 0xFF);
+		break;
+	case FMT_D_PORT:
+		if (!parse_reg(as, ops[0], 'R', &r1) || !eval_range(as, ops[1], 0, 255, &imm))
+			return 0;
+		instr |= r1 << 9 | imm;
+		break;
+	case FMT_PORT_B:
+		if (!eval_range(as, ops[0], 0, 255, &imm) || !parse_reg(as, ops[1], 'R', &r1))
+			return 0;
+		instr |= r1 << 9 | imm;
+		break;
+	case FMT_B_A:
+		if (!parse_reg(as, ops[0], 'R', &r1) || !parse_reg(as, ops[1], 'R', &r2))
+			return 0;
+		instr |= r1 << 9 | r2 << 6;
+		break;
+	case FMT_A:
+		if (!parse_reg(as, ops[0], 'R', &r2))
+			return 0;
+		instr |= r2 << 6;
+		break;
+	case FMT_D:
+		if (!parse_reg(as, ops[0], 'R', &r1))
+			return 0;
+		instr |= r1 << 9;
+		break;
+	case FMT_D_S:
+		if (!parse_reg(as, ops[0], 'R', &r1) || !parse_reg(as, ops[1], 'S', &r2))
+			return 0;
+		instr |= r1 << 9 | r2 << 6;
+		break;
+	case FMT_S_A:
+		if (!parse_reg(as, ops[0], 'S', &r1) || !parse_reg(as, ops[1], 'R', &r2))
+			return 0;
+		instr |= r1 << 9 | r2 << 6;
+		break;
+	case FMT_A_B:
+		if (!parse_reg(as, ops[0], 'R', &r2) || !parse_reg(as, ops[1], 'R', &r1))
+			return 0;
+		instr |= r1 << 9 | r2 << 6;
+		break;
+	case FMT_LI:
+		if (!parse_reg(as, ops[0], 'R', &r1) || !eval_range(as, ops[1], -32768, 65535, &imm))
+			return 0;
+		return emit_word(as, F8(SISA_OPCODE_MOV, SISA_INSTR_MOV_F_MOVI) | r1 << 9 |
+				 (imm & 0xFF)) &&
+		       emit_word(as, F8(SISA_OPCODE_MOV, SISA_INSTR_MOV_F_MOVHI) | r1 << 9 |
+				 ((imm >> 8) & 0xFF));
+	}
+
+	return emit_word(as, instr);
+}
+
+static int parse_string(struct sisa_asm *as, const char *str, int zero)
+{
+	int c;
+
+	str = skip_spaces(str);
+	if (*str++ != '"')
+		return asm_error(as, "expected a string");
+
+	while (*str != '"') {
+		if (!parse_char(as, &str, &c) || !emit_byte(as, c))
+			return 0;
+	}
+
+	if (*skip_spaces(str + 1) != '\0')
+		return asm_error(as, "junk after string");
+
+	return zero ? emit_byte(as, 0) : 1;
+}
+
+static int assemble_directive(struct sisa_asm *as, const char *name, char **ops, int num)
+{
+	struct sisa_asm_section *sec = &as->sections[as->section];
+	char sym[SISA_ASM_MAX_NAME];
+	const char *end;
+	int32_t value, fill = 0;
+	int i;
+
+	if (strcasecmp(name, ".text") == 0 || strcasecmp(name, ".data") == 0) {
+		if (num != 0)
+			return asm_error(as, "%s takes no operands", name);
+		as->section = strcasecmp(name, ".text") == 0 ? SISA_ASM_SECTION_TEXT :
+			      SISA_ASM_SECTION_DATA;
+	} else if (strcasecmp(name, ".org") == 0) {
+		if (num != 1 || !eval_now(as, ops[0], &value))
+			return num != 1 ? asm_error(as, ".org takes 1 operand") : 0;
+		if (value < 0 || value > 0xFFFF)
+			return asm_error(as, ".org address out of range");
+		sec->pc = value;
+	} else if (strcasecmp(name, ".word") == 0 || strcasecmp(name, ".byte") == 0) {
+		int word = strcasecmp(name, ".word") == 0;
+
+		for (i = 0; i < num; i++) {
+			if (!eval_range(as, ops[i], word ? -32768 : -128, word ? 65535 : 255, &value))
+				return 0;
+			if (!(word ? emit_word(as, value) : emit_byte(as, value)))
+				return 0;
+		}
+	} else if (strcasecmp(name, ".ascii") == 0 || strcasecmp(name, ".asciz") == 0) {
+		for (i = 0; i < num; i++) {
+			if (!parse_string(as, ops[i], strcasecmp(name, ".asciz") == 0))
+				return 0;
+		}
+	} else if (strcasecmp(name, ".space") == 0) {
+		if (num < 1 || num > 2 || !eval_now(as, ops[0], &value) ||
+		    (num == 2 && !eval_range(as, ops[1], -128, 255, &fill)))
+			return num < 1 || num > 2 ? asm_error(as, ".space takes 1 or 2 operands") : 0;
+		if (value < 0 || sec->pc + value > SISA_MEMORY_SIZE)
+			return asm_error(as, ".space size out of range");
+		while (value--) {
+			if (!emit_byte(as, fill))
+				return 0;
+		}
+	} else if (strcasecmp(name, ".align") == 0) {
+		if (num != 1 || !eval_now(as, ops[0], &value))
+			return num != 1 ? asm_error(as, ".align takes 1 operand") : 0;
+		if (value <= 0 || (value & (value - 1)))
+			return asm_error(as, ".align needs a power of two");
+		while (sec->pc & (value - 1)) {
+			if (!emit_byte(as, 0))
+				return 0;
+		}
+	} else if (strcasecmp(name, ".equ") == 0 || strcasecmp(name, ".set") == 0) {
+		if (num != 2)
+			return asm_error(as, "%s takes 2 operands", name);
+		end = parse_ident(skip_spaces(ops[0]), sym, sizeof(sym));
+		if (!end || *skip_spaces(end) != '\0')
+			return asm_error(as, "invalid symbol name '%s'", ops[0]);
+		if (as->pass == 1) {
+			if (!eval_now(as, ops[1], &value) || !symbol_define(as, sym, value))
+				return 0;
+		}
+	} else {
+		return asm_error(as, "unknown directive '%s'", name);
+	}
+
+	return 1;
+}
+
+/* Splits the operands at top level commas, outside of quotes and parentheses */
+static int split_operands(struct sisa_asm *as, char *p, char **ops)
+{
+	int num = 0, depth = 0;
+	char quote = 0;
+
+	p = (char *)skip_spaces(p);
+	if (*p == '\0')
+		return 0;
+
+	ops[num++] = p;
+
+	for (; *p; p++) {
+		if (quote) {
+			if (*p == '\\' && p[1])
+				p++;
+			else if (*p == quote)
+				quote = 0;
+		} else if (*p == '"' || *p == '\'') {
+			quote = *p;
+		} else if (*p == '(') {
+			depth++;
+		} else if (*p == ')') {
+			depth--;
+		} else if (*p == ',' && depth == 0) {
+			if (num == MAX_OPERANDS * 64)
+				return asm_error(as, "too many operands"), -1;
+			*p = '\0';
+			ops[num++] = (char *)skip_spaces(p + 1);
+		}
+	}
+
+	return num;
+}
+
+/* Cuts the line at the first comment character outside of quotes */
+static void strip_comment(char *p)
+{
+	char quote = 0;
+
+	for (; *p; p++) {
+		if (quote) {
+			if (*p == '\\' && p[1])
+				p++;
+			else if (*p == quote)
+				quote = 0;
+		} else if (*p == '"' || *p == '\'') {
+			quote = *p;
+		} else if (*p == ';' || *p == '#') {
+			*p = '\0';
+			return;
+		}
+	}
+}
+
+static int assemble_line(struct sisa_asm *as, char *line)
+{
+	char name[SISA_ASM_MAX_NAME];
+	char *ops[MAX_OPERANDS * 64];
+	char *p, *end;
+	int num;
+	unsigned int i;
+
+	strip_comment(line);
+
+	/* Trailing whitespace would end up in the last operand */
+	end = line + strlen(line);
+	while (end > line && isspace((unsigned char)end[-1]))
+		*--end = '\0';
+
+	p = (char *)skip_spaces(line);
+
+	/* Any number of labels */
+	while ((end = (char *)parse_ident(p, name, sizeof(name))) && *skip_spaces(end) == ':') {
+		if (as->pass == 1 && !symbol_define(as, name, as->sections[as->section].pc))
+			return 0;
+		p = (char *)skip_spaces(skip_spaces(end) + 1);
+	}
+
+	if (*p == '\0')
+		return 1;
+
+	if (!(end = (char *)parse_ident(p, name, sizeof(name))))
+		return asm_error(as, "syntax error: '%s'", p);
+
+	if ((num = split_operands(as, end, ops)) < 0)
+		return 0;
+
+	if (name[0] == '.')
+		return assemble_directive(as, name, ops, num);
+
+	for (i = 0; i < NUM_MNEMONICS; i++) {
+		if (strcasecmp(mnemonics[i].name, name) == 0)
+			return assemble_instr(as, &mnemonics[i], ops, num);
+	}
+
+	return asm_error(as, "unknown instruction '%s'", name);
+}
+
+int sisa_asm_mnemonic_encoding(const char *name, uint16_t *instr)
+{
+	int i;
+
+	for (i = 0; i < NUM_MNEMONICS; i++) {
+		if (mnemonics[i].format != FMT_LI && strcasecmp(mnemonics[i].name, name) == 0) {
+			*instr = mnemonics[i].base;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int assemble_pass(struct sisa_asm *as, const char *source, size_t size)
+{
+	char line[MAX_LINE];
+	const char *p = source, *end = source + size, *nl;
+	size_t len;
+	int i;
+
+	for (i = 0; i < SISA_ASM_NUM_SECTIONS; i++) {
+		as->sections[i].pc = as->sections[i].origin;
+		as->sections[i].start = SISA_MEMORY_SIZE;
+		as->sections[i].end = 0;
+	}
+	as->section = SISA_ASM_SECTION_TEXT;
+	as->line = 0;
+
+	while (p < end) {
+		as->line++;
+
+		if (!(nl = memchr(p, '\n', end - p)))
+			nl = end;
+
+		len = nl - p;
+		if (len >= sizeof(line))
+			return asm_error(as, "line too long");
+
+		memcpy(line, p, len);
+		line[len] = '\0';
+
+		if (!assemble_line(as, line))
+			return 0;
+
+		p = nl + 1;
+	}
+
+	return 1;
+}
+
+int sisa_asm_assemble(struct sisa_asm *as, const char *source, size_t size, uint8_t *memory)
+{
+	as->memory = memory;
+	as->num_symbols = 0;
+	as->error[0] = '\0';
+
+	as->pass = 1;
+	if (!assemble_pass(as, source, size))
+		return 0;
+
+	as->pass = 2;
+	if (!assemble_pass(as, source, size))
+		return 0;
+
+	as->line = 0;
+
+	return 1;
+}
+
+int sisa_asm_assemble_file(struct sisa_asm *as, const char *file, uint8_t *memory)
+{
+	FILE *fp;
+	char *source;
+	long size;
+	int ret;
+
+	as->line = 0;
+
+	if (!(fp = fopen(file, "r"))) {
+		asm_error(as, "%s", strerror(errno));
+		return 0;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	rewind(fp);
+
+	if (size < 0 || !(source = malloc(size + 1))) {
+		fclose(fp);
+		return asm_error(as, "out of memory");
+	}
+
+	size = fread(source, 1, size, fp);
+	fclose(fp);
+
+	ret = sisa_asm_assemble(as, source, size, memory);
+
+	free(source);
+
+	return ret;
+}
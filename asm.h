@@ -0,0 +1,77 @@
+#ifndef ASM_H
+#define ASM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "sisa.h"
+
+#define SISA_ASM_MAX_NAME   64
+#define SISA_ASM_ERROR_SIZE 160
+
+enum sisa_asm_section_id {
+	SISA_ASM_SECTION_TEXT,
+	SISA_ASM_SECTION_DATA,
+	SISA_ASM_NUM_SECTIONS,
+};
+
+struct sisa_asm_section {
+	uint16_t origin;
+	uint32_t pc;
+	/* Lowest address and one past the highest one emitted, start > end if empty */
+	uint32_t start;
+	uint32_t end;
+};
+
+struct sisa_asm_symbol {
+	char name[SISA_ASM_MAX_NAME];
+	uint16_t value;
+};
+
+/*
+ * Two pass assembler writing straight into a 64KiB memory image, usually
+ * sisa->memory. The context can be reused for any number of sources; the
+ * symbol table is reset (but not freed) on every call.
+ *
+ * Syntax: one statement per line, ';' or '#' start a comment.
+ *
+ *   label:  ADD R1, R2, R3        registers are R0-R7 and S0-S7
+ *           LD R1, 4(R2)          LD/ST offsets are in bytes and must be even
+ *           BNZ R1, label         branch targets are addresses
+ *           MOVI R1, lo(table)    lo() and hi() take the low and high bytes
+ *           LI R1, 0x1234         pseudo instruction, MOVI + MOVHI
+ *
+ * Expressions take decimal, 0x, 0b and 'c' constants, symbols, . (the
+ * location counter), unary -, ~ and + - * / with the usual precedence.
+ *
+ * Directives: .text, .data (switch section), .org ADDR, .word, .byte,
+ * .ascii, .asciz, .space N[, FILL], .align N, .equ/.set NAME, VALUE.
+ * The text and data sections start at the origins given to
+ * sisa_asm_init(). Expressions in .org, .space, .align and .equ may only
+ * use symbols defined above them.
+ */
+struct sisa_asm {
+	struct sisa_asm_section sections[SISA_ASM_NUM_SECTIONS];
+	enum sisa_asm_section_id section;
+	struct sisa_asm_symbol *symbols;
+	unsigned int num_symbols;
+	unsigned int max_symbols;
+	uint8_t *memory;
+	int pass;
+	int undefined;
+	unsigned int line;
+	char error[SISA_ASM_ERROR_SIZE];
+};
+
+void sisa_asm_init(struct sisa_asm *as, uint16_t text_origin, uint16_t data_origin);
+void sisa_asm_destroy(struct sisa_asm *as);
+
+/* Both return 1 on success, 0 with as->error (and as->line) set otherwise */
+int sisa_asm_assemble(struct sisa_asm *as, const char *source, size_t size, uint8_t *memory);
+int sisa_asm_assemble_file(struct sisa_asm *as, const char *file, uint8_t *memory);
+
+int sisa_asm_lookup(const struct sisa_asm *as, const char *name, uint16_t *value);
+
+/* Encoding of an instruction with all its operands zero, 0 if there's no such mnemonic */
+int sisa_asm_mnemonic_encoding(const char *name, uint16_t *instr);
+
+#endif
@@ -0,0 +1,452 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "bench.h"
+
+#define DEFAULT_CYCLES 50000000ULL
+
+/* Never fetched, PCs are even: only there to select the instrumented interpreter */
+#define UNREACHABLE_BREAKPOINT 0x0001
+
+/*
+ * How a program is run. The run modes go through sisa_run(), which fuses
+ * instruction pairs, with the interpreter variant the program's TLB setting
+ * picks, and with an unreachable breakpoint also the instrumented one.
+ */
+struct bench_mode {
+	const char *name;
+	int run;
+	int instr;
+};
+
+static const struct bench_mode bench_modes[] = {
+	{ "step", 0, 0 },
+	{ "run", 1, 0 },
+	{ "run-instr", 1, 1 },
+};
+
+#define BENCH_NUM_MODES (sizeof(bench_modes) / sizeof(bench_modes[0]))
+
+struct bench_case {
+	const struct bench_program *prog;
+	const struct bench_mode *mode;
+	char name[64];
+};
+
+struct bench_result {
+	uint64_t cycles;
+	uint64_t instructions;
+	double seconds;
+	long peak_rss_kb;
+};
+
+static void usage(char *argv[])
+{
+	printf("Usage: %s [OPTIONS] [PROGRAM...]\n\n"
+		"  -n, --cycles=N          cycles to run each program for\n"
+		"                            (defaults to %llu)\n"
+		"  -o, --output=FILE       writes the results as JSON to FILE\n"
+		"  -b, --baseline=FILE     compares against a previous JSON result\n"
+		"  -c, --commit=ID         commit id recorded in the JSON output\n"
+		"  -m, --mode=MODE         only runs the programs in MODE, can be repeated:\n"
+		"                            step (sisa_step_cycle), run (sisa_run with\n"
+		"                            fusion) or run-instr (sisa_run with the\n"
+		"                            instrumented interpreter), defaults to all\n"
+		"  -l, --list              lists the available programs and exit\n"
+		"  -h, --help              displays this help and exit\n"
+		, argv[0], DEFAULT_CYCLES);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void bench_setup(struct sisa_context *sisa, const struct bench_program *prog,
+			const struct bench_mode *mode)
+{
+	/* sisa_init() leaves the memory alone, so every pass starts the same */
+	memset(sisa, 0, sizeof(*sisa));
+	sisa_init(sisa);
+	bench_program_load(sisa, prog);
+
+	if (mode->instr)
+		sisa_add_breakpoint(sisa, UNREACHABLE_BREAKPOINT);
+}
+
+/* Interpreter copy sisa_run() uses for the program in mode, see sisa.c */
+static const char *bench_variant(const struct bench_program *prog,
+				 const struct bench_mode *mode)
+{
+	if (!mode->run)
+		return "step";
+
+	if (prog->tlb_enabled)
+		return mode->instr ? "tlb_instr" : "tlb";
+
+	return mode->instr ? "instr" : "plain";
+}
+
+static uint64_t bench_step(struct sisa_context *sisa, const struct bench_program *prog,
+			   uint64_t cycles)
+{
+	uint64_t instructions = 0;
+	uint64_t next_stimulus;
+
+	next_stimulus = prog->stimulus_period ? prog->stimulus_period : UINT64_MAX;
+
+	while (sisa->cpu.cycles < cycles && !sisa->cpu.halted) {
+		instructions += sisa->cpu.status == SISA_CPU_STATUS_DEMW;
+		sisa_step_cycle(sisa);
+
+		if (sisa->cpu.cycles == next_stimulus) {
+			sisa_key_toggle(sisa, 0);
+			next_stimulus += prog->stimulus_period;
+		}
+	}
+
+	return instructions;
+}
+
+static void bench_run_fused(struct sisa_context *sisa, const struct bench_program *prog,
+			    uint64_t cycles)
+{
+	uint64_t next_stimulus, end;
+
+	next_stimulus = prog->stimulus_period ? prog->stimulus_period : UINT64_MAX;
+
+	while (sisa->cpu.cycles < cycles && !sisa->cpu.halted) {
+		end = next_stimulus < cycles ? next_stimulus : cycles;
+
+		if (sisa_run(sisa, end - sisa->cpu.cycles) == SISA_STOP_HALT)
+			break;
+
+		if (sisa->cpu.cycles == next_stimulus) {
+			sisa_key_toggle(sisa, 0);
+			next_stimulus += prog->stimulus_period;
+		}
+	}
+}
+
+static void bench_run(const struct bench_case *bc, uint64_t cycles,
+		      struct bench_result *result)
+{
+	static struct sisa_context sisa;
+	uint64_t instructions = 0;
+	double start;
+
+	bench_setup(&sisa, bc->prog, bc->mode);
+
+	start = now();
+
+	if (bc->mode->run)
+		bench_run_fused(&sisa, bc->prog, cycles);
+	else
+		instructions = bench_step(&sisa, bc->prog, cycles);
+
+	result->seconds = now() - start;
+	result->cycles = sisa.cpu.cycles;
+
+	/*
+	 * sisa_run() doesn't stop between instructions to count them: step
+	 * the same cycles again, untimed, they run the same instructions
+	 */
+	if (bc->mode->run) {
+		sisa_destroy(&sisa);
+		bench_setup(&sisa, bc->prog, bc->mode);
+		instructions = bench_step(&sisa, bc->prog, result->cycles);
+	}
+
+	result->instructions = instructions;
+
+	sisa_destroy(&sisa);
+}
+
+/* Each case runs in its own process so the peak RSS is its own */
+static int bench_run_isolated(const struct bench_case *bc, uint64_t cycles,
+			      struct bench_result *result)
+{
+	int fds[2];
+	int status;
+	pid_t pid;
+	struct rusage usage;
+
+	if (pipe(fds) < 0)
+		return 0;
+
+	if ((pid = fork()) < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return 0;
+	} else if (pid == 0) {
+		close(fds[0]);
+		bench_run(bc, cycles, result);
+		_exit(write(fds[1], result, sizeof(*result)) == sizeof(*result) ? 0 : 1);
+	}
+
+	close(fds[1]);
+
+	if (read(fds[0], result, sizeof(*result)) != sizeof(*result)) {
+		close(fds[0]);
+		wait4(pid, &status, 0, &usage);
+		return 0;
+	}
+
+	close(fds[0]);
+
+	if (wait4(pid, &status, 0, &usage) < 0 || !WIFEXITED(status) ||
+	    WEXITSTATUS(status) != 0)
+		return 0;
+
+	result->peak_rss_kb = usage.ru_maxrss;
+
+	return 1;
+}
+
+static double ns_per_instr(const struct bench_result *result)
+{
+	if (result->instructions == 0)
+		return 0;
+
+	return result->seconds * 1e9 / result->instructions;
+}
+
+static double mips(const struct bench_result *result)
+{
+	if (result->seconds == 0)
+		return 0;
+
+	return result->instructions / result->seconds / 1e6;
+}
+
+/* Finds the ns/instruction of a case in a JSON file written by write_json() */
+static int baseline_lookup(const char *file, const char *name, double *value)
+{
+	FILE *fp;
+	char line[512];
+	char key[64];
+	char *p;
+	int found = 0;
+
+	if (!(fp = fopen(file, "r")))
+		return 0;
+
+	snprintf(key, sizeof(key), "\"name\": \"%s\"", name);
+
+	while (!found && fgets(line, sizeof(line), fp)) {
+		if (!strstr(line, key))
+			continue;
+
+		if ((p = strstr(line, "\"ns_per_instr\": ")))
+			found = sscanf(p + strlen("\"ns_per_instr\": "), "%lf", value) == 1;
+	}
+
+	fclose(fp);
+
+	return found;
+}
+
+static int write_json(const char *file, const char *commit, uint64_t cycles,
+		      const struct bench_case *cases,
+		      const struct bench_result *results, unsigned int num)
+{
+	FILE *fp;
+	unsigned int i;
+
+	if (!(fp = fopen(file, "w"))) {
+		printf("Error opening '%s': %s\n", file, strerror(errno));
+		return 0;
+	}
+
+	/* One result per line, so the file diffs and greps nicely */
+	fprintf(fp, "{\n  \"commit\": \"%s\",\n  \"cycles\": %llu,\n  \"results\": [\n",
+		commit ? commit : "", (unsigned long long)cycles);
+
+	for (i = 0; i < num; i++) {
+		fprintf(fp, "    {\"name\": \"%s\", \"variant\": \"%s\", "
+			"\"cycles\": %llu, \"instructions\": %llu, "
+			"\"seconds\": %.6f, \"ns_per_instr\": %.3f, \"mips\": %.3f, "
+			"\"peak_rss_kb\": %ld}%s\n",
+			cases[i].name, bench_variant(cases[i].prog, cases[i].mode),
+			(unsigned long long)results[i].cycles,
+			(unsigned long long)results[i].instructions,
+			results[i].seconds, ns_per_instr(&results[i]),
+			mips(&results[i]), results[i].peak_rss_kb,
+			i + 1 < num ? "," : "");
+	}
+
+	fprintf(fp, "  ]\n}\n");
+	fclose(fp);
+
+	return 1;
+}
+
+static const struct bench_program *find_program(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < bench_num_programs; i++) {
+		if (strcmp(bench_programs[i].name, name) == 0)
+			return &bench_programs[i];
+	}
+
+	return NULL;
+}
+
+static const struct bench_mode *find_mode(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < BENCH_NUM_MODES; i++) {
+		if (strcmp(bench_modes[i].name, name) == 0)
+			return &bench_modes[i];
+	}
+
+	return NULL;
+}
+
+/* Step cases keep the bare program name, so older results still compare */
+static void bench_case_init(struct bench_case *bc, const struct bench_program *prog,
+			    const struct bench_mode *mode)
+{
+	bc->prog = prog;
+	bc->mode = mode;
+
+	if (mode->run)
+		snprintf(bc->name, sizeof(bc->name), "%s/%s", prog->name, mode->name);
+	else
+		snprintf(bc->name, sizeof(bc->name), "%s", prog->name);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	unsigned int i, j;
+	unsigned int num = 0;
+	unsigned int prog_num = 0;
+	uint64_t cycles = DEFAULT_CYCLES;
+	const char *output = NULL;
+	const char *baseline = NULL;
+	const char *commit = NULL;
+	const struct bench_program **progs;
+	const struct bench_mode *mode;
+	int modes[BENCH_NUM_MODES] = { 0 };
+	int any_mode = 0;
+	struct bench_case *cases;
+	struct bench_result *results;
+	double base;
+	int ret = 0;
+
+	struct option long_options[] = {
+		{"cycles", required_argument, NULL, 'n'},
+		{"output", required_argument, NULL, 'o'},
+		{"baseline", required_argument, NULL, 'b'},
+		{"commit", required_argument, NULL, 'c'},
+		{"mode", required_argument, NULL, 'm'},
+		{"list", no_argument, NULL, 'l'},
+		{"help", no_argument, NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+
+	while ((opt = getopt_long(argc, argv, "n:o:b:c:m:lh", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'n':
+			cycles = strtoull(optarg, NULL, 10);
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'b':
+			baseline = optarg;
+			break;
+		case 'c':
+			commit = optarg;
+			break;
+		case 'm':
+			if (!(mode = find_mode(optarg))) {
+				printf("Unknown mode '%s'\n", optarg);
+				return -1;
+			}
+			modes[mode - bench_modes] = 1;
+			any_mode = 1;
+			break;
+		case 'l':
+			for (i = 0; i < bench_num_programs; i++)
+				printf("%-12s %s\n", bench_programs[i].name,
+				       bench_programs[i].description);
+			return 0;
+		case 'h':
+		default:
+			usage(argv);
+			return -1;
+		}
+	}
+
+	progs = calloc(bench_num_programs + argc, sizeof(*progs));
+
+	if (optind < argc) {
+		for (; optind < argc; optind++) {
+			if (!(progs[prog_num] = find_program(argv[optind]))) {
+				printf("Unknown program '%s'\n", argv[optind]);
+				return -1;
+			}
+			prog_num++;
+		}
+	} else {
+		for (i = 0; i < bench_num_programs; i++)
+			progs[prog_num++] = &bench_programs[i];
+	}
+
+	cases = calloc(prog_num * BENCH_NUM_MODES, sizeof(*cases));
+	results = calloc(prog_num * BENCH_NUM_MODES, sizeof(*results));
+
+	for (i = 0; i < prog_num; i++) {
+		for (j = 0; j < BENCH_NUM_MODES; j++) {
+			if (!any_mode || modes[j])
+				bench_case_init(&cases[num++], progs[i], &bench_modes[j]);
+		}
+	}
+
+	printf("%-22s %-10s %12s %12s %10s %10s %10s\n", "case", "variant", "instructions",
+	       "seconds", "ns/instr", "MIPS", "RSS (KiB)");
+
+	for (i = 0; i < num; i++) {
+		if (!bench_run_isolated(&cases[i], cycles, &results[i])) {
+			printf("%-22s failed\n", cases[i].name);
+			ret = -1;
+			continue;
+		}
+
+		printf("%-22s %-10s %12llu %12.3f %10.3f %10.2f %10ld", cases[i].name,
+		       bench_variant(cases[i].prog, cases[i].mode),
+		       (unsigned long long)results[i].instructions, results[i].seconds,
+		       ns_per_instr(&results[i]), mips(&results[i]),
+		       results[i].peak_rss_kb);
+
+		if (baseline && baseline_lookup(baseline, cases[i].name, &base) && base > 0)
+			printf("  (%+.1f%% vs baseline)",
+			       (ns_per_instr(&results[i]) - base) * 100.0 / base);
+
+		putchar('\n');
+	}
+
+	if (output && !write_json(output, commit, cycles, cases, results, num))
+		ret = -1;
+
+	free(progs);
+	free(cases);
+	free(results);
+
+	return ret;
+}
@@ -0,0 +1,76 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "../sisa.h"
+
+/* Instruction encoders, field layout as decoded by sisa_demw_execute */
+#define AL(f, d, a, b)   (0x0000 | (d) << 9 | (a) << 6 | (f) << 3 | (b))
+#define CMP(f, d, a, b)  (0x1000 | (d) << 9 | (a) << 6 | (f) << 3 | (b))
+#define ADDI(d, a, imm)  (0x2000 | (d) << 9 | (a) << 6 | ((imm) & 0x3F))
+#define LD(d, a, off)    (0x3000 | (d) << 9 | (a) << 6 | ((off) & 0x3F))
+#define ST(a, off, b)    (0x4000 | (b) << 9 | (a) << 6 | ((off) & 0x3F))
+#define MOVI(d, imm)     (0x5000 | (d) << 9 | ((imm) & 0xFF))
+#define MOVHI(d, imm)    (0x5100 | (d) << 9 | ((imm) & 0xFF))
+#define BZ(a, off)       (0x6000 | (a) << 9 | ((off) & 0xFF))
+#define BNZ(a, off)      (0x6100 | (a) << 9 | ((off) & 0xFF))
+#define IN(d, port)      (0x7000 | (d) << 9 | (port))
+#define OUT(port, b)     (0x7100 | (b) << 9 | (port))
+#define MD(f, d, a, b)   (0x8000 | (d) << 9 | (a) << 6 | (f) << 3 | (b))
+#define AJ(f, b, a)      (0xA000 | (b) << 9 | (a) << 6 | (f))
+#define LDB(d, a, off)   (0xD000 | (d) << 9 | (a) << 6 | ((off) & 0x3F))
+#define STB(a, off, b)   (0xE000 | (b) << 9 | (a) << 6 | ((off) & 0x3F))
+#define SPECIAL(f, d, a) (0xF000 | (d) << 9 | (a) << 6 | (f))
+
+#define AND(d, a, b)   AL(SISA_INSTR_ARIT_LOGIC_F_AND, d, a, b)
+#define OR(d, a, b)    AL(SISA_INSTR_ARIT_LOGIC_F_OR, d, a, b)
+#define XOR(d, a, b)   AL(SISA_INSTR_ARIT_LOGIC_F_XOR, d, a, b)
+#define NOT(d, a)      AL(SISA_INSTR_ARIT_LOGIC_F_NOT, d, a, 0)
+#define ADD(d, a, b)   AL(SISA_INSTR_ARIT_LOGIC_F_ADD, d, a, b)
+#define SUB(d, a, b)   AL(SISA_INSTR_ARIT_LOGIC_F_SUB, d, a, b)
+#define SHA(d, a, b)   AL(SISA_INSTR_ARIT_LOGIC_F_SHA, d, a, b)
+#define SHL(d, a, b)   AL(SISA_INSTR_ARIT_LOGIC_F_SHL, d, a, b)
+#define CMPLT(d, a, b) CMP(SISA_INSTR_COMPARE_F_CMPLT, d, a, b)
+#define CMPEQ(d, a, b) CMP(SISA_INSTR_COMPARE_F_CMPEQ, d, a, b)
+#define MUL(d, a, b)   MD(SISA_INSTR_MULT_DIV_F_MUL, d, a, b)
+#define MULH(d, a, b)  MD(SISA_INSTR_MULT_DIV_F_MULH, d, a, b)
+#define MULHU(d, a, b) MD(SISA_INSTR_MULT_DIV_F_MULHU, d, a, b)
+#define DIV(d, a, b)   MD(SISA_INSTR_MULT_DIV_F_DIV, d, a, b)
+#define DIVU(d, a, b)  MD(SISA_INSTR_MULT_DIV_F_DIVU, d, a, b)
+#define JMP(a)         AJ(SISA_INSTR_ABSOLUTE_JUMP_F_JMP, 0, a)
+#define CALLS(a)       AJ(SISA_INSTR_ABSOLUTE_JUMP_F_CALLS, 0, a)
+#define EI             SPECIAL(SISA_INSTR_SPECIAL_F_EI, 0, 0)
+#define DI             SPECIAL(SISA_INSTR_SPECIAL_F_DI, 0, 0)
+#define RETI           SPECIAL(SISA_INSTR_SPECIAL_F_RETI, 0, 0)
+#define GETIID(d)      SPECIAL(SISA_INSTR_SPECIAL_F_GETIID, d, 0)
+#define RDS(d, s)      SPECIAL(SISA_INSTR_SPECIAL_F_RDS, d, s)
+#define WRS(s, a)      SPECIAL(SISA_INSTR_SPECIAL_F_WRS, s, a)
+#define HALT           SPECIAL(SISA_INSTR_SPECIAL_F_HALT, 7, 7)
+
+/* Loads a 16 bit constant: MOVI sign extends, MOVHI then fixes the high byte */
+#define LI(d, imm)     MOVI(d, (imm) & 0xFF), MOVHI(d, ((imm) >> 8) & 0xFF)
+
+#define BENCH_MAX_SEGMENTS 2
+
+struct bench_segment {
+	uint16_t addr;
+	const uint16_t *words;
+	size_t num_words;
+};
+
+struct bench_program {
+	const char *name;
+	const char *description;
+	struct bench_segment segments[BENCH_MAX_SEGMENTS];
+	int tlb_enabled;
+	/* If non-zero, toggle key 0 every stimulus_period cycles */
+	unsigned int stimulus_period;
+};
+
+extern const struct bench_program bench_programs[];
+extern const unsigned int bench_num_programs;
+
+void bench_program_load(struct sisa_context *sisa, const struct bench_program *prog);
+
+#endif
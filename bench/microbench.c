@@ -0,0 +1,304 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include "bench.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC 1
+#endif
+
+#define DEFAULT_CYCLES 4000000ULL
+#define BLOCK_SIZE     64
+#define BLOCK_ADDR     SISA_CODE_LOAD_ADDR
+#define UNMAPPED_ADDR  0x4000
+
+/*
+ * Every case runs a block of BLOCK_SIZE copies of one instruction followed
+ * by JMP r7 back to the block. Faulting cases set s5 so that the exception
+ * handler is the block itself, so each copy measures the full entry path.
+ *
+ * Initial registers:
+ *   r0 = 0x1234 (operand), r1 = 3 (small operand, odd address),
+ *   r2 = 0x8000 (mapped data page), r3 = UNMAPPED_ADDR,
+ *   r4 = 7 (TLB entry), r5 = 0x7F (TLB value, shift by -1),
+ *   r6 = 0, r7 = BLOCK_ADDR (readonly kernel page)
+ */
+static const uint16_t init_regs[8] = {
+	0x1234, 3, 0x8000, UNMAPPED_ADDR, 7, 0x7F, 0, BLOCK_ADDR
+};
+
+struct micro_case {
+	const char *name;
+	uint16_t instr;
+	int tlb_enabled;
+	void (*setup)(struct sisa_context *sisa);
+};
+
+struct micro_result {
+	uint64_t attempts;
+	uint64_t guest_cycles;
+	double ns;
+	uint64_t ticks;
+};
+
+static void setup_dtlb_invalid(struct sisa_context *sisa)
+{
+	/* Entry 3 maps the 0x8000 page */
+	sisa->dtlb.entries[3].v = 0;
+}
+
+static void setup_itlb_miss(struct sisa_context *sisa)
+{
+	sisa->cpu.regfile.system.s5 = UNMAPPED_ADDR;
+	sisa->cpu.pc = UNMAPPED_ADDR;
+}
+
+static void setup_reti(struct sisa_context *sisa)
+{
+	sisa->cpu.regfile.system.s0 = sisa->cpu.regfile.system.s7;
+	sisa->cpu.regfile.system.s1 = BLOCK_ADDR;
+}
+
+static void setup_interrupt(struct sisa_context *sisa)
+{
+	/* Never acknowledged, so every EI takes the interrupt */
+	sisa->cpu.ints_pending = 1 << SISA_INTERRUPT_KEY;
+}
+
+#define WRPI(v, e)  SPECIAL(SISA_INSTR_SPECIAL_F_WRPI, v, e)
+#define WRVI(v, e)  SPECIAL(SISA_INSTR_SPECIAL_F_WRVI, v, e)
+#define WRPD(v, e)  SPECIAL(SISA_INSTR_SPECIAL_F_WRPD, v, e)
+#define WRVD(v, e)  SPECIAL(SISA_INSTR_SPECIAL_F_WRVD, v, e)
+#define FLUSH       SPECIAL(SISA_INSTR_SPECIAL_F_FLUSH, 0, 0)
+#define JZ(b, a)    AJ(SISA_INSTR_ABSOLUTE_JUMP_F_JZ, b, a)
+#define JNZ(b, a)   AJ(SISA_INSTR_ABSOLUTE_JUMP_F_JNZ, b, a)
+#define JAL(d, a)   AJ(SISA_INSTR_ABSOLUTE_JUMP_F_JAL, d, a)
+#define CMPLE(d, a, b)  CMP(SISA_INSTR_COMPARE_F_CMPLE, d, a, b)
+#define CMPLTU(d, a, b) CMP(SISA_INSTR_COMPARE_F_CMPLTU, d, a, b)
+#define CMPLEU(d, a, b) CMP(SISA_INSTR_COMPARE_F_CMPLEU, d, a, b)
+
+static const struct micro_case cases[] = {
+	{ "and",              AND(3, 0, 1) },
+	{ "or",               OR(3, 0, 1) },
+	{ "xor",              XOR(3, 0, 1) },
+	{ "not",              NOT(3, 0) },
+	{ "add",              ADD(3, 0, 1) },
+	{ "sub",              SUB(3, 0, 1) },
+	{ "sha left",         SHA(3, 0, 1) },
+	{ "sha right",        SHA(3, 0, 5) },
+	{ "shl left",         SHL(3, 0, 1) },
+	{ "shl right",        SHL(3, 0, 5) },
+	{ "cmplt",            CMPLT(3, 0, 1) },
+	{ "cmple",            CMPLE(3, 0, 1) },
+	{ "cmpeq",            CMPEQ(3, 0, 1) },
+	{ "cmpltu",           CMPLTU(3, 0, 1) },
+	{ "cmpleu",           CMPLEU(3, 0, 1) },
+	{ "addi",             ADDI(3, 0, -5) },
+	{ "ld",               LD(3, 2, 1) },
+	{ "ld tlb",           LD(3, 2, 1), 1 },
+	{ "st",               ST(2, 1, 0) },
+	{ "st tlb",           ST(2, 1, 0), 1 },
+	{ "ldb",              LDB(3, 2, 1) },
+	{ "ldb tlb",          LDB(3, 2, 1), 1 },
+	{ "stb",              STB(2, 1, 0) },
+	{ "stb tlb",          STB(2, 1, 0), 1 },
+	{ "movi",             MOVI(3, 0x34) },
+	{ "movhi",            MOVHI(3, 0x12) },
+	{ "bz taken",         BZ(6, 0) },
+	{ "bz not taken",     BZ(0, 0) },
+	{ "bnz taken",        BNZ(0, 0) },
+	{ "bnz not taken",    BNZ(6, 0) },
+	{ "in",               IN(3, SISA_IO_PORT_KEYS) },
+	{ "out",              OUT(SISA_IO_PORT_LEDS_GREEN, 0) },
+	{ "out kb clear",     OUT(SISA_IO_PORT_KB_CLEAR_CHAR, 0) },
+	{ "mul",              MUL(3, 0, 1) },
+	{ "mulh",             MULH(3, 0, 1) },
+	{ "mulhu",            MULHU(3, 0, 1) },
+	{ "div",              DIV(3, 0, 1) },
+	{ "divu",             DIVU(3, 0, 1) },
+	{ "jz taken",         JZ(6, 7) },
+	{ "jz not taken",     JZ(0, 7) },
+	{ "jnz taken",        JNZ(0, 7) },
+	{ "jnz not taken",    JNZ(6, 7) },
+	{ "jmp",              JMP(7) },
+	{ "jal",              JAL(3, 7) },
+	{ "ei",               EI },
+	{ "di",               DI },
+	{ "reti",             RETI, 0, setup_reti },
+	{ "getiid",           GETIID(3) },
+	{ "rds",              RDS(3, 4) },
+	{ "wrs",              WRS(4, 0) },
+	{ "wrpi",             WRPI(5, 4) },
+	{ "wrvi",             WRVI(5, 4) },
+	{ "wrpd",             WRPD(5, 4) },
+	{ "wrvd",             WRVD(5, 4) },
+	{ "flush",            FLUSH },
+	/* Exception entry paths into SISA_CPU_STATUS_SYSTEM */
+	{ "exc illegal",      0x9000 },
+	{ "exc illegal cmp",  CMP(0b010, 3, 0, 1) },
+	{ "exc div by zero",  DIV(3, 0, 6) },
+	{ "exc divu by zero", DIVU(3, 0, 6) },
+	{ "exc calls",        CALLS(0) },
+	{ "exc interrupt",    EI, 0, setup_interrupt },
+	{ "exc unaligned",    LD(3, 1, 0), 1 },
+	{ "exc dtlb miss",    LD(3, 3, 0), 1 },
+	{ "exc dtlb invalid", LD(3, 2, 0), 1, setup_dtlb_invalid },
+	{ "exc dtlb readonly", ST(7, 0, 0), 1 },
+	{ "exc itlb miss",    0, 1, setup_itlb_miss },
+};
+
+#define NUM_CASES (sizeof(cases) / sizeof(cases[0]))
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint64_t ticks(void)
+{
+#ifdef HAVE_RDTSC
+	return __rdtsc();
+#else
+	return now_ns();
+#endif
+}
+
+static void micro_run(const struct micro_case *c, uint64_t cycles,
+		      struct micro_result *result)
+{
+	static struct sisa_context sisa;
+	uint16_t block[BLOCK_SIZE + 1];
+	uint64_t attempts = 0;
+	uint64_t start_ticks;
+	double start_ns;
+	int i;
+
+	for (i = 0; i < BLOCK_SIZE; i++)
+		block[i] = c->instr;
+	block[BLOCK_SIZE] = JMP(7);
+
+	sisa_init(&sisa);
+	sisa_load_binary(&sisa, BLOCK_ADDR, block, sizeof(block));
+	sisa_tlb_set_enabled(&sisa, c->tlb_enabled);
+	sisa_set_pc(&sisa, BLOCK_ADDR);
+
+	memcpy(sisa.cpu.regfile.general.regs, init_regs, sizeof(init_regs));
+	sisa.cpu.regfile.system.s5 = BLOCK_ADDR;
+
+	if (c->setup)
+		c->setup(&sisa);
+
+	start_ns = now_ns();
+	start_ticks = ticks();
+
+	/* An attempt is every instruction fetch, faulting or not */
+	while (sisa.cpu.cycles < cycles) {
+		attempts += sisa.cpu.status == SISA_CPU_STATUS_FETCH;
+		sisa_step_cycle(&sisa);
+	}
+
+	result->ticks = ticks() - start_ticks;
+	result->ns = now_ns() - start_ns;
+	result->attempts = attempts;
+	result->guest_cycles = sisa.cpu.cycles;
+
+	sisa_destroy(&sisa);
+}
+
+static int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void usage(char *argv[])
+{
+	printf("Usage: %s [OPTIONS] [FILTER]\n\n"
+		"  -n, --cycles=N          guest cycles to run each case for\n"
+		"                            (defaults to %llu)\n"
+		"  -h, --help              displays this help and exit\n"
+		"\nOnly cases whose name contains FILTER are run.\n"
+		, argv[0], DEFAULT_CYCLES);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	unsigned int i, num = 0;
+	uint64_t cycles = DEFAULT_CYCLES;
+	const char *filter = NULL;
+	struct micro_result results[NUM_CASES];
+	double ns_per[NUM_CASES];
+	double sorted[NUM_CASES];
+	double median;
+
+	struct option long_options[] = {
+		{"cycles", required_argument, NULL, 'n'},
+		{"help", no_argument, NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+
+	while ((opt = getopt_long(argc, argv, "n:h", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'n':
+			cycles = strtoull(optarg, NULL, 10);
+			break;
+		case 'h':
+		default:
+			usage(argv);
+			return -1;
+		}
+	}
+
+	if (optind < argc)
+		filter = argv[optind];
+
+	for (i = 0; i < NUM_CASES; i++) {
+		ns_per[i] = -1;
+
+		if (filter && !strstr(cases[i].name, filter))
+			continue;
+
+		micro_run(&cases[i], cycles, &results[i]);
+
+		if (results[i].attempts)
+			ns_per[i] = results[i].ns / results[i].attempts;
+		sorted[num++] = ns_per[i];
+	}
+
+	if (num == 0)
+		return 0;
+
+	qsort(sorted, num, sizeof(double), compare_double);
+	median = sorted[num / 2];
+
+	printf("%-18s %10s %10s %12s %8s\n", "case", "ns/instr",
+#ifdef HAVE_RDTSC
+	       "tsc/instr",
+#else
+	       "ticks/instr",
+#endif
+	       "guest cyc/i", "x median");
+
+	for (i = 0; i < NUM_CASES; i++) {
+		if (ns_per[i] < 0)
+			continue;
+
+		/* Outliers are flagged with a '*' */
+		printf("%-18s %10.2f %10.1f %12.2f %8.2f%s\n", cases[i].name, ns_per[i],
+		       (double)results[i].ticks / results[i].attempts,
+		       (double)results[i].guest_cycles / results[i].attempts,
+		       ns_per[i] / median, ns_per[i] > 1.5 * median ? " *" : "");
+	}
+
+	return 0;
+}
@@ -0,0 +1,176 @@
+#include "bench.h"
+
+#define ADDR(idx) (SISA_CODE_LOAD_ADDR + (idx) * 2)
+#define SEGMENT(addr, words) { addr, words, sizeof(words) / sizeof(words[0]) }
+
+/* Register-only arithmetic and logic, shifts with varying amounts */
+static const uint16_t alu_code[] = {
+	LI(0, ADDR(4)),
+	MOVI(1, 0),
+	MOVI(2, 1),
+/* loop: */
+	ADD(1, 1, 2),
+	XOR(3, 1, 2),
+	AND(4, 3, 1),
+	OR(5, 4, 2),
+	SUB(6, 5, 3),
+	SHL(7, 1, 2),
+	SHA(3, 6, 2),
+	NOT(4, 7),
+	CMPLT(5, 1, 3),
+	CMPEQ(6, 5, 4),
+	ADDI(2, 2, 1),
+	JMP(0),
+};
+
+/* Copies 1024 words from 0x8000 to 0x9000 over and over */
+static const uint16_t memcpy_code[] = {
+	LI(0, ADDR(0)),
+	LI(1, 0x8000),
+	LI(2, 0x9000),
+	LI(3, 0x0400),
+/* loop: */
+	LD(4, 1, 0),
+	ST(2, 0, 4),
+	ADDI(1, 1, 2),
+	ADDI(2, 2, 2),
+	ADDI(3, 3, -1),
+	BNZ(3, -6),
+	JMP(0),
+};
+
+/* Every MULT_DIV function; the loop restarts before the divisor wraps to 0 */
+static const uint16_t muldiv_code[] = {
+	LI(0, ADDR(0)),
+	MOVI(1, 123),
+	MOVI(2, 7),
+/* loop: */
+	MUL(3, 1, 2),
+	MULH(4, 1, 3),
+	MULHU(5, 3, 1),
+	DIV(6, 3, 2),
+	DIVU(7, 5, 2),
+	ADDI(1, 1, 3),
+	ADDI(2, 2, 1),
+	BNZ(2, -8),
+	JMP(0),
+};
+
+/* Kernel: installs the handler and drops to user mode at 0x0000 */
+#define TLB_HANDLER ADDR(7)
+static const uint16_t tlb_kernel_code[] = {
+	LI(1, TLB_HANDLER),
+	WRS(5, 1),
+	MOVI(1, 0),
+	WRS(0, 1),
+	WRS(1, 1),
+	RETI,
+/* handler: */
+	RDS(2, 2),
+	ADDI(3, 3, 1),
+	RETI,
+};
+
+/* User: touches a data page and issues a system call per iteration */
+static const uint16_t tlb_user_code[] = {
+	MOVI(5, 1),
+	LI(6, 0x1000),
+/* loop: */
+	ADDI(4, 4, 1),
+	ST(6, 0, 4),
+	LD(7, 6, 0),
+	CALLS(4),
+	BNZ(5, -5),
+};
+
+/* Spins with interrupts enabled while the harness toggles a key */
+#define IRQ_LOOP    ADDR(6)
+#define IRQ_HANDLER ADDR(8)
+static const uint16_t irq_code[] = {
+	LI(1, IRQ_HANDLER),
+	WRS(5, 1),
+	LI(0, IRQ_LOOP),
+	EI,
+/* loop: */
+	ADDI(5, 5, 1),
+	JMP(0),
+/* handler: */
+	GETIID(2),
+	ADDI(3, 3, 1),
+	IN(4, SISA_IO_PORT_KEYS),
+	RETI,
+};
+
+/* Fills the 80x30 text screen with characters and attributes */
+static const uint16_t vga_code[] = {
+	LI(0, ADDR(0)),
+	LI(1, SISA_VGA_START_ADDR),
+	LI(2, 80 * 30),
+	LI(3, 0x0F20),
+/* loop: */
+	ST(1, 0, 3),
+	ADDI(1, 1, 2),
+	ADDI(3, 3, 1),
+	ADDI(2, 2, -1),
+	BNZ(2, -5),
+	JMP(0),
+};
+
+const struct bench_program bench_programs[] = {
+	{
+		.name = "alu",
+		.description = "ALU-heavy register loop",
+		.segments = { SEGMENT(SISA_CODE_LOAD_ADDR, alu_code) },
+	},
+	{
+		.name = "memcpy",
+		.description = "word memory copy",
+		.segments = { SEGMENT(SISA_CODE_LOAD_ADDR, memcpy_code) },
+	},
+	{
+		.name = "muldiv",
+		.description = "MULT_DIV-heavy loop",
+		.segments = { SEGMENT(SISA_CODE_LOAD_ADDR, muldiv_code) },
+	},
+	{
+		.name = "tlb-syscall",
+		.description = "TLB enabled user/system switching",
+		.segments = {
+			SEGMENT(SISA_CODE_LOAD_ADDR, tlb_kernel_code),
+			SEGMENT(0x0000, tlb_user_code),
+		},
+		.tlb_enabled = 1,
+	},
+	{
+		.name = "irq-storm",
+		.description = "key interrupt every 64 cycles",
+		.segments = { SEGMENT(SISA_CODE_LOAD_ADDR, irq_code) },
+		.stimulus_period = 64,
+	},
+	{
+		.name = "vga-text",
+		.description = "VGA text screen writer",
+		.segments = { SEGMENT(SISA_CODE_LOAD_ADDR, vga_code) },
+	},
+};
+
+const unsigned int bench_num_programs = sizeof(bench_programs) / sizeof(bench_programs[0]);
+
+void bench_program_load(struct sisa_context *sisa, const struct bench_program *prog)
+{
+	int i;
+	const struct bench_segment *seg;
+
+	for (i = 0; i < BENCH_MAX_SEGMENTS; i++) {
+		seg = &prog->segments[i];
+		if (!seg->words)
+			continue;
+
+		/* Like the guest, the host is assumed to be little endian */
+		sisa_load_binary(sisa, seg->addr, (void *)seg->words,
+				 seg->num_words * sizeof(uint16_t));
+	}
+
+	sisa_tlb_set_enabled(sisa, prog->tlb_enabled);
+	sisa_set_pc(sisa, SISA_CODE_LOAD_ADDR);
+}
@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include "cache.h"
+#include "util.h"
+
+enum {
+	SIZE_OPT = 0,
+	LINE_OPT,
+	WAYS_OPT,
+	POLICY_OPT,
+	MISS_OPT,
+	WRITE_OPT,
+};
+
+static char *const cache_subopt_token[] = {
+	[SIZE_OPT] = "size",
+	[LINE_OPT] = "line",
+	[WAYS_OPT] = "ways",
+	[POLICY_OPT] = "policy",
+	[MISS_OPT] = "miss",
+	[WRITE_OPT] = "write",
+	NULL
+};
+
+static int is_power_of_2(unsigned int n)
+{
+	return n && !(n & (n - 1));
+}
+
+void sisa_cache_config_default(struct sisa_cache_config *config)
+{
+	config->size = 4096;
+	config->line_size = 16;
+	config->ways = 2;
+	config->write_policy = SISA_CACHE_WRITE_BACK;
+	config->miss_penalty = 10;
+	config->write_penalty = 10;
+}
+
+int sisa_cache_parse_config(struct sisa_cache_config *config, char *opts)
+{
+	char *value;
+	int token;
+
+	while (*opts != '\0') {
+		token = getsubopt(&opts, cache_subopt_token, &value);
+
+		if (token < 0) {
+			printf("Error: unknown cache option '%s'\n", value);
+			return 0;
+		} else if (!value) {
+			printf("Error: cache option '%s' needs a value\n", cache_subopt_token[token]);
+			return 0;
+		}
+
+		switch (token) {
+		case SIZE_OPT:
+			config->size = strtoul(value, NULL, 0);
+			break;
+		case LINE_OPT:
+			config->line_size = strtoul(value, NULL, 0);
+			break;
+		case WAYS_OPT:
+			config->ways = strtoul(value, NULL, 0);
+			break;
+		case POLICY_OPT:
+			if (strcmp(value, "wb") == 0) {
+				config->write_policy = SISA_CACHE_WRITE_BACK;
+			} else if (strcmp(value, "wt") == 0) {
+				config->write_policy = SISA_CACHE_WRITE_THROUGH;
+			} else {
+				printf("Error: unknown cache write policy '%s'\n", value);
+				return 0;
+			}
+			break;
+		case MISS_OPT:
+			config->miss_penalty = strtoul(value, NULL, 0);
+			break;
+		case WRITE_OPT:
+			config->write_penalty = strtoul(value, NULL, 0);
+			break;
+		}
+	}
+
+	return 1;
+}
+
+int sisa_cache_init(struct sisa_cache *cache, const struct sisa_cache_config *config)
+{
+	unsigned int num_sets;
+
+	if (!is_power_of_2(config->size) || !is_power_of_2(config->line_size) ||
+	    !is_power_of_2(config->ways) || config->line_size < 2 ||
+	    config->size > SISA_MEMORY_SIZE ||
+	    config->size < config->line_size * config->ways) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	num_sets = config->size / (config->line_size * config->ways);
+
+	memset(cache, 0, sizeof(*cache));
+	cache->config = *config;
+	cache->line_shift = ffs(config->line_size) - 1;
+	cache->set_mask = num_sets - 1;
+
+	if (!(cache->lines = calloc(num_sets * config->ways, sizeof(*cache->lines)))) {
+		errno = ENOMEM;
+		return 0;
+	}
+
+	return 1;
+}
+
+void sisa_cache_destroy(struct sisa_cache *cache)
+{
+	free(cache->lines);
+	cache->lines = NULL;
+}
+
+void sisa_cache_reset(struct sisa_cache *cache)
+{
+	memset(cache->lines, 0, (cache->set_mask + 1) * cache->config.ways *
+	       sizeof(*cache->lines));
+	memset(&cache->stats, 0, sizeof(cache->stats));
+	cache->clock = 0;
+}
+
+void sisa_cache_dump_text(const struct sisa_cache *cache, const char *name, FILE *fp)
+{
+	const struct sisa_cache_stats *stats = &cache->stats;
+
+	fprintf(fp, "%s: %u bytes, %u byte lines, %u ways, %s, %u/%u cycle fill/write\n",
+		name, cache->config.size, cache->config.line_size, cache->config.ways,
+		cache->config.write_policy == SISA_CACHE_WRITE_BACK ? "write-back" : "write-through",
+		cache->config.miss_penalty, cache->config.write_penalty);
+	fprintf(fp, "  reads:        %llu (%llu misses, %.2f%%)\n",
+		(unsigned long long)stats->reads, (unsigned long long)stats->read_misses,
+		sisa_percent(stats->read_misses, stats->reads));
+	fprintf(fp, "  writes:       %llu (%llu misses, %.2f%%)\n",
+		(unsigned long long)stats->writes, (unsigned long long)stats->write_misses,
+		sisa_percent(stats->write_misses, stats->writes));
+	fprintf(fp, "  writebacks:   %llu\n", (unsigned long long)stats->writebacks);
+	fprintf(fp, "  stall cycles: %llu\n", (unsigned long long)stats->stall_cycles);
+}
@@ -0,0 +1,28 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdio.h>
+#include "sisa.h"
+
+/* 4 KiB, 16 byte lines, 2 ways, write-back, 10 cycle fills and writes */
+void sisa_cache_config_default(struct sisa_cache_config *config);
+
+/*
+ * Parses 'size=N,line=N,ways=N,policy=wb|wt,miss=N,write=N' over config,
+ * any of them can be left out. Returns 0 and prints why on errors.
+ */
+int sisa_cache_parse_config(struct sisa_cache_config *config, char *opts);
+
+/*
+ * Sizes must be powers of two, with at least one set of ways lines. Fails
+ * with errno set to EINVAL for a bad geometry or ENOMEM.
+ */
+int sisa_cache_init(struct sisa_cache *cache, const struct sisa_cache_config *config);
+void sisa_cache_destroy(struct sisa_cache *cache);
+
+/* Invalidates every line and clears the counters */
+void sisa_cache_reset(struct sisa_cache *cache);
+
+void sisa_cache_dump_text(const struct sisa_cache *cache, const char *name, FILE *fp);
+
+#endif
@@ -0,0 +1,550 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "capture.h"
+#include "util.h"
+
+#define FONT_FIRST  '!'
+#define FONT_LAST   '~'
+#define FONT_WIDTH  5
+#define FONT_HEIGHT 7
+
+/* Bytes of a row of pixels in the PNG, with its filter type byte */
+#define PNG_ROW_SIZE (1 + SISA_CAPTURE_WIDTH)
+#define PNG_RAW_SIZE (PNG_ROW_SIZE * SISA_CAPTURE_HEIGHT)
+/* Fixed Huffman literals take at most 9 bits */
+#define PNG_DEFLATE_MAX (PNG_RAW_SIZE * 9 / 8 + 16)
+
+/* One byte per row, bit 4 the leftmost pixel */
+static const uint8_t font[FONT_LAST - FONT_FIRST + 1][FONT_HEIGHT] = {
+	/* '!' */ { 0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04 },
+	/* '"' */ { 0x0A, 0x0A, 0x0A, 0x00, 0x00, 0x00, 0x00 },
+	/* '#' */ { 0x0A, 0x0A, 0x1F, 0x0A, 0x1F, 0x0A, 0x0A },
+	/* '$' */ { 0x04, 0x0F, 0x14, 0x0E, 0x05, 0x1E, 0x04 },
+	/* '%' */ { 0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03 },
+	/* '&' */ { 0x0C, 0x12, 0x14, 0x08, 0x15, 0x12, 0x0D },
+	/* '\'' */ { 0x04, 0x04, 0x08, 0x00, 0x00, 0x00, 0x00 },
+	/* '(' */ { 0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02 },
+	/* ')' */ { 0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08 },
+	/* '*' */ { 0x00, 0x04, 0x15, 0x0E, 0x15, 0x04, 0x00 },
+	/* '+' */ { 0x00, 0x04, 0x04, 0x1F, 0x04, 0x04, 0x00 },
+	/* ',' */ { 0x00, 0x00, 0x00, 0x00, 0x0C, 0x04, 0x08 },
+	/* '-' */ { 0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00 },
+	/* '.' */ { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C },
+	/* '/' */ { 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00 },
+	/* '0' */ { 0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E },
+	/* '1' */ { 0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E },
+	/* '2' */ { 0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F },
+	/* '3' */ { 0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E },
+	/* '4' */ { 0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02 },
+	/* '5' */ { 0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E },
+	/* '6' */ { 0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E },
+	/* '7' */ { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 },
+	/* '8' */ { 0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E },
+	/* '9' */ { 0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C },
+	/* ':' */ { 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00 },
+	/* ';' */ { 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x04, 0x08 },
+	/* '<' */ { 0x02, 0x04, 0x08, 0x10, 0x08, 0x04, 0x02 },
+	/* '=' */ { 0x00, 0x00, 0x1F, 0x00, 0x1F, 0x00, 0x00 },
+	/* '>' */ { 0x08, 0x04, 0x02, 0x01, 0x02, 0x04, 0x08 },
+	/* '?' */ { 0x0E, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04 },
+	/* '@' */ { 0x0E, 0x11, 0x01, 0x0D, 0x15, 0x15, 0x0E },
+	/* 'A' */ { 0x0E, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 },
+	/* 'B' */ { 0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E },
+	/* 'C' */ { 0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E },
+	/* 'D' */ { 0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C },
+	/* 'E' */ { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F },
+	/* 'F' */ { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10 },
+	/* 'G' */ { 0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F },
+	/* 'H' */ { 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 },
+	/* 'I' */ { 0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E },
+	/* 'J' */ { 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C },
+	/* 'K' */ { 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11 },
+	/* 'L' */ { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F },
+	/* 'M' */ { 0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11 },
+	/* 'N' */ { 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11 },
+	/* 'O' */ { 0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E },
+	/* 'P' */ { 0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10 },
+	/* 'Q' */ { 0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D },
+	/* 'R' */ { 0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11 },
+	/* 'S' */ { 0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E },
+	/* 'T' */ { 0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 },
+	/* 'U' */ { 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E },
+	/* 'V' */ { 0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04 },
+	/* 'W' */ { 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A },
+	/* 'X' */ { 0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11 },
+	/* 'Y' */ { 0x11, 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04 },
+	/* 'Z' */ { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F },
+	/* '[' */ { 0x0E, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0E },
+	/* '\\' */ { 0x00, 0x10, 0x08, 0x04, 0x02, 0x01, 0x00 },
+	/* ']' */ { 0x0E, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0E },
+	/* '^' */ { 0x04, 0x0A, 0x11, 0x00, 0x00, 0x00, 0x00 },
+	/* '_' */ { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F },
+	/* '`' */ { 0x08, 0x04, 0x02, 0x00, 0x00, 0x00, 0x00 },
+	/* 'a' */ { 0x00, 0x00, 0x0E, 0x01, 0x0F, 0x11, 0x0F },
+	/* 'b' */ { 0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x1E },
+	/* 'c' */ { 0x00, 0x00, 0x0E, 0x10, 0x10, 0x11, 0x0E },
+	/* 'd' */ { 0x01, 0x01, 0x0D, 0x13, 0x11, 0x11, 0x0F },
+	/* 'e' */ { 0x00, 0x00, 0x0E, 0x11, 0x1F, 0x10, 0x0E },
+	/* 'f' */ { 0x06, 0x09, 0x08, 0x1C, 0x08, 0x08, 0x08 },
+	/* 'g' */ { 0x00, 0x0F, 0x11, 0x11, 0x0F, 0x01, 0x0E },
+	/* 'h' */ { 0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x11 },
+	/* 'i' */ { 0x04, 0x00, 0x0C, 0x04, 0x04, 0x04, 0x0E },
+	/* 'j' */ { 0x02, 0x00, 0x06, 0x02, 0x02, 0x12, 0x0C },
+	/* 'k' */ { 0x10, 0x10, 0x12, 0x14, 0x18, 0x14, 0x12 },
+	/* 'l' */ { 0x0C, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E },
+	/* 'm' */ { 0x00, 0x00, 0x1A, 0x15, 0x15, 0x11, 0x11 },
+	/* 'n' */ { 0x00, 0x00, 0x16, 0x19, 0x11, 0x11, 0x11 },
+	/* 'o' */ { 0x00, 0x00, 0x0E, 0x11, 0x11, 0x11, 0x0E },
+	/* 'p' */ { 0x00, 0x00, 0x1E, 0x11, 0x1E, 0x10, 0x10 },
+	/* 'q' */ { 0x00, 0x00, 0x0D, 0x13, 0x0F, 0x01, 0x01 },
+	/* 'r' */ { 0x00, 0x00, 0x16, 0x19, 0x10, 0x10, 0x10 },
+	/* 's' */ { 0x00, 0x00, 0x0E, 0x10, 0x0E, 0x01, 0x1E },
+	/* 't' */ { 0x08, 0x08, 0x1C, 0x08, 0x08, 0x09, 0x06 },
+	/* 'u' */ { 0x00, 0x00, 0x11, 0x11, 0x11, 0x13, 0x0D },
+	/* 'v' */ { 0x00, 0x00, 0x11, 0x11, 0x11, 0x0A, 0x04 },
+	/* 'w' */ { 0x00, 0x00, 0x11, 0x11, 0x15, 0x15, 0x0A },
+	/* 'x' */ { 0x00, 0x00, 0x11, 0x0A, 0x04, 0x0A, 0x11 },
+	/* 'y' */ { 0x00, 0x00, 0x11, 0x11, 0x0F, 0x01, 0x0E },
+	/* 'z' */ { 0x00, 0x00, 0x1F, 0x02, 0x04, 0x08, 0x1F },
+	/* '{' */ { 0x02, 0x04, 0x04, 0x08, 0x04, 0x04, 0x02 },
+	/* '|' */ { 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 },
+	/* '}' */ { 0x08, 0x04, 0x04, 0x02, 0x04, 0x04, 0x08 },
+	/* '~' */ { 0x00, 0x00, 0x08, 0x15, 0x02, 0x00, 0x00 },
+};
+
+/* Writes go to out, bits packed from the least significant one as deflate wants */
+struct bit_writer {
+	uint8_t *out;
+	size_t size;
+	uint32_t bits;
+	unsigned int num_bits;
+};
+
+/* Buffers the writer thread reuses between frames */
+struct image_buffers {
+	uint8_t *pixels;
+	uint8_t *raw;
+	uint8_t *deflated;
+};
+
+static const uint16_t length_base[] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+static const uint8_t length_extra[] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+static void pixel_rgb(uint8_t pixel, uint8_t *rgb)
+{
+	rgb[0] = ((pixel >> 5) & 7) * 255 / 7;
+	rgb[1] = ((pixel >> 2) & 7) * 255 / 7;
+	rgb[2] = (pixel & 3) * 255 / 3;
+}
+
+void sisa_capture_render(const uint8_t *vga, uint8_t *pixels)
+{
+	unsigned int row, col, y, x;
+	uint8_t c, color, bits;
+	uint8_t *cell;
+
+	memset(pixels, 0, SISA_CAPTURE_WIDTH * SISA_CAPTURE_HEIGHT);
+
+	for (row = 0; row < SISA_VGA_ROWS; row++) {
+		for (col = 0; col < SISA_VGA_COLS; col++) {
+			c = vga[(row * SISA_VGA_COLS + col) * 2];
+			color = vga[(row * SISA_VGA_COLS + col) * 2 + 1];
+			if (c < FONT_FIRST || c > FONT_LAST)
+				continue;
+			if (!color)
+				color = 0xFF;
+
+			/* One pixel of margin, rows drawn twice */
+			cell = pixels + (row * SISA_CAPTURE_CELL_HEIGHT + 1) * SISA_CAPTURE_WIDTH +
+			       col * SISA_CAPTURE_CELL_WIDTH + 1;
+			for (y = 0; y < FONT_HEIGHT * 2; y++) {
+				bits = font[c - FONT_FIRST][y / 2];
+				for (x = 0; x < FONT_WIDTH; x++)
+					if (bits & (1 << (FONT_WIDTH - 1 - x)))
+						cell[y * SISA_CAPTURE_WIDTH + x] = color;
+			}
+		}
+	}
+}
+
+static void put_bits(struct bit_writer *w, uint32_t value, unsigned int num_bits)
+{
+	w->bits |= value << w->num_bits;
+	w->num_bits += num_bits;
+
+	while (w->num_bits >= 8) {
+		w->out[w->size++] = w->bits;
+		w->bits >>= 8;
+		w->num_bits -= 8;
+	}
+}
+
+/* Huffman codes go most significant bit first */
+static void put_code(struct bit_writer *w, uint32_t code, unsigned int num_bits)
+{
+	uint32_t reversed = 0;
+	unsigned int i;
+
+	for (i = 0; i < num_bits; i++)
+		reversed |= ((code >> i) & 1) << (num_bits - 1 - i);
+
+	put_bits(w, reversed, num_bits);
+}
+
+/* Literal and length symbols of the fixed Huffman code */
+static void put_symbol(struct bit_writer *w, unsigned int symbol)
+{
+	if (symbol < 144)
+		put_code(w, 0x30 + symbol, 8);
+	else if (symbol < 256)
+		put_code(w, 0x190 + symbol - 144, 9);
+	else if (symbol < 280)
+		put_code(w, symbol - 256, 7);
+	else
+		put_code(w, 0xC0 + symbol - 280, 8);
+}
+
+static void put_match(struct bit_writer *w, unsigned int length)
+{
+	unsigned int i = sizeof(length_base) / sizeof(length_base[0]) - 1;
+
+	while (length_base[i] > length)
+		i--;
+
+	put_symbol(w, 257 + i);
+	put_bits(w, length - length_base[i], length_extra[i]);
+	/* Distance 1, code 0 of the fixed 5 bit distance codes */
+	put_code(w, 0, 5);
+}
+
+/*
+ * Text screens are mostly runs of background, a single fixed Huffman
+ * block of literals and distance 1 matches compresses them well enough
+ * without the cost of searching for longer distances.
+ */
+static size_t deflate_runs(const uint8_t *in, size_t size, uint8_t *out)
+{
+	struct bit_writer w = { out, 0, 0, 0 };
+	size_t i = 0, run;
+
+	/* Last block, fixed Huffman codes */
+	put_bits(&w, 1, 1);
+	put_bits(&w, 1, 2);
+
+	while (i < size) {
+		run = 0;
+		if (i > 0)
+			while (i + run < size && run < 258 && in[i + run] == in[i - 1])
+				run++;
+
+		if (run >= 3) {
+			put_match(&w, run);
+			i += run;
+		} else {
+			put_symbol(&w, in[i++]);
+		}
+	}
+
+	put_symbol(&w, 256);
+	put_bits(&w, 0, 7);
+
+	return w.size;
+}
+
+static uint32_t adler32(const uint8_t *data, size_t size)
+{
+	uint32_t a = 1, b = 0;
+
+	while (size--) {
+		a = (a + *data++) % 65521;
+		b = (b + a) % 65521;
+	}
+
+	return b << 16 | a;
+}
+
+static void put_be32(uint8_t *p, uint32_t value)
+{
+	p[0] = value >> 24;
+	p[1] = value >> 16;
+	p[2] = value >> 8;
+	p[3] = value;
+}
+
+static void write_chunk(FILE *fp, const char *type, const uint8_t *data, size_t size)
+{
+	uint8_t word[4];
+	uint32_t crc;
+
+	put_be32(word, size);
+	fwrite(word, sizeof(word), 1, fp);
+	fwrite(type, 4, 1, fp);
+	if (size)
+		fwrite(data, size, 1, fp);
+
+	crc = sisa_crc32_update(0, (const uint8_t *)type, 4);
+	crc = sisa_crc32_update(crc, data, size);
+	put_be32(word, crc);
+	fwrite(word, sizeof(word), 1, fp);
+}
+
+/* An 8 bit palette PNG, the palette maps the RRRGGGBB pixels to RGB */
+static void write_png(const struct image_buffers *buf, FILE *fp)
+{
+	static const uint8_t signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	uint8_t ihdr[13] = { 0 };
+	uint8_t plte[256 * 3];
+	uint8_t *idat = buf->deflated;
+	size_t size;
+	unsigned int i;
+
+	fwrite(signature, sizeof(signature), 1, fp);
+
+	put_be32(ihdr, SISA_CAPTURE_WIDTH);
+	put_be32(ihdr + 4, SISA_CAPTURE_HEIGHT);
+	ihdr[8] = 8;
+	ihdr[9] = 3;
+	write_chunk(fp, "IHDR", ihdr, sizeof(ihdr));
+
+	for (i = 0; i < 256; i++)
+		pixel_rgb(i, plte + i * 3);
+	write_chunk(fp, "PLTE", plte, sizeof(plte));
+
+	/* Every row with filter type 0 */
+	for (i = 0; i < SISA_CAPTURE_HEIGHT; i++) {
+		buf->raw[i * PNG_ROW_SIZE] = 0;
+		memcpy(buf->raw + i * PNG_ROW_SIZE + 1, buf->pixels + i * SISA_CAPTURE_WIDTH,
+		       SISA_CAPTURE_WIDTH);
+	}
+
+	/* zlib stream: deflate with a 32 KiB window, no dictionary */
+	idat[0] = 0x78;
+	idat[1] = 0x01;
+	size = 2 + deflate_runs(buf->raw, PNG_RAW_SIZE, idat + 2);
+	put_be32(idat + size, adler32(buf->raw, PNG_RAW_SIZE));
+	size += 4;
+	write_chunk(fp, "IDAT", idat, size);
+
+	write_chunk(fp, "IEND", NULL, 0);
+}
+
+static void write_ppm(const struct image_buffers *buf, FILE *fp)
+{
+	uint8_t rgb[3];
+	unsigned int i;
+
+	fprintf(fp, "P6\n%u %u\n255\n", SISA_CAPTURE_WIDTH, SISA_CAPTURE_HEIGHT);
+
+	for (i = 0; i < SISA_CAPTURE_WIDTH * SISA_CAPTURE_HEIGHT; i++) {
+		pixel_rgb(buf->pixels[i], rgb);
+		fwrite(rgb, sizeof(rgb), 1, fp);
+	}
+}
+
+static int buffers_alloc(struct image_buffers *buf)
+{
+	buf->pixels = malloc(SISA_CAPTURE_WIDTH * SISA_CAPTURE_HEIGHT);
+	buf->raw = malloc(PNG_RAW_SIZE);
+	buf->deflated = malloc(PNG_DEFLATE_MAX);
+
+	return buf->pixels && buf->raw && buf->deflated;
+}
+
+static void buffers_free(struct image_buffers *buf)
+{
+	free(buf->pixels);
+	free(buf->raw);
+	free(buf->deflated);
+}
+
+/* Prints why on errors */
+static int write_image(const uint8_t *vga, enum sisa_capture_format format, const char *file,
+		       const struct image_buffers *buf)
+{
+	FILE *fp;
+	int err;
+
+	if (!(fp = fopen(file, "w"))) {
+		printf("Error opening '%s': %s\n", file, strerror(errno));
+		return 0;
+	}
+
+	sisa_capture_render(vga, buf->pixels);
+
+	if (format == SISA_CAPTURE_PPM)
+		write_ppm(buf, fp);
+	else
+		write_png(buf, fp);
+
+	err = ferror(fp);
+	if (fclose(fp) || err) {
+		printf("Error writing '%s'\n", file);
+		return 0;
+	}
+
+	return 1;
+}
+
+int sisa_capture_save(const uint8_t *vga, const char *file)
+{
+	struct image_buffers buf;
+	const char *ext = strrchr(file, '.');
+	int ppm = ext != NULL && strcmp(ext + 1, "ppm") == 0;
+	int ret = 0;
+
+	if (!buffers_alloc(&buf))
+		printf("Error allocating the image of '%s'\n", file);
+	else
+		ret = write_image(vga, ppm ? SISA_CAPTURE_PPM : SISA_CAPTURE_PNG, file, &buf);
+
+	buffers_free(&buf);
+
+	return ret;
+}
+
+static void *writer_thread(void *arg)
+{
+	struct sisa_capture *capture = arg;
+	struct image_buffers buf;
+	struct sisa_capture_frame frame;
+	char file[4096];
+	int ok = buffers_alloc(&buf);
+
+	while (1) {
+		pthread_mutex_lock(&capture->lock);
+		while (!capture->count && !capture->done)
+			pthread_cond_wait(&capture->not_empty, &capture->lock);
+
+		if (!capture->count) {
+			pthread_mutex_unlock(&capture->lock);
+			break;
+		}
+
+		/* Copied out so the emulator can queue the next one meanwhile */
+		frame = capture->queue[capture->head];
+		capture->head = (capture->head + 1) % SISA_CAPTURE_QUEUE_LEN;
+		capture->count--;
+		pthread_cond_signal(&capture->not_full);
+		pthread_mutex_unlock(&capture->lock);
+
+		snprintf(file, sizeof(file), "%s/frame-%08llu.%s", capture->dir,
+			 (unsigned long long)frame.number,
+			 capture->format == SISA_CAPTURE_PPM ? "ppm" : "png");
+
+		if (ok && write_image(frame.vga, capture->format, file, &buf))
+			capture->written++;
+		else
+			capture->errors++;
+	}
+
+	buffers_free(&buf);
+
+	return NULL;
+}
+
+int sisa_capture_init(struct sisa_capture *capture, const char *dir, unsigned int fps,
+		      enum sisa_capture_format format)
+{
+	struct stat st;
+	int err;
+
+	memset(capture, 0, sizeof(*capture));
+	capture->format = format;
+	capture->frame_cycles = SISA_CPU_CLK_FREQ / (fps ? fps : SISA_CAPTURE_DEFAULT_FPS);
+	if (!capture->frame_cycles)
+		capture->frame_cycles = 1;
+
+	if (mkdir(dir, 0755) < 0) {
+		if (errno != EEXIST || stat(dir, &st) < 0)
+			return 0;
+		if (!S_ISDIR(st.st_mode)) {
+			errno = ENOTDIR;
+			return 0;
+		}
+	}
+
+	if (!(capture->dir = strdup(dir)))
+		return 0;
+
+	pthread_mutex_init(&capture->lock, NULL);
+	pthread_cond_init(&capture->not_empty, NULL);
+	pthread_cond_init(&capture->not_full, NULL);
+
+	if ((err = pthread_create(&capture->thread, NULL, writer_thread, capture))) {
+		pthread_mutex_destroy(&capture->lock);
+		pthread_cond_destroy(&capture->not_empty);
+		pthread_cond_destroy(&capture->not_full);
+		free(capture->dir);
+		capture->dir = NULL;
+		errno = err;
+		return 0;
+	}
+
+	return 1;
+}
+
+void sisa_capture_destroy(struct sisa_capture *capture)
+{
+	if (!capture->dir)
+		return;
+
+	pthread_mutex_lock(&capture->lock);
+	capture->done = 1;
+	pthread_cond_signal(&capture->not_empty);
+	pthread_mutex_unlock(&capture->lock);
+
+	pthread_join(capture->thread, NULL);
+
+	pthread_mutex_destroy(&capture->lock);
+	pthread_cond_destroy(&capture->not_empty);
+	pthread_cond_destroy(&capture->not_full);
+	free(capture->dir);
+	capture->dir = NULL;
+}
+
+void sisa_capture_frame(struct sisa_capture *capture, const struct sisa_context *sisa)
+{
+	const uint8_t *vga = sisa->memory + SISA_VGA_START_ADDR;
+	uint64_t number = sisa->cpu.cycles / capture->frame_cycles;
+	uint64_t hash = sisa_fnv_bytes(SISA_FNV_OFFSET_BASIS, vga, SISA_CAPTURE_VGA_SIZE);
+	struct sisa_capture_frame *frame;
+
+	capture->next_cycle = (number + 1) * capture->frame_cycles;
+
+	if (capture->has_last && hash == capture->last_hash) {
+		capture->duplicates++;
+		return;
+	}
+
+	capture->last_hash = hash;
+	capture->has_last = 1;
+
+	pthread_mutex_lock(&capture->lock);
+	while (capture->count == SISA_CAPTURE_QUEUE_LEN)
+		pthread_cond_wait(&capture->not_full, &capture->lock);
+
+	frame = &capture->queue[(capture->head + capture->count) % SISA_CAPTURE_QUEUE_LEN];
+	frame->number = number;
+	memcpy(frame->vga, vga, SISA_CAPTURE_VGA_SIZE);
+	capture->count++;
+	pthread_cond_signal(&capture->not_empty);
+	pthread_mutex_unlock(&capture->lock);
+
+	capture->captured++;
+}
+
+void sisa_capture_reset(struct sisa_capture *capture)
+{
+	capture->next_cycle = 0;
+	capture->has_last = 0;
+}
@@ -0,0 +1,92 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "sisa.h"
+
+#define SISA_CAPTURE_DEFAULT_FPS 60
+#define SISA_CAPTURE_CELL_WIDTH  8
+#define SISA_CAPTURE_CELL_HEIGHT 16
+#define SISA_CAPTURE_WIDTH       (SISA_VGA_COLS * SISA_CAPTURE_CELL_WIDTH)
+#define SISA_CAPTURE_HEIGHT      (SISA_VGA_ROWS * SISA_CAPTURE_CELL_HEIGHT)
+#define SISA_CAPTURE_VGA_SIZE    (SISA_VGA_ROWS * SISA_VGA_COLS * 2)
+#define SISA_CAPTURE_QUEUE_LEN   16
+
+/*
+ * Frames are the VGA text window rendered to 640x480 images, 8x16 pixel
+ * cells with a built-in 5x7 font doubled in height. The attribute byte is
+ * the foreground color as RRRGGGBB over a black background, and 0 draws
+ * white so text written without attributes shows up. Characters outside
+ * '!'..'~' are blank and the cursor isn't drawn.
+ */
+enum sisa_capture_format {
+	SISA_CAPTURE_PNG,
+	SISA_CAPTURE_PPM,
+};
+
+struct sisa_capture_frame {
+	uint64_t number;
+	uint8_t vga[SISA_CAPTURE_VGA_SIZE];
+};
+
+struct sisa_capture {
+	char *dir;
+	enum sisa_capture_format format;
+	/* Guest cycles per frame */
+	uint64_t frame_cycles;
+	uint64_t next_cycle;
+	uint64_t last_hash;
+	int has_last;
+	uint64_t captured;
+	uint64_t duplicates;
+	/* Written by the writer thread, only read them after sisa_capture_destroy() */
+	uint64_t written;
+	uint64_t errors;
+	/* Frames waiting for the writer thread, count of them from head */
+	struct sisa_capture_frame queue[SISA_CAPTURE_QUEUE_LEN];
+	unsigned int head;
+	unsigned int count;
+	int done;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+};
+
+/*
+ * Starts the writer thread saving frames to dir as frame-NNNNNNNN.png (or
+ * .ppm), NNNNNNNN being the frame number, the cycle it was taken at
+ * divided by the frame period, so skipped duplicates leave gaps and runs
+ * of the same program number their frames the same. Returns 0 with errno
+ * set on errors.
+ */
+int sisa_capture_init(struct sisa_capture *capture, const char *dir, unsigned int fps,
+		      enum sisa_capture_format format);
+/* Waits for the queued frames to be written and stops the writer thread */
+void sisa_capture_destroy(struct sisa_capture *capture);
+
+/*
+ * Queues the screen of sisa as the frame of the current cycle unless it's
+ * the same as the last one queued. Blocks while the queue is full, so
+ * the guest waits for the disk rather than frames getting lost.
+ */
+void sisa_capture_frame(struct sisa_capture *capture, const struct sisa_context *sisa);
+
+/* Takes the frame when a frame period went by, cheap to call after every cycle */
+static inline void sisa_capture_update(struct sisa_capture *capture, const struct sisa_context *sisa)
+{
+	if (sisa->cpu.cycles >= capture->next_cycle)
+		sisa_capture_frame(capture, sisa);
+}
+
+/* Starts over from frame 0, after a reset */
+void sisa_capture_reset(struct sisa_capture *capture);
+
+/* Renders a VGA window to SISA_CAPTURE_WIDTH x SISA_CAPTURE_HEIGHT RRRGGGBB pixels */
+void sisa_capture_render(const uint8_t *vga, uint8_t *pixels);
+
+/* Saves a VGA window as an image, PPM if file ends with .ppm and PNG otherwise */
+int sisa_capture_save(const uint8_t *vga, const char *file);
+
+#endif
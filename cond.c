@@ -0,0 +1,713 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "cond.h"
+
+enum cond_opcode {
+	OP_CONST,
+	OP_PC,
+	OP_REG,
+	OP_SREG,
+	OP_PSW_M,
+	OP_PSW_I,
+	OP_CYCLES,
+	OP_HITS,
+	OP_MEM16,
+	OP_MEM8,
+	OP_PORT,
+	OP_NOT,
+	OP_BNOT,
+	OP_NEG,
+	OP_BOOL,
+	OP_ADD,
+	OP_SUB,
+	OP_AND,
+	OP_OR,
+	OP_XOR,
+	OP_EQ,
+	OP_NE,
+	OP_LT,
+	OP_LE,
+	OP_GT,
+	OP_GE,
+	/* Short-circuit: jump to arg keeping the result, or pop and go on */
+	OP_JFALSE,
+	OP_JTRUE,
+};
+
+struct parser {
+	const char *text;
+	const char *p;
+	struct sisa_cond_op *code;
+	unsigned int num_ops;
+	unsigned int max_ops;
+	int depth;
+	int max_depth;
+	/* Inside parentheses, brackets or unary operators */
+	int nest;
+	int has_or;
+	int has_pc;
+	uint16_t pc;
+	uint16_t pages;
+	uint8_t ports[SISA_NUM_IO_PORTS / 8];
+	int has_ports;
+	/* Memory or port operands at addresses computed at run time */
+	int dynamic_addr;
+	int error;
+};
+
+static void parse_error(struct parser *ps, const char *msg)
+{
+	if (!ps->error)
+		printf("Error in condition '%s': %s at '%s'\n", ps->text, msg, ps->p);
+	ps->error = 1;
+}
+
+/* Stack effect of each opcode, the jumps pop on the path that goes on */
+static int op_effect(uint8_t opcode)
+{
+	switch (opcode) {
+	case OP_CONST: case OP_PC: case OP_REG: case OP_SREG: case OP_PSW_M:
+	case OP_PSW_I: case OP_CYCLES: case OP_HITS:
+		return 1;
+	case OP_MEM16: case OP_MEM8: case OP_PORT: case OP_NOT: case OP_BNOT:
+	case OP_NEG: case OP_BOOL:
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+static unsigned int emit(struct parser *ps, uint8_t opcode, uint64_t arg)
+{
+	struct sisa_cond_op *code;
+
+	if (ps->error)
+		return 0;
+
+	if (ps->num_ops == ps->max_ops) {
+		ps->max_ops = ps->max_ops ? ps->max_ops * 2 : 16;
+		code = realloc(ps->code, ps->max_ops * sizeof(*code));
+		if (!code) {
+			parse_error(ps, "out of memory");
+			return 0;
+		}
+		ps->code = code;
+	}
+
+	ps->code[ps->num_ops].opcode = opcode;
+	ps->code[ps->num_ops].arg = arg;
+
+	ps->depth += op_effect(opcode);
+	if (ps->depth > ps->max_depth)
+		ps->max_depth = ps->depth;
+
+	return ps->num_ops++;
+}
+
+static void skip_spaces(struct parser *ps)
+{
+	while (isspace((unsigned char)*ps->p))
+		ps->p++;
+}
+
+static int accept(struct parser *ps, const char *token)
+{
+	size_t len = strlen(token);
+
+	skip_spaces(ps);
+	if (strncmp(ps->p, token, len) != 0)
+		return 0;
+
+	/* Don't take the first character of a longer operator */
+	if (len == 1 && strchr("&|=<>!", token[0]) && ps->p[1] == '=' && token[0] != '!')
+		return 0;
+	if (len == 1 && (token[0] == '&' || token[0] == '|') && ps->p[1] == token[0])
+		return 0;
+	if (len == 1 && token[0] == '!' && ps->p[1] == '=')
+		return 0;
+
+	ps->p += len;
+
+	return 1;
+}
+
+static void expect(struct parser *ps, const char *token)
+{
+	if (!accept(ps, token))
+		parse_error(ps, token[0] == ']' ? "expected ']'" : "expected ')'");
+}
+
+static void parse_or(struct parser *ps);
+
+static void parse_memory(struct parser *ps, uint8_t opcode)
+{
+	unsigned int start = ps->num_ops;
+
+	ps->nest++;
+	parse_or(ps);
+	expect(ps, "]");
+	ps->nest--;
+
+	if (ps->error)
+		return;
+
+	/* Constant addresses give the pages and ports to watch */
+	if (ps->num_ops == start + 1 && ps->code[start].opcode == OP_CONST) {
+		uint16_t addr = ps->code[start].arg;
+
+		if (opcode == OP_PORT) {
+			ps->ports[(uint8_t)addr >> 3] |= 1 << (addr & 7);
+			ps->has_ports = 1;
+		} else {
+			ps->pages |= 1 << (addr >> SISA_PAGE_SHIFT);
+			if (opcode == OP_MEM16)
+				ps->pages |= 1 << (((addr + 1) & 0xFFFF) >> SISA_PAGE_SHIFT);
+		}
+	} else {
+		ps->dynamic_addr = 1;
+	}
+
+	emit(ps, opcode, 0);
+}
+
+static void parse_primary(struct parser *ps)
+{
+	char name[16];
+	unsigned int len = 0;
+	char *end;
+	uint64_t value;
+
+	skip_spaces(ps);
+
+	if (accept(ps, "(")) {
+		ps->nest++;
+		parse_or(ps);
+		expect(ps, ")");
+		ps->nest--;
+		return;
+	}
+
+	if (isdigit((unsigned char)*ps->p)) {
+		value = strtoull(ps->p, &end, 0);
+		ps->p = end;
+		emit(ps, OP_CONST, value);
+		return;
+	}
+
+	while ((isalnum((unsigned char)ps->p[len]) || ps->p[len] == '.') && len < sizeof(name) - 1) {
+		name[len] = tolower((unsigned char)ps->p[len]);
+		len++;
+	}
+	name[len] = '\0';
+
+	if (len == 0) {
+		parse_error(ps, "expected a value");
+		return;
+	}
+
+	ps->p += len;
+
+	if (strcmp(name, "pc") == 0) {
+		emit(ps, OP_PC, 0);
+	} else if (strcmp(name, "cycles") == 0) {
+		emit(ps, OP_CYCLES, 0);
+	} else if (strcmp(name, "hits") == 0) {
+		emit(ps, OP_HITS, 0);
+	} else if (strcmp(name, "psw.m") == 0) {
+		emit(ps, OP_PSW_M, 0);
+	} else if (strcmp(name, "psw.i") == 0) {
+		emit(ps, OP_PSW_I, 0);
+	} else if (len == 2 && name[0] == 'r' && name[1] >= '0' && name[1] <= '7') {
+		emit(ps, OP_REG, name[1] - '0');
+	} else if (len == 2 && name[0] == 's' && name[1] >= '0' && name[1] <= '7') {
+		emit(ps, OP_SREG, name[1] - '0');
+	} else if (strcmp(name, "mem16") == 0 && accept(ps, "[")) {
+		parse_memory(ps, OP_MEM16);
+	} else if (strcmp(name, "mem8") == 0 && accept(ps, "[")) {
+		parse_memory(ps, OP_MEM8);
+	} else if (strcmp(name, "port") == 0 && accept(ps, "[")) {
+		parse_memory(ps, OP_PORT);
+	} else {
+		ps->p -= len;
+		parse_error(ps, "unknown name");
+	}
+}
+
+static void parse_unary(struct parser *ps)
+{
+	uint8_t opcode;
+
+	if (accept(ps, "!"))
+		opcode = OP_NOT;
+	else if (accept(ps, "~"))
+		opcode = OP_BNOT;
+	else if (accept(ps, "-"))
+		opcode = OP_NEG;
+	else {
+		parse_primary(ps);
+		return;
+	}
+
+	ps->nest++;
+	parse_unary(ps);
+	ps->nest--;
+	emit(ps, opcode, 0);
+}
+
+static void parse_additive(struct parser *ps)
+{
+	parse_unary(ps);
+
+	while (!ps->error) {
+		if (accept(ps, "+")) {
+			parse_unary(ps);
+			emit(ps, OP_ADD, 0);
+		} else if (accept(ps, "-")) {
+			parse_unary(ps);
+			emit(ps, OP_SUB, 0);
+		} else {
+			break;
+		}
+	}
+}
+
+static void parse_bitwise(struct parser *ps)
+{
+	parse_additive(ps);
+
+	while (!ps->error) {
+		if (accept(ps, "&")) {
+			parse_additive(ps);
+			emit(ps, OP_AND, 0);
+		} else if (accept(ps, "|")) {
+			parse_additive(ps);
+			emit(ps, OP_OR, 0);
+		} else if (accept(ps, "^")) {
+			parse_additive(ps);
+			emit(ps, OP_XOR, 0);
+		} else {
+			break;
+		}
+	}
+}
+
+static void parse_relational(struct parser *ps)
+{
+	parse_bitwise(ps);
+
+	while (!ps->error) {
+		if (accept(ps, "<=")) {
+			parse_bitwise(ps);
+			emit(ps, OP_LE, 0);
+		} else if (accept(ps, ">=")) {
+			parse_bitwise(ps);
+			emit(ps, OP_GE, 0);
+		} else if (accept(ps, "<")) {
+			parse_bitwise(ps);
+			emit(ps, OP_LT, 0);
+		} else if (accept(ps, ">")) {
+			parse_bitwise(ps);
+			emit(ps, OP_GT, 0);
+		} else {
+			break;
+		}
+	}
+}
+
+static void parse_equality(struct parser *ps)
+{
+	parse_relational(ps);
+
+	while (!ps->error) {
+		if (accept(ps, "==")) {
+			parse_relational(ps);
+			emit(ps, OP_EQ, 0);
+		} else if (accept(ps, "!=")) {
+			parse_relational(ps);
+			emit(ps, OP_NE, 0);
+		} else {
+			break;
+		}
+	}
+}
+
+/* A top level 'pc == CONST' or 'CONST == pc' term makes the condition a breakpoint */
+static void check_pc_term(struct parser *ps, unsigned int start)
+{
+	const struct sisa_cond_op *op = ps->code + start;
+
+	if (ps->error || ps->nest || ps->num_ops != start + 3 || op[2].opcode != OP_EQ)
+		return;
+
+	if (op[0].opcode == OP_PC && op[1].opcode == OP_CONST) {
+		ps->has_pc = 1;
+		ps->pc = op[1].arg;
+	} else if (op[0].opcode == OP_CONST && op[1].opcode == OP_PC) {
+		ps->has_pc = 1;
+		ps->pc = op[0].arg;
+	}
+}
+
+static void parse_and(struct parser *ps)
+{
+	unsigned int start = ps->num_ops, jump;
+
+	parse_equality(ps);
+	check_pc_term(ps, start);
+
+	while (!ps->error && accept(ps, "&&")) {
+		jump = emit(ps, OP_JFALSE, 0);
+		start = ps->num_ops;
+		parse_equality(ps);
+		check_pc_term(ps, start);
+		emit(ps, OP_BOOL, 0);
+		if (!ps->error)
+			ps->code[jump].arg = ps->num_ops;
+	}
+}
+
+static void parse_or(struct parser *ps)
+{
+	unsigned int jump;
+
+	parse_and(ps);
+
+	while (!ps->error && accept(ps, "||")) {
+		if (!ps->nest)
+			ps->has_or = 1;
+		jump = emit(ps, OP_JTRUE, 0);
+		parse_and(ps);
+		emit(ps, OP_BOOL, 0);
+		if (!ps->error)
+			ps->code[jump].arg = ps->num_ops;
+	}
+}
+
+static int compile(struct sisa_cond *cond, const char *expr, int polled)
+{
+	struct parser ps;
+
+	memset(cond, 0, sizeof(*cond));
+	memset(&ps, 0, sizeof(ps));
+	ps.text = expr;
+	ps.p = expr;
+
+	parse_or(&ps);
+
+	skip_spaces(&ps);
+	if (!ps.error && *ps.p != '\0')
+		parse_error(&ps, "unexpected text");
+
+	if (!ps.error && ps.max_depth > SISA_COND_MAX_STACK)
+		parse_error(&ps, "expression too deep");
+
+	/* A PC term under an || doesn't restrict where the condition can be true */
+	if (ps.has_or)
+		ps.has_pc = 0;
+
+	if (!ps.error && !polled && !ps.has_pc &&
+	    (ps.dynamic_addr || (!ps.pages && !ps.has_ports))) {
+		printf("Error in condition '%s': needs a 'pc == ADDR' term or memory and port "
+		       "operands at constant addresses\n", expr);
+		ps.error = 1;
+	}
+
+	if (ps.error) {
+		free(ps.code);
+		return 0;
+	}
+
+	cond->text = strdup(expr);
+	cond->code = ps.code;
+	cond->num_ops = ps.num_ops;
+	cond->has_pc = ps.has_pc;
+	cond->pc = ps.pc;
+	if (!ps.has_pc) {
+		cond->pages = ps.pages;
+		memcpy(cond->ports, ps.ports, sizeof(cond->ports));
+	}
+
+	return 1;
+}
+
+int sisa_cond_compile(struct sisa_cond *cond, const char *expr)
+{
+	return compile(cond, expr, 0);
+}
+
+int sisa_cond_compile_polled(struct sisa_cond *cond, const char *expr)
+{
+	return compile(cond, expr, 1);
+}
+
+void sisa_cond_free(struct sisa_cond *cond)
+{
+	free(cond->text);
+	free(cond->code);
+	memset(cond, 0, sizeof(*cond));
+}
+
+int sisa_cond_eval(struct sisa_cond *cond, const struct sisa_context *sisa)
+{
+	uint64_t stack[SISA_COND_MAX_STACK];
+	const struct sisa_cond_op *op;
+	unsigned int i;
+	int sp = 0;
+	uint16_t addr;
+
+	cond->hits++;
+
+	/* Plain breakpoints */
+	if (!cond->num_ops)
+		return 1;
+
+	for (i = 0; i < cond->num_ops; i++) {
+		op = &cond->code[i];
+
+		switch (op->opcode) {
+		case OP_CONST:
+			stack[sp++] = op->arg;
+			break;
+		case OP_PC:
+			stack[sp++] = sisa->cpu.pc;
+			break;
+		case OP_REG:
+			stack[sp++] = sisa->cpu.regfile.general.regs[op->arg];
+			break;
+		case OP_SREG:
+			stack[sp++] = sisa->cpu.regfile.system.regs[op->arg];
+			break;
+		case OP_PSW_M:
+			stack[sp++] = sisa->cpu.regfile.system.psw.m;
+			break;
+		case OP_PSW_I:
+			stack[sp++] = sisa->cpu.regfile.system.psw.i;
+			break;
+		case OP_CYCLES:
+			stack[sp++] = sisa->cpu.cycles;
+			break;
+		case OP_HITS:
+			stack[sp++] = cond->hits;
+			break;
+		case OP_MEM16:
+			addr = stack[sp - 1];
+			stack[sp - 1] = sisa->memory[(uint16_t)(addr + 1)] << 8 | sisa->memory[addr];
+			break;
+		case OP_MEM8:
+			stack[sp - 1] = sisa->memory[(uint16_t)stack[sp - 1]];
+			break;
+		case OP_PORT:
+			stack[sp - 1] = sisa->io_ports[(uint8_t)stack[sp - 1]];
+			break;
+		case OP_NOT:
+			stack[sp - 1] = !stack[sp - 1];
+			break;
+		case OP_BNOT:
+			stack[sp - 1] = ~stack[sp - 1];
+			break;
+		case OP_NEG:
+			stack[sp - 1] = -stack[sp - 1];
+			break;
+		case OP_BOOL:
+			stack[sp - 1] = !!stack[sp - 1];
+			break;
+		case OP_JFALSE:
+			if (!stack[sp - 1])
+				i = op->arg - 1;
+			else
+				sp--;
+			break;
+		case OP_JTRUE:
+			if (stack[sp - 1]) {
+				stack[sp - 1] = 1;
+				i = op->arg - 1;
+			} else {
+				sp--;
+			}
+			break;
+		default:
+			sp--;
+			switch (op->opcode) {
+			case OP_ADD: stack[sp - 1] += stack[sp]; break;
+			case OP_SUB: stack[sp - 1] -= stack[sp]; break;
+			case OP_AND: stack[sp - 1] &= stack[sp]; break;
+			case OP_OR:  stack[sp - 1] |= stack[sp]; break;
+			case OP_XOR: stack[sp - 1] ^= stack[sp]; break;
+			case OP_EQ:  stack[sp - 1] = stack[sp - 1] == stack[sp]; break;
+			case OP_NE:  stack[sp - 1] = stack[sp - 1] != stack[sp]; break;
+			case OP_LT:  stack[sp - 1] = stack[sp - 1] < stack[sp]; break;
+			case OP_LE:  stack[sp - 1] = stack[sp - 1] <= stack[sp]; break;
+			case OP_GT:  stack[sp - 1] = stack[sp - 1] > stack[sp]; break;
+			case OP_GE:  stack[sp - 1] = stack[sp - 1] >= stack[sp]; break;
+			}
+			break;
+		}
+	}
+
+	return stack[0] != 0;
+}
+
+static void cond_watch(struct sisa_context *sisa, uint16_t paddr, unsigned int size, void *arg)
+{
+	struct sisa_cond_set *set = arg;
+	uint16_t pages = 1 << (paddr >> SISA_PAGE_SHIFT) |
+			 1 << (((paddr + size - 1) >> SISA_PAGE_SHIFT) & 0xF);
+	unsigned int i;
+
+	for (i = 0; i < set->num_conds; i++) {
+		if ((set->conds[i].pages & pages) && sisa_cond_eval(&set->conds[i], sisa) &&
+		    !set->hit) {
+			set->hit = &set->conds[i];
+			sisa_request_stop(sisa);
+		}
+	}
+}
+
+static void cond_set_update_watch(struct sisa_cond_set *set)
+{
+	uint16_t pages = 0;
+	unsigned int i;
+
+	if (set->watch_id >= 0)
+		sisa_write_watch_remove(set->sisa, set->watch_id);
+	set->watch_id = -1;
+
+	for (i = 0; i < set->num_conds; i++)
+		pages |= set->conds[i].pages;
+
+	if (pages)
+		set->watch_id = sisa_write_watch_add(set->sisa, pages, cond_watch, set);
+}
+
+void sisa_cond_set_init(struct sisa_cond_set *set, struct sisa_context *sisa)
+{
+	memset(set, 0, sizeof(*set));
+	set->sisa = sisa;
+	set->watch_id = -1;
+}
+
+void sisa_cond_set_destroy(struct sisa_cond_set *set)
+{
+	unsigned int i;
+
+	for (i = 0; i < set->num_conds; i++) {
+		if (set->conds[i].has_pc)
+			sisa_remove_breakpoint(set->sisa, set->conds[i].pc);
+		sisa_cond_free(&set->conds[i]);
+	}
+
+	if (set->watch_id >= 0)
+		sisa_write_watch_remove(set->sisa, set->watch_id);
+
+	free(set->conds);
+	set->conds = NULL;
+	set->num_conds = 0;
+	set->watch_id = -1;
+	set->hit = NULL;
+}
+
+/* Makes room for one more condition, returns NULL if out of memory */
+static struct sisa_cond *cond_set_new(struct sisa_cond_set *set)
+{
+	struct sisa_cond *conds;
+
+	conds = realloc(set->conds, (set->num_conds + 1) * sizeof(*conds));
+	if (!conds) {
+		printf("Error: out of memory for the conditions\n");
+		return NULL;
+	}
+
+	set->conds = conds;
+
+	return &set->conds[set->num_conds];
+}
+
+int sisa_cond_set_add(struct sisa_cond_set *set, const char *expr)
+{
+	struct sisa_cond *cond;
+
+	if (!(cond = cond_set_new(set)) || !sisa_cond_compile(cond, expr))
+		return 0;
+
+	set->num_conds++;
+
+	if (cond->has_pc)
+		sisa_add_breakpoint(set->sisa, cond->pc);
+	else
+		cond_set_update_watch(set);
+
+	if (cond->pages && set->watch_id < 0) {
+		printf("Error: no write watch left for condition '%s'\n", expr);
+		sisa_cond_free(cond);
+		set->num_conds--;
+		return 0;
+	}
+
+	return 1;
+}
+
+int sisa_cond_set_add_breakpoint(struct sisa_cond_set *set, uint16_t pc)
+{
+	struct sisa_cond *cond;
+
+	if (!(cond = cond_set_new(set)))
+		return 0;
+
+	memset(cond, 0, sizeof(*cond));
+	cond->has_pc = 1;
+	cond->pc = pc;
+	set->num_conds++;
+
+	sisa_add_breakpoint(set->sisa, pc);
+
+	return 1;
+}
+
+void sisa_cond_set_rearm(struct sisa_cond_set *set)
+{
+	unsigned int i;
+
+	for (i = 0; i < set->num_conds; i++) {
+		if (set->conds[i].has_pc)
+			sisa_add_breakpoint(set->sisa, set->conds[i].pc);
+	}
+
+	/* The old watch is gone with the rest of the context, its id may be reused */
+	set->watch_id = -1;
+	cond_set_update_watch(set);
+	set->hit = NULL;
+}
+
+int sisa_cond_set_breakpoint(struct sisa_context *sisa, uint16_t pc, void *arg)
+{
+	struct sisa_cond_set *set = arg;
+	int stop = 0;
+	unsigned int i;
+
+	/* Every condition on this PC counts the hit, even after one is true */
+	for (i = 0; i < set->num_conds; i++) {
+		if (set->conds[i].has_pc && set->conds[i].pc == pc &&
+		    sisa_cond_eval(&set->conds[i], sisa) && !stop) {
+			set->hit = &set->conds[i];
+			stop = 1;
+		}
+	}
+
+	return stop;
+}
+
+void sisa_cond_set_out(struct sisa_context *sisa, uint8_t port, uint16_t value, void *arg)
+{
+	struct sisa_cond_set *set = arg;
+	unsigned int i;
+
+	for (i = 0; i < set->num_conds; i++) {
+		if (sisa_cond_watches_port(&set->conds[i], port) &&
+		    sisa_cond_eval(&set->conds[i], sisa) && !set->hit) {
+			set->hit = &set->conds[i];
+			sisa_request_stop(sisa);
+		}
+	}
+}
@@ -0,0 +1,96 @@
+#ifndef COND_H
+#define COND_H
+
+#include <stdint.h>
+#include "sisa.h"
+
+#define SISA_COND_MAX_STACK 16
+
+/*
+ * Conditions are C like expressions, compiled once to a small stack
+ * bytecode:
+ *
+ *   pc, r0-r7, s0-s7, psw.m, psw.i   CPU state
+ *   mem16[ADDR], mem8[ADDR]          physical memory, little endian words
+ *   port[N]                          I/O port N
+ *   cycles                           cycles since reset
+ *   hits                             times the condition has been checked,
+ *                                    this one included (not rewound by
+ *                                    reverse execution)
+ *
+ * with decimal and 0x constants, ! ~ - + & | ^ == != < <= > >= && || and
+ * parentheses. Values are unsigned and, unlike C, the bitwise operators
+ * bind tighter than the comparisons, so 'r1 & 4 != 0' does what it reads.
+ *
+ * A condition is only checked when something can have made it true: if
+ * it is a conjunction with a 'pc == ADDR' term it is a breakpoint at
+ * ADDR, otherwise it is checked after every write to the pages of its
+ * constant memory addresses and every OUT to its constant ports.
+ * Conditions with neither are rejected, there is no per cycle evaluation
+ * unless the caller does it, see sisa_cond_compile_polled().
+ */
+struct sisa_cond_op {
+	uint8_t opcode;
+	uint64_t arg;
+};
+
+struct sisa_cond {
+	char *text;
+	struct sisa_cond_op *code;
+	unsigned int num_ops;
+	int has_pc;
+	uint16_t pc;
+	uint16_t pages;
+	uint8_t ports[SISA_NUM_IO_PORTS / 8];
+	uint64_t hits;
+};
+
+/* Prints where the expression is wrong and returns 0 on errors */
+int sisa_cond_compile(struct sisa_cond *cond, const char *expr);
+/* Accepts any expression, for callers that evaluate it every cycle themselves */
+int sisa_cond_compile_polled(struct sisa_cond *cond, const char *expr);
+void sisa_cond_free(struct sisa_cond *cond);
+
+/* Counts the hit and evaluates the condition, returns whether it is true */
+int sisa_cond_eval(struct sisa_cond *cond, const struct sisa_context *sisa);
+
+static inline int sisa_cond_watches_port(const struct sisa_cond *cond, uint8_t port)
+{
+	return (cond->ports[port >> 3] >> (port & 7)) & 1;
+}
+
+/*
+ * Conditions armed on a context: breakpoints for the PC ones, a write
+ * watch on the pages of the others and sisa_cond_set_out() for their
+ * ports. hit points at the condition that made execution stop, plain
+ * breakpoints are conditions without text or code.
+ */
+struct sisa_cond_set {
+	struct sisa_context *sisa;
+	struct sisa_cond *conds;
+	unsigned int num_conds;
+	int watch_id;
+	const struct sisa_cond *hit;
+};
+
+void sisa_cond_set_init(struct sisa_cond_set *set, struct sisa_context *sisa);
+void sisa_cond_set_destroy(struct sisa_cond_set *set);
+int sisa_cond_set_add(struct sisa_cond_set *set, const char *expr);
+/* Adds a breakpoint at pc that always stops */
+int sisa_cond_set_add_breakpoint(struct sisa_cond_set *set, uint16_t pc);
+
+/* Arms the conditions again after sisa_init(), which drops breakpoints and watches */
+void sisa_cond_set_rearm(struct sisa_cond_set *set);
+
+/*
+ * Whether the breakpoint at pc should stop execution: plain breakpoints
+ * always do, conditional ones when one of their conditions is true and
+ * breakpoints added by someone else never do. Can be used as the
+ * breakpoint callback, with the set as the argument.
+ */
+int sisa_cond_set_breakpoint(struct sisa_context *sisa, uint16_t pc, void *arg);
+
+/* Checks the conditions on port, requesting a stop if one is true. Can be the out callback */
+void sisa_cond_set_out(struct sisa_context *sisa, uint8_t port, uint16_t value, void *arg);
+
+#endif
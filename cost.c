@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "cost.h"
+#include "asm.h"
+#include "stats.h"
+
+#define MAX_LINE 256
+
+#define EXCEPTION_PREFIX "exception."
+
+void sisa_cost_init(struct sisa_cost_model *cost)
+{
+	memset(cost, 0, sizeof(*cost));
+}
+
+static uint16_t *cost_slot(struct sisa_cost_model *cost, const char *key)
+{
+	uint16_t instr;
+	unsigned int i;
+	const char *name;
+
+	if (strcmp(key, "fetch") == 0)
+		return &cost->fetch;
+	else if (strcmp(key, "read") == 0)
+		return &cost->read;
+	else if (strcmp(key, "write") == 0)
+		return &cost->write;
+
+	if (strncmp(key, EXCEPTION_PREFIX, strlen(EXCEPTION_PREFIX)) == 0) {
+		for (i = 0; i < SISA_NUM_EXCEPTIONS; i++) {
+			name = sisa_stats_exception_name(i);
+			if (name && strcmp(key + strlen(EXCEPTION_PREFIX), name) == 0)
+				return &cost->exceptions[i];
+		}
+		return NULL;
+	}
+
+	if (sisa_asm_mnemonic_encoding(key, &instr))
+		return &cost->instr[instr >> 12][sisa_instr_function(instr)];
+
+	return NULL;
+}
+
+int sisa_cost_load_file(struct sisa_cost_model *cost, const char *file)
+{
+	FILE *fp;
+	char line[MAX_LINE];
+	char *p, *key, *value, *end, *save;
+	unsigned int line_num = 0;
+	unsigned long cycles;
+	uint16_t *slot;
+
+	if (!(fp = fopen(file, "r"))) {
+		printf("Error opening '%s': %s\n", file, strerror(errno));
+		return 0;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		line_num++;
+
+		if ((p = strchr(line, '#')))
+			*p = '\0';
+
+		if (!(key = strtok_r(line, " \t\r\n", &save)))
+			continue;
+
+		value = strtok_r(NULL, " \t\r\n", &save);
+		if (!value || strtok_r(NULL, " \t\r\n", &save))
+			goto error;
+
+		cycles = strtoul(value, &end, 0);
+		if (*end != '\0' || cycles > UINT16_MAX || !(slot = cost_slot(cost, key)))
+			goto error;
+
+		*slot = cycles;
+	}
+
+	fclose(fp);
+
+	return 1;
+
+error:
+	printf("%s:%u: invalid cost\n", file, line_num);
+	fclose(fp);
+
+	return 0;
+}
@@ -0,0 +1,24 @@
+#ifndef COST_H
+#define COST_H
+
+#include "sisa.h"
+
+/*
+ * Cost model files have one 'KEY CYCLES' pair per line, '#' starts a
+ * comment. CYCLES are added to the base model (see struct
+ * sisa_cost_model) and KEY is one of:
+ *
+ *   MNEMONIC        an instruction, like mul or ld (case insensitive)
+ *   fetch           every instruction fetch
+ *   read, write     every data memory access, on top of its instruction
+ *   exception.NAME  entering an exception, named like in the stats dumps
+ *                   (exception.calls, exception.interrupt...)
+ *
+ * Anything not listed costs nothing extra.
+ */
+void sisa_cost_init(struct sisa_cost_model *cost);
+
+/* Loads over cost, returns 0 and prints the offending line on errors */
+int sisa_cost_load_file(struct sisa_cost_model *cost, const char *file);
+
+#endif
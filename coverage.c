@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "coverage.h"
+
+#define COVERAGE_MAGIC "SISACOV1"
+
+static int coverage_test(const uint8_t *map, uint16_t paddr)
+{
+	return (map[paddr >> 4] >> ((paddr >> 1) & 7)) & 1;
+}
+
+static int is_branch(uint16_t instr)
+{
+	switch (instr >> 12) {
+	case SISA_OPCODE_RELATIVE_JUMP:
+		return 1;
+	case SISA_OPCODE_ABSOLUTE_JUMP:
+		return (instr & 7) == SISA_INSTR_ABSOLUTE_JUMP_F_JZ ||
+		       (instr & 7) == SISA_INSTR_ABSOLUTE_JUMP_F_JNZ;
+	default:
+		return 0;
+	}
+}
+
+static uint16_t read_word(const uint8_t *memory, uint16_t paddr)
+{
+	return memory[(uint16_t)(paddr + 1)] << 8 | memory[paddr];
+}
+
+void sisa_coverage_merge(struct sisa_coverage *dst, const struct sisa_coverage *src)
+{
+	int i;
+
+	for (i = 0; i < SISA_COVERAGE_MAP_SIZE; i++) {
+		dst->executed[i] |= src->executed[i];
+		dst->taken[i] |= src->taken[i];
+		dst->not_taken[i] |= src->not_taken[i];
+	}
+}
+
+int sisa_coverage_save(const struct sisa_coverage *coverage, const char *file)
+{
+	FILE *fp;
+	int ok;
+
+	if (!(fp = fopen(file, "wb"))) {
+		printf("Error opening '%s': %s\n", file, strerror(errno));
+		return 0;
+	}
+
+	ok = fwrite(COVERAGE_MAGIC, 1, strlen(COVERAGE_MAGIC), fp) == strlen(COVERAGE_MAGIC) &&
+	     fwrite(coverage, sizeof(*coverage), 1, fp) == 1;
+
+	if (fclose(fp) != 0 || !ok) {
+		printf("Error writing '%s'\n", file);
+		return 0;
+	}
+
+	return 1;
+}
+
+int sisa_coverage_merge_file(struct sisa_coverage *coverage, const char *file)
+{
+	FILE *fp;
+	char magic[sizeof(COVERAGE_MAGIC) - 1];
+	struct sisa_coverage other;
+
+	if (!(fp = fopen(file, "rb"))) {
+		printf("Error opening '%s': %s\n", file, strerror(errno));
+		return 0;
+	}
+
+	if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic) ||
+	    memcmp(magic, COVERAGE_MAGIC, sizeof(magic)) != 0 ||
+	    fread(&other, sizeof(other), 1, fp) != 1) {
+		printf("'%s' is not a coverage file\n", file);
+		fclose(fp);
+		return 0;
+	}
+
+	fclose(fp);
+
+	sisa_coverage_merge(coverage, &other);
+
+	return 1;
+}
+
+void sisa_coverage_report_lcov(const struct sisa_coverage *coverage, const uint8_t *memory,
+			       uint16_t addr, size_t size, const char *source, FILE *fp)
+{
+	size_t i;
+	uint16_t paddr;
+	int executed;
+	unsigned int lines_hit = 0, branches = 0, branches_hit = 0;
+
+	fprintf(fp, "TN:\nSF:%s\n", source);
+
+	for (i = 0; i < size / 2; i++) {
+		paddr = addr + 2 * i;
+		executed = coverage_test(coverage->executed, paddr);
+
+		fprintf(fp, "DA:%zu,%d\n", i + 1, executed);
+		lines_hit += executed;
+
+		if (!is_branch(read_word(memory, paddr)))
+			continue;
+
+		/* lcov wants '-' for branches whose line never ran */
+		if (executed) {
+			fprintf(fp, "BRDA:%zu,0,0,%d\nBRDA:%zu,0,1,%d\n",
+				i + 1, coverage_test(coverage->taken, paddr),
+				i + 1, coverage_test(coverage->not_taken, paddr));
+			branches_hit += coverage_test(coverage->taken, paddr) +
+					coverage_test(coverage->not_taken, paddr);
+		} else {
+			fprintf(fp, "BRDA:%zu,0,0,-\nBRDA:%zu,0,1,-\n", i + 1, i + 1);
+		}
+		branches += 2;
+	}
+
+	fprintf(fp, "BRF:%u\nBRH:%u\nLF:%zu\nLH:%u\nend_of_record\n",
+		branches, branches_hit, size / 2, lines_hit);
+}
+
+/*
+ * One line per word: address, word, '+' if executed ('-' otherwise) and,
+ * for branches, 'T'/'N' for the directions taken ('.' for the missing ones).
+ */
+void sisa_coverage_report_listing(const struct sisa_coverage *coverage, const uint8_t *memory,
+				  uint16_t addr, size_t size, const char *source, FILE *fp)
+{
+	size_t i;
+	uint16_t paddr, word;
+	unsigned int lines_hit = 0, branches = 0, branches_hit = 0;
+
+	for (i = 0; i < size / 2; i++) {
+		paddr = addr + 2 * i;
+		lines_hit += coverage_test(coverage->executed, paddr);
+
+		if (is_branch(read_word(memory, paddr))) {
+			branches += 2;
+			branches_hit += coverage_test(coverage->taken, paddr) +
+					coverage_test(coverage->not_taken, paddr);
+		}
+	}
+
+	fprintf(fp, "; %s at 0x%04X: %u/%zu words executed, %u/%u branch directions\n",
+		source, addr, lines_hit, size / 2, branches_hit, branches);
+
+	for (i = 0; i < size / 2; i++) {
+		paddr = addr + 2 * i;
+		word = read_word(memory, paddr);
+
+		fprintf(fp, "%04X  %04X  %c", paddr, word,
+			coverage_test(coverage->executed, paddr) ? '+' : '-');
+
+		if (is_branch(word))
+			fprintf(fp, " %c%c", coverage_test(coverage->taken, paddr) ? 'T' : '.',
+				coverage_test(coverage->not_taken, paddr) ? 'N' : '.');
+
+		fputc('\n', fp);
+	}
+}
@@ -0,0 +1,25 @@
+#ifndef COVERAGE_H
+#define COVERAGE_H
+
+#include <stdio.h>
+#include "sisa.h"
+
+/*
+ * Coverage files are the raw maps behind a small header, so runs can be
+ * saved independently and merged later by ORing them together.
+ */
+void sisa_coverage_merge(struct sisa_coverage *dst, const struct sisa_coverage *src);
+int sisa_coverage_save(const struct sisa_coverage *coverage, const char *file);
+int sisa_coverage_merge_file(struct sisa_coverage *coverage, const char *file);
+
+/*
+ * Reports cover the words of an image loaded at addr. In the lcov report
+ * word N of the image is line N + 1 of source, which matches .hex files
+ * with one word per line.
+ */
+void sisa_coverage_report_lcov(const struct sisa_coverage *coverage, const uint8_t *memory,
+			       uint16_t addr, size_t size, const char *source, FILE *fp);
+void sisa_coverage_report_listing(const struct sisa_coverage *coverage, const uint8_t *memory,
+				  uint16_t addr, size_t size, const char *source, FILE *fp);
+
+#endif
@@ -0,0 +1,273 @@
+/*
+ * libFuzzer persistent-mode harness for a SISA guest kernel.
+ *
+ * The kernel image is booted once in LLVMFuzzerInitialize() and a snapshot
+ * taken. Every input then restores that snapshot in place (only the pages
+ * the previous run wrote to are copied back), is written into a guest
+ * buffer and enters the kernel through a real CALLS instruction or an
+ * interrupt. Guest PC edges are reported through libFuzzer's extra
+ * coverage counters.
+ *
+ * Configuration is taken from the environment:
+ *   SISA_FUZZ_CODE        kernel code image, loaded at 0xC000 (required)
+ *   SISA_FUZZ_DATA        kernel data image, loaded at 0x8000
+ *   SISA_FUZZ_TLB         1 to enable the TLB (default 0)
+ *   SISA_FUZZ_BOOT_PC     snapshot when the PC first reaches this address
+ *   SISA_FUZZ_BOOT_CYCLES cycles to boot for (default 1000000, or the
+ *                         limit to reach SISA_FUZZ_BOOT_PC)
+ *   SISA_FUZZ_TARGET      "calls" (default) or "interrupt"
+ *   SISA_FUZZ_BUF         guest physical address of the input buffer
+ *                         (default 0x2000)
+ *   SISA_FUZZ_BUF_SIZE    size of the input buffer (default 256)
+ *   SISA_FUZZ_CYCLES      cycle limit per input (default 100000)
+ *
+ * Input layout: bytes 0-15 are r0-r7 at kernel entry (CALLS passes r0 in
+ * s3). In interrupt mode byte 16 is the pending interrupt mask, bytes
+ * 17-18 the switches, byte 19 the keys and byte 20 a keyboard character.
+ * The rest of the input goes to the guest buffer.
+ *
+ * A crash is an exception raised while already in system mode (other than
+ * CALLS or an interrupt) or the CPU halting.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "../sisa.h"
+#include "../loader.h"
+
+#define EDGE_MAP_SIZE (1 << 16)
+#define REGS_SIZE     16
+#define IRQ_SIZE      5
+
+#define ADDI_R0_R0_0  0x2000
+#define CALLS_R0      (0xA000 | SISA_INSTR_ABSOLUTE_JUMP_F_CALLS)
+
+enum fuzz_target {
+	FUZZ_TARGET_CALLS,
+	FUZZ_TARGET_INTERRUPT,
+};
+
+/* Scanned by libFuzzer as additional coverage counters */
+__attribute__((section("__libfuzzer_extra_counters")))
+static uint8_t edge_counters[EDGE_MAP_SIZE];
+
+static struct sisa_context sisa;
+static struct sisa_snapshot booted;
+static uint16_t dirty_pages;
+static enum fuzz_target target;
+static uint16_t buf_addr;
+static size_t buf_size;
+static uint64_t cycle_limit;
+
+static unsigned long env_ulong(const char *name, unsigned long def)
+{
+	const char *value = getenv(name);
+
+	return value ? strtoul(value, NULL, 0) : def;
+}
+
+static void dirty_watch_cb(struct sisa_context *sisa, uint16_t paddr,
+			   unsigned int size, void *arg)
+{
+	dirty_pages |= 1 << (paddr >> SISA_PAGE_SHIFT) |
+		       1 << (((paddr + size - 1) >> SISA_PAGE_SHIFT) & 0xF);
+}
+
+static int exception_cb(struct sisa_context *sisa, enum sisa_exception exception,
+			void *arg)
+{
+	/* Called on entry, before the PSW is saved and switched to system mode */
+	if (sisa->cpu.regfile.system.psw.m == SISA_CPU_MODE_SYSTEM &&
+	    exception != SISA_EXCEPTION_CALLS && exception != SISA_EXCEPTION_INTERRUPT) {
+		fprintf(stderr, "kernel exception 0x%X at 0x%04X (s3: 0x%04X)\n",
+			exception, sisa->cpu.pc, sisa->cpu.regfile.system.s3);
+		abort();
+	}
+
+	return 0;
+}
+
+static void halt_cb(struct sisa_context *sisa, void *arg)
+{
+	fprintf(stderr, "CPU halted at 0x%04X\n", sisa->cpu.pc);
+	abort();
+}
+
+static int load(const char *file, uint16_t addr)
+{
+	if (sisa_load_file(&sisa, file, addr) < 0) {
+		fprintf(stderr, "Error loading '%s': %s\n", file, strerror(errno));
+		return 0;
+	}
+
+	return 1;
+}
+
+int LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+	const char *code = getenv("SISA_FUZZ_CODE");
+	const char *data = getenv("SISA_FUZZ_DATA");
+	const char *target_name = getenv("SISA_FUZZ_TARGET");
+	const char *boot_pc = getenv("SISA_FUZZ_BOOT_PC");
+	uint64_t boot_cycles = env_ulong("SISA_FUZZ_BOOT_CYCLES", 1000000);
+	struct sisa_callbacks callbacks = {
+		.halt = halt_cb,
+		.exception = exception_cb,
+	};
+
+	if (!code) {
+		fprintf(stderr, "SISA_FUZZ_CODE must point to the kernel image\n");
+		exit(1);
+	}
+
+	sisa_init(&sisa);
+
+	if (!load(code, SISA_CODE_LOAD_ADDR) || (data && !load(data, SISA_DATA_LOAD_ADDR)))
+		exit(1);
+
+	sisa_tlb_set_enabled(&sisa, env_ulong("SISA_FUZZ_TLB", 0));
+
+	target = target_name && strcmp(target_name, "interrupt") == 0 ?
+		 FUZZ_TARGET_INTERRUPT : FUZZ_TARGET_CALLS;
+	buf_addr = env_ulong("SISA_FUZZ_BUF", 0x2000);
+	buf_size = env_ulong("SISA_FUZZ_BUF_SIZE", 256);
+	cycle_limit = env_ulong("SISA_FUZZ_CYCLES", 100000);
+
+	if (buf_size > SISA_MEMORY_SIZE - buf_addr)
+		buf_size = SISA_MEMORY_SIZE - buf_addr;
+
+	/* Boot */
+	if (boot_pc) {
+		sisa_add_breakpoint(&sisa, strtoul(boot_pc, NULL, 0));
+		if (sisa_run(&sisa, boot_cycles) != SISA_STOP_BREAKPOINT) {
+			fprintf(stderr, "Boot didn't reach SISA_FUZZ_BOOT_PC\n");
+			exit(1);
+		}
+		sisa_clear_breakpoints(&sisa);
+	} else {
+		sisa_run(&sisa, boot_cycles);
+	}
+
+	/* Always stop at an instruction boundary before taking the snapshot */
+	while (sisa.cpu.status != SISA_CPU_STATUS_FETCH && !sisa.cpu.halted)
+		sisa_step_cycle(&sisa);
+
+	if (sisa.cpu.halted) {
+		fprintf(stderr, "CPU halted while booting\n");
+		exit(1);
+	}
+
+	sisa_snapshot_save(&sisa, &booted);
+
+	sisa_set_callbacks(&sisa, &callbacks);
+	sisa_write_watch_add(&sisa, 0xFFFF, dirty_watch_cb, NULL);
+
+	return 0;
+}
+
+static void fuzz_enter(const uint8_t *data, size_t size)
+{
+	int i;
+	uint8_t regs[REGS_SIZE] = { 0 };
+	const uint8_t *irq;
+
+	memcpy(regs, data, size < REGS_SIZE ? size : REGS_SIZE);
+	for (i = 0; i < 8; i++)
+		sisa.cpu.regfile.general.regs[i] = regs[2 * i] | regs[2 * i + 1] << 8;
+
+	data += REGS_SIZE;
+	size = size > REGS_SIZE ? size - REGS_SIZE : 0;
+
+	if (target == FUZZ_TARGET_INTERRUPT) {
+		uint8_t irq_bytes[IRQ_SIZE] = { 0 };
+
+		memcpy(irq_bytes, data, size < IRQ_SIZE ? size : IRQ_SIZE);
+		irq = irq_bytes;
+
+		sisa_switches_set(&sisa, (irq[1] | irq[2] << 8) & ((1 << SISA_NUM_SWITCHES) - 1));
+		sisa_keys_set(&sisa, irq[3] & ((1 << SISA_NUM_KEYS) - 1));
+		if (irq[4])
+			sisa_keyboard_press(&sisa, irq[4]);
+		sisa.cpu.ints_pending = (irq[0] & 0xF) ? (irq[0] & 0xF) : 1;
+
+		data += IRQ_SIZE;
+		size = size > IRQ_SIZE ? size - IRQ_SIZE : 0;
+	}
+
+	if (size > buf_size)
+		size = buf_size;
+
+	if (size) {
+		memcpy(sisa.memory + buf_addr, data, size);
+		dirty_pages |= 1 << (buf_addr >> SISA_PAGE_SHIFT) |
+			       1 << (((buf_addr + size - 1) >> SISA_PAGE_SHIFT) & 0xF);
+	}
+
+	/* Execute the entry instruction as if it had just been fetched */
+	if (target == FUZZ_TARGET_INTERRUPT) {
+		sisa.cpu.regfile.system.psw.i = 1;
+		sisa.cpu.ir = ADDI_R0_R0_0;
+	} else {
+		sisa.cpu.ir = CALLS_R0;
+	}
+
+	sisa.cpu.status = SISA_CPU_STATUS_DEMW;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	uint16_t prev = 0;
+	uint64_t end;
+
+	sisa_snapshot_restore_pages(&sisa, &booted, dirty_pages);
+	dirty_pages = 0;
+
+	fuzz_enter(data, size);
+
+	end = sisa.cpu.cycles + cycle_limit;
+
+	/* Run until the kernel returns to user mode or the cycle limit */
+	while (sisa.cpu.cycles < end) {
+		sisa_step_cycle(&sisa);
+
+		if (sisa.cpu.status == SISA_CPU_STATUS_FETCH) {
+			if (sisa.cpu.regfile.system.psw.m == SISA_CPU_MODE_USER)
+				break;
+
+			edge_counters[(sisa.cpu.pc ^ prev) & (EDGE_MAP_SIZE - 1)]++;
+			prev = sisa.cpu.pc >> 1;
+		}
+	}
+
+	return 0;
+}
+
+#ifdef SISA_FUZZ_STANDALONE
+/* Replays inputs from files without libFuzzer, e.g. to reproduce a crash */
+int main(int argc, char *argv[])
+{
+	int i;
+	FILE *fp;
+	size_t size;
+	static uint8_t input[SISA_MEMORY_SIZE];
+
+	LLVMFuzzerInitialize(&argc, &argv);
+
+	for (i = 1; i < argc; i++) {
+		if (!(fp = fopen(argv[i], "rb"))) {
+			fprintf(stderr, "Error opening '%s': %s\n", argv[i], strerror(errno));
+			return 1;
+		}
+
+		size = fread(input, 1, sizeof(input), fp);
+		fclose(fp);
+
+		LLVMFuzzerTestOneInput(input, size);
+		printf("%s: %llu cycles\n", argv[i], (unsigned long long)sisa.cpu.cycles -
+		       booted.cpu.cycles);
+	}
+
+	return 0;
+}
+#endif
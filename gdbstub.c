@@ -0,0 +1,559 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "gdbstub.h"
+
+#define GDB_SIGINT  2
+#define GDB_SIGTRAP 5
+
+static const char hex_chars[] = "0123456789abcdef";
+
+static int hex_value(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	else if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	else if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+static unsigned long parse_hex(const char **p)
+{
+	unsigned long value = 0;
+	int digit;
+
+	while ((digit = hex_value(**p)) >= 0) {
+		value = (value << 4) | digit;
+		(*p)++;
+	}
+
+	return value;
+}
+
+static void put_hex8(char **p, uint8_t value)
+{
+	*(*p)++ = hex_chars[value >> 4];
+	*(*p)++ = hex_chars[value & 0xF];
+}
+
+/* Registers go on the wire in target (little endian) byte order */
+static void put_hex16(char **p, uint16_t value)
+{
+	put_hex8(p, value & 0xFF);
+	put_hex8(p, value >> 8);
+}
+
+static int get_hex16(const char **p, uint16_t *value)
+{
+	int i;
+	int digits[4];
+
+	for (i = 0; i < 4; i++) {
+		if ((digits[i] = hex_value((*p)[i])) < 0)
+			return 0;
+	}
+
+	*value = (digits[0] << 4 | digits[1]) | (digits[2] << 4 | digits[3]) << 8;
+	*p += 4;
+
+	return 1;
+}
+
+static uint16_t *gdb_reg(struct sisa_context *sisa, unsigned int num)
+{
+	if (num < 8)
+		return &sisa->cpu.regfile.general.regs[num];
+	else if (num < 16)
+		return &sisa->cpu.regfile.system.regs[num - 8];
+	else if (num == 16)
+		return &sisa->cpu.pc;
+	return NULL;
+}
+
+static int bp_test(const struct sisa_gdb *gdb, uint16_t addr)
+{
+	return (gdb->breakpoints[addr >> 6] >> ((addr >> 1) & 31)) & 1;
+}
+
+static void bp_set(struct sisa_gdb *gdb, uint16_t addr, int set)
+{
+	if (set)
+		gdb->breakpoints[addr >> 6] |= 1u << ((addr >> 1) & 31);
+	else
+		gdb->breakpoints[addr >> 6] &= ~(1u << ((addr >> 1) & 31));
+}
+
+static int gdb_write_all(struct sisa_gdb *gdb, const void *data, size_t size)
+{
+	const char *p = data;
+	ssize_t ret;
+
+	while (size > 0) {
+		ret = write(gdb->fd, p, size);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return 0;
+		}
+		p += ret;
+		size -= ret;
+	}
+
+	return 1;
+}
+
+/* Returns the next byte from the connection, or -1 when it's closed */
+static int gdb_getc(struct sisa_gdb *gdb)
+{
+	ssize_t ret;
+
+	if (gdb->rx_pos == gdb->rx_len) {
+		do {
+			ret = read(gdb->fd, gdb->rx_buf, sizeof(gdb->rx_buf));
+		} while (ret < 0 && errno == EINTR);
+
+		if (ret <= 0)
+			return -1;
+
+		gdb->rx_len = ret;
+		gdb->rx_pos = 0;
+	}
+
+	return gdb->rx_buf[gdb->rx_pos++];
+}
+
+static int gdb_send_packet(struct sisa_gdb *gdb, const char *data)
+{
+	char trailer[3];
+	uint8_t checksum = 0;
+	size_t len = strlen(data);
+	size_t i;
+	int c;
+
+	for (i = 0; i < len; i++)
+		checksum += (uint8_t)data[i];
+
+	trailer[0] = '#';
+	trailer[1] = hex_chars[checksum >> 4];
+	trailer[2] = hex_chars[checksum & 0xF];
+
+	while (1) {
+		if (!gdb_write_all(gdb, "$", 1) || !gdb_write_all(gdb, data, len) ||
+		    !gdb_write_all(gdb, trailer, 3))
+			return 0;
+
+		if (gdb->no_ack)
+			return 1;
+
+		do {
+			c = gdb_getc(gdb);
+		} while (c >= 0 && c != '+' && c != '-');
+
+		if (c < 0)
+			return 0;
+		else if (c == '+')
+			return 1;
+	}
+}
+
+/* Reads a packet into gdb->packet; returns its length or -1 on disconnect */
+static int gdb_recv_packet(struct sisa_gdb *gdb)
+{
+	int c;
+	int len;
+	uint8_t checksum;
+	int hi, lo;
+
+	while (1) {
+		do {
+			c = gdb_getc(gdb);
+		} while (c >= 0 && c != '$');
+
+		if (c < 0)
+			return -1;
+
+		len = 0;
+		checksum = 0;
+
+		while ((c = gdb_getc(gdb)) >= 0 && c != '#') {
+			if (len < SISA_GDB_PACKET_SIZE - 1)
+				gdb->packet[len++] = c;
+			checksum += c;
+		}
+
+		if (c < 0 || (hi = gdb_getc(gdb)) < 0 || (lo = gdb_getc(gdb)) < 0)
+			return -1;
+
+		gdb->packet[len] = '\0';
+
+		if (gdb->no_ack)
+			return len;
+
+		if (hex_value(hi) << 4 == (checksum & 0xF0) && hex_value(lo) == (checksum & 0xF)) {
+			gdb_write_all(gdb, "+", 1);
+			return len;
+		}
+
+		gdb_write_all(gdb, "-", 1);
+	}
+}
+
+/* Non-blocking check for the 0x03 break request; a closed connection also stops */
+static int gdb_interrupt_requested(struct sisa_gdb *gdb)
+{
+	struct pollfd pfd = { .fd = gdb->fd, .events = POLLIN };
+	int c;
+
+	while (gdb->rx_pos < gdb->rx_len) {
+		if (gdb->rx_buf[gdb->rx_pos++] == 0x03)
+			return 1;
+	}
+
+	if (poll(&pfd, 1, 0) <= 0)
+		return 0;
+
+	while (poll(&pfd, 1, 0) > 0) {
+		if ((c = gdb_getc(gdb)) < 0 || c == 0x03)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Runs cycles until the next instruction fetch (or halt) */
+static void gdb_step_instruction(struct sisa_context *sisa)
+{
+	do {
+		sisa_step_cycle(sisa);
+	} while (sisa->cpu.status != SISA_CPU_STATUS_FETCH && !sisa->cpu.halted);
+}
+
+static int gdb_continue(struct sisa_gdb *gdb, struct sisa_context *sisa)
+{
+	unsigned int i;
+
+	while (1) {
+		/* Full speed between polls, only a bitmap lookup per fetch */
+		for (i = 0; i < SISA_GDB_POLL_CYCLES; i++) {
+			sisa_step_cycle(sisa);
+
+			if (sisa->cpu.halted)
+				return GDB_SIGTRAP;
+
+			if (sisa->cpu.status == SISA_CPU_STATUS_FETCH &&
+			    bp_test(gdb, sisa->cpu.pc))
+				return GDB_SIGTRAP;
+		}
+
+		if (gdb_interrupt_requested(gdb))
+			return GDB_SIGINT;
+	}
+}
+
+static void gdb_read_registers(struct sisa_context *sisa, char *out)
+{
+	unsigned int i;
+
+	for (i = 0; i < SISA_GDB_NUM_REGS; i++)
+		put_hex16(&out, *gdb_reg(sisa, i));
+
+	*out = '\0';
+}
+
+static int gdb_write_registers(struct sisa_context *sisa, const char *in)
+{
+	unsigned int i;
+	uint16_t value;
+
+	for (i = 0; i < SISA_GDB_NUM_REGS; i++) {
+		if (!get_hex16(&in, &value))
+			return 0;
+		*gdb_reg(sisa, i) = value;
+	}
+
+	return 1;
+}
+
+static int gdb_read_memory(struct sisa_context *sisa, const char *in, char *out)
+{
+	unsigned long addr, len, i;
+
+	addr = parse_hex(&in);
+	if (*in++ != ',')
+		return 0;
+	len = parse_hex(&in);
+
+	if (addr >= SISA_MEMORY_SIZE || len > SISA_MEMORY_SIZE - addr ||
+	    len * 2 >= SISA_GDB_PACKET_SIZE)
+		return 0;
+
+	for (i = 0; i < len; i++)
+		put_hex8(&out, sisa->memory[addr + i]);
+
+	*out = '\0';
+
+	return 1;
+}
+
+static int gdb_write_memory(struct sisa_context *sisa, const char *in)
+{
+	unsigned long addr, len, i;
+	int hi, lo;
+
+	addr = parse_hex(&in);
+	if (*in++ != ',')
+		return 0;
+	len = parse_hex(&in);
+	if (*in++ != ':')
+		return 0;
+
+	if (addr >= SISA_MEMORY_SIZE || len > SISA_MEMORY_SIZE - addr)
+		return 0;
+
+	for (i = 0; i < len; i++) {
+		if ((hi = hex_value(in[2 * i])) < 0 || (lo = hex_value(in[2 * i + 1])) < 0)
+			break;
+		sisa->memory[addr + i] = hi << 4 | lo;
+	}
+
+	sisa_memory_written(sisa, addr, i);
+
+	return i == len;
+}
+
+static int gdb_breakpoint(struct sisa_gdb *gdb, const char *in, int set)
+{
+	unsigned long addr;
+
+	/* Only software breakpoints: Z0,addr,kind */
+	if (*in++ != '0' || *in++ != ',')
+		return -1;
+
+	addr = parse_hex(&in);
+	if (addr >= SISA_MEMORY_SIZE)
+		return 0;
+
+	bp_set(gdb, addr, set);
+
+	return 1;
+}
+
+static int gdb_resume(struct sisa_gdb *gdb, struct sisa_context *sisa, const char *in, int step)
+{
+	char reply[4];
+	int sig;
+
+	/* Optional resume address */
+	if (*in)
+		sisa->cpu.pc = parse_hex(&in);
+
+	if (step) {
+		gdb_step_instruction(sisa);
+		sig = GDB_SIGTRAP;
+	} else {
+		sig = gdb_continue(gdb, sisa);
+	}
+
+	if (sisa->cpu.halted)
+		printf("CPU halted at 0x%04X\n", sisa->cpu.pc);
+
+	snprintf(reply, sizeof(reply), "S%02x", sig);
+
+	return gdb_send_packet(gdb, reply);
+}
+
+int sisa_gdb_listen(struct sisa_gdb *gdb, const char *addr)
+{
+	int one = 1;
+
+	memset(gdb, 0, sizeof(*gdb));
+	gdb->fd = -1;
+
+	/* Anything that looks like a path is a Unix socket, otherwise a TCP port */
+	if (strchr(addr, '/')) {
+		struct sockaddr_un sun = { .sun_family = AF_UNIX };
+
+		if (strlen(addr) >= sizeof(sun.sun_path)) {
+			printf("Error: GDB socket path too long\n");
+			return 0;
+		}
+
+		strcpy(sun.sun_path, addr);
+		unlink(addr);
+
+		gdb->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (gdb->listen_fd < 0 ||
+		    bind(gdb->listen_fd, (struct sockaddr *)&sun, sizeof(sun)) < 0)
+			goto err;
+
+		gdb->unix_path = strdup(addr);
+	} else {
+		struct sockaddr_in sin = {
+			.sin_family = AF_INET,
+			.sin_port = htons(strtol(addr, NULL, 10)),
+			.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+		};
+
+		gdb->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (gdb->listen_fd < 0)
+			goto err;
+
+		setsockopt(gdb->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+		if (bind(gdb->listen_fd, (struct sockaddr *)&sin, sizeof(sin)) < 0)
+			goto err;
+	}
+
+	if (listen(gdb->listen_fd, 1) < 0)
+		goto err;
+
+	return 1;
+
+err:
+	printf("Error listening on '%s': %s\n", addr, strerror(errno));
+	if (gdb->listen_fd >= 0)
+		close(gdb->listen_fd);
+	gdb->listen_fd = -1;
+	return 0;
+}
+
+int sisa_gdb_serve(struct sisa_gdb *gdb, struct sisa_context *sisa)
+{
+	char *reply = malloc(SISA_GDB_PACKET_SIZE);
+	const char *p;
+	int ret;
+	int one = 1;
+
+	signal(SIGPIPE, SIG_IGN);
+
+	gdb->fd = accept(gdb->listen_fd, NULL, NULL);
+	if (gdb->fd < 0) {
+		printf("Error accepting GDB connection: %s\n", strerror(errno));
+		free(reply);
+		return 0;
+	}
+
+	setsockopt(gdb->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	while (gdb_recv_packet(gdb) >= 0) {
+		p = gdb->packet + 1;
+		reply[0] = '\0';
+
+		switch (gdb->packet[0]) {
+		case '?':
+			strcpy(reply, "S05");
+			break;
+		case 'g':
+			gdb_read_registers(sisa, reply);
+			break;
+		case 'G':
+			strcpy(reply, gdb_write_registers(sisa, p) ? "OK" : "E01");
+			break;
+		case 'p': {
+			uint16_t *reg = gdb_reg(sisa, parse_hex(&p));
+			char *out = reply;
+
+			if (reg) {
+				put_hex16(&out, *reg);
+				*out = '\0';
+			} else {
+				strcpy(reply, "E01");
+			}
+			break;
+		}
+		case 'P': {
+			uint16_t *reg = gdb_reg(sisa, parse_hex(&p));
+			uint16_t value;
+
+			if (reg && *p++ == '=' && get_hex16(&p, &value)) {
+				*reg = value;
+				strcpy(reply, "OK");
+			} else {
+				strcpy(reply, "E01");
+			}
+			break;
+		}
+		case 'm':
+			if (!gdb_read_memory(sisa, p, reply))
+				strcpy(reply, "E01");
+			break;
+		case 'M':
+			strcpy(reply, gdb_write_memory(sisa, p) ? "OK" : "E01");
+			break;
+		case 'Z':
+		case 'z':
+			ret = gdb_breakpoint(gdb, p, gdb->packet[0] == 'Z');
+			if (ret > 0)
+				strcpy(reply, "OK");
+			else if (ret == 0)
+				strcpy(reply, "E01");
+			break;
+		case 's':
+		case 'c':
+			if (!gdb_resume(gdb, sisa, p, gdb->packet[0] == 's'))
+				goto out;
+			continue;
+		case 'H':
+			strcpy(reply, "OK");
+			break;
+		case 'q':
+			if (strncmp(p, "Supported", 9) == 0)
+				snprintf(reply, SISA_GDB_PACKET_SIZE,
+					 "PacketSize=%x;QStartNoAckMode+", SISA_GDB_PACKET_SIZE);
+			else if (strcmp(p, "Attached") == 0)
+				strcpy(reply, "1");
+			break;
+		case 'Q':
+			if (strcmp(p, "StartNoAckMode") == 0) {
+				gdb_send_packet(gdb, "OK");
+				gdb->no_ack = 1;
+				continue;
+			}
+			break;
+		case 'D':
+			gdb_send_packet(gdb, "OK");
+			goto out;
+		case 'k':
+			goto out;
+		}
+
+		if (!gdb_send_packet(gdb, reply))
+			break;
+	}
+
+out:
+	close(gdb->fd);
+	gdb->fd = -1;
+	free(reply);
+
+	return 1;
+}
+
+void sisa_gdb_close(struct sisa_gdb *gdb)
+{
+	if (gdb->fd >= 0)
+		close(gdb->fd);
+
+	if (gdb->listen_fd >= 0)
+		close(gdb->listen_fd);
+
+	if (gdb->unix_path) {
+		unlink(gdb->unix_path);
+		free(gdb->unix_path);
+	}
+
+	gdb->fd = -1;
+	gdb->listen_fd = -1;
+	gdb->unix_path = NULL;
+}
@@ -0,0 +1,32 @@
+#ifndef GDBSTUB_H
+#define GDBSTUB_H
+
+#include <stdint.h>
+#include "sisa.h"
+
+#define SISA_GDB_PACKET_SIZE 4096
+#define SISA_GDB_POLL_CYCLES 65536
+
+/*
+ * Register numbering exposed to the debugger:
+ *   0-7: r0-r7, 8-15: s0-s7, 16: pc
+ */
+#define SISA_GDB_NUM_REGS 17
+
+struct sisa_gdb {
+	int listen_fd;
+	int fd;
+	char *unix_path;
+	int no_ack;
+	uint8_t rx_buf[SISA_GDB_PACKET_SIZE];
+	unsigned int rx_len;
+	unsigned int rx_pos;
+	char packet[SISA_GDB_PACKET_SIZE];
+	uint32_t breakpoints[SISA_MEMORY_SIZE / 2 / 32];
+};
+
+int sisa_gdb_listen(struct sisa_gdb *gdb, const char *addr);
+int sisa_gdb_serve(struct sisa_gdb *gdb, struct sisa_context *sisa);
+void sisa_gdb_close(struct sisa_gdb *gdb);
+
+#endif
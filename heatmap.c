@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "heatmap.h"
+#include "util.h"
+
+#define NUM_PAGES      (SISA_MEMORY_SIZE / SISA_PAGE_SIZE)
+#define WORDS_PER_PAGE (SISA_PAGE_SIZE / 2)
+
+#define PPM_WIDTH  256
+#define PPM_HEIGHT (SISA_HEATMAP_NUM_WORDS / PPM_WIDTH)
+
+/* VGA text mode buffer, a character and attribute byte per cell */
+#define VGA_END_ADDR (SISA_VGA_START_ADDR + SISA_VGA_COLS * SISA_VGA_ROWS * 2)
+
+void sisa_heatmap_reset(struct sisa_heatmap *heatmap)
+{
+	memset(heatmap, 0, sizeof(*heatmap));
+}
+
+void sisa_heatmap_dump_pages(const struct sisa_heatmap *heatmap, uint64_t cycles, FILE *fp)
+{
+	uint64_t fetches[NUM_PAGES] = { 0 }, reads[NUM_PAGES] = { 0 }, writes[NUM_PAGES] = { 0 };
+	uint64_t data = 0, vga_writes = 0;
+	unsigned int i, page;
+
+	for (i = 0; i < SISA_HEATMAP_NUM_WORDS; i++) {
+		page = i / WORDS_PER_PAGE;
+		fetches[page] += heatmap->fetches[i];
+		reads[page] += heatmap->reads[i];
+		writes[page] += heatmap->writes[i];
+		data += heatmap->reads[i] + heatmap->writes[i];
+
+		if (i * 2 >= SISA_VGA_START_ADDR && i * 2 < VGA_END_ADDR)
+			vga_writes += heatmap->writes[i];
+	}
+
+	fprintf(fp, "heatmap: page       fetches        reads       writes     data\n");
+	for (page = 0; page < NUM_PAGES; page++) {
+		if (!fetches[page] && !reads[page] && !writes[page])
+			continue;
+
+		fprintf(fp, "  0x%04X-0x%04X %12llu %12llu %12llu %7.2f%%\n",
+			page * SISA_PAGE_SIZE, (page + 1) * SISA_PAGE_SIZE - 1,
+			(unsigned long long)fetches[page], (unsigned long long)reads[page],
+			(unsigned long long)writes[page], sisa_percent(reads[page] + writes[page], data));
+	}
+
+	fprintf(fp, "  vga writes:   %llu (%.1f per second)\n", (unsigned long long)vga_writes,
+		cycles ? (double)vga_writes * SISA_CPU_CLK_FREQ / cycles : 0.0);
+}
+
+void sisa_heatmap_dump_csv(const struct sisa_heatmap *heatmap, FILE *fp)
+{
+	unsigned int i;
+
+	fprintf(fp, "paddr,fetches,reads,writes\n");
+	for (i = 0; i < SISA_HEATMAP_NUM_WORDS; i++) {
+		if (!heatmap->fetches[i] && !heatmap->reads[i] && !heatmap->writes[i])
+			continue;
+
+		fprintf(fp, "0x%04X,%llu,%llu,%llu\n", i * 2,
+			(unsigned long long)heatmap->fetches[i],
+			(unsigned long long)heatmap->reads[i],
+			(unsigned long long)heatmap->writes[i]);
+	}
+}
+
+/* Number of significant bits, so 0 stays black and each doubling brightens */
+static unsigned int bits(uint64_t n)
+{
+	unsigned int b = 0;
+
+	while (n) {
+		b++;
+		n >>= 1;
+	}
+
+	return b;
+}
+
+static uint8_t scale(uint64_t n, unsigned int max_bits)
+{
+	return max_bits ? bits(n) * 255 / max_bits : 0;
+}
+
+static unsigned int max_bits(const uint64_t *counts)
+{
+	uint64_t max = 0;
+	unsigned int i;
+
+	for (i = 0; i < SISA_HEATMAP_NUM_WORDS; i++) {
+		if (counts[i] > max)
+			max = counts[i];
+	}
+
+	return bits(max);
+}
+
+void sisa_heatmap_dump_ppm(const struct sisa_heatmap *heatmap, FILE *fp)
+{
+	unsigned int fetch_bits = max_bits(heatmap->fetches);
+	unsigned int read_bits = max_bits(heatmap->reads);
+	unsigned int write_bits = max_bits(heatmap->writes);
+	uint8_t pixel[3];
+	unsigned int i;
+
+	fprintf(fp, "P6\n%u %u\n255\n", PPM_WIDTH, PPM_HEIGHT);
+
+	for (i = 0; i < SISA_HEATMAP_NUM_WORDS; i++) {
+		pixel[0] = scale(heatmap->writes[i], write_bits);
+		pixel[1] = scale(heatmap->reads[i], read_bits);
+		pixel[2] = scale(heatmap->fetches[i], fetch_bits);
+		fwrite(pixel, sizeof(pixel), 1, fp);
+	}
+}
+
+int sisa_heatmap_save(const struct sisa_heatmap *heatmap, const char *file)
+{
+	FILE *fp;
+	const char *ext = strrchr(file, '.');
+	int ppm = ext != NULL && strcmp(ext + 1, "ppm") == 0;
+
+	if (!(fp = fopen(file, "w"))) {
+		printf("Error opening '%s': %s\n", file, strerror(errno));
+		return 0;
+	}
+
+	if (ppm)
+		sisa_heatmap_dump_ppm(heatmap, fp);
+	else
+		sisa_heatmap_dump_csv(heatmap, fp);
+
+	fclose(fp);
+
+	return 1;
+}
@@ -0,0 +1,29 @@
+#ifndef HEATMAP_H
+#define HEATMAP_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "sisa.h"
+
+void sisa_heatmap_reset(struct sisa_heatmap *heatmap);
+
+/*
+ * Per 4 KiB page totals, each page's share of the data accesses, and the
+ * writes to the VGA text window with their rate over cycles of guest time.
+ */
+void sisa_heatmap_dump_pages(const struct sisa_heatmap *heatmap, uint64_t cycles, FILE *fp);
+
+/* 'paddr,fetches,reads,writes' lines for the words accessed at least once */
+void sisa_heatmap_dump_csv(const struct sisa_heatmap *heatmap, FILE *fp);
+
+/*
+ * A 256x128 binary PPM with one pixel per word, rows of 512 bytes so each
+ * page is a band of 8 rows. Red is writes, green reads and blue fetches,
+ * each on a log2 scale up to the hottest word of its kind.
+ */
+void sisa_heatmap_dump_ppm(const struct sisa_heatmap *heatmap, FILE *fp);
+
+/* PPM if file ends with .ppm, CSV otherwise. Prints why on errors */
+int sisa_heatmap_save(const struct sisa_heatmap *heatmap, const char *file);
+
+#endif
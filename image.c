@@ -0,0 +1,313 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "image.h"
+#include "util.h"
+
+#define ALIGN_UP(x, a) (((x) + (a) - 1) & ~((size_t)(a) - 1))
+
+static uint32_t crc32_table[256];
+static pthread_once_t crc32_table_once = PTHREAD_ONCE_INIT;
+
+static void crc32_table_init(void)
+{
+	uint32_t c;
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		c = i;
+		for (j = 0; j < 8; j++)
+			c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+		crc32_table[i] = c;
+	}
+}
+
+/* Also used by the capture writer thread, hence the table built once */
+uint32_t sisa_crc32_update(uint32_t crc, const uint8_t *data, size_t size)
+{
+	pthread_once(&crc32_table_once, crc32_table_init);
+
+	crc = ~crc;
+	while (size--)
+		crc = crc32_table[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+
+	return ~crc;
+}
+
+static void tlb_to_image(const struct sisa_tlb *tlb, struct sisa_image_tlb_entry *entries)
+{
+	int i;
+
+	for (i = 0; i < SISA_NUM_TLB_ENTRIES; i++) {
+		entries[i].vpn = tlb->entries[i].vpn;
+		entries[i].pfn = tlb->entries[i].pfn;
+		entries[i].flags = (tlb->entries[i].v ? SISA_IMAGE_TLB_V : 0) |
+				   (tlb->entries[i].r ? SISA_IMAGE_TLB_R : 0) |
+				   (tlb->entries[i].p ? SISA_IMAGE_TLB_P : 0);
+		entries[i].reserved = 0;
+	}
+}
+
+static void tlb_from_image(struct sisa_tlb *tlb, const struct sisa_image_tlb_entry *entries)
+{
+	int i;
+
+	for (i = 0; i < SISA_NUM_TLB_ENTRIES; i++) {
+		tlb->entries[i].vpn = entries[i].vpn;
+		tlb->entries[i].pfn = entries[i].pfn;
+		tlb->entries[i].v = !!(entries[i].flags & SISA_IMAGE_TLB_V);
+		tlb->entries[i].r = !!(entries[i].flags & SISA_IMAGE_TLB_R);
+		tlb->entries[i].p = !!(entries[i].flags & SISA_IMAGE_TLB_P);
+	}
+}
+
+int sisa_image_write(const char *file, const struct sisa_image *image)
+{
+	struct sisa_image_header header;
+	struct sisa_image_segment_entry *segments;
+	struct sisa_image_symbol_entry *symbols;
+	uint8_t *buffer;
+	size_t size, strtab_offset, strtab_size = 0, offset;
+	unsigned int i;
+	FILE *fp;
+	int ok;
+
+	if (image->num_segments > 0xFFFF || image->num_symbols > 0xFFFF) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	for (i = 0; i < image->num_symbols; i++)
+		strtab_size += strlen(image->symbols[i].name) + 1;
+
+	/* Lay out the whole file in memory, then write it in one go */
+	strtab_offset = sizeof(header) + image->num_segments * sizeof(*segments) +
+			image->num_symbols * sizeof(*symbols);
+	size = ALIGN_UP(strtab_offset + strtab_size, SISA_IMAGE_ALIGN);
+	for (i = 0; i < image->num_segments; i++)
+		size = ALIGN_UP(size + image->segments[i].size, SISA_IMAGE_ALIGN);
+
+	if (!(buffer = calloc(1, size)))
+		return 0;
+
+	segments = (void *)(buffer + sizeof(header));
+	symbols = (void *)(segments + image->num_segments);
+
+	offset = 0;
+	for (i = 0; i < image->num_symbols; i++) {
+		symbols[i].addr = image->symbols[i].addr;
+		symbols[i].name = offset;
+		strcpy((char *)buffer + strtab_offset + offset, image->symbols[i].name);
+		offset += strlen(image->symbols[i].name) + 1;
+	}
+
+	offset = ALIGN_UP(strtab_offset + strtab_size, SISA_IMAGE_ALIGN);
+	for (i = 0; i < image->num_segments; i++) {
+		segments[i].addr = image->segments[i].addr;
+		segments[i].size = image->segments[i].size;
+		segments[i].offset = offset;
+		memcpy(buffer + offset, image->segments[i].data, image->segments[i].size);
+		offset = ALIGN_UP(offset + image->segments[i].size, SISA_IMAGE_ALIGN);
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SISA_IMAGE_MAGIC, sizeof(header.magic));
+	header.version = SISA_IMAGE_VERSION;
+	header.flags = (image->tlb_enabled ? SISA_IMAGE_F_TLB_ENABLED : 0) |
+		       (image->has_tlb_presets ? SISA_IMAGE_F_TLB_PRESETS : 0);
+	header.entry_pc = image->entry_pc;
+	header.num_segments = image->num_segments;
+	header.num_symbols = image->num_symbols;
+	header.strtab_size = strtab_size;
+	if (image->has_tlb_presets) {
+		tlb_to_image(&image->itlb, header.itlb);
+		tlb_to_image(&image->dtlb, header.dtlb);
+	}
+	header.crc32 = sisa_crc32_update(0, buffer + sizeof(header), size - sizeof(header));
+	memcpy(buffer, &header, sizeof(header));
+
+	if (!(fp = fopen(file, "wb"))) {
+		free(buffer);
+		return 0;
+	}
+
+	ok = fwrite(buffer, 1, size, fp) == size;
+	ok = fclose(fp) == 0 && ok;
+
+	free(buffer);
+
+	return ok;
+}
+
+/* Checks every table and offset against the file size */
+static int image_validate(const uint8_t *data, size_t size)
+{
+	const struct sisa_image_header *header = (const void *)data;
+	const struct sisa_image_segment_entry *segments;
+	const struct sisa_image_symbol_entry *symbols;
+	const char *strtab;
+	size_t strtab_offset;
+	unsigned int i;
+
+	if (size < sizeof(*header) || memcmp(header->magic, SISA_IMAGE_MAGIC, 4) != 0 ||
+	    header->version != SISA_IMAGE_VERSION)
+		return 0;
+
+	strtab_offset = sizeof(*header) + header->num_segments * sizeof(*segments) +
+			header->num_symbols * sizeof(*symbols);
+	if (strtab_offset + header->strtab_size > size)
+		return 0;
+
+	segments = (const void *)(data + sizeof(*header));
+	symbols = (const void *)(segments + header->num_segments);
+	strtab = (const char *)data + strtab_offset;
+
+	for (i = 0; i < header->num_segments; i++) {
+		if (segments[i].offset > size || segments[i].size > size - segments[i].offset ||
+		    segments[i].size > SISA_MEMORY_SIZE - segments[i].addr)
+			return 0;
+	}
+
+	if (header->num_symbols && (header->strtab_size == 0 ||
+				    strtab[header->strtab_size - 1] != '\0'))
+		return 0;
+
+	for (i = 0; i < header->num_symbols; i++) {
+		if (symbols[i].name >= header->strtab_size)
+			return 0;
+	}
+
+	for (i = 0; i < SISA_NUM_TLB_ENTRIES; i++) {
+		if (header->itlb[i].vpn > 0xF || header->itlb[i].pfn > 0xF ||
+		    header->dtlb[i].vpn > 0xF || header->dtlb[i].pfn > 0xF)
+			return 0;
+	}
+
+	return sisa_crc32_update(0, data + sizeof(*header), size - sizeof(*header)) == header->crc32;
+}
+
+long sisa_image_load(struct sisa_context *sisa, const char *file, struct sisa_image *image)
+{
+	int fd;
+	struct stat st;
+	const uint8_t *data;
+	const struct sisa_image_header *header;
+	const struct sisa_image_segment_entry *segments;
+	const struct sisa_image_symbol_entry *symbols;
+	size_t strtab_offset;
+	long loaded = 0;
+	unsigned int i;
+
+	memset(image, 0, sizeof(*image));
+
+	if ((fd = open(file, O_RDONLY)) < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	if (st.st_size < sizeof(*header)) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (data == MAP_FAILED)
+		return -1;
+
+	if (!image_validate(data, st.st_size)) {
+		munmap((void *)data, st.st_size);
+		errno = EINVAL;
+		return -1;
+	}
+
+	header = (const void *)data;
+	segments = (const void *)(data + sizeof(*header));
+	symbols = (const void *)(segments + header->num_segments);
+	strtab_offset = sizeof(*header) + header->num_segments * sizeof(*segments) +
+			header->num_symbols * sizeof(*symbols);
+
+	image->segments = calloc(header->num_segments, sizeof(*image->segments));
+	image->symbols = calloc(header->num_symbols, sizeof(*image->symbols));
+	image->strtab = malloc(header->strtab_size);
+
+	if ((header->num_segments && !image->segments) ||
+	    (header->num_symbols && !image->symbols) ||
+	    (header->strtab_size && !image->strtab)) {
+		sisa_image_free(image);
+		munmap((void *)data, st.st_size);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	for (i = 0; i < header->num_segments; i++) {
+		sisa_load_binary(sisa, segments[i].addr, (void *)(data + segments[i].offset),
+				 segments[i].size);
+		image->segments[i].addr = segments[i].addr;
+		image->segments[i].data = sisa->memory + segments[i].addr;
+		image->segments[i].size = segments[i].size;
+		loaded += segments[i].size;
+	}
+	image->num_segments = header->num_segments;
+
+	memcpy(image->strtab, data + strtab_offset, header->strtab_size);
+	for (i = 0; i < header->num_symbols; i++) {
+		image->symbols[i].addr = symbols[i].addr;
+		image->symbols[i].name = image->strtab + symbols[i].name;
+	}
+	image->num_symbols = header->num_symbols;
+
+	image->entry_pc = header->entry_pc;
+	image->tlb_enabled = !!(header->flags & SISA_IMAGE_F_TLB_ENABLED);
+	image->has_tlb_presets = !!(header->flags & SISA_IMAGE_F_TLB_PRESETS);
+
+	if (image->has_tlb_presets) {
+		tlb_from_image(&image->itlb, header->itlb);
+		tlb_from_image(&image->dtlb, header->dtlb);
+		sisa->itlb = image->itlb;
+		sisa->dtlb = image->dtlb;
+	}
+
+	sisa_tlb_set_enabled(sisa, image->tlb_enabled);
+	sisa_set_pc(sisa, image->entry_pc);
+
+	munmap((void *)data, st.st_size);
+
+	return loaded;
+}
+
+void sisa_image_free(struct sisa_image *image)
+{
+	free(image->segments);
+	free(image->symbols);
+	free(image->strtab);
+	image->segments = NULL;
+	image->symbols = NULL;
+	image->strtab = NULL;
+	image->num_segments = 0;
+	image->num_symbols = 0;
+}
+
+const struct sisa_symbol *sisa_image_find_symbol(const struct sisa_image *image,
+						 const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < image->num_symbols; i++) {
+		if (strcmp(image->symbols[i].name, name) == 0)
+			return &image->symbols[i];
+	}
+
+	return NULL;
+}
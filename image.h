@@ -0,0 +1,105 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "sisa.h"
+
+/*
+ * Program container (.simg), everything little endian:
+ *
+ *   struct sisa_image_header
+ *   struct sisa_image_segment_entry[num_segments]
+ *   struct sisa_image_symbol_entry[num_symbols]
+ *   string table (strtab_size bytes of NUL terminated symbol names)
+ *   segment data, each segment aligned to SISA_IMAGE_ALIGN bytes
+ *
+ * The CRC32 covers everything after the header, so a cached image can
+ * be verified without parsing it.
+ */
+#define SISA_IMAGE_MAGIC   "SIMG"
+#define SISA_IMAGE_VERSION 1
+#define SISA_IMAGE_ALIGN   16
+
+#define SISA_IMAGE_F_TLB_ENABLED 0x1
+#define SISA_IMAGE_F_TLB_PRESETS 0x2
+
+#define SISA_IMAGE_TLB_V 0x1
+#define SISA_IMAGE_TLB_R 0x2
+#define SISA_IMAGE_TLB_P 0x4
+
+struct sisa_image_tlb_entry {
+	uint8_t vpn;
+	uint8_t pfn;
+	uint8_t flags;
+	uint8_t reserved;
+};
+
+struct sisa_image_header {
+	char magic[4];
+	uint16_t version;
+	uint16_t flags;
+	uint16_t entry_pc;
+	uint16_t num_segments;
+	uint16_t num_symbols;
+	uint16_t reserved;
+	uint32_t strtab_size;
+	uint32_t crc32;
+	struct sisa_image_tlb_entry itlb[SISA_NUM_TLB_ENTRIES];
+	struct sisa_image_tlb_entry dtlb[SISA_NUM_TLB_ENTRIES];
+};
+
+struct sisa_image_segment_entry {
+	uint16_t addr;
+	uint16_t reserved;
+	uint32_t size;
+	uint32_t offset;
+};
+
+struct sisa_image_symbol_entry {
+	uint16_t addr;
+	uint16_t reserved;
+	uint32_t name;
+};
+
+struct sisa_image_segment {
+	uint16_t addr;
+	const void *data;
+	size_t size;
+};
+
+struct sisa_symbol {
+	uint16_t addr;
+	const char *name;
+};
+
+/* In-memory description of an image, for both writing and loading */
+struct sisa_image {
+	uint16_t entry_pc;
+	int tlb_enabled;
+	int has_tlb_presets;
+	struct sisa_tlb itlb;
+	struct sisa_tlb dtlb;
+	struct sisa_image_segment *segments;
+	unsigned int num_segments;
+	struct sisa_symbol *symbols;
+	unsigned int num_symbols;
+	/* Owned by sisa_image_load() */
+	char *strtab;
+};
+
+int sisa_image_write(const char *file, const struct sisa_image *image);
+
+/*
+ * Validates the whole image before touching the context, then copies the
+ * segments into memory[] and applies the PC, TLB enable and TLB presets.
+ * Returns the number of bytes loaded, or -1 with errno set (EINVAL for a
+ * malformed or corrupted image). The loaded segments point into memory[].
+ */
+long sisa_image_load(struct sisa_context *sisa, const char *file, struct sisa_image *image);
+void sisa_image_free(struct sisa_image *image);
+
+const struct sisa_symbol *sisa_image_find_symbol(const struct sisa_image *image,
+						 const char *name);
+
+#endif
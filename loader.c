@@ -0,0 +1,513 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "loader.h"
+#include "asm.h"
+
+struct mapped_file {
+	const char *data;
+	size_t size;
+};
+
+/* Memory a parser wrote to, from start up to end, empty while start >= end */
+struct load_range {
+	uint32_t start;
+	uint32_t end;
+};
+
+static void load_range_add(struct load_range *range, uint32_t addr, uint32_t size)
+{
+	if (addr < range->start)
+		range->start = addr;
+	if (addr + size > range->end)
+		range->end = addr + size;
+}
+
+/* Maps the whole file read-only, empty files get a NULL mapping */
+static int map_file(const char *file, struct mapped_file *map)
+{
+	int fd;
+	struct stat st;
+	void *data;
+
+	if ((fd = open(file, O_RDONLY)) < 0)
+		return 0;
+
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return 0;
+	}
+
+	map->data = NULL;
+	map->size = st.st_size;
+
+	if (map->size > 0) {
+		data = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			close(fd);
+			return 0;
+		}
+		map->data = data;
+	}
+
+	close(fd);
+
+	return 1;
+}
+
+static void unmap_file(struct mapped_file *map)
+{
+	if (map->data)
+		munmap((void *)map->data, map->size);
+}
+
+static int hex_digit(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	else if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	else if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	else
+		return -1;
+}
+
+static int is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+long sisa_load_file_bin(struct sisa_context *sisa, const char *file, uint16_t addr)
+{
+	struct mapped_file map;
+
+	if (!map_file(file, &map))
+		return -1;
+
+	if (SISA_MEMORY_SIZE - addr < map.size) {
+		unmap_file(&map);
+		errno = EFBIG;
+		return -1;
+	}
+
+	if (map.size > 0)
+		sisa_load_binary(sisa, addr, (void *)map.data, map.size);
+
+	unmap_file(&map);
+
+	return map.size;
+}
+
+/* Whitespace separated words of up to 4 hex digits, stops at anything else */
+static long parse_hex(struct sisa_context *sisa, const struct mapped_file *map, uint16_t addr,
+		       struct load_range *range)
+{
+	const char *p = map->data;
+	const char *end = map->data + map->size;
+	uint16_t word;
+	int digits, value;
+	size_t offset = 0;
+	const size_t max_size = SISA_MEMORY_SIZE - addr;
+
+	while (2 * offset + 1 < max_size) {
+		while (p < end && is_space(*p))
+			p++;
+
+		word = 0;
+		for (digits = 0; digits < 4 && p < end && (value = hex_digit(*p)) >= 0; digits++, p++)
+			word = word << 4 | value;
+
+		if (digits == 0)
+			break;
+
+		sisa->memory[addr + 2 * offset] = word & 0xFF;
+		sisa->memory[addr + 2 * offset + 1] = word >> 8;
+		offset++;
+	}
+
+	load_range_add(range, addr, 2 * offset);
+
+	return 2 * offset;
+}
+
+static int ihex_byte(const char *p, const char *end)
+{
+	int hi, lo;
+
+	if (end - p < 2 || (hi = hex_digit(p[0])) < 0 || (lo = hex_digit(p[1])) < 0)
+		return -1;
+
+	return hi << 4 | lo;
+}
+
+/*
+ * Intel HEX, with the record addresses as byte offsets from addr. Only
+ * the first 64KiB can be addressed, so extended address records must be 0.
+ */
+static long parse_ihex(struct sisa_context *sisa, const struct mapped_file *map, uint16_t addr,
+		        struct load_range *range)
+{
+	const char *p = map->data;
+	const char *end = map->data + map->size;
+	int bytes[4 + 255 + 1];
+	int len, i;
+	uint8_t sum;
+	uint32_t dest;
+	size_t loaded = 0;
+
+	while (1) {
+		while (p < end && is_space(*p))
+			p++;
+
+		if (p == end || *p++ != ':')
+			goto invalid;
+
+		/* Byte count, address, type, data and checksum */
+		if ((len = ihex_byte(p, end)) < 0)
+			goto invalid;
+
+		sum = 0;
+		for (i = 0; i < 4 + len + 1; i++) {
+			if ((bytes[i] = ihex_byte(p + 2 * i, end)) < 0)
+				goto invalid;
+			sum += bytes[i];
+		}
+		p += 2 * i;
+
+		if (sum != 0)
+			goto invalid;
+
+		switch (bytes[3]) {
+		case 0x00:
+			dest = addr + (bytes[1] << 8 | bytes[2]);
+			if (dest + len > SISA_MEMORY_SIZE)
+				goto too_big;
+			for (i = 0; i < len; i++)
+				sisa->memory[dest + i] = bytes[4 + i];
+			load_range_add(range, dest, len);
+			if (dest + len - addr > loaded)
+				loaded = dest + len - addr;
+			break;
+		case 0x01:
+			return loaded;
+		case 0x02:
+		case 0x04:
+			if (len != 2 || bytes[4] != 0 || bytes[5] != 0)
+				goto too_big;
+			break;
+		case 0x03:
+		case 0x05:
+			/* Start address, the PC is set separately */
+			break;
+		default:
+			goto invalid;
+		}
+	}
+
+invalid:
+	errno = EINVAL;
+	return -1;
+too_big:
+	errno = EFBIG;
+	return -1;
+}
+
+struct mif_parser {
+	const char *p;
+	const char *end;
+};
+
+/* Skips whitespace and both "-- line" and "% block %" comments */
+static void mif_skip(struct mif_parser *mif)
+{
+	while (mif->p < mif->end) {
+		if (is_space(*mif->p)) {
+			mif->p++;
+		} else if (*mif->p == '-' && mif->p + 1 < mif->end && mif->p[1] == '-') {
+			while (mif->p < mif->end && *mif->p != '\n')
+				mif->p++;
+		} else if (*mif->p == '%') {
+			mif->p++;
+			while (mif->p < mif->end && *mif->p != '%')
+				mif->p++;
+			if (mif->p < mif->end)
+				mif->p++;
+		} else {
+			break;
+		}
+	}
+}
+
+static int mif_accept(struct mif_parser *mif, const char *token)
+{
+	size_t len = strlen(token);
+
+	mif_skip(mif);
+
+	if (mif->end - mif->p < len || strncasecmp(mif->p, token, len) != 0)
+		return 0;
+
+	mif->p += len;
+
+	return 1;
+}
+
+static int mif_word(struct mif_parser *mif, char *word, size_t size)
+{
+	size_t len = 0;
+
+	mif_skip(mif);
+
+	while (mif->p < mif->end && len < size - 1 &&
+	       (isalnum((unsigned char)*mif->p) || *mif->p == '_'))
+		word[len++] = *mif->p++;
+
+	word[len] = '\0';
+
+	return len > 0;
+}
+
+static int mif_number(struct mif_parser *mif, int radix, uint32_t *value)
+{
+	char word[40];
+	char *end;
+
+	if (!mif_word(mif, word, sizeof(word)))
+		return 0;
+
+	*value = strtoul(word, &end, radix);
+
+	return *end == '\0';
+}
+
+static int mif_radix(const char *name)
+{
+	if (strcasecmp(name, "HEX") == 0)
+		return 16;
+	else if (strcasecmp(name, "DEC") == 0 || strcasecmp(name, "UNS") == 0)
+		return 10;
+	else if (strcasecmp(name, "OCT") == 0)
+		return 8;
+	else if (strcasecmp(name, "BIN") == 0)
+		return 2;
+	else
+		return 0;
+}
+
+#define MIF_MAX_VALUES 256
+
+/*
+ * Quartus Memory Initialization File, WIDTH 8 or 16. Addresses in the
+ * file are in units of WIDTH, starting at addr. "A : X Y;" fills A and
+ * A + 1, "[A..B] : X Y;" repeats X Y over the whole range.
+ */
+static long parse_mif(struct sisa_context *sisa, const struct mapped_file *map, uint16_t addr,
+		       struct load_range *range)
+{
+	struct mif_parser mif = { map->data, map->data + map->size };
+	char key[32], value[32];
+	unsigned int width = 16, depth = 0;
+	int addr_radix = 16, data_radix = 16;
+	uint32_t values[MIF_MAX_VALUES];
+	uint32_t start, last, a, dest;
+	unsigned int num, word_size;
+	int bracket;
+	size_t loaded = 0;
+
+	/* Header: KEY = VALUE; up to CONTENT BEGIN */
+	while (!mif_accept(&mif, "CONTENT")) {
+		if (!mif_word(&mif, key, sizeof(key)) || !mif_accept(&mif, "=") ||
+		    !mif_word(&mif, value, sizeof(value)) || !mif_accept(&mif, ";"))
+			goto invalid;
+
+		if (strcasecmp(key, "WIDTH") == 0)
+			width = strtoul(value, NULL, 10);
+		else if (strcasecmp(key, "DEPTH") == 0)
+			depth = strtoul(value, NULL, 10);
+		else if (strcasecmp(key, "ADDRESS_RADIX") == 0)
+			addr_radix = mif_radix(value);
+		else if (strcasecmp(key, "DATA_RADIX") == 0)
+			data_radix = mif_radix(value);
+	}
+
+	if (!mif_accept(&mif, "BEGIN") || (width != 8 && width != 16) ||
+	    !addr_radix || !data_radix)
+		goto invalid;
+
+	word_size = width / 8;
+
+	while (!mif_accept(&mif, "END")) {
+		if ((bracket = mif_accept(&mif, "["))) {
+			if (!mif_number(&mif, addr_radix, &start) || !mif_accept(&mif, "..") ||
+			    !mif_number(&mif, addr_radix, &last) || !mif_accept(&mif, "]") ||
+			    last < start)
+				goto invalid;
+		} else if (!mif_number(&mif, addr_radix, &start)) {
+			goto invalid;
+		}
+
+		if (!mif_accept(&mif, ":"))
+			goto invalid;
+
+		for (num = 0; !mif_accept(&mif, ";"); num++) {
+			if (num == MIF_MAX_VALUES || !mif_number(&mif, data_radix, &values[num]))
+				goto invalid;
+		}
+
+		if (num == 0)
+			goto invalid;
+
+		/* Bounded first, so neither last nor the sizes below can overflow */
+		if (start > SISA_MEMORY_SIZE / word_size - 1)
+			goto too_big;
+
+		if (!bracket)
+			last = start + num - 1;
+
+		if (last > SISA_MEMORY_SIZE / word_size - 1 || (depth && last >= depth) ||
+		    addr + ((uint64_t)last + 1) * word_size > SISA_MEMORY_SIZE)
+			goto too_big;
+
+		for (a = start; a <= last; a++) {
+			dest = addr + a * word_size;
+			sisa->memory[dest] = values[(a - start) % num] & 0xFF;
+			if (word_size == 2)
+				sisa->memory[dest + 1] = (values[(a - start) % num] >> 8) & 0xFF;
+		}
+
+		load_range_add(range, addr + start * word_size, (last - start + 1) * word_size);
+
+		if ((last + 1) * word_size > loaded)
+			loaded = (last + 1) * word_size;
+	}
+
+	return loaded;
+
+invalid:
+	errno = EINVAL;
+	return -1;
+too_big:
+	errno = EFBIG;
+	return -1;
+}
+
+static long load_mapped(struct sisa_context *sisa, const char *file, uint16_t addr,
+			long (*parse)(struct sisa_context *, const struct mapped_file *, uint16_t,
+				      struct load_range *))
+{
+	struct mapped_file map;
+	struct load_range range = { SISA_MEMORY_SIZE, 0 };
+	long ret;
+	int saved_errno;
+
+	if (!map_file(file, &map))
+		return -1;
+
+	ret = parse(sisa, &map, addr, &range);
+	saved_errno = errno;
+
+	/*
+	 * Records and sections can go anywhere, not just after addr. A parse
+	 * that failed halfway may still have written some, usually nothing.
+	 */
+	if (range.end > range.start)
+		sisa_memory_written(sisa, range.start, range.end - range.start);
+
+	unmap_file(&map);
+	errno = saved_errno;
+
+	return ret;
+}
+
+long sisa_load_file_hex(struct sisa_context *sisa, const char *file, uint16_t addr)
+{
+	return load_mapped(sisa, file, addr, parse_hex);
+}
+
+long sisa_load_file_ihex(struct sisa_context *sisa, const char *file, uint16_t addr)
+{
+	return load_mapped(sisa, file, addr, parse_ihex);
+}
+
+long sisa_load_file_mif(struct sisa_context *sisa, const char *file, uint16_t addr)
+{
+	return load_mapped(sisa, file, addr, parse_mif);
+}
+
+/* The text section starts at addr, the data section at SISA_DATA_LOAD_ADDR */
+static long parse_asm(struct sisa_context *sisa, const struct mapped_file *map, uint16_t addr,
+		       struct load_range *range)
+{
+	struct sisa_asm as;
+	long loaded = 0;
+	int i, ok;
+
+	sisa_asm_init(&as, addr, SISA_DATA_LOAD_ADDR);
+	ok = sisa_asm_assemble(&as, map->data, map->size, sisa->memory);
+
+	for (i = 0; i < SISA_ASM_NUM_SECTIONS; i++) {
+		if (as.sections[i].end > as.sections[i].start) {
+			loaded += as.sections[i].end - as.sections[i].start;
+			load_range_add(range, as.sections[i].start,
+				       as.sections[i].end - as.sections[i].start);
+		}
+	}
+
+	sisa_asm_destroy(&as);
+
+	if (!ok) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return loaded;
+}
+
+long sisa_load_file_asm(struct sisa_context *sisa, const char *file, uint16_t addr)
+{
+	return load_mapped(sisa, file, addr, parse_asm);
+}
+
+/* Plain hex words unless the first non-blank character starts an Intel HEX record */
+static long parse_text(struct sisa_context *sisa, const struct mapped_file *map, uint16_t addr,
+		        struct load_range *range)
+{
+	size_t i = 0;
+
+	while (i < map->size && is_space(map->data[i]))
+		i++;
+
+	if (i < map->size && map->data[i] == ':')
+		return parse_ihex(sisa, map, addr, range);
+	else
+		return parse_hex(sisa, map, addr, range);
+}
+
+/*
+ * .bin is raw binary, .mif a Quartus MIF and .s/.asm assembly source.
+ * Anything else is text:
+ * Intel HEX if it starts with ':', plain hex words otherwise.
+ */
+long sisa_load_file(struct sisa_context *sisa, const char *file, uint16_t addr)
+{
+	const char *ext = strrchr(file, '.');
+
+	if (ext != NULL && strcmp(ext + 1, "bin") == 0) {
+		return sisa_load_file_bin(sisa, file, addr);
+	} else if (ext != NULL && strcasecmp(ext + 1, "mif") == 0) {
+		return sisa_load_file_mif(sisa, file, addr);
+	} else if (ext != NULL && (strcasecmp(ext + 1, "s") == 0 ||
+				   strcasecmp(ext + 1, "asm") == 0)) {
+		return sisa_load_file_asm(sisa, file, addr);
+	} else {
+		return load_mapped(sisa, file, addr, parse_text);
+	}
+}
@@ -0,0 +1,21 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <stdint.h>
+#include "sisa.h"
+
+/*
+ * All loaders return the number of bytes loaded, or -1 with errno set
+ * on failure (EFBIG if the image doesn't fit at the given address,
+ * EINVAL if an Intel HEX or MIF file is malformed or an assembly
+ * source doesn't assemble, see sisa-as for the error message). Files are mmapped
+ * and copied straight into the guest memory.
+ */
+long sisa_load_file_bin(struct sisa_context *sisa, const char *file, uint16_t addr);
+long sisa_load_file_hex(struct sisa_context *sisa, const char *file, uint16_t addr);
+long sisa_load_file_ihex(struct sisa_context *sisa, const char *file, uint16_t addr);
+long sisa_load_file_mif(struct sisa_context *sisa, const char *file, uint16_t addr);
+long sisa_load_file_asm(struct sisa_context *sisa, const char *file, uint16_t addr);
+long sisa_load_file(struct sisa_context *sisa, const char *file, uint16_t addr);
+
+#endif
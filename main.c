@@ -6,7 +6,24 @@
 #include <unistd.h>
 #include <getopt.h>
 #include <errno.h>
+#include <ctype.h>
 #include "sisa.h"
+#include "reverse.h"
+#include "gdbstub.h"
+#include "stats.h"
+#include "loader.h"
+#include "coverage.h"
+#include "image.h"
+#include "cache.h"
+#include "cost.h"
+#include "profile.h"
+#include "heatmap.h"
+#include "statehash.h"
+#include "cond.h"
+#include "stimulus.h"
+#include "shm.h"
+#include "capture.h"
+#include "vcd.h"
 
 #define xstr(a) str(a)
 #define str(a) #a
@@ -17,11 +34,25 @@ enum run_mode {
 };
 
 static struct termios told;
+static struct sisa_coverage coverage;
+static struct sisa_cache icache, dcache;
+static struct sisa_cost_model cost;
+static struct sisa_profile profile;
+static struct sisa_heatmap heatmap;
+static struct sisa_state_hash state_hash;
+static struct sisa_cond_set conds;
+static struct sisa_stimulus stimulus;
+static struct sisa_shm shm;
+static struct sisa_capture capture;
+static struct sisa_vcd vcd;
+/* Kept for the profile report */
+static struct sisa_image image;
 
 static void usage(char *argv[])
 {
 	printf("Source code: https://github.com/xerpi/sisa-emu\n\n"
-		"Usage: %s [OPTIONS] <code.bin> <data.bin>\n\n"
+		"Usage: %s [OPTIONS] <code.bin> <data.bin>\n"
+		"       %s [OPTIONS] <program.simg> [data.bin]\n\n"
 		"  -t, --enable-tlb        enables the TLB\n"
 		"                            (defaults to disabled)\n"
 		"  -v, --show-vga          prints the VGA when in continue mode\n"
@@ -43,6 +74,62 @@ static void usage(char *argv[])
 		"  -p, --pc-addr=ADDR      initial address of the PC\n"
 		"                            (defaults to " xstr(SISA_CODE_LOAD_ADDR) ")\n"
 		"  -b, --breakpoint=ADDR   adds a breakpoint to ADDR\n"
+		"      --break-if=EXPR     stops when EXPR is true, for example\n"
+		"                            'pc==0xC120 && r3>10' or 'mem16[0x8004]!=0',\n"
+		"                            checked at its PC or on writes to its memory\n"
+		"                            operands (see cond.h, not in GDB mode)\n"
+		"      --stimulus=FILE     drives the keys, switches and keyboard from the\n"
+		"                            events in FILE, on cycles or conditions (see\n"
+		"                            stimulus.h, stepping back doesn't rewind it,\n"
+		"                            not in GDB mode)\n"
+		"  -i, --rev-interval=N    cycles between reverse execution checkpoints\n"
+		"                            (defaults to " xstr(SISA_REV_DEFAULT_INTERVAL) ", adapts to the budget)\n"
+		"  -r, --rev-budget=MB     memory budget for reverse execution checkpoints\n"
+		"                            (defaults to 64)\n"
+		"  -g, --gdb=PORT|PATH     runs headless, serving the GDB remote protocol on\n"
+		"                            localhost TCP PORT or Unix socket PATH\n"
+		"      --stats=FILE        dumps the run statistics to FILE at exit, as\n"
+		"                            JSON if it ends with .json ('-' is stdout)\n"
+		"                            (needs a build with STATS=1)\n"
+		"      --coverage=FILE     records the executed code and branch directions\n"
+		"                            and saves them to FILE at exit (see sisa-cov)\n"
+		"      --icache[=OPTS]     models an instruction cache, misses stall the CPU\n"
+		"      --dcache[=OPTS]     models a data cache, the counters are printed at exit\n"
+		"                            OPTS: size=N,line=N,ways=N,policy=wb|wt,miss=N,write=N\n"
+		"                            (defaults to size=4096,line=16,ways=2,policy=wb,\n"
+		"                            miss=10,write=10; stepping back doesn't rewind caches)\n"
+		"      --cost-model=FILE   adds the extra cycles listed in FILE to instructions,\n"
+		"                            fetches, data accesses and exceptions (see cost.h)\n"
+		"      --profile[=HZ]      samples the PC HZ times per second of host CPU time\n"
+		"                            and prints the hottest code at exit, symbolized\n"
+		"                            with the symbols of a .simg (defaults to "
+		xstr(SISA_PROFILE_DEFAULT_FREQ) ")\n"
+		"      --heatmap[=FILE]    counts fetches, reads and writes per word, prints\n"
+		"                            the per page totals at exit and saves the words\n"
+		"                            to FILE, as a PPM image if it ends with .ppm\n"
+		"                            and as CSV otherwise\n"
+		"      --hash-log file=FILE[,interval=N][,from=CYCLE][,to=CYCLE]\n"
+		"                          logs a hash of the machine state to FILE every N\n"
+		"                            cycles (defaults to " xstr(SISA_STATE_HASH_DEFAULT_INTERVAL) "), see sisa-bisect\n"
+		"                            (not in GDB mode)\n"
+		"      --shm name=NAME[,interval=N]\n"
+		"                          exports memory, I/O ports, registers and stats\n"
+		"                            to the POSIX shared memory NAME every N cycles\n"
+		"                            (defaults to " xstr(SISA_SHM_DEFAULT_INTERVAL) ") and at every step,\n"
+		"                            see sisa-monitor (not in GDB mode)\n"
+		"      --capture dir=DIR[,fps=N][,format=png|ppm]\n"
+		"                          saves the VGA text screen, attributes included, as\n"
+		"                            images in DIR at N frames per second of guest\n"
+		"                            time (defaults to " xstr(SISA_CAPTURE_DEFAULT_FPS) " and png), skipping\n"
+		"                            frames identical to the previous one (not in GDB\n"
+		"                            mode, stepping back doesn't rewind it)\n"
+		"      --vcd file=FILE[,from=CYCLE][,cycles=N][,trigger=EXPR][,ports=P:P...]\n"
+		"                          writes pc, ir, status, exception, ints_pending,\n"
+		"                            the registers and ports P as a VCD waveform,\n"
+		"                            only the changes of each cycle, N cycles from\n"
+		"                            CYCLE on or from when the condition EXPR is\n"
+		"                            true after it (ports default to " SISA_VCD_DEFAULT_PORTS ",\n"
+		"                            not in GDB mode, stepping back isn't recorded)\n"
 		"  -l, --load addr=ADDR,file=FILE loads FILE to ADDR\n"
 		"  -h, --help              displays this help and exit\n"
 		"\nExample:\n"
@@ -51,8 +138,104 @@ static void usage(char *argv[])
 		" and 'sysdata.bin' to " xstr(SISA_DATA_LOAD_ADDR) "\n"
 		"\nTo switch between keyboard immersive/non immersive modes press the TAB key.\n"
 		"\nNote: when loading a file, if the filename ends with .bin it will be loaded as\n"
-		"raw binary, and as text (ASCII) otherwise (for example if it ends with .hex).\n"
-		, argv[0]);
+		"raw binary, if it ends with .mif as a Quartus MIF, if it ends with .s or .asm\n"
+		"it is assembled (see sisa-as, the text section starts at the load address),\n"
+		"and it is loaded as text (ASCII) otherwise: Intel HEX if it starts\n"
+		"with ':', hex words (for example .hex) if not.\n"
+		"A .simg image (see sisa-pack) sets the PC and TLB itself, -p and -t override it.\n"
+		, argv[0], argv[0]);
+}
+
+/* Prints the cache counters at exit and frees the caches */
+static void report_caches(int use_icache, int use_dcache)
+{
+	if (use_icache) {
+		sisa_cache_dump_text(&icache, "icache", stdout);
+		sisa_cache_destroy(&icache);
+	}
+
+	if (use_dcache) {
+		sisa_cache_dump_text(&dcache, "dcache", stdout);
+		sisa_cache_destroy(&dcache);
+	}
+}
+
+/*
+ * Runs the checkpoints after a cycle and fires the due stimulus events.
+ * Breakpoints stop when unconditional or when one of their conditions is
+ * true.
+ */
+static int break_reached(struct sisa_context *sisa, int use_stimulus)
+{
+	int reached = sisa_breakpoint_reached(sisa);
+
+	if (use_stimulus) {
+		if (reached)
+			sisa_stimulus_breakpoint(sisa, sisa->cpu.pc, &stimulus);
+		sisa_stimulus_apply(&stimulus);
+	}
+
+	if (conds.hit || stimulus.stopped)
+		return 1;
+
+	return reached && sisa_cond_set_breakpoint(sisa, sisa->cpu.pc, &conds);
+}
+
+static void io_out(struct sisa_context *sisa, uint8_t port, uint16_t value, void *arg)
+{
+	sisa_cond_set_out(sisa, port, value, &conds);
+	sisa_stimulus_out(sisa, port, value, &stimulus);
+}
+
+static void set_callbacks(struct sisa_context *sisa)
+{
+	struct sisa_callbacks callbacks = { 0 };
+
+	callbacks.out = io_out;
+	sisa_set_callbacks(sisa, &callbacks);
+}
+
+/* Stimulus inputs are logged like the terminal ones so stepping back replays them */
+static void stimulus_input(struct sisa_context *sisa, enum sisa_stimulus_action action,
+			   uint8_t value, void *arg)
+{
+	struct sisa_rev *rev = arg;
+
+	switch (action) {
+	case SISA_STIMULUS_KEY:
+		sisa_rev_key_toggle(rev, sisa, value);
+		break;
+	case SISA_STIMULUS_SWITCH:
+		sisa_rev_switch_toggle(rev, sisa, value);
+		break;
+	case SISA_STIMULUS_KEYBOARD:
+		sisa_rev_keyboard_press(rev, sisa, value);
+		break;
+	default:
+		break;
+	}
+}
+
+/* Stops the profiler, prints its histogram and frees it */
+static void report_profile(int use_profile)
+{
+	if (!use_profile)
+		return;
+
+	sisa_profile_stop(&profile);
+	sisa_profile_report(&profile, image.symbols, image.num_symbols, stdout);
+	sisa_profile_destroy(&profile);
+}
+
+static void report_heatmap(int use_heatmap, const char *heatmap_file, uint64_t cycles)
+{
+	if (!use_heatmap)
+		return;
+
+	sisa_heatmap_dump_pages(&heatmap, cycles, stdout);
+
+	if (heatmap_file)
+		sisa_heatmap_save(&heatmap, heatmap_file);
 }
 
 static void print_help()
@@ -60,7 +243,10 @@ static void print_help()
 	printf(
 		"Help:\n"
 		"s - do step\n"
+		"S - step back\n"
 		"c - pause/continue\n"
+		"C - continue back to the previous breakpoint\n"
+		"W - run back to the last write of a physical address\n"
 		"r - reset\n"
 		"a - info all\n"
 		"i - info registers\n"
@@ -96,107 +282,68 @@ static int kbhit()
 	return select(1, &fds, NULL, NULL, &tv);
 }
 
-static size_t fp_get_size(FILE *fp)
-{
-	size_t size;
-
-	fseek(fp, 0, SEEK_END);
-	size = ftell(fp);
-	rewind(fp);
-
-	return size;
-}
-
-static int load_file_bin(struct sisa_context *sisa, const char *file, uint16_t addr)
+static int read_hex(uint16_t *value)
 {
-	FILE *fp;
-	size_t size;
-	size_t read_size;
-	void *buffer;
-
-	if (!(fp = fopen(file, "rb"))) {
-		printf("Error opening '%s': %s\n", file, strerror(errno));
-		return 0;
+	char buf[8];
+	int len = 0;
+	int c;
+
+	while ((c = getchar()) != EOF && c != '\n') {
+		if (isxdigit(c) && len < sizeof(buf) - 1) {
+			buf[len++] = c;
+			putchar(c);
+		}
 	}
 
-	size = fp_get_size(fp);
+	putchar('\n');
+	buf[len] = '\0';
 
-	if (SISA_MEMORY_SIZE - addr < size) {
-		printf("Error loading '%s': size limit exceeded\n", file);
-		fclose(fp);
+	if (len == 0)
 		return 0;
-	}
 
-	buffer = malloc(size);
-	read_size = fread(buffer, 1, size, fp);
-
-	sisa_load_binary(sisa, addr, buffer, read_size);
-
-	free(buffer);
-	fclose(fp);
-
-	printf("Loaded '%s' at address 0x%04X\n", file, addr);
+	*value = strtol(buf, NULL, 16);
 
 	return 1;
 }
 
-static int load_file_hex(struct sisa_context *sisa, const char *file, uint16_t addr)
+static int load_file(struct sisa_context *sisa, const char *file, uint16_t addr)
 {
-	FILE *fp;
-	int ret;
-	uint16_t *buffer;
-	uint16_t word;
-	uint16_t offset = 0;
-	const uint16_t max_size = SISA_MEMORY_SIZE - addr;
-
-	if (!(fp = fopen(file, "r"))) {
-		printf("Error opening '%s': %s\n", file, strerror(errno));
+	if (sisa_load_file(sisa, file, addr) < 0) {
+		if (errno == EFBIG)
+			printf("Error loading '%s': size limit exceeded\n", file);
+		else if (errno == EINVAL)
+			printf("Error loading '%s': invalid file format\n", file);
+		else
+			printf("Error loading '%s': %s\n", file, strerror(errno));
 		return 0;
 	}
 
-	buffer = malloc(max_size);
-
-	while (2 * offset < max_size) {
-		ret = fscanf(fp, "%4hx", &word);
-		if (ret == -1) {
-			if (errno != 0) {
-				printf("Error loading '%s': %s\n", file,
-					strerror(errno));
-				free(buffer);
-				fclose(fp);
-				return 0;
-			} else {
-				break;
-			}
-		}
-
-		if (ret == EOF || ret == 0)
-			break;
-
-		buffer[offset] = word;
-		offset++;
-	}
-
-	sisa_load_binary(sisa, addr, buffer, 2 * offset);
-
-	free(buffer);
-	fclose(fp);
-
 	printf("Loaded '%s' at address 0x%04X\n", file, addr);
 
 	return 1;
 }
 
-
-static int load_file(struct sisa_context *sisa, const char *file, uint16_t addr)
+static int is_image_file(const char *file)
 {
 	const char *ext = strrchr(file, '.');
 
-	if (ext != NULL && strcmp(ext + 1, "bin") == 0) {
-		return load_file_bin(sisa, file, addr);
-	} else {
-		return load_file_hex(sisa, file, addr);
+	return ext != NULL && strcmp(ext + 1, "simg") == 0;
+}
+
+static int load_image(struct sisa_context *sisa, const char *file, struct sisa_image *image)
+{
+	if (sisa_image_load(sisa, file, image) < 0) {
+		if (errno == EINVAL)
+			printf("Error loading '%s': invalid or corrupted image\n", file);
+		else
+			printf("Error loading '%s': %s\n", file, strerror(errno));
+		return 0;
 	}
+
+	printf("Loaded image '%s': %u segments, %u symbols\n", file, image->num_segments,
+	       image->num_symbols);
+
+	return 1;
 }
 
 enum load_subopt {
@@ -248,10 +395,262 @@ static int parse_load_subopt(struct sisa_context *sisa, char *optarg)
 	return 1;
 }
 
+enum hash_log_subopt {
+	HASH_FILE_OPT = 0,
+	HASH_INTERVAL_OPT,
+	HASH_FROM_OPT,
+	HASH_TO_OPT
+};
+
+static char *const hash_log_subopt_token[] = {
+	[HASH_FILE_OPT] = "file",
+	[HASH_INTERVAL_OPT] = "interval",
+	[HASH_FROM_OPT] = "from",
+	[HASH_TO_OPT] = "to",
+	NULL
+};
+
+struct hash_log_opts {
+	char *file;
+	uint64_t interval;
+	uint64_t from;
+	uint64_t to;
+};
+
+static int parse_hash_log_subopt(struct hash_log_opts *opts, char *optarg)
+{
+	char *value;
+	char *subopts = optarg;
+	int token;
+
+	while (*subopts != '\0') {
+		token = getsubopt(&subopts, hash_log_subopt_token, &value);
+
+		if (token < 0) {
+			printf("Error: unknown hash log option '%s'\n", value);
+			return 0;
+		} else if (!value) {
+			printf("Error: hash log option '%s' needs a value\n",
+			       hash_log_subopt_token[token]);
+			return 0;
+		}
+
+		switch (token) {
+		case HASH_FILE_OPT:
+			opts->file = value;
+			break;
+		case HASH_INTERVAL_OPT:
+			opts->interval = strtoull(value, NULL, 0);
+			break;
+		case HASH_FROM_OPT:
+			opts->from = strtoull(value, NULL, 0);
+			break;
+		case HASH_TO_OPT:
+			opts->to = strtoull(value, NULL, 0);
+			break;
+		}
+	}
+
+	if (!opts->file) {
+		printf("Error: the hash log needs a file\n");
+		return 0;
+	}
+
+	return 1;
+}
+
+enum shm_subopt {
+	SHM_NAME_OPT = 0,
+	SHM_INTERVAL_OPT
+};
+
+static char *const shm_subopt_token[] = {
+	[SHM_NAME_OPT] = "name",
+	[SHM_INTERVAL_OPT] = "interval",
+	NULL
+};
+
+struct shm_opts {
+	char *name;
+	uint64_t interval;
+};
+
+static int parse_shm_subopt(struct shm_opts *opts, char *optarg)
+{
+	char *value;
+	char *subopts = optarg;
+	int token;
+
+	while (*subopts != '\0') {
+		token = getsubopt(&subopts, shm_subopt_token, &value);
+
+		if (token < 0) {
+			printf("Error: unknown shared memory option '%s'\n", value);
+			return 0;
+		} else if (!value) {
+			printf("Error: shared memory option '%s' needs a value\n",
+			       shm_subopt_token[token]);
+			return 0;
+		}
+
+		switch (token) {
+		case SHM_NAME_OPT:
+			opts->name = value;
+			break;
+		case SHM_INTERVAL_OPT:
+			opts->interval = strtoull(value, NULL, 0);
+			break;
+		}
+	}
+
+	if (!opts->name) {
+		printf("Error: the shared memory export needs a name\n");
+		return 0;
+	}
+
+	return 1;
+}
+
+enum capture_subopt {
+	CAPTURE_DIR_OPT = 0,
+	CAPTURE_FPS_OPT,
+	CAPTURE_FORMAT_OPT
+};
+
+static char *const capture_subopt_token[] = {
+	[CAPTURE_DIR_OPT] = "dir",
+	[CAPTURE_FPS_OPT] = "fps",
+	[CAPTURE_FORMAT_OPT] = "format",
+	NULL
+};
+
+struct capture_opts {
+	char *dir;
+	unsigned int fps;
+	enum sisa_capture_format format;
+};
+
+static int parse_capture_subopt(struct capture_opts *opts, char *optarg)
+{
+	char *value;
+	char *subopts = optarg;
+	int token;
+
+	while (*subopts != '\0') {
+		token = getsubopt(&subopts, capture_subopt_token, &value);
+
+		if (token < 0) {
+			printf("Error: unknown capture option '%s'\n", value);
+			return 0;
+		} else if (!value) {
+			printf("Error: capture option '%s' needs a value\n",
+			       capture_subopt_token[token]);
+			return 0;
+		}
+
+		switch (token) {
+		case CAPTURE_DIR_OPT:
+			opts->dir = value;
+			break;
+		case CAPTURE_FPS_OPT:
+			opts->fps = strtoul(value, NULL, 0);
+			break;
+		case CAPTURE_FORMAT_OPT:
+			if (strcmp(value, "png") == 0) {
+				opts->format = SISA_CAPTURE_PNG;
+			} else if (strcmp(value, "ppm") == 0) {
+				opts->format = SISA_CAPTURE_PPM;
+			} else {
+				printf("Error: unknown capture format '%s'\n", value);
+				return 0;
+			}
+			break;
+		}
+	}
+
+	if (!opts->dir) {
+		printf("Error: the capture needs a directory\n");
+		return 0;
+	}
+
+	return 1;
+}
+
+enum vcd_subopt {
+	VCD_FILE_OPT = 0,
+	VCD_FROM_OPT,
+	VCD_CYCLES_OPT,
+	VCD_TRIGGER_OPT,
+	VCD_PORTS_OPT
+};
+
+static char *const vcd_subopt_token[] = {
+	[VCD_FILE_OPT] = "file",
+	[VCD_FROM_OPT] = "from",
+	[VCD_CYCLES_OPT] = "cycles",
+	[VCD_TRIGGER_OPT] = "trigger",
+	[VCD_PORTS_OPT] = "ports",
+	NULL
+};
+
+struct vcd_opts {
+	char *file;
+	struct sisa_vcd_config config;
+};
+
+static int parse_vcd_subopt(struct vcd_opts *opts, char *optarg)
+{
+	char *value;
+	char *subopts = optarg;
+	int token;
+
+	sisa_vcd_config_default(&opts->config);
+
+	while (*subopts != '\0') {
+		token = getsubopt(&subopts, vcd_subopt_token, &value);
+
+		if (token < 0) {
+			printf("Error: unknown VCD option '%s'\n", value);
+			return 0;
+		} else if (!value) {
+			printf("Error: VCD option '%s' needs a value\n", vcd_subopt_token[token]);
+			return 0;
+		}
+
+		switch (token) {
+		case VCD_FILE_OPT:
+			opts->file = value;
+			break;
+		case VCD_FROM_OPT:
+			opts->config.from = strtoull(value, NULL, 0);
+			break;
+		case VCD_CYCLES_OPT:
+			opts->config.cycles = strtoull(value, NULL, 0);
+			break;
+		case VCD_TRIGGER_OPT:
+			opts->config.trigger = value;
+			break;
+		case VCD_PORTS_OPT:
+			if (!sisa_vcd_parse_ports(&opts->config, value))
+				return 0;
+			break;
+		}
+	}
+
+	if (!opts->file) {
+		printf("Error: the VCD output needs a file\n");
+		return 0;
+	}
+
+	return 1;
+}
+
 int main(int argc, char *argv[])
 {
 	int i;
-	struct sisa_context sisa;
+	/* Static so memory and I/O ports sisa_init() leaves alone start zeroed */
+	static struct sisa_context sisa;
+	struct sisa_rev rev;
 	enum run_mode run_mode = RUN_MODE_STEP;
 	int kb_immersive_mode = 0;
 	int do_step;
@@ -271,6 +670,24 @@ int main(int argc, char *argv[])
 	uint16_t code_addr = SISA_CODE_LOAD_ADDR;
 	uint16_t data_addr = SISA_DATA_LOAD_ADDR;
 	uint16_t pc_addr = SISA_CODE_LOAD_ADDR;
+	int pc_set = 0;
+	uint64_t rev_interval = SISA_REV_DEFAULT_INTERVAL;
+	size_t rev_budget = SISA_REV_DEFAULT_BUDGET;
+	const char *gdb_addr = NULL;
+	const char *stats_file = NULL;
+	const char *coverage_file = NULL;
+	struct sisa_cache_config icache_config, dcache_config;
+	int use_icache = 0, use_dcache = 0;
+	const char *cost_file = NULL;
+	unsigned int profile_freq = 0;
+	int use_profile = 0;
+	const char *heatmap_file = NULL;
+	int use_heatmap = 0;
+	struct hash_log_opts hash_log = { 0 };
+	const char *stimulus_file = NULL;
+	struct shm_opts shm_opts = { 0 };
+	struct capture_opts capture_opts = { 0 };
+	struct vcd_opts vcd_opts = { 0 };
 
 	struct option long_options[] = {
 		{"enable-tlb", no_argument, NULL, 't'},
@@ -285,6 +702,22 @@ int main(int argc, char *argv[])
 		{"pc-addr", required_argument, NULL, 'p'},
 		{"load", required_argument, NULL, 'l'},
 		{"breakpoint", required_argument, NULL, 'b'},
+		{"rev-interval", required_argument, NULL, 'i'},
+		{"rev-budget", required_argument, NULL, 'r'},
+		{"gdb", required_argument, NULL, 'g'},
+		{"stats", required_argument, NULL, 'S'},
+		{"coverage", required_argument, NULL, 'C'},
+		{"icache", optional_argument, NULL, 'I'},
+		{"dcache", optional_argument, NULL, 'D'},
+		{"cost-model", required_argument, NULL, 'M'},
+		{"profile", optional_argument, NULL, 'P'},
+		{"heatmap", optional_argument, NULL, 'H'},
+		{"hash-log", required_argument, NULL, 'L'},
+		{"break-if", required_argument, NULL, 'B'},
+		{"stimulus", required_argument, NULL, 'T'},
+		{"shm", required_argument, NULL, 'X'},
+		{"capture", required_argument, NULL, 'F'},
+		{"vcd", required_argument, NULL, 'V'},
 		{"help", no_argument, NULL, 'h'},
 		{NULL, 0, NULL, 0}
 	};
@@ -297,8 +730,11 @@ int main(int argc, char *argv[])
 	}
 
 	sisa_init(&sisa);
+	sisa_cond_set_init(&conds, &sisa);
+	sisa_cache_config_default(&icache_config);
+	sisa_cache_config_default(&dcache_config);
 
-	while ((opt = getopt_long(argc, argv, "tvekw7s:c:d:p:l:b:h", long_options, NULL)) != -1) {
+	while ((opt = getopt_long(argc, argv, "tvekw7s:c:d:p:l:b:i:r:g:h", long_options, NULL)) != -1) {
 		switch (opt) {
 		case 't':
 			enable_tlb = 1;
@@ -331,16 +767,76 @@ int main(int argc, char *argv[])
 			break;
 		case 'p':
 			pc_addr = strtol(optarg, NULL, 16);
+			pc_set = 1;
 			break;
 		case 'l':
 			if (!parse_load_subopt(&sisa, optarg))
 				return -1;
 			break;
-		case 'b': {
-			uint16_t bp_addr = strtol(optarg, NULL, 16);
-			sisa_add_breakpoint(&sisa, bp_addr);
+		case 'b':
+			if (!sisa_cond_set_add_breakpoint(&conds, strtol(optarg, NULL, 16)))
+				return -1;
+			break;
+		case 'i':
+			rev_interval = strtoull(optarg, NULL, 10);
+			break;
+		case 'r':
+			rev_budget = strtoul(optarg, NULL, 10) << 20;
+			break;
+		case 'g':
+			gdb_addr = optarg;
+			break;
+		case 'S':
+			stats_file = optarg;
+			break;
+		case 'C':
+			coverage_file = optarg;
+			break;
+		case 'I':
+			if (optarg && !sisa_cache_parse_config(&icache_config, optarg))
+				return -1;
+			use_icache = 1;
+			break;
+		case 'D':
+			if (optarg && !sisa_cache_parse_config(&dcache_config, optarg))
+				return -1;
+			use_dcache = 1;
+			break;
+		case 'M':
+			cost_file = optarg;
+			break;
+		case 'P':
+			if (optarg)
+				profile_freq = strtoul(optarg, NULL, 0);
+			use_profile = 1;
+			break;
+		case 'H':
+			heatmap_file = optarg;
+			use_heatmap = 1;
+			break;
+		case 'L':
+			if (!parse_hash_log_subopt(&hash_log, optarg))
+				return -1;
+			break;
+		case 'B':
+			if (!sisa_cond_set_add(&conds, optarg))
+				return -1;
+			break;
+		case 'T':
+			stimulus_file = optarg;
+			break;
+		case 'X':
+			if (!parse_shm_subopt(&shm_opts, optarg))
+				return -1;
+			break;
+		case 'F':
+			if (!parse_capture_subopt(&capture_opts, optarg))
+				return -1;
+			break;
+		case 'V':
+			if (!parse_vcd_subopt(&vcd_opts, optarg))
+				return -1;
 			break;
-		}
 		case 'h':
 			usage(argv);
 			return -1;
@@ -356,7 +852,17 @@ int main(int argc, char *argv[])
 	has_code = argc > 0;
 	has_data = argc > 1;
 
-	if (has_code) {
+	/* An image brings its own segments, PC and TLB setup */
+	if (has_code && is_image_file(argv[0])) {
+		if (!load_image(&sisa, argv[0], &image))
+			return -1;
+
+		if (!pc_set)
+			pc_addr = image.entry_pc;
+		enable_tlb |= image.tlb_enabled;
+
+		has_code = 0;
+	} else if (has_code) {
 		if (!load_file(&sisa, argv[0], code_addr))
 			return -1;
 	}
@@ -381,6 +887,120 @@ int main(int argc, char *argv[])
 
 	printf("PC address: 0x%04X\n\n", pc_addr);
 
+	if (stats_file && !sisa_stats_enabled())
+		printf("Warning: statistics support not built in, rebuild with STATS=1\n");
+
+	if (coverage_file)
+		sisa_coverage_set(&sisa, &coverage);
+
+	if ((use_icache && !sisa_cache_init(&icache, &icache_config)) ||
+	    (use_dcache && !sisa_cache_init(&dcache, &dcache_config))) {
+		printf("Error setting up the cache model: %s\n", strerror(errno));
+		return -1;
+	}
+
+	sisa_cache_set(&sisa, use_icache ? &icache : NULL, use_dcache ? &dcache : NULL);
+
+	if (cost_file) {
+		sisa_cost_init(&cost);
+		if (!sisa_cost_load_file(&cost, cost_file))
+			return -1;
+		sisa_cost_set(&sisa, &cost);
+	}
+
+	if (use_heatmap)
+		sisa_heatmap_set(&sisa, &heatmap);
+
+	if (use_profile && (!sisa_profile_init(&profile, profile_freq) ||
+			    !sisa_profile_start(&profile, &sisa))) {
+		printf("Error starting the profiler: %s\n", strerror(errno));
+		return -1;
+	}
+
+	if (gdb_addr) {
+		struct sisa_gdb gdb;
+
+		if (!sisa_gdb_listen(&gdb, gdb_addr))
+			return -1;
+
+		printf("Waiting for GDB connection on %s\n", gdb_addr);
+		fflush(stdout);
+
+		sisa_gdb_serve(&gdb, &sisa);
+		sisa_gdb_close(&gdb);
+
+		if (stats_file)
+			sisa_stats_dump_file(sisa_stats_get(&sisa), stats_file);
+
+		if (coverage_file)
+			sisa_coverage_save(&coverage, coverage_file);
+
+		report_caches(use_icache, use_dcache);
+		report_profile(use_profile);
+		report_heatmap(use_heatmap, heatmap_file, sisa.cpu.cycles);
+
+		sisa_image_free(&image);
+		sisa_destroy(&sisa);
+
+		return 0;
+	}
+
+	if (!sisa_rev_init(&rev, rev_interval, rev_budget)) {
+		printf("Error allocating the reverse execution checkpoints\n");
+		return -1;
+	}
+
+	sisa_rev_reset(&rev, &sisa);
+
+	if (hash_log.file) {
+		if (!sisa_state_hash_init(&state_hash, &sisa)) {
+			printf("Error: no write watch left for the state hash\n");
+			return -1;
+		}
+
+		if (!sisa_state_hash_log_open(&state_hash, hash_log.file, hash_log.interval,
+					      hash_log.from, hash_log.to))
+			return -1;
+
+		sisa_state_hash_record(&state_hash);
+	}
+
+	if (stimulus_file) {
+		if (!sisa_stimulus_load_file(&stimulus, stimulus_file))
+			return -1;
+
+		if (!sisa_stimulus_arm(&stimulus, &sisa)) {
+			printf("Error: no write watch left for the stimulus script\n");
+			return -1;
+		}
+
+		stimulus.input = stimulus_input;
+		stimulus.input_arg = &rev;
+		sisa_stimulus_apply(&stimulus);
+	}
+
+	set_callbacks(&sisa);
+
+	if (shm_opts.name) {
+		if (!sisa_shm_create(&shm, shm_opts.name, shm_opts.interval)) {
+			printf("Error creating the shared memory '%s': %s\n", shm_opts.name,
+			       strerror(errno));
+			return -1;
+		}
+
+		sisa_shm_publish(&shm, &sisa);
+	}
+
+	if (capture_opts.dir && !sisa_capture_init(&capture, capture_opts.dir, capture_opts.fps,
+						   capture_opts.format)) {
+		printf("Error starting the capture to '%s': %s\n", capture_opts.dir,
+		       strerror(errno));
+		return -1;
+	}
+
+	if (vcd_opts.file && !sisa_vcd_open(&vcd, vcd_opts.file, &vcd_opts.config))
+		return -1;
+
 	stdin_setup();
 
 	while (1) {
@@ -395,27 +1015,87 @@ int main(int argc, char *argv[])
 				kb_immersive_mode ^= 1;
 			} else if (c == 'k') {
 				printf("Enter key number to toggle: ");
-				sisa_key_toggle(&sisa, getchar() - '0');
+				sisa_rev_key_toggle(&rev, &sisa, getchar() - '0');
 				putchar('\n');
 				if (run_mode == RUN_MODE_STEP)
 					sisa_print_keys_dump(&sisa);
 			} else if (c == 'w') {
 				printf("Enter switch number to toggle: ");
-				sisa_switch_toggle(&sisa, getchar() - '0');
+				sisa_rev_switch_toggle(&rev, &sisa, getchar() - '0');
 				putchar('\n');
 				if (run_mode == RUN_MODE_STEP)
 					sisa_print_switches_dump(&sisa);
 			} else if (!kb_immersive_mode) {
 				if (c == 's') {
 					do_step = 1;
+				} else if (c == 'S') {
+					if (!sisa_rev_step_back(&rev, &sisa))
+						printf("Already at the oldest checkpoint\n");
+					if (hash_log.file)
+						sisa_state_hash_invalidate(&state_hash);
+					run_mode = RUN_MODE_STEP;
+					sisa_print_dump(&sisa);
 				} else if (c == 'c') {
 					if (run_mode == RUN_MODE_STEP)
 						run_mode = RUN_MODE_RUN;
 					else
 						run_mode = RUN_MODE_STEP;
+				} else if (c == 'C') {
+					if (sisa_rev_continue_back(&rev, &sisa))
+						printf("Breakpoint reached at 0x%04X\n", sisa.cpu.pc);
+					else
+						printf("No previous breakpoint, rewound to cycle %llu\n",
+						       (unsigned long long)sisa.cpu.cycles);
+					if (hash_log.file)
+						sisa_state_hash_invalidate(&state_hash);
+					run_mode = RUN_MODE_STEP;
+					sisa_print_dump(&sisa);
+				} else if (c == 'W') {
+					uint16_t addr;
+
+					printf("Enter physical address: ");
+					if (read_hex(&addr)) {
+						if (sisa_rev_last_write(&rev, &sisa, addr))
+							printf("Last write to 0x%04X at cycle %llu\n", addr,
+							       (unsigned long long)sisa.cpu.cycles);
+						else
+							printf("No previous write to 0x%04X\n", addr);
+						if (hash_log.file)
+							sisa_state_hash_invalidate(&state_hash);
+					}
+					run_mode = RUN_MODE_STEP;
+					sisa_print_dump(&sisa);
 				} else if (c == 'r') {
 					printf("CPU reseted\n");
 					sisa_init(&sisa);
+					if (coverage_file)
+						sisa_coverage_set(&sisa, &coverage);
+					if (use_icache)
+						sisa_cache_reset(&icache);
+					if (use_dcache)
+						sisa_cache_reset(&dcache);
+					sisa_cache_set(&sisa, use_icache ? &icache : NULL,
+						       use_dcache ? &dcache : NULL);
+					if (cost_file)
+						sisa_cost_set(&sisa, &cost);
+					if (use_heatmap) {
+						/* The rates are over the cycles since reset */
+						sisa_heatmap_reset(&heatmap);
+						sisa_heatmap_set(&sisa, &heatmap);
+					}
+					if (hash_log.file) {
+						sisa_state_hash_reset(&state_hash);
+						sisa_state_hash_record(&state_hash);
+					}
+					sisa_cond_set_rearm(&conds);
+					if (stimulus_file && !sisa_stimulus_arm(&stimulus, &sisa))
+						printf("Error: no write watch left for the stimulus script\n");
+					set_callbacks(&sisa);
+					sisa_rev_reset(&rev, &sisa);
+					if (stimulus_file)
+						sisa_stimulus_apply(&stimulus);
+					if (capture_opts.dir)
+						sisa_capture_reset(&capture);
 					run_mode = RUN_MODE_STEP;
 				} else if (c == 'a') {
 					sisa_print_vga_dump(&sisa);
@@ -454,19 +1134,33 @@ int main(int argc, char *argv[])
 						break;
 					}
 				}
-				sisa_keyboard_press(&sisa, c);
+				sisa_rev_keyboard_press(&rev, &sisa, c);
 			}
 		}
 
 		if (run_mode == RUN_MODE_STEP && do_step) {
 			sisa_step_cycle(&sisa);
+			sisa_rev_record(&rev, &sisa);
+			if (hash_log.file)
+				sisa_state_hash_record(&state_hash);
+			if (capture_opts.dir)
+				sisa_capture_update(&capture, &sisa);
+			if (vcd_opts.file)
+				sisa_vcd_update(&vcd, &sisa);
 			sisa_print_dump(&sisa);
-			bp_reached = sisa_breakpoint_reached(&sisa);
+			bp_reached = break_reached(&sisa, stimulus_file != NULL);
 		} else if (run_mode == RUN_MODE_RUN) {
 			/* Do as many cycles as the speedup */
 			for (i = 0; i < speedup && !bp_reached; i++) {
 				sisa_step_cycle(&sisa);
-				bp_reached = sisa_breakpoint_reached(&sisa);
+				sisa_rev_record(&rev, &sisa);
+				if (hash_log.file)
+					sisa_state_hash_record(&state_hash);
+				if (capture_opts.dir)
+					sisa_capture_update(&capture, &sisa);
+				if (vcd_opts.file)
+					sisa_vcd_update(&vcd, &sisa);
+				bp_reached = break_reached(&sisa, stimulus_file != NULL);
 			}
 
 			if (show_vga) {
@@ -494,12 +1188,29 @@ int main(int argc, char *argv[])
 			sisa_print_dump(&sisa);
 		}
 
+		/* Monitors follow every step, and the run at the export interval */
+		if (shm_opts.name) {
+			if (run_mode == RUN_MODE_RUN)
+				sisa_shm_update(&shm, &sisa);
+			else
+				sisa_shm_publish(&shm, &sisa);
+		}
+
 		if (sisa_cpu_is_halted(&sisa)) {
 			printf("CPU halted at 0x%04X\n", sisa.cpu.pc);
 			run_mode = RUN_MODE_STEP;
 			kb_immersive_mode = 0;
 		} else if (bp_reached) {
-			printf("Breakpoint reached at 0x%04X\n", sisa.cpu.pc);
+			if (conds.hit && conds.hit->text)
+				printf("Condition '%s' true at 0x%04X (hit %llu)\n", conds.hit->text,
+				       sisa.cpu.pc, (unsigned long long)conds.hit->hits);
+			else if (stimulus.stopped)
+				printf("Stimulus script stopped at cycle %llu\n",
+				       (unsigned long long)sisa.cpu.cycles);
+			else
+				printf("Breakpoint reached at 0x%04X\n", sisa.cpu.pc);
+			conds.hit = NULL;
+			stimulus.stopped = 0;
 			run_mode = RUN_MODE_STEP;
 			kb_immersive_mode = 0;
 			bp_reached = 0;
@@ -508,6 +1219,44 @@ int main(int argc, char *argv[])
 
 	stdin_restore();
 
+	if (stats_file)
+		sisa_stats_dump_file(sisa_stats_get(&sisa), stats_file);
+
+	if (coverage_file)
+		sisa_coverage_save(&coverage, coverage_file);
+
+	report_caches(use_icache, use_dcache);
+	report_profile(use_profile);
+	report_heatmap(use_heatmap, heatmap_file, sisa.cpu.cycles);
+
+	if (hash_log.file)
+		sisa_state_hash_destroy(&state_hash);
+
+	sisa_cond_set_destroy(&conds);
+
+	if (stimulus_file) {
+		sisa_stimulus_disarm(&stimulus);
+		sisa_stimulus_free(&stimulus);
+	}
+
+	if (shm_opts.name)
+		sisa_shm_destroy(&shm);
+
+	if (capture_opts.dir) {
+		sisa_capture_destroy(&capture);
+		printf("VGA capture: %llu frames written to '%s', %llu duplicates skipped",
+		       (unsigned long long)capture.written, capture_opts.dir,
+		       (unsigned long long)capture.duplicates);
+		if (capture.errors)
+			printf(", %llu errors", (unsigned long long)capture.errors);
+		printf("\n");
+	}
+
+	if (vcd_opts.file)
+		sisa_vcd_close(&vcd);
+
+	sisa_image_free(&image);
+	sisa_rev_destroy(&rev);
 	sisa_destroy(&sisa);
 
 	return 0;
@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/time.h>
+#include "profile.h"
+#include "stats.h"
+#include "util.h"
+
+/* Slot keys: valid bit, exception being handled if any, mode and PC */
+#define KEY_VALID           0x80000000u
+#define KEY_IN_EXCEPTION    0x40000000u
+#define KEY_EXCEPTION_SHIFT 17
+#define KEY_MODE_SHIFT      16
+
+#define KEY_PC(key)        ((key) & 0xFFFF)
+#define KEY_MODE(key)      (((key) >> KEY_MODE_SHIFT) & 1)
+#define KEY_EXCEPTION(key) (((key) >> KEY_EXCEPTION_SHIFT) & 0xF)
+
+/* Linear probing gives up after this many slots and drops the sample */
+#define MAX_PROBES 64
+
+#define REPORT_NUM_ADDRESSES 20
+
+static struct sisa_profile *volatile active_profile;
+static struct sigaction old_action;
+
+static void profile_signal(int sig)
+{
+	struct sisa_profile *profile = active_profile;
+	const struct sisa_cpu *cpu;
+	struct sisa_profile_slot *slot;
+	uint32_t key, hash;
+	unsigned int i;
+
+	if (!profile)
+		return;
+
+	cpu = &profile->sisa->cpu;
+	key = KEY_VALID | cpu->pc | (cpu->regfile.system.psw.m << KEY_MODE_SHIFT);
+	if (cpu->in_exception)
+		key |= KEY_IN_EXCEPTION | (cpu->regfile.system.s2 & 0xF) << KEY_EXCEPTION_SHIFT;
+
+	hash = (key * 2654435761u) >> 16;
+
+	for (i = 0; i < MAX_PROBES; i++) {
+		slot = &profile->slots[(hash + i) & (SISA_PROFILE_NUM_SLOTS - 1)];
+		if (slot->key == key || slot->key == 0) {
+			slot->key = key;
+			slot->count++;
+			profile->samples++;
+			return;
+		}
+	}
+
+	profile->dropped++;
+}
+
+int sisa_profile_init(struct sisa_profile *profile, unsigned int freq)
+{
+	memset(profile, 0, sizeof(*profile));
+
+	profile->slots = calloc(SISA_PROFILE_NUM_SLOTS, sizeof(*profile->slots));
+	if (!profile->slots)
+		return 0;
+
+	profile->freq = freq ? freq : SISA_PROFILE_DEFAULT_FREQ;
+
+	return 1;
+}
+
+void sisa_profile_destroy(struct sisa_profile *profile)
+{
+	free(profile->slots);
+	profile->slots = NULL;
+}
+
+int sisa_profile_start(struct sisa_profile *profile, const struct sisa_context *sisa)
+{
+	struct sigaction action;
+	struct itimerval timer;
+
+	if (active_profile) {
+		errno = EBUSY;
+		return 0;
+	}
+
+	profile->sisa = sisa;
+	active_profile = profile;
+
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = profile_signal;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+
+	if (sigaction(SIGPROF, &action, &old_action) < 0) {
+		active_profile = NULL;
+		return 0;
+	}
+
+	timer.it_interval.tv_sec = 0;
+	timer.it_interval.tv_usec = 1000000 / profile->freq;
+	if (timer.it_interval.tv_usec == 0)
+		timer.it_interval.tv_usec = 1;
+	timer.it_value = timer.it_interval;
+
+	if (setitimer(ITIMER_PROF, &timer, NULL) < 0) {
+		sigaction(SIGPROF, &old_action, NULL);
+		active_profile = NULL;
+		return 0;
+	}
+
+	return 1;
+}
+
+void sisa_profile_stop(struct sisa_profile *profile)
+{
+	struct itimerval timer;
+
+	if (active_profile != profile)
+		return;
+
+	memset(&timer, 0, sizeof(timer));
+	setitimer(ITIMER_PROF, &timer, NULL);
+	sigaction(SIGPROF, &old_action, NULL);
+	active_profile = NULL;
+}
+
+static int compare_symbols(const void *a, const void *b)
+{
+	const struct sisa_symbol *sa = a, *sb = b;
+
+	return (int)sa->addr - (int)sb->addr;
+}
+
+static int compare_slots(const void *a, const void *b)
+{
+	const struct sisa_profile_slot *sa = a, *sb = b;
+
+	if (sa->count != sb->count)
+		return sa->count < sb->count ? 1 : -1;
+
+	return sa->key < sb->key ? -1 : sa->key > sb->key;
+}
+
+/* Index of the closest symbol at or below addr in sorted symbols, -1 if none */
+static int find_symbol(const struct sisa_symbol *symbols, unsigned int num_symbols, uint16_t addr)
+{
+	int lo = 0, hi = (int)num_symbols - 1, mid, found = -1;
+
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		if (symbols[mid].addr <= addr) {
+			found = mid;
+			lo = mid + 1;
+		} else {
+			hi = mid - 1;
+		}
+	}
+
+	return found;
+}
+
+static const char *key_context(uint32_t key, char *buf, size_t size)
+{
+	const char *mode = KEY_MODE(key) == SISA_CPU_MODE_USER ? "user" : "system";
+	const char *name;
+
+	if (!(key & KEY_IN_EXCEPTION))
+		return mode;
+
+	name = sisa_stats_exception_name(KEY_EXCEPTION(key));
+	snprintf(buf, size, "%s/%s", mode, name ? name : "?");
+
+	return buf;
+}
+
+void sisa_profile_report(const struct sisa_profile *profile, const struct sisa_symbol *symbols,
+			 unsigned int num_symbols, FILE *fp)
+{
+	struct sisa_profile_slot *slots;
+	struct sisa_symbol *sorted = NULL;
+	struct sisa_profile_slot *functions;
+	unsigned int num_slots = 0, i;
+	char context[32];
+	int sym;
+
+	fprintf(fp, "profile: %llu samples at %u Hz (%llu dropped)\n",
+		(unsigned long long)profile->samples, profile->freq,
+		(unsigned long long)profile->dropped);
+
+	slots = malloc(SISA_PROFILE_NUM_SLOTS * sizeof(*slots));
+	/* One entry per symbol plus one for the addresses below all of them */
+	functions = calloc(num_symbols + 1, sizeof(*functions));
+	if (num_symbols)
+		sorted = malloc(num_symbols * sizeof(*sorted));
+
+	if (!slots || !functions || (num_symbols && !sorted)) {
+		fprintf(fp, "  out of memory\n");
+		goto out;
+	}
+
+	for (i = 0; i < SISA_PROFILE_NUM_SLOTS; i++) {
+		if (profile->slots[i].key)
+			slots[num_slots++] = profile->slots[i];
+	}
+
+	if (num_symbols) {
+		memcpy(sorted, symbols, num_symbols * sizeof(*sorted));
+		qsort(sorted, num_symbols, sizeof(*sorted), compare_symbols);
+	}
+
+	for (i = 0; i < num_slots; i++) {
+		sym = find_symbol(sorted, num_symbols, KEY_PC(slots[i].key));
+		functions[sym + 1].key = sym + 1;
+		functions[sym + 1].count += slots[i].count;
+	}
+
+	qsort(slots, num_slots, sizeof(*slots), compare_slots);
+	qsort(functions, num_symbols + 1, sizeof(*functions), compare_slots);
+
+	fprintf(fp, "  samples       %%  symbol\n");
+	for (i = 0; i < num_symbols + 1 && functions[i].count; i++) {
+		fprintf(fp, "  %7u  %5.1f%%  %s\n", functions[i].count,
+			sisa_percent(functions[i].count, profile->samples),
+			functions[i].key ? sorted[functions[i].key - 1].name : "??");
+	}
+
+	fprintf(fp, "  samples       %%  address  context              symbol\n");
+	for (i = 0; i < num_slots && i < REPORT_NUM_ADDRESSES; i++) {
+		fprintf(fp, "  %7u  %5.1f%%  0x%04X   %-20s ", slots[i].count,
+			sisa_percent(slots[i].count, profile->samples), KEY_PC(slots[i].key),
+			key_context(slots[i].key, context, sizeof(context)));
+
+		sym = find_symbol(sorted, num_symbols, KEY_PC(slots[i].key));
+		if (sym < 0)
+			fprintf(fp, "??\n");
+		else
+			fprintf(fp, "%s+0x%X\n", sorted[sym].name,
+				KEY_PC(slots[i].key) - sorted[sym].addr);
+	}
+
+out:
+	free(slots);
+	free(functions);
+	free(sorted);
+}
@@ -0,0 +1,52 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "sisa.h"
+#include "image.h"
+
+#define SISA_PROFILE_DEFAULT_FREQ 1000
+/* Power of 2, more than the distinct PC/mode/exception triples of most programs */
+#define SISA_PROFILE_NUM_SLOTS    65536
+
+struct sisa_profile_slot {
+	uint32_t key;
+	uint32_t count;
+};
+
+/*
+ * Statistical profiler: a SIGPROF interval timer samples the guest PC,
+ * the CPU mode and the exception being handled, if any (S2 between the
+ * handler entry and its RETI). The signal handler is the only writer of
+ * the slots and never allocates or locks, the emulator itself runs
+ * untouched. Samples that find the table full are counted as dropped.
+ *
+ * The timer and its signal are process wide, so only one profile can be
+ * running at a time.
+ */
+struct sisa_profile {
+	const struct sisa_context *sisa;
+	unsigned int freq;
+	struct sisa_profile_slot *slots;
+	volatile uint64_t samples;
+	volatile uint64_t dropped;
+};
+
+/* Fails with errno set to ENOMEM */
+int sisa_profile_init(struct sisa_profile *profile, unsigned int freq);
+void sisa_profile_destroy(struct sisa_profile *profile);
+
+/* Arms the timer on sisa's CPU time, returns 0 with errno set on errors */
+int sisa_profile_start(struct sisa_profile *profile, const struct sisa_context *sisa);
+void sisa_profile_stop(struct sisa_profile *profile);
+
+/*
+ * Prints the samples per symbol and the hottest addresses, symbolized as
+ * the closest symbol at or below them. symbols can be NULL. The profile
+ * must be stopped.
+ */
+void sisa_profile_report(const struct sisa_profile *profile, const struct sisa_symbol *symbols,
+			 unsigned int num_symbols, FILE *fp);
+
+#endif
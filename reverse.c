@@ -0,0 +1,382 @@
+#include <stdlib.h>
+#include <string.h>
+#include "reverse.h"
+
+struct last_write_watch {
+	uint16_t paddr;
+	uint64_t end;
+	int found;
+	uint64_t cycle;
+};
+
+/* The embedder's hooks, put aside while a replay runs */
+struct rev_muted {
+	struct sisa_callbacks callbacks;
+	sisa_write_watch_cb watch_cbs[SISA_MAX_WRITE_WATCHES];
+};
+
+int sisa_rev_init(struct sisa_rev *rev, uint64_t interval, size_t budget)
+{
+	memset(rev, 0, sizeof(*rev));
+
+	rev->checkpoint_max = budget / sizeof(struct sisa_snapshot);
+	if (rev->checkpoint_max < 2 || interval == 0)
+		return 0;
+
+	rev->checkpoints = malloc(rev->checkpoint_max * sizeof(struct sisa_snapshot));
+	if (!rev->checkpoints)
+		return 0;
+
+	rev->interval = interval;
+
+	return 1;
+}
+
+void sisa_rev_destroy(struct sisa_rev *rev)
+{
+	free(rev->checkpoints);
+	free(rev->inputs);
+	memset(rev, 0, sizeof(*rev));
+}
+
+void sisa_rev_reset(struct sisa_rev *rev, struct sisa_context *sisa)
+{
+	rev->checkpoint_num = 0;
+	rev->input_num = 0;
+	rev->input_next = 0;
+	rev->next_checkpoint = 0;
+
+	sisa_rev_record(rev, sisa);
+}
+
+/* Drop every other checkpoint (keeping the first one) and double the interval */
+static void sisa_rev_thin(struct sisa_rev *rev)
+{
+	unsigned int i, j;
+
+	for (i = 0, j = 0; i < rev->checkpoint_num; i += 2, j++) {
+		if (i != j)
+			memcpy(&rev->checkpoints[j], &rev->checkpoints[i],
+			       sizeof(struct sisa_snapshot));
+	}
+
+	rev->checkpoint_num = j;
+	rev->interval *= 2;
+}
+
+static void sisa_rev_apply_input(struct sisa_context *sisa,
+				 const struct sisa_rev_input *input)
+{
+	switch (input->type) {
+	case SISA_REV_INPUT_KEY_TOGGLE:
+		sisa_key_toggle(sisa, input->value);
+		break;
+	case SISA_REV_INPUT_SWITCH_TOGGLE:
+		sisa_switch_toggle(sisa, input->value);
+		break;
+	case SISA_REV_INPUT_KEYBOARD_PRESS:
+		sisa_keyboard_press(sisa, input->value);
+		break;
+	}
+}
+
+void sisa_rev_record(struct sisa_rev *rev, struct sisa_context *sisa)
+{
+	/* Coming forward again after a rewind: replay what was logged */
+	while (rev->input_next < rev->input_num &&
+	       rev->inputs[rev->input_next].cycle <= sisa->cpu.cycles)
+		sisa_rev_apply_input(sisa, &rev->inputs[rev->input_next++]);
+
+	if (sisa->cpu.cycles < rev->next_checkpoint)
+		return;
+
+	if (rev->checkpoint_num == rev->checkpoint_max)
+		sisa_rev_thin(rev);
+
+	sisa_snapshot_save(sisa, &rev->checkpoints[rev->checkpoint_num]);
+	rev->checkpoint_num++;
+
+	rev->next_checkpoint = sisa->cpu.cycles + rev->interval;
+}
+
+/*
+ * Forget everything recorded after the current cycle, including the inputs
+ * logged for it that haven't been replayed yet: it's a new timeline now
+ */
+static void sisa_rev_truncate(struct sisa_rev *rev, const struct sisa_context *sisa)
+{
+	uint64_t cycle = sisa->cpu.cycles;
+
+	while (rev->checkpoint_num > 1 &&
+	       rev->checkpoints[rev->checkpoint_num - 1].cpu.cycles > cycle)
+		rev->checkpoint_num--;
+
+	rev->input_num = rev->input_next;
+
+	rev->next_checkpoint = rev->checkpoints[rev->checkpoint_num - 1].cpu.cycles +
+			       rev->interval;
+}
+
+static void sisa_rev_log_input(struct sisa_rev *rev, struct sisa_context *sisa,
+			       enum sisa_rev_input_type type, uint8_t value)
+{
+	struct sisa_rev_input *input;
+
+	/* Injecting an input after stepping back rewrites the future */
+	if (rev->input_next < rev->input_num ||
+	    (rev->checkpoint_num > 0 &&
+	     rev->checkpoints[rev->checkpoint_num - 1].cpu.cycles > sisa->cpu.cycles))
+		sisa_rev_truncate(rev, sisa);
+
+	if (rev->input_num == rev->input_max) {
+		unsigned int max = rev->input_max ? rev->input_max * 2 : 64;
+		struct sisa_rev_input *inputs = realloc(rev->inputs,
+			max * sizeof(struct sisa_rev_input));
+
+		if (!inputs)
+			return;
+
+		rev->inputs = inputs;
+		rev->input_max = max;
+	}
+
+	input = &rev->inputs[rev->input_num++];
+	rev->input_next = rev->input_num;
+	input->cycle = sisa->cpu.cycles;
+	input->type = type;
+	input->value = value;
+
+	sisa_rev_apply_input(sisa, input);
+}
+
+void sisa_rev_key_toggle(struct sisa_rev *rev, struct sisa_context *sisa, uint8_t key_num)
+{
+	sisa_rev_log_input(rev, sisa, SISA_REV_INPUT_KEY_TOGGLE, key_num);
+}
+
+void sisa_rev_switch_toggle(struct sisa_rev *rev, struct sisa_context *sisa, uint8_t switch_num)
+{
+	sisa_rev_log_input(rev, sisa, SISA_REV_INPUT_SWITCH_TOGGLE, switch_num);
+}
+
+void sisa_rev_keyboard_press(struct sisa_rev *rev, struct sisa_context *sisa, uint8_t key)
+{
+	sisa_rev_log_input(rev, sisa, SISA_REV_INPUT_KEYBOARD_PRESS, key);
+}
+
+static void rev_muted_watch_cb(struct sisa_context *sisa, uint16_t paddr,
+			       unsigned int size, void *arg)
+{
+}
+
+/*
+ * Replayed cycles already happened once: keep them from reaching the OUT
+ * callback and the write watches (conditions, stimulus, state hash...)
+ */
+static void sisa_rev_mute(struct sisa_context *sisa, struct rev_muted *muted)
+{
+	int i;
+
+	muted->callbacks = sisa->callbacks;
+	sisa_set_callbacks(sisa, NULL);
+
+	for (i = 0; i < SISA_MAX_WRITE_WATCHES; i++) {
+		muted->watch_cbs[i] = sisa->write_watches[i].cb;
+		if (muted->watch_cbs[i])
+			sisa->write_watches[i].cb = rev_muted_watch_cb;
+	}
+}
+
+static void sisa_rev_unmute(struct sisa_context *sisa, const struct rev_muted *muted)
+{
+	int i;
+
+	for (i = 0; i < SISA_MAX_WRITE_WATCHES; i++) {
+		if (muted->watch_cbs[i])
+			sisa->write_watches[i].cb = muted->watch_cbs[i];
+	}
+
+	sisa_set_callbacks(sisa, &muted->callbacks);
+}
+
+/* Index of the latest checkpoint taken at or before cycle, or -1 */
+static int sisa_rev_find_checkpoint(const struct sisa_rev *rev, uint64_t cycle)
+{
+	int i;
+
+	for (i = rev->checkpoint_num - 1; i >= 0; i--) {
+		if (rev->checkpoints[i].cpu.cycles <= cycle)
+			return i;
+	}
+
+	return -1;
+}
+
+static unsigned int sisa_rev_restore(const struct sisa_rev *rev, struct sisa_context *sisa,
+				     int cp)
+{
+	unsigned int in = 0;
+
+	sisa_snapshot_restore(sisa, &rev->checkpoints[cp]);
+
+	/* Inputs logged at the checkpoint cycle happened after it was taken */
+	while (in < rev->input_num && rev->inputs[in].cycle < sisa->cpu.cycles)
+		in++;
+
+	return in;
+}
+
+static void sisa_rev_apply_inputs(const struct sisa_rev *rev, struct sisa_context *sisa,
+				  unsigned int *in)
+{
+	while (*in < rev->input_num && rev->inputs[*in].cycle == sisa->cpu.cycles) {
+		sisa_rev_apply_input(sisa, &rev->inputs[*in]);
+		(*in)++;
+	}
+}
+
+static void sisa_rev_advance(const struct sisa_rev *rev, struct sisa_context *sisa,
+			     unsigned int *in)
+{
+	sisa_rev_apply_inputs(rev, sisa, in);
+	sisa_step_cycle(sisa);
+}
+
+static void sisa_rev_replay_to(struct sisa_rev *rev, struct sisa_context *sisa,
+			       int cp, uint64_t cycle)
+{
+	unsigned int in = sisa_rev_restore(rev, sisa, cp);
+
+	while (sisa->cpu.cycles < cycle && !sisa->cpu.halted)
+		sisa_rev_advance(rev, sisa, &in);
+
+	sisa_rev_apply_inputs(rev, sisa, &in);
+
+	/* The rest of the log is replayed by sisa_rev_record() going forward */
+	rev->input_next = in;
+}
+
+int sisa_rev_goto(struct sisa_rev *rev, struct sisa_context *sisa, uint64_t cycle)
+{
+	struct rev_muted muted;
+	int cp = sisa_rev_find_checkpoint(rev, cycle);
+
+	if (cp < 0)
+		return 0;
+
+	sisa_rev_mute(sisa, &muted);
+	sisa_rev_replay_to(rev, sisa, cp, cycle);
+	sisa_rev_unmute(sisa, &muted);
+
+	return 1;
+}
+
+int sisa_rev_step_back(struct sisa_rev *rev, struct sisa_context *sisa)
+{
+	if (rev->checkpoint_num == 0 ||
+	    sisa->cpu.cycles <= rev->checkpoints[0].cpu.cycles)
+		return 0;
+
+	return sisa_rev_goto(rev, sisa, sisa->cpu.cycles - 1);
+}
+
+static uint64_t sisa_rev_segment_end(const struct sisa_rev *rev, int cp, uint64_t current)
+{
+	if (cp + 1 < rev->checkpoint_num &&
+	    rev->checkpoints[cp + 1].cpu.cycles < current)
+		return rev->checkpoints[cp + 1].cpu.cycles;
+
+	return current;
+}
+
+int sisa_rev_continue_back(struct sisa_rev *rev, struct sisa_context *sisa)
+{
+	unsigned int in;
+	uint64_t end, hit;
+	int found = 0;
+	struct rev_muted muted;
+	const uint64_t current = sisa->cpu.cycles;
+	int cp = current > 0 ? sisa_rev_find_checkpoint(rev, current - 1) : -1;
+
+	sisa_rev_mute(sisa, &muted);
+
+	/* Replay each checkpoint interval, newest first, remembering the last hit */
+	for (; cp >= 0 && !found; cp--) {
+		end = sisa_rev_segment_end(rev, cp, current);
+		in = sisa_rev_restore(rev, sisa, cp);
+
+		while (sisa->cpu.cycles < end && !sisa->cpu.halted) {
+			if (sisa_breakpoint_reached(sisa)) {
+				hit = sisa->cpu.cycles;
+				found = 1;
+			}
+			sisa_rev_advance(rev, sisa, &in);
+		}
+	}
+
+	if (found)
+		sisa_rev_replay_to(rev, sisa, sisa_rev_find_checkpoint(rev, hit), hit);
+	else if (rev->checkpoint_num > 0)
+		sisa_rev_replay_to(rev, sisa, 0, rev->checkpoints[0].cpu.cycles);
+
+	sisa_rev_unmute(sisa, &muted);
+
+	return found;
+}
+
+static void last_write_watch_cb(struct sisa_context *sisa, uint16_t paddr,
+				unsigned int size, void *arg)
+{
+	struct last_write_watch *w = arg;
+
+	if (w->paddr >= paddr && w->paddr < paddr + size &&
+	    sisa->cpu.cycles < w->end) {
+		w->cycle = sisa->cpu.cycles;
+		w->found = 1;
+	}
+}
+
+int sisa_rev_last_write(struct sisa_rev *rev, struct sisa_context *sisa, uint16_t paddr)
+{
+	int id;
+	unsigned int in;
+	uint64_t target;
+	struct last_write_watch w;
+	struct rev_muted muted;
+	const uint64_t current = sisa->cpu.cycles;
+	int cp = current > 0 ? sisa_rev_find_checkpoint(rev, current - 1) : -1;
+
+	w.paddr = paddr;
+
+	/* Muted first so our own watch still fires */
+	sisa_rev_mute(sisa, &muted);
+
+	id = sisa_write_watch_add(sisa, 1 << (paddr >> SISA_PAGE_SHIFT),
+				  last_write_watch_cb, &w);
+	if (id < 0) {
+		sisa_rev_unmute(sisa, &muted);
+		return 0;
+	}
+
+	for (; cp >= 0; cp--) {
+		w.found = 0;
+		w.end = sisa_rev_segment_end(rev, cp, current);
+		in = sisa_rev_restore(rev, sisa, cp);
+
+		while (sisa->cpu.cycles < w.end && !sisa->cpu.halted)
+			sisa_rev_advance(rev, sisa, &in);
+
+		if (w.found)
+			break;
+	}
+
+	sisa_write_watch_remove(sisa, id);
+
+	/* No write found: go back to where we started */
+	target = cp >= 0 ? w.cycle : current;
+	sisa_rev_replay_to(rev, sisa, sisa_rev_find_checkpoint(rev, target), target);
+
+	sisa_rev_unmute(sisa, &muted);
+
+	return cp >= 0;
+}
@@ -0,0 +1,59 @@
+#ifndef REVERSE_H
+#define REVERSE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "sisa.h"
+
+#define SISA_REV_DEFAULT_INTERVAL 100000
+#define SISA_REV_DEFAULT_BUDGET   (64 << 20)
+
+enum sisa_rev_input_type {
+	SISA_REV_INPUT_KEY_TOGGLE,
+	SISA_REV_INPUT_SWITCH_TOGGLE,
+	SISA_REV_INPUT_KEYBOARD_PRESS,
+};
+
+struct sisa_rev_input {
+	uint64_t cycle;
+	enum sisa_rev_input_type type;
+	uint8_t value;
+};
+
+/*
+ * Checkpoints are kept sorted by cycle. When the memory budget is
+ * exhausted every other checkpoint is dropped and the interval doubles,
+ * so the history always spans the whole run at a coarser granularity.
+ *
+ * Rewinding keeps the checkpoints and inputs after the target, so going
+ * forward again replays the same timeline; it's only cut there when a new
+ * input is injected. Replays run with the callbacks and write watches muted.
+ */
+struct sisa_rev {
+	struct sisa_snapshot *checkpoints;
+	unsigned int checkpoint_num;
+	unsigned int checkpoint_max;
+	uint64_t interval;
+	uint64_t next_checkpoint;
+	struct sisa_rev_input *inputs;
+	unsigned int input_num;
+	unsigned int input_max;
+	unsigned int input_next;	/* first input not applied yet, after a rewind */
+};
+
+int sisa_rev_init(struct sisa_rev *rev, uint64_t interval, size_t budget);
+void sisa_rev_destroy(struct sisa_rev *rev);
+void sisa_rev_reset(struct sisa_rev *rev, struct sisa_context *sisa);
+/* Call after every cycle, it also replays the inputs logged past a rewind */
+void sisa_rev_record(struct sisa_rev *rev, struct sisa_context *sisa);
+
+void sisa_rev_key_toggle(struct sisa_rev *rev, struct sisa_context *sisa, uint8_t key_num);
+void sisa_rev_switch_toggle(struct sisa_rev *rev, struct sisa_context *sisa, uint8_t switch_num);
+void sisa_rev_keyboard_press(struct sisa_rev *rev, struct sisa_context *sisa, uint8_t key);
+
+int sisa_rev_goto(struct sisa_rev *rev, struct sisa_context *sisa, uint64_t cycle);
+int sisa_rev_step_back(struct sisa_rev *rev, struct sisa_context *sisa);
+int sisa_rev_continue_back(struct sisa_rev *rev, struct sisa_context *sisa);
+int sisa_rev_last_write(struct sisa_rev *rev, struct sisa_context *sisa, uint16_t paddr);
+
+#endif
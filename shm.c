@@ -0,0 +1,142 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shm.h"
+
+int sisa_shm_create(struct sisa_shm *shm, const char *name, uint64_t interval)
+{
+	int fd, err;
+
+	memset(shm, 0, sizeof(*shm));
+	shm->interval = interval ? interval : SISA_SHM_DEFAULT_INTERVAL;
+
+	if (!(shm->name = strdup(name)))
+		return 0;
+
+	fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		goto error;
+
+	if (ftruncate(fd, sizeof(*shm->state)) < 0) {
+		err = errno;
+		close(fd);
+		shm_unlink(name);
+		errno = err;
+		goto error;
+	}
+
+	shm->state = mmap(NULL, sizeof(*shm->state), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	err = errno;
+	close(fd);
+
+	if (shm->state == MAP_FAILED) {
+		shm->state = NULL;
+		shm_unlink(name);
+		errno = err;
+		goto error;
+	}
+
+	/* A fresh segment reads as zeros, the magic goes in last */
+	shm->state->version = SISA_SHM_VERSION;
+	shm->state->size = sizeof(*shm->state);
+	__atomic_store_n(&shm->state->magic, SISA_SHM_MAGIC, __ATOMIC_RELEASE);
+
+	return 1;
+
+error:
+	free(shm->name);
+	shm->name = NULL;
+	return 0;
+}
+
+void sisa_shm_destroy(struct sisa_shm *shm)
+{
+	if (shm->state) {
+		munmap(shm->state, sizeof(*shm->state));
+		shm_unlink(shm->name);
+	}
+
+	free(shm->name);
+	shm->name = NULL;
+	shm->state = NULL;
+}
+
+void sisa_shm_publish(struct sisa_shm *shm, const struct sisa_context *sisa)
+{
+	struct sisa_shm_state *state = shm->state;
+	uint32_t seq = state->seq;
+
+	__atomic_store_n(&state->seq, seq + 1, __ATOMIC_RELAXED);
+	/* Readers that see any of the new data must see the odd seq */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	state->publishes++;
+	state->cycles = sisa->cpu.cycles;
+	state->pc = sisa->cpu.pc;
+	state->ir = sisa->cpu.ir;
+	memcpy(state->regs, sisa->cpu.regfile.general.regs, sizeof(state->regs));
+	memcpy(state->sregs, sisa->cpu.regfile.system.regs, sizeof(state->sregs));
+	state->ints_pending = sisa->cpu.ints_pending;
+	state->status = sisa->cpu.status;
+	state->exception = sisa->cpu.exception;
+	state->halted = sisa->cpu.halted;
+	state->tlb_enabled = sisa->tlb_enabled;
+	state->stats = sisa->stats;
+	memcpy(state->io_ports, sisa->io_ports, sizeof(state->io_ports));
+	memcpy(state->memory, sisa->memory, sizeof(state->memory));
+
+	__atomic_store_n(&state->seq, seq + 2, __ATOMIC_RELEASE);
+
+	shm->last_cycles = sisa->cpu.cycles;
+}
+
+const struct sisa_shm_state *sisa_shm_attach(const char *name)
+{
+	struct sisa_shm_state *state;
+	struct stat st;
+	int fd, err;
+
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) < 0) {
+		err = errno;
+		close(fd);
+		errno = err;
+		return NULL;
+	}
+
+	if (st.st_size != sizeof(*state)) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	state = mmap(NULL, sizeof(*state), PROT_READ, MAP_SHARED, fd, 0);
+	err = errno;
+	close(fd);
+
+	if (state == MAP_FAILED) {
+		errno = err;
+		return NULL;
+	}
+
+	if (__atomic_load_n(&state->magic, __ATOMIC_ACQUIRE) != SISA_SHM_MAGIC ||
+	    state->version != SISA_SHM_VERSION || state->size != sizeof(*state)) {
+		munmap(state, sizeof(*state));
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return state;
+}
+
+void sisa_shm_detach(const struct sisa_shm_state *state)
+{
+	munmap((void *)state, sizeof(*state));
+}
@@ -0,0 +1,93 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include <stdint.h>
+#include "sisa.h"
+
+#define SISA_SHM_MAGIC            0x4D485353 /* "SSHM" */
+#define SISA_SHM_VERSION          1
+#define SISA_SHM_DEFAULT_INTERVAL 100000
+
+/*
+ * Live guest state in a POSIX shared memory segment, for monitors that
+ * attach read-only. The emulator copies its state in every interval
+ * cycles and never waits for readers: seq is a seqlock counter, odd
+ * while a copy is in progress, so readers retry instead of locking:
+ *
+ *	do {
+ *		seq = sisa_shm_read_begin(state);
+ *		leds = state->io_ports[SISA_IO_PORT_LEDS_GREEN];
+ *		...
+ *	} while (sisa_shm_read_retry(state, seq));
+ *
+ * Only copy out between the two calls, the values can be torn until
+ * sisa_shm_read_retry() says otherwise. stats is all zeros unless built
+ * with STATS=1.
+ */
+struct sisa_shm_state {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;
+	uint32_t seq;
+	uint64_t publishes;
+	uint64_t cycles;
+	uint16_t pc;
+	uint16_t ir;
+	uint16_t regs[8];
+	uint16_t sregs[8];
+	uint16_t ints_pending;
+	uint8_t status;
+	uint8_t exception;
+	uint8_t halted;
+	uint8_t tlb_enabled;
+	uint8_t padding[6];
+	struct sisa_stats stats;
+	uint16_t io_ports[SISA_NUM_IO_PORTS];
+	uint8_t memory[SISA_MEMORY_SIZE];
+};
+
+struct sisa_shm {
+	char *name;
+	struct sisa_shm_state *state;
+	uint64_t interval;
+	uint64_t last_cycles;
+};
+
+/* Creates the segment, returns 0 with errno set on errors */
+int sisa_shm_create(struct sisa_shm *shm, const char *name, uint64_t interval);
+/* Unmaps and unlinks the segment, attached readers keep their mapping */
+void sisa_shm_destroy(struct sisa_shm *shm);
+
+void sisa_shm_publish(struct sisa_shm *shm, const struct sisa_context *sisa);
+
+/* Publishes when interval cycles went by, or went back, since the last time */
+static inline void sisa_shm_update(struct sisa_shm *shm, const struct sisa_context *sisa)
+{
+	if (sisa->cpu.cycles - shm->last_cycles >= shm->interval ||
+	    sisa->cpu.cycles < shm->last_cycles)
+		sisa_shm_publish(shm, sisa);
+}
+
+/* Maps a segment read-only, returns NULL with errno set (EINVAL if not a state segment) */
+const struct sisa_shm_state *sisa_shm_attach(const char *name);
+void sisa_shm_detach(const struct sisa_shm_state *state);
+
+static inline uint32_t sisa_shm_read_begin(const struct sisa_shm_state *state)
+{
+	uint32_t seq;
+
+	/* Copies take microseconds, spinning is cheaper than sleeping */
+	while ((seq = __atomic_load_n(&state->seq, __ATOMIC_ACQUIRE)) & 1)
+		;
+
+	return seq;
+}
+
+static inline int sisa_shm_read_retry(const struct sisa_shm_state *state, uint32_t seq)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+	return __atomic_load_n(&state->seq, __ATOMIC_RELAXED) != seq;
+}
+
+#endif
@@ -30,9 +30,60 @@
 #define ABSOLUTE_JUMP_F_BITS(instr) X_DOWNTO_Y(instr, 2, 0)
 #define SPECIAL_F_BITS(instr)       X_DOWNTO_Y(instr, 5, 0)
 
+#ifdef SISA_STATS
+#define STAT_INC(field) (sisa->stats.field++)
+#else
+#define STAT_INC(field) do { } while (0)
+#endif
+
+#define COVERAGE_SET(map, paddr) ((map)[(paddr) >> 4] |= BIT(((paddr) >> 1) & 7))
+/* Only used from sisa_exec.h, compiled out of the variants without instrumentation */
+#define COVERAGE_BRANCH(cond) \
+	do { \
+		if (EXEC_INSTR && sisa->coverage) { \
+			if (cond) \
+				COVERAGE_SET(sisa->coverage->taken, sisa->fetch_paddr); \
+			else \
+				COVERAGE_SET(sisa->coverage->not_taken, sisa->fetch_paddr); \
+		} \
+	} while (0)
+
+/* Only used from sisa_exec.h, adds the stall cycles of a cache access */
+#define CACHE_ACCESS(cache, paddr, write) \
+	do { \
+		if (EXEC_INSTR && (cache)) \
+			sisa->cpu.stall += sisa_cache_access(cache, paddr, write); \
+	} while (0)
+
+/* Only used from sisa_exec.h, counts an access to the word at paddr */
+#define HEATMAP_COUNT(kind, paddr) \
+	do { \
+		if (EXEC_INSTR && sisa->heatmap) \
+			sisa->heatmap->kind[(paddr) >> 1]++; \
+	} while (0)
+
+/* Only used from sisa_exec.h, adds the extra cycles of the cost model */
+#define COST_ADD(field) \
+	do { \
+		if (EXEC_INSTR && sisa->cost) \
+			sisa->cpu.stall += sisa->cost->field; \
+	} while (0)
+
 #define REGS  (sisa->cpu.regfile.general.regs)
 #define SREGS (sisa->cpu.regfile.system.regs)
 
+/* What the interpreter variant in use was specialized for */
+#define SISA_VARIANT_TLB   BIT(0)
+#define SISA_VARIANT_INSTR BIT(1)
+
+/* Returned by the variants' run loops, never by sisa_run() */
+#define SISA_RUN_VARIANT_CHANGED -1
+
+/* sisa->fuse_pairs values */
+#define FUSE_UNKNOWN 0
+#define FUSE_NONE    1
+#define FUSE_PAIR    2
+
 static void sisa_tlb_init(struct sisa_tlb *tlb)
 {
 	int i;
@@ -63,6 +114,24 @@ static void sisa_tlb_init(struct sisa_tlb *tlb)
 	}
 }
 
+/*
+ * Picks the interpreter copy matching the TLB enable and whether coverage,
+ * write watches, breakpoints, caches, a cost model or a heatmap are in use,
+ * so the common case doesn't pay for them. Called by everything that
+ * changes one of those.
+ */
+static void sisa_update_variant(struct sisa_context *sisa)
+{
+	sisa->exec_variant = 0;
+
+	if (sisa->tlb_enabled)
+		sisa->exec_variant |= SISA_VARIANT_TLB;
+
+	if (sisa->breakpoint_num || sisa->watched_pages || sisa->coverage ||
+	    sisa->icache || sisa->dcache || sisa->cost || sisa->heatmap)
+		sisa->exec_variant |= SISA_VARIANT_INSTR;
+}
+
 void sisa_init(struct sisa_context *sisa)
 {
 	int i;
@@ -75,6 +144,8 @@ void sisa_init(struct sisa_context *sisa)
 	sisa->cpu.ints_pending = 0;
 	sisa->cpu.halted = 0;
 	sisa->cpu.cycles = 0;
+	sisa->cpu.stall = 0;
+	sisa->cpu.in_exception = 0;
 
 	for (i = 0; i < SISA_NUM_IO_PORTS; i++)
 		sisa->io_ports[i] = 0;
@@ -88,6 +159,26 @@ void sisa_init(struct sisa_context *sisa)
 
 	sisa->breakpoint_list = NULL;
 	sisa->breakpoint_num = 0;
+
+	memset(sisa->write_watches, 0, sizeof(sisa->write_watches));
+	sisa->watched_pages = 0;
+
+	sisa_stats_reset(sisa);
+
+	memset(&sisa->callbacks, 0, sizeof(sisa->callbacks));
+	sisa->stop_requested = 0;
+
+	sisa->coverage = NULL;
+	sisa->fetch_paddr = 0;
+
+	sisa->icache = NULL;
+	sisa->dcache = NULL;
+	sisa->cost = NULL;
+	sisa->heatmap = NULL;
+
+	memset(sisa->fuse_pairs, FUSE_UNKNOWN, sizeof(sisa->fuse_pairs));
+
+	sisa_update_variant(sisa);
 }
 
 void sisa_destroy(struct sisa_context *sisa)
@@ -98,17 +189,18 @@ void sisa_destroy(struct sisa_context *sisa)
 	}
 }
 
-static int sisa_tlb_access(struct sisa_context *sisa, const struct sisa_tlb *tlb,
-			    uint16_t vaddr, uint16_t *paddr, int word_access, int write)
+/* The TLB lookup and permission checks, only called with the TLB enabled */
+static int sisa_tlb_translate(struct sisa_context *sisa, const struct sisa_tlb *tlb,
+			      uint16_t vaddr, uint16_t *paddr, int word_access, int write)
 {
 	int i;
 	int found;
 	uint8_t vpn, pfn, v, r, p;
 
-	if (!sisa->tlb_enabled) {
-		*paddr = vaddr;
-		return 1;
-	}
+	if (&sisa->itlb == tlb)
+		STAT_INC(itlb_accesses);
+	else
+		STAT_INC(dtlb_accesses);
 
 	if (word_access && vaddr & 1) {
 		sisa->cpu.exception = SISA_EXCEPTION_UNALIGNED_ACCESS;
@@ -167,378 +259,266 @@ static int sisa_tlb_access(struct sisa_context *sisa, const struct sisa_tlb *tlb
 	return 1;
 }
 
-static void sisa_demw_execute(struct sisa_context *sisa)
+static int sisa_tlb_access(struct sisa_context *sisa, const struct sisa_tlb *tlb,
+			   uint16_t vaddr, uint16_t *paddr, int word_access, int write)
 {
-	const uint16_t instr = sisa->cpu.ir;
+	if (!sisa->tlb_enabled) {
+		*paddr = vaddr;
+		return 1;
+	}
+
+	return sisa_tlb_translate(sisa, tlb, vaddr, paddr, word_access, write);
+}
 
+static void sisa_write_watch_notify(struct sisa_context *sisa, uint16_t paddr,
+				    unsigned int size)
+{
+	int i;
+	uint16_t pages = BIT(paddr >> SISA_PAGE_SHIFT) |
+			 BIT(((paddr + size - 1) >> SISA_PAGE_SHIFT) & 0xF);
+
+	for (i = 0; i < SISA_MAX_WRITE_WATCHES; i++) {
+		const struct sisa_write_watch *w = &sisa->write_watches[i];
+
+		if (w->cb && (w->pages & pages))
+			w->cb(sisa, paddr, size, w->arg);
+	}
+}
+
+int sisa_dtlb_access(struct sisa_context *sisa, uint16_t vaddr, uint16_t *paddr,
+		     int word_access, int write)
+{
+	return sisa_tlb_access(sisa, &sisa->dtlb, vaddr, paddr, word_access, write);
+}
+
+void sisa_cpu_out(struct sisa_context *sisa, uint8_t port, uint16_t value)
+{
+	sisa->io_ports[port] = value;
+
+	/* If there's a pending key in the kb buffer, copy it to the I/O port */
+	if (port == SISA_IO_PORT_KB_CLEAR_CHAR && sisa->cpu.kb_key_buffer) {
+		sisa->io_ports[SISA_IO_PORT_KB_READ_CHAR] = sisa->cpu.kb_key_buffer;
+		sisa->io_ports[SISA_IO_PORT_KB_DATA_READY] = 1;
+		sisa->cpu.ints_pending |= BIT(SISA_INTERRUPT_KEYBOARD);
+		sisa->cpu.kb_key_buffer = 0;
+	} else {
+		sisa->io_ports[SISA_IO_PORT_KB_READ_CHAR] = 0;
+		sisa->io_ports[SISA_IO_PORT_KB_DATA_READY] = 0;
+	}
+
+	if (sisa->callbacks.out)
+		sisa->callbacks.out(sisa, port, value, sisa->callbacks.arg);
+}
+
+static inline unsigned int sisa_function_bits(uint16_t instr)
+{
 	switch (INSTR_OPCODE(instr)) {
 	case SISA_OPCODE_ARIT_LOGIC:
-		switch (ARIT_LOGIC_F_BITS(instr)) {
-		case SISA_INSTR_ARIT_LOGIC_F_AND:
-			REGS[INSTR_Rd(instr)] = REGS[INSTR_Ra_6(instr)] & REGS[INSTR_Rb_0(instr)];
-			break;
-		case SISA_INSTR_ARIT_LOGIC_F_OR:
-			REGS[INSTR_Rd(instr)] = REGS[INSTR_Ra_6(instr)] | REGS[INSTR_Rb_0(instr)];
-			break;
-		case SISA_INSTR_ARIT_LOGIC_F_XOR:
-			REGS[INSTR_Rd(instr)] = REGS[INSTR_Ra_6(instr)] ^ REGS[INSTR_Rb_0(instr)];
-			break;
-		case SISA_INSTR_ARIT_LOGIC_F_NOT:
-			REGS[INSTR_Rd(instr)] = ~REGS[INSTR_Ra_6(instr)];
-			break;
-		case SISA_INSTR_ARIT_LOGIC_F_ADD:
-			REGS[INSTR_Rd(instr)] = REGS[INSTR_Ra_6(instr)] + REGS[INSTR_Rb_0(instr)];
-			break;
-		case SISA_INSTR_ARIT_LOGIC_F_SUB:
-			REGS[INSTR_Rd(instr)] = REGS[INSTR_Ra_6(instr)] - REGS[INSTR_Rb_0(instr)];
-			break;
-		case SISA_INSTR_ARIT_LOGIC_F_SHA: {
-			int shift = SEXT_5(X_DOWNTO_Y(REGS[INSTR_Rb_0(instr)], 4, 0));
-			if (shift > 0) {
-				REGS[INSTR_Rd(instr)] = (int16_t)REGS[INSTR_Ra_6(instr)] << shift;
-			} else {
-				REGS[INSTR_Rd(instr)] = (int16_t)REGS[INSTR_Ra_6(instr)] >> -shift;
-			}
-			break;
-		}
-		case SISA_INSTR_ARIT_LOGIC_F_SHL: {
-			int shift = SEXT_5(X_DOWNTO_Y(REGS[INSTR_Rb_0(instr)], 4, 0));
-			if (shift > 0) {
-				REGS[INSTR_Rd(instr)] = REGS[INSTR_Ra_6(instr)] << shift;
-			} else {
-				REGS[INSTR_Rd(instr)] = REGS[INSTR_Ra_6(instr)] >> -shift;
-			}
-			break;
+	case SISA_OPCODE_COMPARE:
+	case SISA_OPCODE_MULT_DIV:
+		return X_DOWNTO_Y(instr, 5, 3);
+	case SISA_OPCODE_MOV:
+	case SISA_OPCODE_RELATIVE_JUMP:
+	case SISA_OPCODE_IN_OUT:
+		return X_DOWNTO_Y(instr, 8, 8);
+	case SISA_OPCODE_ABSOLUTE_JUMP:
+		return ABSOLUTE_JUMP_F_BITS(instr);
+	case SISA_OPCODE_SPECIAL:
+		return SPECIAL_F_BITS(instr);
+	default:
+		return 0;
+	}
+}
+
+/* The function field the cost model indexes instructions by, 0 when there's none */
+unsigned int sisa_instr_function(uint16_t instr)
+{
+	return sisa_function_bits(instr);
+}
+
+/* Looks paddr up and updates the cache, returns the stall cycles it costs */
+static unsigned int sisa_cache_access(struct sisa_cache *cache, uint16_t paddr, int write)
+{
+	const uint16_t tag = paddr >> cache->line_shift;
+	struct sisa_cache_line *set = &cache->lines[(tag & cache->set_mask) * cache->config.ways];
+	struct sisa_cache_line *victim = set;
+	unsigned int i, stall = 0;
+
+	cache->clock++;
+
+	if (write)
+		cache->stats.writes++;
+	else
+		cache->stats.reads++;
+
+	for (i = 0; i < cache->config.ways; i++) {
+		if (set[i].valid && set[i].tag == tag) {
+			set[i].last_used = cache->clock;
+
+			if (write && cache->config.write_policy == SISA_CACHE_WRITE_BACK)
+				set[i].dirty = 1;
+			else if (write)
+				stall = cache->config.write_penalty;
+
+			cache->stats.stall_cycles += stall;
+			return stall;
 		}
+
+		/* Invalid lines first, then the least recently used */
+		if (victim->valid && (!set[i].valid || set[i].last_used < victim->last_used))
+			victim = &set[i];
+	}
+
+	if (write)
+		cache->stats.write_misses++;
+	else
+		cache->stats.read_misses++;
+
+	if (write && cache->config.write_policy == SISA_CACHE_WRITE_THROUGH) {
+		stall = cache->config.write_penalty;
+	} else {
+		if (victim->valid && victim->dirty) {
+			cache->stats.writebacks++;
+			stall += cache->config.write_penalty;
 		}
-		break;
+
+		victim->tag = tag;
+		victim->valid = 1;
+		victim->dirty = write;
+		victim->last_used = cache->clock;
+		stall += cache->config.miss_penalty;
+	}
+
+	cache->stats.stall_cycles += stall;
+	return stall;
+}
+
+/* MOVI+MOVHI on the same register, ADDI+BZ/BNZ or CMPxx+BZ/BNZ */
+static int sisa_fuse_match(uint16_t instr, uint16_t next)
+{
+	switch (INSTR_OPCODE(instr)) {
+	case SISA_OPCODE_MOV:
+		return MOV_F_BITS(instr) == SISA_INSTR_MOV_F_MOVI &&
+		       INSTR_OPCODE(next) == SISA_OPCODE_MOV &&
+		       MOV_F_BITS(next) == SISA_INSTR_MOV_F_MOVHI && INSTR_Rd(next) == INSTR_Rd(instr);
+	case SISA_OPCODE_ADDI:
+		return INSTR_OPCODE(next) == SISA_OPCODE_RELATIVE_JUMP;
 	case SISA_OPCODE_COMPARE:
 		switch (COMPARE_F_BITS(instr)) {
 		case SISA_INSTR_COMPARE_F_CMPLT:
-			REGS[INSTR_Rd(instr)] = (int16_t)REGS[INSTR_Ra_6(instr)] < (int16_t)REGS[INSTR_Rb_0(instr)];
-			break;
 		case SISA_INSTR_COMPARE_F_CMPLE:
-			REGS[INSTR_Rd(instr)] = (int16_t)REGS[INSTR_Ra_6(instr)] <= (int16_t)REGS[INSTR_Rb_0(instr)];
-			break;
 		case SISA_INSTR_COMPARE_F_CMPEQ:
-			REGS[INSTR_Rd(instr)] = REGS[INSTR_Ra_6(instr)] == REGS[INSTR_Rb_0(instr)];
-			break;
 		case SISA_INSTR_COMPARE_F_CMPLTU:
-			REGS[INSTR_Rd(instr)] = REGS[INSTR_Ra_6(instr)] < REGS[INSTR_Rb_0(instr)];
-			break;
 		case SISA_INSTR_COMPARE_F_CMPLEU:
-			REGS[INSTR_Rd(instr)] = REGS[INSTR_Ra_6(instr)] <= REGS[INSTR_Rb_0(instr)];
-			break;
-		default:
-			sisa->cpu.exception = SISA_EXCEPTION_ILLEGAL_INSTR;
-			sisa->cpu.exc_happened = 1;
-			break;
+			return INSTR_OPCODE(next) == SISA_OPCODE_RELATIVE_JUMP;
 		}
-		break;
-	case SISA_OPCODE_ADDI:
-		REGS[INSTR_Rd(instr)] = REGS[INSTR_Ra_6(instr)] + SEXT_6(X_DOWNTO_Y(instr, 5, 0));
-		break;
-	case SISA_OPCODE_LOAD: {
-		uint16_t paddr;
-		uint16_t vaddr = REGS[INSTR_Ra_6(instr)] + (SEXT_6(X_DOWNTO_Y(instr, 5, 0)) << 1);
+		return 0;
+	default:
+		return 0;
+	}
+}
 
-		if (!sisa_tlb_access(sisa, &sisa->dtlb, vaddr, &paddr, 1, 0)) {
-			break;
-		}
+/* Pairs starting in the word before addr end inside the range */
+static void sisa_fuse_forget_range(struct sisa_context *sisa, uint16_t addr, size_t size)
+{
+	size_t first = addr >> 1;
+	size_t last = (addr + size - 1) >> 1;
 
-		REGS[INSTR_Rd(instr)] = sisa->memory[paddr + 1] << 8 |  sisa->memory[paddr];
-		break;
-	}
-	case SISA_OPCODE_STORE: {
-		uint16_t paddr;
-		uint16_t vaddr = REGS[INSTR_Ra_6(instr)] + (SEXT_6(X_DOWNTO_Y(instr, 5, 0)) << 1);
+	if (!size)
+		return;
 
-		if (!sisa_tlb_access(sisa, &sisa->dtlb, vaddr, &paddr, 1, 1)) {
-			break;
-		}
+	if (first)
+		first--;
 
-		sisa->memory[paddr] = REGS[INSTR_Rb_9(instr)] & 0xFF;
-		sisa->memory[paddr + 1] = REGS[INSTR_Rb_9(instr)] >> 8;
-		break;
-	}
-	case SISA_OPCODE_MOV:
-		switch (MOV_F_BITS(instr)) {
-		case SISA_INSTR_MOV_F_MOVI:
-			REGS[INSTR_Rd(instr)] = SEXT_8(INSTR_IMM8(instr));
-			break;
-		case SISA_INSTR_MOV_F_MOVHI:
-			REGS[INSTR_Rd(instr)] = (INSTR_IMM8(instr) << 8) | (REGS[INSTR_Ra_9(instr)] & 0xFF);
-			break;
-		}
-		break;
-	case SISA_OPCODE_RELATIVE_JUMP:
-		switch (RELATIVE_JUMP_F_BITS(instr)) {
-		case SISA_INSTR_RELATIVE_JUMP_F_BZ:
-			if (REGS[INSTR_Rb_9(instr)] == 0) {
-				sisa->cpu.pc += (int8_t)INSTR_IMM8(instr) << 1;
-			}
-			break;
-		case SISA_INSTR_RELATIVE_JUMP_F_BNZ:
-			if (REGS[INSTR_Rb_9(instr)] != 0) {
-				sisa->cpu.pc += (int8_t)INSTR_IMM8(instr) << 1;
-			}
-			break;
-		}
+	memset(sisa->fuse_pairs + first, FUSE_UNKNOWN, last - first + 1);
+}
 
-		break;
-	case SISA_OPCODE_IN_OUT:
-		switch (IN_OUT_F_BITS(instr)) {
-		case SISA_INSTR_IN_OUT_F_IN:
-			REGS[INSTR_Rd(instr)] = sisa->io_ports[INSTR_IMM8(instr)];
-			break;
-		case SISA_INSTR_IN_OUT_F_OUT: {
-			uint8_t port = INSTR_IMM8(instr);
-			sisa->io_ports[port] = REGS[INSTR_Rb_9(instr)];
-
-			/* If there's a pending key in the kb buffer, copy it to the I/O port */
-			if (port == SISA_IO_PORT_KB_CLEAR_CHAR && sisa->cpu.kb_key_buffer) {
-				sisa->io_ports[SISA_IO_PORT_KB_READ_CHAR] = sisa->cpu.kb_key_buffer;
-				sisa->io_ports[SISA_IO_PORT_KB_DATA_READY] = 1;
-				sisa->cpu.ints_pending |= BIT(SISA_INTERRUPT_KEYBOARD);
-				sisa->cpu.kb_key_buffer = 0;
-			} else {
-				sisa->io_ports[SISA_IO_PORT_KB_READ_CHAR] = 0;
-				sisa->io_ports[SISA_IO_PORT_KB_DATA_READY] = 0;
-			}
+static int sisa_relative_jump_taken(const struct sisa_context *sisa, uint16_t instr)
+{
+	if (RELATIVE_JUMP_F_BITS(instr) == SISA_INSTR_RELATIVE_JUMP_F_BZ)
+		return REGS[INSTR_Rb_9(instr)] == 0;
+	else
+		return REGS[INSTR_Rb_9(instr)] != 0;
+}
 
-			break;
-		}
-		}
-		break;
-	case SISA_OPCODE_MULT_DIV:
-		switch (MULT_DIV_F_BITS(instr)) {
-		case SISA_INSTR_MULT_DIV_F_MUL:
-			REGS[INSTR_Rd(instr)] = REGS[INSTR_Ra_6(instr)] * REGS[INSTR_Rb_0(instr)];
-			break;
-		case SISA_INSTR_MULT_DIV_F_MULH:
-			REGS[INSTR_Rd(instr)] = ((int32_t)REGS[INSTR_Ra_6(instr)] * (int32_t)REGS[INSTR_Rb_0(instr)]) >> 16;
-			break;
-		case SISA_INSTR_MULT_DIV_F_MULHU:
-			REGS[INSTR_Rd(instr)] = ((uint32_t)REGS[INSTR_Ra_6(instr)] * (uint32_t)REGS[INSTR_Rb_0(instr)]) >> 16;
-			break;
-		case SISA_INSTR_MULT_DIV_F_DIV:
-			if (REGS[INSTR_Rb_0(instr)] == 0) {
-				sisa->cpu.exception = SISA_EXCEPTION_DIVISION_BY_ZERO;
-				sisa->cpu.exc_happened = 1;
-				break;
-			}
-			REGS[INSTR_Rd(instr)] = (int16_t)REGS[INSTR_Ra_6(instr)] / (int16_t)REGS[INSTR_Rb_0(instr)];
-			break;
-		case SISA_INSTR_MULT_DIV_F_DIVU:
-			if (REGS[INSTR_Rb_0(instr)] == 0) {
-				sisa->cpu.exception = SISA_EXCEPTION_DIVISION_BY_ZERO;
-				sisa->cpu.exc_happened = 1;
-				break;
-			}
-			REGS[INSTR_Rd(instr)] = REGS[INSTR_Ra_6(instr)] / REGS[INSTR_Rb_0(instr)];
-			break;
-		default:
-			sisa->cpu.exception = SISA_EXCEPTION_ILLEGAL_INSTR;
-			sisa->cpu.exc_happened = 1;
-			break;
-		}
-		break;
-	case SISA_OPCODE_ABSOLUTE_JUMP:
-		switch (ABSOLUTE_JUMP_F_BITS(instr)) {
-		case SISA_INSTR_ABSOLUTE_JUMP_F_JZ:
-			if (REGS[INSTR_Rb_9(instr)] == 0) {
-				sisa->cpu.pc = REGS[INSTR_Ra_6(instr)] - 2;
-			}
-			break;
-		case SISA_INSTR_ABSOLUTE_JUMP_F_JNZ:
-			if (REGS[INSTR_Rb_9(instr)] != 0) {
-				sisa->cpu.pc = REGS[INSTR_Ra_6(instr)] - 2;
-			}
-			break;
-		case SISA_INSTR_ABSOLUTE_JUMP_F_JMP:
-			sisa->cpu.pc = REGS[INSTR_Ra_6(instr)] - 2;
-			break;
-		case SISA_INSTR_ABSOLUTE_JUMP_F_JAL: {
-			uint16_t pc = sisa->cpu.pc;
-			sisa->cpu.pc = REGS[INSTR_Ra_6(instr)] - 2;
-			REGS[INSTR_Rd(instr)] = pc + 2;
-			break;
-		}
-		case SISA_INSTR_ABSOLUTE_JUMP_F_CALLS:
-			sisa->cpu.regfile.system.s3 = REGS[INSTR_Ra_6(instr)];
-			sisa->cpu.exception = SISA_EXCEPTION_CALLS;
-			sisa->cpu.exc_happened = 1;
-			break;
-		default:
-			sisa->cpu.exception = SISA_EXCEPTION_ILLEGAL_INSTR;
-			sisa->cpu.exc_happened = 1;
-			break;
-		}
-		break;
-	case SISA_OPCODE_LOAD_BYTE: {
-		uint16_t paddr;
-		uint16_t vaddr = REGS[INSTR_Ra_6(instr)] + SEXT_6(X_DOWNTO_Y(instr, 5, 0));
+#define EXEC_VARIANT 0
+#define EXEC_FN(name) name##_plain
+#include "sisa_exec.h"
 
-		if (!sisa_tlb_access(sisa, &sisa->dtlb, vaddr, &paddr, 0, 0)) {
-			break;
-		}
+#define EXEC_VARIANT SISA_VARIANT_TLB
+#define EXEC_FN(name) name##_tlb
+#include "sisa_exec.h"
 
-		REGS[INSTR_Rd(instr)] = SEXT_8(sisa->memory[paddr]);
-		break;
-	}
-	case SISA_OPCODE_STORE_BYTE: {
-		uint16_t paddr;
-		uint16_t vaddr = REGS[INSTR_Ra_6(instr)] + SEXT_6(X_DOWNTO_Y(instr, 5, 0));
+#define EXEC_VARIANT SISA_VARIANT_INSTR
+#define EXEC_FN(name) name##_instr
+#include "sisa_exec.h"
 
-		if (!sisa_tlb_access(sisa, &sisa->dtlb, vaddr, &paddr, 0, 1)) {
-			break;
-		}
+#define EXEC_VARIANT (SISA_VARIANT_TLB | SISA_VARIANT_INSTR)
+#define EXEC_FN(name) name##_tlb_instr
+#include "sisa_exec.h"
 
-		sisa->memory[paddr] = REGS[INSTR_Rb_9(instr)] & 0xFF;
+void sisa_step_cycle(struct sisa_context *sisa)
+{
+	switch (sisa->exec_variant) {
+	case 0:
+		sisa_step_cycle_plain(sisa);
 		break;
-	}
-	case SISA_OPCODE_SPECIAL:
-		switch (SPECIAL_F_BITS(instr)) {
-		case SISA_INSTR_SPECIAL_F_EI:
-			sisa->cpu.regfile.system.psw.i = 1;
-			break;
-		case SISA_INSTR_SPECIAL_F_DI:
-			sisa->cpu.regfile.system.psw.i = 0;
-			break;
-		case SISA_INSTR_SPECIAL_F_RETI:
-			sisa->cpu.regfile.system.s7 = sisa->cpu.regfile.system.s0;
-			sisa->cpu.pc = sisa->cpu.regfile.system.s1 - 2;
-			break;
-		case SISA_INSTR_SPECIAL_F_GETIID: {
-			int lsb = ffs(sisa->cpu.ints_pending);
-
-			/* Clear the highest priority interrupt and return its id */
-			if (lsb) {
-				sisa->cpu.ints_pending &= ~BIT(lsb - 1);
-				REGS[INSTR_Rd(instr)] = lsb - 1;
-			} else {
-				REGS[INSTR_Rd(instr)] = 0;
-			}
-			break;
-		}
-		case SISA_INSTR_SPECIAL_F_RDS:
-			REGS[INSTR_Rd(instr)] = SREGS[INSTR_Sa(instr)];
-			break;
-		case SISA_INSTR_SPECIAL_F_WRS:
-			SREGS[INSTR_Sd(instr)] = REGS[INSTR_Ra_6(instr)];
-			break;
-		case SISA_INSTR_SPECIAL_F_WRPI: {
-			uint8_t entry = REGS[INSTR_Ra_6(instr)];
-			uint16_t value = REGS[INSTR_Rb_9(instr)];
-			sisa->itlb.entries[entry].pfn = X_DOWNTO_Y(value, 3, 0);
-			sisa->itlb.entries[entry].r = X_DOWNTO_Y(value, 4, 4);
-			sisa->itlb.entries[entry].v = X_DOWNTO_Y(value, 5, 5);
-			sisa->itlb.entries[entry].p = X_DOWNTO_Y(value, 6, 6);
-			break;
-		}
-		case SISA_INSTR_SPECIAL_F_WRVI: {
-			uint8_t entry = REGS[INSTR_Ra_6(instr)];
-			uint16_t value = REGS[INSTR_Rb_9(instr)];
-			sisa->itlb.entries[entry].vpn = X_DOWNTO_Y(value, 3, 0);
-			break;
-		}
-		case SISA_INSTR_SPECIAL_F_WRPD: {
-			uint8_t entry = REGS[INSTR_Ra_6(instr)];
-			uint16_t value = REGS[INSTR_Rb_9(instr)];
-			sisa->dtlb.entries[entry].pfn = X_DOWNTO_Y(value, 3, 0);
-			sisa->dtlb.entries[entry].r = X_DOWNTO_Y(value, 4, 4);
-			sisa->dtlb.entries[entry].v = X_DOWNTO_Y(value, 5, 5);
-			sisa->dtlb.entries[entry].p = X_DOWNTO_Y(value, 6, 6);
-			break;
-		}
-		case SISA_INSTR_SPECIAL_F_WRVD: {
-			uint8_t entry = REGS[INSTR_Ra_6(instr)];
-			uint16_t value = REGS[INSTR_Rb_9(instr)];
-			sisa->dtlb.entries[entry].vpn = X_DOWNTO_Y(value, 3, 0);
-			break;
-		}
-		case SISA_INSTR_SPECIAL_F_FLUSH:
-			break;
-		case SISA_INSTR_SPECIAL_F_HALT:
-			sisa->cpu.halted = 1;
-			break;
-		}
+	case SISA_VARIANT_TLB:
+		sisa_step_cycle_tlb(sisa);
+		break;
+	case SISA_VARIANT_INSTR:
+		sisa_step_cycle_instr(sisa);
 		break;
 	default:
-		sisa->cpu.exception = SISA_EXCEPTION_ILLEGAL_INSTR;
-		sisa->cpu.exc_happened = 1;
+		sisa_step_cycle_tlb_instr(sisa);
 		break;
 	}
 }
 
-void sisa_step_cycle(struct sisa_context *sisa)
+void sisa_load_binary(struct sisa_context *sisa, uint16_t address, void *data, size_t size)
 {
-	if (sisa->cpu.halted)
-		return;
+	memcpy(sisa->memory + address, data, size);
+	sisa_memory_written(sisa, address, size);
+}
 
-	switch (sisa->cpu.status) {
-	case SISA_CPU_STATUS_FETCH: {
-		uint16_t paddr;
+enum sisa_stop_reason sisa_run(struct sisa_context *sisa, uint64_t max_cycles)
+{
+	const uint64_t end = sisa->cpu.cycles + max_cycles;
+	int ret;
 
-		if (!sisa_tlb_access(sisa, &sisa->itlb, sisa->cpu.pc, &paddr, 1, 0)) {
-			sisa->cpu.status = SISA_CPU_STATUS_NOP;
-			break;
-		}
+	sisa->stop_requested = 0;
 
-		sisa->cpu.ir = sisa->memory[paddr + 1] << 8 | sisa->memory[paddr];
-		sisa->cpu.status = SISA_CPU_STATUS_DEMW;
-		break;
-	}
-	case SISA_CPU_STATUS_DEMW:
-		sisa_demw_execute(sisa);
-		sisa->cpu.pc += 2;
-		if (sisa->cpu.exc_happened) {
-			sisa->cpu.status = SISA_CPU_STATUS_SYSTEM;
+	do {
+		switch (sisa->exec_variant) {
+		case 0:
+			ret = sisa_run_plain(sisa, end);
+			break;
+		case SISA_VARIANT_TLB:
+			ret = sisa_run_tlb(sisa, end);
 			break;
-		} else if (sisa->cpu.regfile.system.psw.i && sisa->cpu.ints_pending) {
-			sisa->cpu.exception = SISA_EXCEPTION_INTERRUPT;
-			sisa->cpu.exc_happened = 1;
-			sisa->cpu.status = SISA_CPU_STATUS_SYSTEM;
+		case SISA_VARIANT_INSTR:
+			ret = sisa_run_instr(sisa, end);
+			break;
+		default:
+			ret = sisa_run_tlb_instr(sisa, end);
 			break;
 		}
-		sisa->cpu.status = SISA_CPU_STATUS_FETCH;
-		break;
-	case SISA_CPU_STATUS_NOP:
-		sisa->cpu.status = SISA_CPU_STATUS_SYSTEM;
-		break;
-	case SISA_CPU_STATUS_SYSTEM:
-		sisa->cpu.regfile.system.s0 = sisa->cpu.regfile.system.s7;
-		sisa->cpu.regfile.system.s1 = sisa->cpu.pc;
-		sisa->cpu.regfile.system.s2 = sisa->cpu.exception;
-		sisa->cpu.pc = sisa->cpu.regfile.system.s5;
-		sisa->cpu.regfile.system.psw.i = 0;
-		sisa->cpu.regfile.system.psw.m = SISA_CPU_MODE_SYSTEM;
-		sisa->cpu.status = SISA_CPU_STATUS_FETCH;
-		/* Is this the best place to clear the exception flag? */
-		sisa->cpu.exc_happened = 0;
-		break;
-	}
-
-	sisa->cpu.cycles++;
-
-	/* Timer interrupt generator */
-	if (sisa->cpu.cycles % (SISA_CPU_CLK_FREQ / SISA_TIMER_FREQ) == 0) {
-		sisa->cpu.ints_pending |= BIT(SISA_INTERRUPT_TIMER);
-	}
+	} while (ret == SISA_RUN_VARIANT_CHANGED);
 
-	/* Update milliseconds counter */
-	if (sisa->cpu.cycles % (SISA_CPU_CLK_FREQ / 1000) == 0 &&
-	    sisa->io_ports[SISA_IO_PORT_MILLIS_COUNTER] > 0) {
-		sisa->io_ports[SISA_IO_PORT_MILLIS_COUNTER]--;
-	}
+	return ret;
+}
 
-	/* Update pseudorandom number (cycles) */
-	sisa->io_ports[SISA_IO_PORT_CYCLES] = (uint16_t)sisa->cpu.cycles;
+void sisa_set_callbacks(struct sisa_context *sisa, const struct sisa_callbacks *callbacks)
+{
+	if (callbacks)
+		sisa->callbacks = *callbacks;
+	else
+		memset(&sisa->callbacks, 0, sizeof(sisa->callbacks));
 }
 
-void sisa_load_binary(struct sisa_context *sisa, uint16_t address, void *data, size_t size)
+void sisa_request_stop(struct sisa_context *sisa)
 {
-	memcpy(sisa->memory + address, data, size);
+	sisa->stop_requested = 1;
 }
 
 int sisa_cpu_is_halted(const struct sisa_context *sisa)
@@ -546,7 +526,7 @@ int sisa_cpu_is_halted(const struct sisa_context *sisa)
 	return sisa->cpu.halted;
 }
 
-int sisa_breakpoint_reached(const struct sisa_context *sisa)
+int sisa_breakpoint_reached(struct sisa_context *sisa)
 {
 	int i;
 
@@ -555,8 +535,10 @@ int sisa_breakpoint_reached(const struct sisa_context *sisa)
 		return 0;
 
 	for (i = 0; i < sisa->breakpoint_num; i++) {
-		if (sisa->cpu.pc == sisa->breakpoint_list[i])
+		if (sisa->cpu.pc == sisa->breakpoint_list[i]) {
+			STAT_INC(breakpoint_hits);
 			return 1;
+		}
 	}
 
 	return 0;
@@ -564,11 +546,35 @@ int sisa_breakpoint_reached(const struct sisa_context *sisa)
 
 void sisa_add_breakpoint(struct sisa_context *sisa, uint16_t addr)
 {
-	sisa->breakpoint_list = realloc(sisa->breakpoint_list,
-		sisa->breakpoint_num + 1);
+	uint16_t *list = realloc(sisa->breakpoint_list,
+		(sisa->breakpoint_num + 1) * sizeof(*list));
+
+	if (!list)
+		return;
 
+	sisa->breakpoint_list = list;
 	sisa->breakpoint_list[sisa->breakpoint_num] = addr;
 	sisa->breakpoint_num++;
+	sisa_update_variant(sisa);
+}
+
+void sisa_remove_breakpoint(struct sisa_context *sisa, uint16_t addr)
+{
+	int i;
+
+	for (i = 0; i < sisa->breakpoint_num; i++) {
+		if (sisa->breakpoint_list[i] == addr) {
+			sisa->breakpoint_list[i] = sisa->breakpoint_list[--sisa->breakpoint_num];
+			sisa_update_variant(sisa);
+			return;
+		}
+	}
+}
+
+void sisa_clear_breakpoints(struct sisa_context *sisa)
+{
+	sisa->breakpoint_num = 0;
+	sisa_update_variant(sisa);
 }
 
 void sisa_set_pc(struct sisa_context *sisa, uint16_t pc)
@@ -576,9 +582,111 @@ void sisa_set_pc(struct sisa_context *sisa, uint16_t pc)
 	sisa->cpu.pc = pc;
 }
 
+uint16_t sisa_get_pc(const struct sisa_context *sisa)
+{
+	return sisa->cpu.pc;
+}
+
+uint64_t sisa_get_cycles(const struct sisa_context *sisa)
+{
+	return sisa->cpu.cycles;
+}
+
+enum sisa_cpu_mode sisa_get_mode(const struct sisa_context *sisa)
+{
+	return sisa->cpu.regfile.system.psw.m;
+}
+
+uint16_t sisa_reg_get(const struct sisa_context *sisa, unsigned int reg)
+{
+	return REGS[reg & 7];
+}
+
+void sisa_reg_set(struct sisa_context *sisa, unsigned int reg, uint16_t value)
+{
+	REGS[reg & 7] = value;
+}
+
+uint16_t sisa_sreg_get(const struct sisa_context *sisa, unsigned int reg)
+{
+	return SREGS[reg & 7];
+}
+
+void sisa_sreg_set(struct sisa_context *sisa, unsigned int reg, uint16_t value)
+{
+	SREGS[reg & 7] = value;
+}
+
+/* Physical memory accessors, fail if the range doesn't fit in memory */
+int sisa_memory_read(const struct sisa_context *sisa, uint16_t addr, void *data, size_t size)
+{
+	if (size > SISA_MEMORY_SIZE - addr)
+		return 0;
+
+	memcpy(data, sisa->memory + addr, size);
+
+	return 1;
+}
+
+int sisa_memory_write(struct sisa_context *sisa, uint16_t addr, const void *data, size_t size)
+{
+	if (size > SISA_MEMORY_SIZE - addr)
+		return 0;
+
+	memcpy(sisa->memory + addr, data, size);
+	sisa_memory_written(sisa, addr, size);
+
+	return 1;
+}
+
+void sisa_memory_written(struct sisa_context *sisa, uint16_t addr, size_t size)
+{
+	size_t chunk;
+
+	sisa_fuse_forget_range(sisa, addr, size);
+
+	/* Watches are told about one page at a time, like the CPU's stores */
+	while (sisa->watched_pages && size) {
+		chunk = SISA_PAGE_SIZE - (addr & (SISA_PAGE_SIZE - 1));
+		if (chunk > size)
+			chunk = size;
+		sisa_write_watch_notify(sisa, addr, chunk);
+		addr += chunk;
+		size -= chunk;
+	}
+}
+
+uint16_t sisa_io_port_get(const struct sisa_context *sisa, uint8_t port)
+{
+	return sisa->io_ports[port];
+}
+
+void sisa_io_port_set(struct sisa_context *sisa, uint8_t port, uint16_t value)
+{
+	sisa->io_ports[port] = value;
+}
+
+/* Fills text with SISA_VGA_ROWS lines of SISA_VGA_COLS characters, NUL terminated */
+void sisa_vga_get_text(const struct sisa_context *sisa, char *text)
+{
+	int i, j;
+	char c;
+
+	for (i = 0; i < SISA_VGA_ROWS; i++) {
+		for (j = 0; j < SISA_VGA_COLS; j++) {
+			c = sisa->memory[SISA_VGA_START_ADDR + (i * SISA_VGA_COLS + j) * 2];
+			*text++ = isgraph(c) ? c : ' ';
+		}
+		*text++ = '\n';
+	}
+
+	*text = '\0';
+}
+
 void sisa_tlb_set_enabled(struct sisa_context *sisa, int enabled)
 {
 	sisa->tlb_enabled = enabled;
+	sisa_update_variant(sisa);
 }
 
 int sisa_tlb_is_enabled(const struct sisa_context *sisa)
@@ -642,12 +750,145 @@ void sisa_keyboard_press(struct sisa_context *sisa, uint8_t key)
 	}
 }
 
+void sisa_snapshot_save(const struct sisa_context *sisa, struct sisa_snapshot *snap)
+{
+	snap->cpu = sisa->cpu;
+	memcpy(snap->memory, sisa->memory, sizeof(snap->memory));
+	memcpy(snap->io_ports, sisa->io_ports, sizeof(snap->io_ports));
+	snap->itlb = sisa->itlb;
+	snap->dtlb = sisa->dtlb;
+	snap->tlb_enabled = sisa->tlb_enabled;
+}
+
+void sisa_snapshot_restore(struct sisa_context *sisa, const struct sisa_snapshot *snap)
+{
+	sisa->cpu = snap->cpu;
+	memcpy(sisa->memory, snap->memory, sizeof(sisa->memory));
+	memset(sisa->fuse_pairs, FUSE_UNKNOWN, sizeof(sisa->fuse_pairs));
+	memcpy(sisa->io_ports, snap->io_ports, sizeof(sisa->io_ports));
+	sisa->itlb = snap->itlb;
+	sisa->dtlb = snap->dtlb;
+	sisa->tlb_enabled = snap->tlb_enabled;
+	sisa_update_variant(sisa);
+}
+
+/* Like sisa_snapshot_restore() but only copies back the memory pages in the mask */
+void sisa_snapshot_restore_pages(struct sisa_context *sisa, const struct sisa_snapshot *snap,
+				 uint16_t pages)
+{
+	int i;
+
+	sisa->cpu = snap->cpu;
+	memcpy(sisa->io_ports, snap->io_ports, sizeof(sisa->io_ports));
+	sisa->itlb = snap->itlb;
+	sisa->dtlb = snap->dtlb;
+	sisa->tlb_enabled = snap->tlb_enabled;
+	sisa_update_variant(sisa);
+
+	for (i = 0; pages; i++, pages >>= 1) {
+		if (pages & 1) {
+			memcpy(sisa->memory + i * SISA_PAGE_SIZE,
+			       snap->memory + i * SISA_PAGE_SIZE, SISA_PAGE_SIZE);
+			sisa_fuse_forget_range(sisa, i * SISA_PAGE_SIZE, SISA_PAGE_SIZE);
+		}
+	}
+}
+
+static void sisa_write_watch_update_pages(struct sisa_context *sisa)
+{
+	int i;
+
+	sisa->watched_pages = 0;
+
+	for (i = 0; i < SISA_MAX_WRITE_WATCHES; i++) {
+		if (sisa->write_watches[i].cb)
+			sisa->watched_pages |= sisa->write_watches[i].pages;
+	}
+
+	sisa_update_variant(sisa);
+}
+
+int sisa_write_watch_add(struct sisa_context *sisa, uint16_t pages,
+			 sisa_write_watch_cb cb, void *arg)
+{
+	int i;
+
+	for (i = 0; i < SISA_MAX_WRITE_WATCHES; i++) {
+		if (!sisa->write_watches[i].cb) {
+			sisa->write_watches[i].pages = pages;
+			sisa->write_watches[i].cb = cb;
+			sisa->write_watches[i].arg = arg;
+			sisa_write_watch_update_pages(sisa);
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+void sisa_write_watch_remove(struct sisa_context *sisa, int id)
+{
+	if (id < 0 || id >= SISA_MAX_WRITE_WATCHES)
+		return;
+
+	sisa->write_watches[id].cb = NULL;
+	sisa_write_watch_update_pages(sisa);
+}
+
+int sisa_stats_enabled(void)
+{
+#ifdef SISA_STATS
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+const struct sisa_stats *sisa_stats_get(const struct sisa_context *sisa)
+{
+	return &sisa->stats;
+}
+
+void sisa_stats_reset(struct sisa_context *sisa)
+{
+	memset(&sisa->stats, 0, sizeof(sisa->stats));
+}
+
+/* The coverage maps are owned by the caller and only ever ORed into, NULL disables */
+void sisa_coverage_set(struct sisa_context *sisa, struct sisa_coverage *coverage)
+{
+	sisa->coverage = coverage;
+	sisa_update_variant(sisa);
+}
+
+/* The model is owned by the caller and must outlive its use, NULL disables */
+void sisa_cost_set(struct sisa_context *sisa, const struct sisa_cost_model *cost)
+{
+	sisa->cost = cost;
+	sisa_update_variant(sisa);
+}
+
+/* The counters are owned by the caller and only ever incremented, NULL disables */
+void sisa_heatmap_set(struct sisa_context *sisa, struct sisa_heatmap *heatmap)
+{
+	sisa->heatmap = heatmap;
+	sisa_update_variant(sisa);
+}
+
+/* Caches are set up with sisa_cache_init() and owned by the caller, NULL disables */
+void sisa_cache_set(struct sisa_context *sisa, struct sisa_cache *icache, struct sisa_cache *dcache)
+{
+	sisa->icache = icache;
+	sisa->dcache = dcache;
+	sisa_update_variant(sisa);
+}
+
 void sisa_print_dump(const struct sisa_context *sisa)
 {
 	int i;
 
 	static const char *status_str[] = {
-		"fetch", "demw", "system", "nop"
+		"fetch", "demw", "system", "nop", "stall"
 	};
 
 	printf("%s\n", status_str[sisa->cpu.status]);
@@ -691,8 +932,8 @@ void sisa_print_tlb_dump(const struct sisa_context *sisa)
 void sisa_print_vga_dump(const struct sisa_context *sisa)
 {
 	int i, j;
-	const int num_cols = 80;
-	const int num_rows = 30;
+	const int num_cols = SISA_VGA_COLS;
+	const int num_rows = SISA_VGA_ROWS;
 	char c;
 
 	for (i = 0; i < num_cols + 2; i++)
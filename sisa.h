@@ -19,6 +19,8 @@
 #define SISA_NUM_KEYS        4
 #define SISA_NUM_SWITCHES    10
 #define SISA_NUM_7SEGS       4
+#define SISA_VGA_COLS        80
+#define SISA_VGA_ROWS        30
 
 enum sisa_opcode {
 	SISA_OPCODE_ARIT_LOGIC    = 0b0000,
@@ -153,6 +155,8 @@ enum sisa_cpu_status {
 	SISA_CPU_STATUS_DEMW,
 	SISA_CPU_STATUS_SYSTEM,
 	SISA_CPU_STATUS_NOP,
+	/* Waiting for a cache miss, see struct sisa_cache */
+	SISA_CPU_STATUS_STALL,
 };
 
 struct sisa_tlb {
@@ -209,6 +213,154 @@ struct sisa_cpu {
 	uint8_t kb_key_buffer;
 	int halted;
 	uint64_t cycles;
+	/* Cycles left in SISA_CPU_STATUS_STALL, and where to go after them */
+	unsigned int stall;
+	enum sisa_cpu_status stall_status;
+	/* Set from entering an exception handler to its RETI */
+	int in_exception;
+};
+
+#define SISA_NUM_EXCEPTIONS 16
+#define SISA_NUM_INTERRUPTS 4
+
+/* Only updated when built with -DSISA_STATS, all zeros otherwise */
+struct sisa_stats {
+	uint64_t instructions;
+	uint64_t cycles;
+	uint64_t itlb_accesses;
+	uint64_t dtlb_accesses;
+	uint64_t exceptions[SISA_NUM_EXCEPTIONS];
+	uint64_t interrupts[SISA_NUM_INTERRUPTS];
+	uint64_t io_in[SISA_NUM_IO_PORTS];
+	uint64_t io_out[SISA_NUM_IO_PORTS];
+	uint64_t halts;
+	uint64_t breakpoint_hits;
+};
+
+/*
+ * Guest code coverage, one bit per physical word address (paddr / 2).
+ * Branch bits are only set for BZ, BNZ, JZ and JNZ.
+ */
+#define SISA_COVERAGE_MAP_SIZE (SISA_MEMORY_SIZE / 2 / 8)
+
+struct sisa_coverage {
+	uint8_t executed[SISA_COVERAGE_MAP_SIZE];
+	uint8_t taken[SISA_COVERAGE_MAP_SIZE];
+	uint8_t not_taken[SISA_COVERAGE_MAP_SIZE];
+};
+
+/*
+ * Memory access counters, one per physical word (paddr / 2) and kind of
+ * access. Byte accesses count for the word they fall in. See heatmap.h
+ * for the per page summaries and the exports.
+ */
+#define SISA_HEATMAP_NUM_WORDS (SISA_MEMORY_SIZE / 2)
+
+struct sisa_heatmap {
+	uint64_t fetches[SISA_HEATMAP_NUM_WORDS];
+	uint64_t reads[SISA_HEATMAP_NUM_WORDS];
+	uint64_t writes[SISA_HEATMAP_NUM_WORDS];
+};
+
+/*
+ * Optional instruction and data cache models of the board's SRAM path.
+ * Misses stall the CPU for the configured cycles, which then show up in
+ * cpu.cycles like any other. Only the timing is modelled, memory is
+ * always up to date. Writes through a write-back cache allocate lines,
+ * write-through ones don't. See cache.h to set one up.
+ */
+enum sisa_cache_write_policy {
+	SISA_CACHE_WRITE_BACK,
+	SISA_CACHE_WRITE_THROUGH,
+};
+
+struct sisa_cache_config {
+	unsigned int size;
+	unsigned int line_size;
+	unsigned int ways;
+	enum sisa_cache_write_policy write_policy;
+	/* Cycles to fill a line, and to write to memory (write-through or dirty eviction) */
+	unsigned int miss_penalty;
+	unsigned int write_penalty;
+};
+
+struct sisa_cache_stats {
+	uint64_t reads;
+	uint64_t read_misses;
+	uint64_t writes;
+	uint64_t write_misses;
+	uint64_t writebacks;
+	uint64_t stall_cycles;
+};
+
+struct sisa_cache_line {
+	uint16_t tag;
+	uint8_t valid;
+	uint8_t dirty;
+	uint64_t last_used;
+};
+
+struct sisa_cache {
+	struct sisa_cache_config config;
+	struct sisa_cache_line *lines;
+	unsigned int line_shift;
+	unsigned int set_mask;
+	uint64_t clock;
+	struct sisa_cache_stats stats;
+};
+
+/*
+ * Optional cycle cost model, for counts closer to the multicycle hardware.
+ * Every value is cycles added to the base model (FETCH and DEMW for an
+ * instruction, SYSTEM for an exception entry), spent stalled like cache
+ * misses. Instructions are charged when they complete, by opcode and
+ * function field (see sisa_instr_function()), memory accesses when they
+ * go through and exceptions (interrupts included) when entered. See
+ * cost.h to load one from a file.
+ */
+#define SISA_NUM_OPCODES   16
+#define SISA_NUM_FUNCTIONS 64
+
+struct sisa_cost_model {
+	uint16_t instr[SISA_NUM_OPCODES][SISA_NUM_FUNCTIONS];
+	uint16_t fetch;
+	uint16_t read;
+	uint16_t write;
+	uint16_t exceptions[SISA_NUM_EXCEPTIONS];
+};
+
+struct sisa_context;
+
+enum sisa_stop_reason {
+	SISA_STOP_CYCLES,
+	SISA_STOP_HALT,
+	SISA_STOP_BREAKPOINT,
+	SISA_STOP_CALLBACK,
+};
+
+/*
+ * Embedding callbacks, all optional. The exception and breakpoint ones
+ * return non-zero to make sisa_run() stop; breakpoints without a
+ * callback always stop. out is called after an OUT instruction wrote
+ * the port.
+ */
+struct sisa_callbacks {
+	void (*halt)(struct sisa_context *sisa, void *arg);
+	int (*exception)(struct sisa_context *sisa, enum sisa_exception exception, void *arg);
+	int (*breakpoint)(struct sisa_context *sisa, uint16_t pc, void *arg);
+	void (*out)(struct sisa_context *sisa, uint8_t port, uint16_t value, void *arg);
+	void *arg;
+};
+
+typedef void (*sisa_write_watch_cb)(struct sisa_context *sisa, uint16_t paddr,
+				    unsigned int size, void *arg);
+
+#define SISA_MAX_WRITE_WATCHES 8
+
+struct sisa_write_watch {
+	uint16_t pages;
+	sisa_write_watch_cb cb;
+	void *arg;
 };
 
 struct sisa_context {
@@ -220,25 +372,123 @@ struct sisa_context {
 	int tlb_enabled;
 	uint16_t *breakpoint_list;
 	unsigned int breakpoint_num;
+	struct sisa_write_watch write_watches[SISA_MAX_WRITE_WATCHES];
+	uint16_t watched_pages;
+	struct sisa_stats stats;
+	struct sisa_callbacks callbacks;
+	int stop_requested;
+	struct sisa_coverage *coverage;
+	uint16_t fetch_paddr;
+	struct sisa_cache *icache;
+	struct sisa_cache *dcache;
+	const struct sisa_cost_model *cost;
+	struct sisa_heatmap *heatmap;
+	/* SISA_VARIANT_* flags of the interpreter copy in use, private to sisa.c */
+	unsigned int exec_variant;
+	/*
+	 * Whether the instruction in each even physical address starts a pair
+	 * sisa_run() fuses, 0 until worked out. Memory writes forget the words
+	 * they change.
+	 */
+	uint8_t fuse_pairs[SISA_MEMORY_SIZE / 2];
+};
+
+/* Machine state only: everything needed to resume execution deterministically */
+struct sisa_snapshot {
+	struct sisa_cpu cpu;
+	uint8_t memory[SISA_MEMORY_SIZE];
+	uint16_t io_ports[SISA_NUM_IO_PORTS];
+	struct sisa_tlb itlb;
+	struct sisa_tlb dtlb;
+	int tlb_enabled;
 };
 
 void sisa_init(struct sisa_context *sisa);
 void sisa_destroy(struct sisa_context *sisa);
 void sisa_step_cycle(struct sisa_context *sisa);
 void sisa_load_binary(struct sisa_context *sisa, uint16_t address, void *data, size_t size);
+/*
+ * Runs up to max_cycles. Unlike stepping with sisa_step_cycle(), it fuses
+ * some pairs of instructions into a single step, so only its users get
+ * that speedup (see sisa_exec.h).
+ */
+enum sisa_stop_reason sisa_run(struct sisa_context *sisa, uint64_t max_cycles);
+void sisa_set_callbacks(struct sisa_context *sisa, const struct sisa_callbacks *callbacks);
+/* Makes sisa_run() stop after the current cycle, for callbacks without a return value */
+void sisa_request_stop(struct sisa_context *sisa);
 
 int sisa_cpu_is_halted(const struct sisa_context *sisa);
-int sisa_breakpoint_reached(const struct sisa_context *sisa);
+int sisa_breakpoint_reached(struct sisa_context *sisa);
 void sisa_add_breakpoint(struct sisa_context *sisa, uint16_t addr);
+void sisa_remove_breakpoint(struct sisa_context *sisa, uint16_t addr);
+void sisa_clear_breakpoints(struct sisa_context *sisa);
 void sisa_set_pc(struct sisa_context *sisa, uint16_t pc);
 void sisa_tlb_set_enabled(struct sisa_context *sisa, int enabled);
 int sisa_tlb_is_enabled(const struct sisa_context *sisa);
+uint16_t sisa_get_pc(const struct sisa_context *sisa);
+uint64_t sisa_get_cycles(const struct sisa_context *sisa);
+enum sisa_cpu_mode sisa_get_mode(const struct sisa_context *sisa);
+uint16_t sisa_reg_get(const struct sisa_context *sisa, unsigned int reg);
+void sisa_reg_set(struct sisa_context *sisa, unsigned int reg, uint16_t value);
+uint16_t sisa_sreg_get(const struct sisa_context *sisa, unsigned int reg);
+void sisa_sreg_set(struct sisa_context *sisa, unsigned int reg, uint16_t value);
+int sisa_memory_read(const struct sisa_context *sisa, uint16_t addr, void *data, size_t size);
+int sisa_memory_write(struct sisa_context *sisa, uint16_t addr, const void *data, size_t size);
+/*
+ * For code writing to sisa->memory directly, like the loaders and the gdb
+ * stub: tells the context what changed, write watches included
+ */
+void sisa_memory_written(struct sisa_context *sisa, uint16_t addr, size_t size);
+
+/*
+ * Forgets the fused pairs a store of size bytes to paddr can change: the
+ * ones starting in the words it writes, which are two for a word store to
+ * an odd address, and the one starting in the word before
+ */
+static inline void sisa_fuse_forget(struct sisa_context *sisa, uint16_t paddr, unsigned int size)
+{
+	unsigned int word = (paddr >> 1) + SISA_MEMORY_SIZE / 2 - 1;
+	unsigned int last = ((paddr + size - 1) >> 1) + SISA_MEMORY_SIZE / 2;
+
+	for (; word <= last; word++)
+		sisa->fuse_pairs[word & (SISA_MEMORY_SIZE / 2 - 1)] = 0;
+}
+
+uint16_t sisa_io_port_get(const struct sisa_context *sisa, uint8_t port);
+void sisa_io_port_set(struct sisa_context *sisa, uint8_t port, uint16_t value);
+void sisa_vga_get_text(const struct sisa_context *sisa, char *text);
 void sisa_keys_set(struct sisa_context *sisa, uint8_t keys);
 void sisa_switches_set(struct sisa_context *sisa, uint16_t switches);
 void sisa_key_toggle(struct sisa_context *sisa, uint8_t key_num);
 void sisa_switch_toggle(struct sisa_context *sisa, uint8_t switch_num);
 void sisa_keyboard_press(struct sisa_context *sisa, uint8_t key);
 
+void sisa_snapshot_save(const struct sisa_context *sisa, struct sisa_snapshot *snap);
+void sisa_snapshot_restore(struct sisa_context *sisa, const struct sisa_snapshot *snap);
+void sisa_snapshot_restore_pages(struct sisa_context *sisa, const struct sisa_snapshot *snap,
+				 uint16_t pages);
+int sisa_write_watch_add(struct sisa_context *sisa, uint16_t pages,
+			 sisa_write_watch_cb cb, void *arg);
+void sisa_write_watch_remove(struct sisa_context *sisa, int id);
+
+int sisa_stats_enabled(void);
+const struct sisa_stats *sisa_stats_get(const struct sisa_context *sisa);
+void sisa_stats_reset(struct sisa_context *sisa);
+
+void sisa_coverage_set(struct sisa_context *sisa, struct sisa_coverage *coverage);
+void sisa_cache_set(struct sisa_context *sisa, struct sisa_cache *icache, struct sisa_cache *dcache);
+void sisa_cost_set(struct sisa_context *sisa, const struct sisa_cost_model *cost);
+unsigned int sisa_instr_function(uint16_t instr);
+void sisa_heatmap_set(struct sisa_context *sisa, struct sisa_heatmap *heatmap);
+
+/*
+ * Pieces of the interpreter for translated code (see aot.h): a data TLB
+ * access that raises the same exceptions as LD/ST, and the OUT side effects.
+ */
+int sisa_dtlb_access(struct sisa_context *sisa, uint16_t vaddr, uint16_t *paddr,
+		     int word_access, int write);
+void sisa_cpu_out(struct sisa_context *sisa, uint8_t port, uint16_t value);
+
 void sisa_print_dump(const struct sisa_context *sisa);
 void sisa_print_tlb_dump(const struct sisa_context *sisa);
 void sisa_print_vga_dump(const struct sisa_context *sisa);
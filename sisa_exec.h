@@ -0,0 +1,550 @@
+/*
+ * The interpreter's execute path, included by sisa.c once per variant
+ * (see sisa_update_variant()) with these defined:
+ *
+ *   EXEC_VARIANT  SISA_VARIANT_* flags the copy is built for
+ *   EXEC_FN(name) name of a function of this copy
+ *
+ * With SISA_VARIANT_TLB clear, translation compiles down to the identity
+ * mapping, and with SISA_VARIANT_INSTR clear the coverage, write watch,
+ * breakpoint, cache, cost model and heatmap checks go away. Not a regular
+ * header, no include guard.
+ */
+
+#define EXEC_TLB   (EXEC_VARIANT & SISA_VARIANT_TLB)
+#define EXEC_INSTR (EXEC_VARIANT & SISA_VARIANT_INSTR)
+
+#define EXEC_TLB_ACCESS(sisa, tlb, vaddr, paddr, word_access, write) \
+	(EXEC_TLB ? sisa_tlb_translate(sisa, tlb, vaddr, paddr, word_access, write) : \
+		    (*(paddr) = (vaddr), 1))
+
+static void EXEC_FN(sisa_demw_execute)(struct sisa_context *sisa)
+{
+	const uint16_t instr = sisa->cpu.ir;
+
+	switch (INSTR_OPCODE(instr)) {
+	case SISA_OPCODE_ARIT_LOGIC:
+		switch (ARIT_LOGIC_F_BITS(instr)) {
+		case SISA_INSTR_ARIT_LOGIC_F_AND:
+			REGS[INSTR_Rd(instr)] = REGS[INSTR_Ra_6(instr)] & REGS[INSTR_Rb_0(instr)];
+			break;
+		case SISA_INSTR_ARIT_LOGIC_F_OR:
+			REGS[INSTR_Rd(instr)] = REGS[INSTR_Ra_6(instr)] | REGS[INSTR_Rb_0(instr)];
+			break;
+		case SISA_INSTR_ARIT_LOGIC_F_XOR:
+			REGS[INSTR_Rd(instr)] = REGS[INSTR_Ra_6(instr)] ^ REGS[INSTR_Rb_0(instr)];
+			break;
+		case SISA_INSTR_ARIT_LOGIC_F_NOT:
+			REGS[INSTR_Rd(instr)] = ~REGS[INSTR_Ra_6(instr)];
+			break;
+		case SISA_INSTR_ARIT_LOGIC_F_ADD:
+			REGS[INSTR_Rd(instr)] = REGS[INSTR_Ra_6(instr)] + REGS[INSTR_Rb_0(instr)];
+			break;
+		case SISA_INSTR_ARIT_LOGIC_F_SUB:
+			REGS[INSTR_Rd(instr)] = REGS[INSTR_Ra_6(instr)] - REGS[INSTR_Rb_0(instr)];
+			break;
+		case SISA_INSTR_ARIT_LOGIC_F_SHA: {
+			int shift = SEXT_5(X_DOWNTO_Y(REGS[INSTR_Rb_0(instr)], 4, 0));
+			if (shift > 0) {
+				REGS[INSTR_Rd(instr)] = (int16_t)REGS[INSTR_Ra_6(instr)] << shift;
+			} else {
+				REGS[INSTR_Rd(instr)] = (int16_t)REGS[INSTR_Ra_6(instr)] >> -shift;
+			}
+			break;
+		}
+		case SISA_INSTR_ARIT_LOGIC_F_SHL: {
+			int shift = SEXT_5(X_DOWNTO_Y(REGS[INSTR_Rb_0(instr)], 4, 0));
+			if (shift > 0) {
+				REGS[INSTR_Rd(instr)] = REGS[INSTR_Ra_6(instr)] << shift;
+			} else {
+				REGS[INSTR_Rd(instr)] = REGS[INSTR_Ra_6(instr)] >> -shift;
+			}
+			break;
+		}
+		}
+		break;
+	case SISA_OPCODE_COMPARE:
+		switch (COMPARE_F_BITS(instr)) {
+		case SISA_INSTR_COMPARE_F_CMPLT:
+			REGS[INSTR_Rd(instr)] = (int16_t)REGS[INSTR_Ra_6(instr)] < (int16_t)REGS[INSTR_Rb_0(instr)];
+			break;
+		case SISA_INSTR_COMPARE_F_CMPLE:
+			REGS[INSTR_Rd(instr)] = (int16_t)REGS[INSTR_Ra_6(instr)] <= (int16_t)REGS[INSTR_Rb_0(instr)];
+			break;
+		case SISA_INSTR_COMPARE_F_CMPEQ:
+			REGS[INSTR_Rd(instr)] = REGS[INSTR_Ra_6(instr)] == REGS[INSTR_Rb_0(instr)];
+			break;
+		case SISA_INSTR_COMPARE_F_CMPLTU:
+			REGS[INSTR_Rd(instr)] = REGS[INSTR_Ra_6(instr)] < REGS[INSTR_Rb_0(instr)];
+			break;
+		case SISA_INSTR_COMPARE_F_CMPLEU:
+			REGS[INSTR_Rd(instr)] = REGS[INSTR_Ra_6(instr)] <= REGS[INSTR_Rb_0(instr)];
+			break;
+		default:
+			sisa->cpu.exception = SISA_EXCEPTION_ILLEGAL_INSTR;
+			sisa->cpu.exc_happened = 1;
+			break;
+		}
+		break;
+	case SISA_OPCODE_ADDI:
+		REGS[INSTR_Rd(instr)] = REGS[INSTR_Ra_6(instr)] + SEXT_6(X_DOWNTO_Y(instr, 5, 0));
+		break;
+	case SISA_OPCODE_LOAD: {
+		uint16_t paddr;
+		uint16_t vaddr = REGS[INSTR_Ra_6(instr)] + (SEXT_6(X_DOWNTO_Y(instr, 5, 0)) << 1);
+
+		if (!EXEC_TLB_ACCESS(sisa, &sisa->dtlb, vaddr, &paddr, 1, 0)) {
+			break;
+		}
+
+		REGS[INSTR_Rd(instr)] = sisa->memory[paddr + 1] << 8 |  sisa->memory[paddr];
+		CACHE_ACCESS(sisa->dcache, paddr, 0);
+		COST_ADD(read);
+		HEATMAP_COUNT(reads, paddr);
+		break;
+	}
+	case SISA_OPCODE_STORE: {
+		uint16_t paddr;
+		uint16_t vaddr = REGS[INSTR_Ra_6(instr)] + (SEXT_6(X_DOWNTO_Y(instr, 5, 0)) << 1);
+
+		if (!EXEC_TLB_ACCESS(sisa, &sisa->dtlb, vaddr, &paddr, 1, 1)) {
+			break;
+		}
+
+		sisa->memory[paddr] = REGS[INSTR_Rb_9(instr)] & 0xFF;
+		sisa->memory[paddr + 1] = REGS[INSTR_Rb_9(instr)] >> 8;
+		sisa_fuse_forget(sisa, paddr, 2);
+		CACHE_ACCESS(sisa->dcache, paddr, 1);
+		COST_ADD(write);
+		HEATMAP_COUNT(writes, paddr);
+
+		if (EXEC_INSTR && sisa->watched_pages)
+			sisa_write_watch_notify(sisa, paddr, 2);
+		break;
+	}
+	case SISA_OPCODE_MOV:
+		switch (MOV_F_BITS(instr)) {
+		case SISA_INSTR_MOV_F_MOVI:
+			REGS[INSTR_Rd(instr)] = SEXT_8(INSTR_IMM8(instr));
+			break;
+		case SISA_INSTR_MOV_F_MOVHI:
+			REGS[INSTR_Rd(instr)] = (INSTR_IMM8(instr) << 8) | (REGS[INSTR_Ra_9(instr)] & 0xFF);
+			break;
+		}
+		break;
+	case SISA_OPCODE_RELATIVE_JUMP:
+		switch (RELATIVE_JUMP_F_BITS(instr)) {
+		case SISA_INSTR_RELATIVE_JUMP_F_BZ:
+			COVERAGE_BRANCH(REGS[INSTR_Rb_9(instr)] == 0);
+			if (REGS[INSTR_Rb_9(instr)] == 0) {
+				sisa->cpu.pc += (int8_t)INSTR_IMM8(instr) << 1;
+			}
+			break;
+		case SISA_INSTR_RELATIVE_JUMP_F_BNZ:
+			COVERAGE_BRANCH(REGS[INSTR_Rb_9(instr)] != 0);
+			if (REGS[INSTR_Rb_9(instr)] != 0) {
+				sisa->cpu.pc += (int8_t)INSTR_IMM8(instr) << 1;
+			}
+			break;
+		}
+
+		break;
+	case SISA_OPCODE_IN_OUT:
+		switch (IN_OUT_F_BITS(instr)) {
+		case SISA_INSTR_IN_OUT_F_IN:
+			REGS[INSTR_Rd(instr)] = sisa->io_ports[INSTR_IMM8(instr)];
+			STAT_INC(io_in[INSTR_IMM8(instr)]);
+			break;
+		case SISA_INSTR_IN_OUT_F_OUT:
+			sisa_cpu_out(sisa, INSTR_IMM8(instr), REGS[INSTR_Rb_9(instr)]);
+			STAT_INC(io_out[INSTR_IMM8(instr)]);
+			break;
+		}
+		break;
+	case SISA_OPCODE_MULT_DIV:
+		switch (MULT_DIV_F_BITS(instr)) {
+		case SISA_INSTR_MULT_DIV_F_MUL:
+			REGS[INSTR_Rd(instr)] = REGS[INSTR_Ra_6(instr)] * REGS[INSTR_Rb_0(instr)];
+			break;
+		case SISA_INSTR_MULT_DIV_F_MULH:
+			REGS[INSTR_Rd(instr)] = ((int32_t)REGS[INSTR_Ra_6(instr)] * (int32_t)REGS[INSTR_Rb_0(instr)]) >> 16;
+			break;
+		case SISA_INSTR_MULT_DIV_F_MULHU:
+			REGS[INSTR_Rd(instr)] = ((uint32_t)REGS[INSTR_Ra_6(instr)] * (uint32_t)REGS[INSTR_Rb_0(instr)]) >> 16;
+			break;
+		case SISA_INSTR_MULT_DIV_F_DIV:
+			if (REGS[INSTR_Rb_0(instr)] == 0) {
+				sisa->cpu.exception = SISA_EXCEPTION_DIVISION_BY_ZERO;
+				sisa->cpu.exc_happened = 1;
+				break;
+			}
+			REGS[INSTR_Rd(instr)] = (int16_t)REGS[INSTR_Ra_6(instr)] / (int16_t)REGS[INSTR_Rb_0(instr)];
+			break;
+		case SISA_INSTR_MULT_DIV_F_DIVU:
+			if (REGS[INSTR_Rb_0(instr)] == 0) {
+				sisa->cpu.exception = SISA_EXCEPTION_DIVISION_BY_ZERO;
+				sisa->cpu.exc_happened = 1;
+				break;
+			}
+			REGS[INSTR_Rd(instr)] = REGS[INSTR_Ra_6(instr)] / REGS[INSTR_Rb_0(instr)];
+			break;
+		default:
+			sisa->cpu.exception = SISA_EXCEPTION_ILLEGAL_INSTR;
+			sisa->cpu.exc_happened = 1;
+			break;
+		}
+		break;
+	case SISA_OPCODE_ABSOLUTE_JUMP:
+		switch (ABSOLUTE_JUMP_F_BITS(instr)) {
+		case SISA_INSTR_ABSOLUTE_JUMP_F_JZ:
+			COVERAGE_BRANCH(REGS[INSTR_Rb_9(instr)] == 0);
+			if (REGS[INSTR_Rb_9(instr)] == 0) {
+				sisa->cpu.pc = REGS[INSTR_Ra_6(instr)] - 2;
+			}
+			break;
+		case SISA_INSTR_ABSOLUTE_JUMP_F_JNZ:
+			COVERAGE_BRANCH(REGS[INSTR_Rb_9(instr)] != 0);
+			if (REGS[INSTR_Rb_9(instr)] != 0) {
+				sisa->cpu.pc = REGS[INSTR_Ra_6(instr)] - 2;
+			}
+			break;
+		case SISA_INSTR_ABSOLUTE_JUMP_F_JMP:
+			sisa->cpu.pc = REGS[INSTR_Ra_6(instr)] - 2;
+			break;
+		case SISA_INSTR_ABSOLUTE_JUMP_F_JAL: {
+			uint16_t pc = sisa->cpu.pc;
+			sisa->cpu.pc = REGS[INSTR_Ra_6(instr)] - 2;
+			REGS[INSTR_Rd(instr)] = pc + 2;
+			break;
+		}
+		case SISA_INSTR_ABSOLUTE_JUMP_F_CALLS:
+			sisa->cpu.regfile.system.s3 = REGS[INSTR_Ra_6(instr)];
+			sisa->cpu.exception = SISA_EXCEPTION_CALLS;
+			sisa->cpu.exc_happened = 1;
+			break;
+		default:
+			sisa->cpu.exception = SISA_EXCEPTION_ILLEGAL_INSTR;
+			sisa->cpu.exc_happened = 1;
+			break;
+		}
+		break;
+	case SISA_OPCODE_LOAD_BYTE: {
+		uint16_t paddr;
+		uint16_t vaddr = REGS[INSTR_Ra_6(instr)] + SEXT_6(X_DOWNTO_Y(instr, 5, 0));
+
+		if (!EXEC_TLB_ACCESS(sisa, &sisa->dtlb, vaddr, &paddr, 0, 0)) {
+			break;
+		}
+
+		REGS[INSTR_Rd(instr)] = SEXT_8(sisa->memory[paddr]);
+		CACHE_ACCESS(sisa->dcache, paddr, 0);
+		COST_ADD(read);
+		HEATMAP_COUNT(reads, paddr);
+		break;
+	}
+	case SISA_OPCODE_STORE_BYTE: {
+		uint16_t paddr;
+		uint16_t vaddr = REGS[INSTR_Ra_6(instr)] + SEXT_6(X_DOWNTO_Y(instr, 5, 0));
+
+		if (!EXEC_TLB_ACCESS(sisa, &sisa->dtlb, vaddr, &paddr, 0, 1)) {
+			break;
+		}
+
+		sisa->memory[paddr] = REGS[INSTR_Rb_9(instr)] & 0xFF;
+		sisa_fuse_forget(sisa, paddr, 1);
+		CACHE_ACCESS(sisa->dcache, paddr, 1);
+		COST_ADD(write);
+		HEATMAP_COUNT(writes, paddr);
+
+		if (EXEC_INSTR && sisa->watched_pages)
+			sisa_write_watch_notify(sisa, paddr, 1);
+		break;
+	}
+	case SISA_OPCODE_SPECIAL:
+		switch (SPECIAL_F_BITS(instr)) {
+		case SISA_INSTR_SPECIAL_F_EI:
+			sisa->cpu.regfile.system.psw.i = 1;
+			break;
+		case SISA_INSTR_SPECIAL_F_DI:
+			sisa->cpu.regfile.system.psw.i = 0;
+			break;
+		case SISA_INSTR_SPECIAL_F_RETI:
+			sisa->cpu.regfile.system.s7 = sisa->cpu.regfile.system.s0;
+			sisa->cpu.pc = sisa->cpu.regfile.system.s1 - 2;
+			sisa->cpu.in_exception = 0;
+			break;
+		case SISA_INSTR_SPECIAL_F_GETIID: {
+			int lsb = ffs(sisa->cpu.ints_pending);
+
+			/* Clear the highest priority interrupt and return its id */
+			if (lsb) {
+				sisa->cpu.ints_pending &= ~BIT(lsb - 1);
+				REGS[INSTR_Rd(instr)] = lsb - 1;
+			} else {
+				REGS[INSTR_Rd(instr)] = 0;
+			}
+			break;
+		}
+		case SISA_INSTR_SPECIAL_F_RDS:
+			REGS[INSTR_Rd(instr)] = SREGS[INSTR_Sa(instr)];
+			break;
+		case SISA_INSTR_SPECIAL_F_WRS:
+			SREGS[INSTR_Sd(instr)] = REGS[INSTR_Ra_6(instr)];
+			break;
+		case SISA_INSTR_SPECIAL_F_WRPI: {
+			uint8_t entry = REGS[INSTR_Ra_6(instr)];
+			uint16_t value = REGS[INSTR_Rb_9(instr)];
+			sisa->itlb.entries[entry].pfn = X_DOWNTO_Y(value, 3, 0);
+			sisa->itlb.entries[entry].r = X_DOWNTO_Y(value, 4, 4);
+			sisa->itlb.entries[entry].v = X_DOWNTO_Y(value, 5, 5);
+			sisa->itlb.entries[entry].p = X_DOWNTO_Y(value, 6, 6);
+			break;
+		}
+		case SISA_INSTR_SPECIAL_F_WRVI: {
+			uint8_t entry = REGS[INSTR_Ra_6(instr)];
+			uint16_t value = REGS[INSTR_Rb_9(instr)];
+			sisa->itlb.entries[entry].vpn = X_DOWNTO_Y(value, 3, 0);
+			break;
+		}
+		case SISA_INSTR_SPECIAL_F_WRPD: {
+			uint8_t entry = REGS[INSTR_Ra_6(instr)];
+			uint16_t value = REGS[INSTR_Rb_9(instr)];
+			sisa->dtlb.entries[entry].pfn = X_DOWNTO_Y(value, 3, 0);
+			sisa->dtlb.entries[entry].r = X_DOWNTO_Y(value, 4, 4);
+			sisa->dtlb.entries[entry].v = X_DOWNTO_Y(value, 5, 5);
+			sisa->dtlb.entries[entry].p = X_DOWNTO_Y(value, 6, 6);
+			break;
+		}
+		case SISA_INSTR_SPECIAL_F_WRVD: {
+			uint8_t entry = REGS[INSTR_Ra_6(instr)];
+			uint16_t value = REGS[INSTR_Rb_9(instr)];
+			sisa->dtlb.entries[entry].vpn = X_DOWNTO_Y(value, 3, 0);
+			break;
+		}
+		case SISA_INSTR_SPECIAL_F_FLUSH:
+			break;
+		case SISA_INSTR_SPECIAL_F_HALT:
+			sisa->cpu.halted = 1;
+			STAT_INC(halts);
+			if (sisa->callbacks.halt)
+				sisa->callbacks.halt(sisa, sisa->callbacks.arg);
+			break;
+		}
+		break;
+	default:
+		sisa->cpu.exception = SISA_EXCEPTION_ILLEGAL_INSTR;
+		sisa->cpu.exc_happened = 1;
+		break;
+	}
+}
+
+static inline void EXEC_FN(sisa_step_cycle)(struct sisa_context *sisa)
+{
+	if (sisa->cpu.halted)
+		return;
+
+	switch (sisa->cpu.status) {
+	case SISA_CPU_STATUS_FETCH: {
+		uint16_t paddr;
+
+		if (!EXEC_TLB_ACCESS(sisa, &sisa->itlb, sisa->cpu.pc, &paddr, 1, 0)) {
+			sisa->cpu.status = SISA_CPU_STATUS_NOP;
+			break;
+		}
+
+		sisa->cpu.ir = sisa->memory[paddr + 1] << 8 | sisa->memory[paddr];
+		sisa->cpu.status = SISA_CPU_STATUS_DEMW;
+		CACHE_ACCESS(sisa->icache, paddr, 0);
+		COST_ADD(fetch);
+		HEATMAP_COUNT(fetches, paddr);
+		/* For coverage and fusing */
+		sisa->fetch_paddr = paddr;
+
+		if (EXEC_INSTR && sisa->coverage)
+			COVERAGE_SET(sisa->coverage->executed, paddr);
+		break;
+	}
+	case SISA_CPU_STATUS_DEMW:
+		EXEC_FN(sisa_demw_execute)(sisa);
+		sisa->cpu.pc += 2;
+		if (sisa->cpu.exc_happened) {
+			sisa->cpu.status = SISA_CPU_STATUS_SYSTEM;
+			break;
+		}
+
+		STAT_INC(instructions);
+		COST_ADD(instr[INSTR_OPCODE(sisa->cpu.ir)][sisa_function_bits(sisa->cpu.ir)]);
+
+		if (sisa->cpu.regfile.system.psw.i && sisa->cpu.ints_pending) {
+			STAT_INC(interrupts[ffs(sisa->cpu.ints_pending) - 1]);
+			sisa->cpu.exception = SISA_EXCEPTION_INTERRUPT;
+			sisa->cpu.exc_happened = 1;
+			sisa->cpu.status = SISA_CPU_STATUS_SYSTEM;
+			break;
+		}
+		sisa->cpu.status = SISA_CPU_STATUS_FETCH;
+		break;
+	case SISA_CPU_STATUS_STALL:
+		if (--sisa->cpu.stall == 0)
+			sisa->cpu.status = sisa->cpu.stall_status;
+		break;
+	case SISA_CPU_STATUS_NOP:
+		sisa->cpu.status = SISA_CPU_STATUS_SYSTEM;
+		break;
+	case SISA_CPU_STATUS_SYSTEM:
+		STAT_INC(exceptions[sisa->cpu.exception]);
+		COST_ADD(exceptions[sisa->cpu.exception]);
+		if (sisa->callbacks.exception &&
+		    sisa->callbacks.exception(sisa, sisa->cpu.exception, sisa->callbacks.arg))
+			sisa->stop_requested = 1;
+		sisa->cpu.regfile.system.s0 = sisa->cpu.regfile.system.s7;
+		sisa->cpu.regfile.system.s1 = sisa->cpu.pc;
+		sisa->cpu.regfile.system.s2 = sisa->cpu.exception;
+		sisa->cpu.pc = sisa->cpu.regfile.system.s5;
+		sisa->cpu.regfile.system.psw.i = 0;
+		sisa->cpu.regfile.system.psw.m = SISA_CPU_MODE_SYSTEM;
+		sisa->cpu.in_exception = 1;
+		sisa->cpu.status = SISA_CPU_STATUS_FETCH;
+		/* Is this the best place to clear the exception flag? */
+		sisa->cpu.exc_happened = 0;
+		break;
+	}
+
+	/* Cache misses delay whatever comes after the cycle that had them */
+	if (EXEC_INSTR && sisa->cpu.stall && sisa->cpu.status != SISA_CPU_STATUS_STALL) {
+		sisa->cpu.stall_status = sisa->cpu.status;
+		sisa->cpu.status = SISA_CPU_STATUS_STALL;
+	}
+
+	sisa->cpu.cycles++;
+	STAT_INC(cycles);
+
+	/* Timer interrupt generator */
+	if (sisa->cpu.cycles % (SISA_CPU_CLK_FREQ / SISA_TIMER_FREQ) == 0) {
+		sisa->cpu.ints_pending |= BIT(SISA_INTERRUPT_TIMER);
+	}
+
+	/* Update milliseconds counter */
+	if (sisa->cpu.cycles % (SISA_CPU_CLK_FREQ / 1000) == 0 &&
+	    sisa->io_ports[SISA_IO_PORT_MILLIS_COUNTER] > 0) {
+		sisa->io_ports[SISA_IO_PORT_MILLIS_COUNTER]--;
+	}
+
+	/* Update pseudorandom number (cycles) */
+	sisa->io_ports[SISA_IO_PORT_CYCLES] = (uint16_t)sisa->cpu.cycles;
+}
+
+/*
+ * Superinstructions: MOVI+MOVHI on the same register, ADDI+BZ/BNZ and
+ * CMPxx+BZ/BNZ. Once the first one has been fetched, the rest of the pair
+ * (its DEMW, the second fetch and DEMW) runs as one 3 cycle step. Neither
+ * can raise an exception once fetched, so a pair is only split by what
+ * happens between the instructions: timer and millisecond ticks, pending
+ * interrupts and breakpoints. Any of those, or coverage, a cache, a cost
+ * model or a heatmap being in use, leaves the pair to the cycle by cycle
+ * path. Only sisa_run() fuses, sisa_step_cycle() callers like sisa-emu's
+ * interactive loop see every cycle.
+ *
+ * Whether the word fetched starts a pair is worked out once per even
+ * physical address and kept in fuse_pairs until a write changes either
+ * word. Fetches from odd addresses, possible with the TLB disabled, read a
+ * different instruction than the even address's and are never fused. The
+ * second instruction must be in the same page, where its fetch can't
+ * fault after the first one's didn't. Returns whether a pair was executed.
+ */
+static int EXEC_FN(sisa_run_fused)(struct sisa_context *sisa, uint64_t end)
+{
+	uint16_t paddr = sisa->fetch_paddr;
+	uint16_t instr = sisa->cpu.ir;
+	uint16_t next, pc;
+	uint8_t *pair = &sisa->fuse_pairs[paddr >> 1];
+
+	if ((paddr & 1) || *pair == FUSE_NONE)
+		return 0;
+
+	if (*pair == FUSE_UNKNOWN) {
+		if ((paddr & (SISA_PAGE_SIZE - 1)) == SISA_PAGE_SIZE - 2 ||
+		    !sisa_fuse_match(instr, sisa->memory[paddr + 3] << 8 | sisa->memory[paddr + 2])) {
+			*pair = FUSE_NONE;
+			return 0;
+		}
+		*pair = FUSE_PAIR;
+	}
+
+	if (sisa->cpu.cycles + 3 > end ||
+	    sisa->cpu.cycles % (SISA_CPU_CLK_FREQ / 1000) + 3 >= SISA_CPU_CLK_FREQ / 1000 ||
+	    (sisa->cpu.regfile.system.psw.i && sisa->cpu.ints_pending) ||
+	    (EXEC_INSTR && (sisa->breakpoint_num || sisa->coverage ||
+			    sisa->icache || sisa->dcache || sisa->cost || sisa->heatmap)))
+		return 0;
+
+	next = sisa->memory[paddr + 3] << 8 | sisa->memory[paddr + 2];
+
+	switch (INSTR_OPCODE(instr)) {
+	case SISA_OPCODE_MOV:
+		/* MOVHI keeps the low byte MOVI wrote */
+		REGS[INSTR_Rd(instr)] = INSTR_IMM8(next) << 8 | INSTR_IMM8(instr);
+		break;
+	case SISA_OPCODE_ADDI:
+		REGS[INSTR_Rd(instr)] = REGS[INSTR_Ra_6(instr)] + SEXT_6(X_DOWNTO_Y(instr, 5, 0));
+		break;
+	default:
+		EXEC_FN(sisa_demw_execute)(sisa);
+		break;
+	}
+
+	pc = sisa->cpu.pc + 4;
+	if (INSTR_OPCODE(next) == SISA_OPCODE_RELATIVE_JUMP && sisa_relative_jump_taken(sisa, next))
+		pc += (int8_t)INSTR_IMM8(next) << 1;
+
+	sisa->cpu.ir = next;
+	sisa->cpu.pc = pc;
+	sisa->cpu.status = SISA_CPU_STATUS_FETCH;
+	sisa->cpu.cycles += 3;
+	sisa->io_ports[SISA_IO_PORT_CYCLES] = (uint16_t)sisa->cpu.cycles;
+	sisa->fetch_paddr = paddr + 2;
+
+#ifdef SISA_STATS
+	sisa->stats.instructions += 2;
+	sisa->stats.cycles += 3;
+	if (EXEC_TLB)
+		sisa->stats.itlb_accesses++;
+#endif
+
+	return 1;
+}
+
+/* Runs until the cycle budget ends, something stops it or the variant changes */
+static int EXEC_FN(sisa_run)(struct sisa_context *sisa, uint64_t end)
+{
+	while (sisa->cpu.cycles < end) {
+		if (sisa->exec_variant != EXEC_VARIANT)
+			return SISA_RUN_VARIANT_CHANGED;
+
+		if (sisa->cpu.halted)
+			return SISA_STOP_HALT;
+
+		EXEC_FN(sisa_step_cycle)(sisa);
+
+		if (sisa->stop_requested)
+			return SISA_STOP_CALLBACK;
+
+		/* A fused pair leaves the CPU at the next fetch, like the last cycle did */
+		if (sisa->cpu.status == SISA_CPU_STATUS_DEMW && EXEC_FN(sisa_run_fused)(sisa, end))
+			continue;
+
+		if (EXEC_INSTR && sisa->breakpoint_num && sisa_breakpoint_reached(sisa)) {
+			if (!sisa->callbacks.breakpoint ||
+			    sisa->callbacks.breakpoint(sisa, sisa->cpu.pc, sisa->callbacks.arg))
+				return SISA_STOP_BREAKPOINT;
+		}
+	}
+
+	return sisa->cpu.halted ? SISA_STOP_HALT : SISA_STOP_CYCLES;
+}
+
+#undef EXEC_TLB_ACCESS
+#undef EXEC_INSTR
+#undef EXEC_TLB
+#undef EXEC_FN
+#undef EXEC_VARIANT
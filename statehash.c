@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "statehash.h"
+#include "util.h"
+
+uint64_t sisa_fnv_bytes(uint64_t h, const uint8_t *data, size_t size)
+{
+	while (size--) {
+		h ^= *data++;
+		h *= SISA_FNV_PRIME;
+	}
+
+	return h;
+}
+
+static uint64_t fnv_u16(uint64_t h, uint16_t value)
+{
+	uint8_t bytes[2] = { value & 0xFF, value >> 8 };
+
+	return sisa_fnv_bytes(h, bytes, sizeof(bytes));
+}
+
+static uint64_t fnv_u64(uint64_t h, uint64_t value)
+{
+	uint8_t bytes[8];
+	int i;
+
+	for (i = 0; i < 8; i++)
+		bytes[i] = value >> (i * 8);
+
+	return sisa_fnv_bytes(h, bytes, sizeof(bytes));
+}
+
+static uint64_t hash_tlb(uint64_t h, const struct sisa_tlb *tlb)
+{
+	int i;
+
+	for (i = 0; i < SISA_NUM_TLB_ENTRIES; i++) {
+		h = fnv_u16(h, tlb->entries[i].vpn | tlb->entries[i].pfn << 4 |
+			       tlb->entries[i].r << 8 | tlb->entries[i].v << 9 |
+			       tlb->entries[i].p << 10);
+	}
+
+	return h;
+}
+
+/* First multiple of the interval at or after the from cycle */
+static uint64_t first_record(const struct sisa_state_hash *hash)
+{
+	return (hash->from + hash->interval - 1) / hash->interval * hash->interval;
+}
+
+static void mark_dirty(struct sisa_context *sisa, uint16_t paddr, unsigned int size, void *arg)
+{
+	struct sisa_state_hash *hash = arg;
+
+	hash->dirty_pages |= 1 << (paddr >> SISA_PAGE_SHIFT);
+	hash->dirty_pages |= 1 << (((paddr + size - 1) >> SISA_PAGE_SHIFT) & 0xF);
+}
+
+int sisa_state_hash_init(struct sisa_state_hash *hash, struct sisa_context *sisa)
+{
+	memset(hash, 0, sizeof(*hash));
+	hash->sisa = sisa;
+	hash->dirty_pages = 0xFFFF;
+
+	hash->watch_id = sisa_write_watch_add(sisa, 0xFFFF, mark_dirty, hash);
+
+	return hash->watch_id >= 0;
+}
+
+int sisa_state_hash_reset(struct sisa_state_hash *hash)
+{
+	hash->dirty_pages = 0xFFFF;
+	hash->next_record = first_record(hash);
+
+	if (hash->log)
+		fprintf(hash->log, "# reset\n");
+
+	hash->watch_id = sisa_write_watch_add(hash->sisa, 0xFFFF, mark_dirty, hash);
+
+	return hash->watch_id >= 0;
+}
+
+void sisa_state_hash_destroy(struct sisa_state_hash *hash)
+{
+	sisa_state_hash_log_close(hash);
+	sisa_write_watch_remove(hash->sisa, hash->watch_id);
+	hash->watch_id = -1;
+}
+
+void sisa_state_hash_invalidate(struct sisa_state_hash *hash)
+{
+	hash->dirty_pages = 0xFFFF;
+}
+
+uint64_t sisa_state_hash_get(struct sisa_state_hash *hash)
+{
+	const struct sisa_context *sisa = hash->sisa;
+	uint64_t h = SISA_FNV_OFFSET_BASIS;
+	int i;
+
+	for (i = 0; i < SISA_STATE_HASH_NUM_PAGES; i++) {
+		if (hash->dirty_pages & (1 << i))
+			hash->page_hashes[i] = sisa_fnv_bytes(SISA_FNV_OFFSET_BASIS,
+							      sisa->memory + i * SISA_PAGE_SIZE,
+							      SISA_PAGE_SIZE);
+	}
+	hash->dirty_pages = 0;
+
+	for (i = 0; i < 8; i++)
+		h = fnv_u16(h, sisa->cpu.regfile.general.regs[i]);
+	/* PSW is S7 */
+	for (i = 0; i < 8; i++)
+		h = fnv_u16(h, sisa->cpu.regfile.system.regs[i]);
+	h = fnv_u16(h, sisa->cpu.pc);
+	h = fnv_u16(h, sisa->cpu.ir);
+	h = fnv_u16(h, sisa->cpu.status);
+	h = fnv_u16(h, sisa->cpu.exception);
+	h = fnv_u16(h, sisa->cpu.in_exception);
+	h = fnv_u16(h, sisa->cpu.stall);
+	h = fnv_u16(h, sisa->cpu.stall_status);
+	h = fnv_u16(h, sisa->cpu.ints_pending);
+	h = fnv_u16(h, sisa->cpu.kb_key_buffer);
+	h = fnv_u16(h, sisa->cpu.halted);
+
+	h = fnv_u16(h, sisa->tlb_enabled);
+	h = hash_tlb(h, &sisa->itlb);
+	h = hash_tlb(h, &sisa->dtlb);
+
+	for (i = 0; i < SISA_NUM_IO_PORTS; i++)
+		h = fnv_u16(h, sisa->io_ports[i]);
+
+	for (i = 0; i < SISA_STATE_HASH_NUM_PAGES; i++)
+		h = fnv_u64(h, hash->page_hashes[i]);
+
+	return h;
+}
+
+int sisa_state_hash_log_open(struct sisa_state_hash *hash, const char *file,
+			     uint64_t interval, uint64_t from, uint64_t to)
+{
+	if (!(hash->log = fopen(file, "w"))) {
+		printf("Error opening '%s': %s\n", file, strerror(errno));
+		return 0;
+	}
+
+	hash->interval = interval ? interval : SISA_STATE_HASH_DEFAULT_INTERVAL;
+	hash->from = from;
+	hash->to = to;
+	hash->next_record = first_record(hash);
+
+	fprintf(hash->log, "# sisa state hash log, every %llu cycles\n",
+		(unsigned long long)hash->interval);
+
+	return 1;
+}
+
+void sisa_state_hash_log_close(struct sisa_state_hash *hash)
+{
+	if (hash->log)
+		fclose(hash->log);
+	hash->log = NULL;
+}
+
+void sisa_state_hash_record(struct sisa_state_hash *hash)
+{
+	uint64_t cycles = hash->sisa->cpu.cycles;
+
+	if (!hash->log || cycles < hash->next_record || (hash->to && cycles > hash->to))
+		return;
+
+	fprintf(hash->log, "%llu %016llx\n", (unsigned long long)cycles,
+		(unsigned long long)sisa_state_hash_get(hash));
+
+	hash->next_record = (cycles / hash->interval + 1) * hash->interval;
+}
+
+uint64_t sisa_state_hash_next_record(const struct sisa_state_hash *hash)
+{
+	return hash->next_record;
+}
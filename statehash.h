@@ -0,0 +1,67 @@
+#ifndef STATEHASH_H
+#define STATEHASH_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "sisa.h"
+
+#define SISA_STATE_HASH_NUM_PAGES        (SISA_MEMORY_SIZE / SISA_PAGE_SIZE)
+#define SISA_STATE_HASH_DEFAULT_INTERVAL 1000000
+
+/*
+ * Incremental hash of the machine state: registers, PC, IR, PSW, the
+ * CPU status, exception and stall, pending interrupts and keys, TLBs and
+ * I/O ports are hashed directly and memory through per page hashes, only
+ * recomputed for the pages written since the last hash. Writes are
+ * tracked with a write watch, CPU stores and sisa_memory_written() ones
+ * alike, so the interpreter runs its instrumented copy while a hash is
+ * set up.
+ *
+ * Fields are hashed one by one as little endian values, never as raw
+ * structs, so the same state hashes the same on any host and build.
+ *
+ * A log gets a 'CYCLE HASH' line every interval cycles from the from
+ * cycle on, up to the to cycle (0 for no limit). See sisa-bisect for
+ * finding where two logs diverge.
+ */
+struct sisa_state_hash {
+	struct sisa_context *sisa;
+	int watch_id;
+	uint16_t dirty_pages;
+	uint64_t page_hashes[SISA_STATE_HASH_NUM_PAGES];
+	FILE *log;
+	uint64_t interval;
+	uint64_t from;
+	uint64_t to;
+	uint64_t next_record;
+};
+
+/* Fails if there's no write watch slot left */
+int sisa_state_hash_init(struct sisa_state_hash *hash, struct sisa_context *sisa);
+void sisa_state_hash_destroy(struct sisa_state_hash *hash);
+
+/*
+ * Memory changes the write watch doesn't see, like snapshot restores and
+ * loads, need all the pages rehashed.
+ */
+void sisa_state_hash_invalidate(struct sisa_state_hash *hash);
+
+/* After sisa_init(), which drops the write watch. The log starts over */
+int sisa_state_hash_reset(struct sisa_state_hash *hash);
+
+uint64_t sisa_state_hash_get(struct sisa_state_hash *hash);
+
+/* Prints why on errors */
+int sisa_state_hash_log_open(struct sisa_state_hash *hash, const char *file,
+			     uint64_t interval, uint64_t from, uint64_t to);
+void sisa_state_hash_log_close(struct sisa_state_hash *hash);
+
+/*
+ * Writes a log line if the next record cycle has been reached. Callers
+ * running more than a cycle at a time should stop at
+ * sisa_state_hash_next_record() so the logs of different engines line up.
+ */
+void sisa_state_hash_record(struct sisa_state_hash *hash);
+uint64_t sisa_state_hash_next_record(const struct sisa_state_hash *hash);
+
+#endif
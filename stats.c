@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "stats.h"
+
+static const char *exception_names[SISA_NUM_EXCEPTIONS] = {
+	[SISA_EXCEPTION_ILLEGAL_INSTR]    = "illegal_instr",
+	[SISA_EXCEPTION_UNALIGNED_ACCESS] = "unaligned_access",
+	[SISA_EXCEPTION_DIVISION_BY_ZERO] = "division_by_zero",
+	[SISA_EXCEPTION_ITLB_MISS]        = "itlb_miss",
+	[SISA_EXCEPTION_DTLB_MISS]        = "dtlb_miss",
+	[SISA_EXCEPTION_ITLB_INVALID]     = "itlb_invalid",
+	[SISA_EXCEPTION_DTLB_INVALID]     = "dtlb_invalid",
+	[SISA_EXCEPTION_ITLB_PROTECTED]   = "itlb_protected",
+	[SISA_EXCEPTION_DTLB_PROTECTED]   = "dtlb_protected",
+	[SISA_EXCEPTION_DTLB_READONLY]    = "dtlb_readonly",
+	[SISA_EXCEPTION_PROTECTED_INSTR]  = "protected_instr",
+	[SISA_EXCEPTION_CALLS]            = "calls",
+	[SISA_EXCEPTION_INTERRUPT]        = "interrupt",
+};
+
+static const char *interrupt_names[SISA_NUM_INTERRUPTS] = {
+	[SISA_INTERRUPT_TIMER]    = "timer",
+	[SISA_INTERRUPT_KEY]      = "key",
+	[SISA_INTERRUPT_SWITCH]   = "switch",
+	[SISA_INTERRUPT_KEYBOARD] = "keyboard",
+};
+
+const char *sisa_stats_exception_name(unsigned int exception)
+{
+	return exception < SISA_NUM_EXCEPTIONS ? exception_names[exception] : NULL;
+}
+
+void sisa_stats_dump_text(const struct sisa_stats *stats, FILE *fp)
+{
+	int i;
+
+	fprintf(fp, "instructions %llu\n", (unsigned long long)stats->instructions);
+	fprintf(fp, "cycles %llu\n", (unsigned long long)stats->cycles);
+	fprintf(fp, "itlb.accesses %llu\n", (unsigned long long)stats->itlb_accesses);
+	fprintf(fp, "dtlb.accesses %llu\n", (unsigned long long)stats->dtlb_accesses);
+
+	for (i = 0; i < SISA_NUM_EXCEPTIONS; i++) {
+		if (exception_names[i])
+			fprintf(fp, "exception.%s %llu\n", exception_names[i],
+				(unsigned long long)stats->exceptions[i]);
+	}
+
+	for (i = 0; i < SISA_NUM_INTERRUPTS; i++)
+		fprintf(fp, "interrupt.%s %llu\n", interrupt_names[i],
+			(unsigned long long)stats->interrupts[i]);
+
+	for (i = 0; i < SISA_NUM_IO_PORTS; i++) {
+		if (stats->io_in[i])
+			fprintf(fp, "io.in.%d %llu\n", i, (unsigned long long)stats->io_in[i]);
+	}
+
+	for (i = 0; i < SISA_NUM_IO_PORTS; i++) {
+		if (stats->io_out[i])
+			fprintf(fp, "io.out.%d %llu\n", i, (unsigned long long)stats->io_out[i]);
+	}
+
+	fprintf(fp, "halts %llu\n", (unsigned long long)stats->halts);
+	fprintf(fp, "breakpoint_hits %llu\n", (unsigned long long)stats->breakpoint_hits);
+}
+
+static void dump_json_ports(const uint64_t *counters, FILE *fp)
+{
+	int i;
+	const char *sep = "";
+
+	fputc('{', fp);
+
+	for (i = 0; i < SISA_NUM_IO_PORTS; i++) {
+		if (counters[i]) {
+			fprintf(fp, "%s\"%d\": %llu", sep, i, (unsigned long long)counters[i]);
+			sep = ", ";
+		}
+	}
+
+	fputc('}', fp);
+}
+
+void sisa_stats_dump_json(const struct sisa_stats *stats, FILE *fp)
+{
+	int i;
+	const char *sep = "";
+
+	fprintf(fp, "{\n");
+	fprintf(fp, "  \"instructions\": %llu,\n", (unsigned long long)stats->instructions);
+	fprintf(fp, "  \"cycles\": %llu,\n", (unsigned long long)stats->cycles);
+	fprintf(fp, "  \"itlb_accesses\": %llu,\n", (unsigned long long)stats->itlb_accesses);
+	fprintf(fp, "  \"dtlb_accesses\": %llu,\n", (unsigned long long)stats->dtlb_accesses);
+
+	fprintf(fp, "  \"exceptions\": {");
+	for (i = 0; i < SISA_NUM_EXCEPTIONS; i++) {
+		if (exception_names[i]) {
+			fprintf(fp, "%s\"%s\": %llu", sep, exception_names[i],
+				(unsigned long long)stats->exceptions[i]);
+			sep = ", ";
+		}
+	}
+	fprintf(fp, "},\n");
+
+	sep = "";
+	fprintf(fp, "  \"interrupts\": {");
+	for (i = 0; i < SISA_NUM_INTERRUPTS; i++) {
+		fprintf(fp, "%s\"%s\": %llu", sep, interrupt_names[i],
+			(unsigned long long)stats->interrupts[i]);
+		sep = ", ";
+	}
+	fprintf(fp, "},\n");
+
+	fprintf(fp, "  \"io_in\": ");
+	dump_json_ports(stats->io_in, fp);
+	fprintf(fp, ",\n  \"io_out\": ");
+	dump_json_ports(stats->io_out, fp);
+	fprintf(fp, ",\n");
+
+	fprintf(fp, "  \"halts\": %llu,\n", (unsigned long long)stats->halts);
+	fprintf(fp, "  \"breakpoint_hits\": %llu\n", (unsigned long long)stats->breakpoint_hits);
+	fprintf(fp, "}\n");
+}
+
+/* "-" is stdout; files ending in .json get JSON, anything else plain text */
+int sisa_stats_dump_file(const struct sisa_stats *stats, const char *file)
+{
+	FILE *fp;
+	const char *ext = strrchr(file, '.');
+	int json = ext != NULL && strcmp(ext + 1, "json") == 0;
+
+	if (strcmp(file, "-") == 0) {
+		sisa_stats_dump_text(stats, stdout);
+		return 1;
+	}
+
+	if (!(fp = fopen(file, "w"))) {
+		printf("Error opening '%s': %s\n", file, strerror(errno));
+		return 0;
+	}
+
+	if (json)
+		sisa_stats_dump_json(stats, fp);
+	else
+		sisa_stats_dump_text(stats, fp);
+
+	fclose(fp);
+
+	return 1;
+}
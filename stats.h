@@ -0,0 +1,19 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include "sisa.h"
+
+/*
+ * Both formats are stable: keys are never renamed or reordered, new
+ * counters are only ever appended. Per-port I/O counters are listed
+ * for the ports that were accessed at least once.
+ */
+void sisa_stats_dump_text(const struct sisa_stats *stats, FILE *fp);
+void sisa_stats_dump_json(const struct sisa_stats *stats, FILE *fp);
+int sisa_stats_dump_file(const struct sisa_stats *stats, const char *file);
+
+/* Name of an exception in the dumps, NULL for the unused numbers */
+const char *sisa_stats_exception_name(unsigned int exception);
+
+#endif
@@ -0,0 +1,570 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include "stimulus.h"
+
+#define MAX_LINE 1024
+
+#define VGA_ROW_ADDR(row) (SISA_VGA_START_ADDR + (row) * SISA_VGA_COLS * 2)
+
+static char *skip_spaces(char *p)
+{
+	while (isspace((unsigned char)*p))
+		p++;
+
+	return p;
+}
+
+/* Consumes word if it is the next one on the line */
+static int parse_word(char **p, const char *word)
+{
+	size_t len = strlen(word);
+	char *q = skip_spaces(*p);
+
+	if (strncmp(q, word, len) != 0 || (q[len] != '\0' && !isspace((unsigned char)q[len])))
+		return 0;
+
+	*p = q + len;
+
+	return 1;
+}
+
+static int parse_number(char **p, uint64_t *value, int base)
+{
+	char *q = skip_spaces(*p), *end;
+
+	if (!isxdigit((unsigned char)*q))
+		return 0;
+
+	*value = strtoull(q, &end, base);
+	if (end == q || (*end != '\0' && !isspace((unsigned char)*end)))
+		return 0;
+
+	*p = end;
+
+	return 1;
+}
+
+/* Unescapes a quoted, non empty string into a new buffer */
+static char *parse_string(char **p)
+{
+	char *q = skip_spaces(*p), *text, *out, *end;
+	unsigned long hex;
+
+	if (*q++ != '"')
+		return NULL;
+
+	if (!(text = malloc(strlen(q) + 1)))
+		return NULL;
+
+	for (out = text; *q && *q != '"'; q++) {
+		if (*q != '\\') {
+			*out++ = *q;
+			continue;
+		}
+
+		switch (*++q) {
+		case 'n':
+			*out++ = '\n';
+			break;
+		case 't':
+			*out++ = '\t';
+			break;
+		case '\\':
+		case '"':
+			*out++ = *q;
+			break;
+		case 'x':
+			hex = strtoul(q + 1, &end, 16);
+			if (end == q + 1 || end > q + 3 || hex == 0)
+				goto error;
+			*out++ = hex;
+			q = end - 1;
+			break;
+		default:
+			goto error;
+		}
+	}
+
+	if (*q != '"' || out == text)
+		goto error;
+
+	*out = '\0';
+	*p = q + 1;
+
+	return text;
+
+error:
+	free(text);
+	return NULL;
+}
+
+static int parse_action(struct sisa_stimulus_event *event, char *p)
+{
+	uint64_t value;
+
+	if (parse_word(&p, "key")) {
+		if (!parse_number(&p, &value, 10) || value >= SISA_NUM_KEYS)
+			return 0;
+		event->action = SISA_STIMULUS_KEY;
+		event->value = value;
+	} else if (parse_word(&p, "switch")) {
+		if (!parse_number(&p, &value, 10) || value >= SISA_NUM_SWITCHES)
+			return 0;
+		event->action = SISA_STIMULUS_SWITCH;
+		event->value = value;
+	} else if (parse_word(&p, "keyboard")) {
+		if (!parse_number(&p, &value, 16) || value > 0xFF)
+			return 0;
+		event->action = SISA_STIMULUS_KEYBOARD;
+		event->value = value;
+	} else if (parse_word(&p, "type")) {
+		if (!(event->text = parse_string(&p)))
+			return 0;
+		event->action = SISA_STIMULUS_TYPE;
+	} else if (parse_word(&p, "stop")) {
+		event->action = SISA_STIMULUS_STOP;
+	} else {
+		return 0;
+	}
+
+	return *skip_spaces(p) == '\0';
+}
+
+/* Finds the 'do' ending a condition, conditions never contain it as a word */
+static char *find_do(char *p)
+{
+	char *q;
+
+	for (q = p; (q = strstr(q, "do")); q += 2) {
+		if (q > p && isspace((unsigned char)q[-1]) &&
+		    (q[2] == '\0' || isspace((unsigned char)q[2])))
+			return q;
+	}
+
+	return NULL;
+}
+
+static int parse_event(struct sisa_stimulus_event *event, char *p)
+{
+	uint64_t value;
+	char *action, *end;
+
+	if (parse_word(&p, "at")) {
+		if (!parse_number(&p, &event->cycle, 10))
+			return 0;
+		event->trigger = SISA_STIMULUS_AT;
+		return parse_action(event, p);
+	}
+
+	if (!parse_word(&p, "when"))
+		return 0;
+
+	if (parse_word(&p, "vga")) {
+		if (!parse_number(&p, &value, 10) || value >= SISA_VGA_ROWS ||
+		    !parse_word(&p, "contains") || !(event->vga_text = parse_string(&p)) ||
+		    !parse_word(&p, "do"))
+			return 0;
+		event->trigger = SISA_STIMULUS_WHEN_VGA;
+		event->vga_row = value;
+		return parse_action(event, p);
+	}
+
+	if (!(action = find_do(p)))
+		return 0;
+
+	/* Trim the condition so errors quote it as written */
+	for (end = action; end > p && isspace((unsigned char)end[-1]); end--)
+		;
+	*end = '\0';
+
+	if (!sisa_cond_compile(&event->cond, skip_spaces(p)))
+		return 0;
+
+	event->trigger = SISA_STIMULUS_WHEN;
+
+	return parse_action(event, action + 2);
+}
+
+/* Cuts the line at a '#' outside of strings */
+static void strip_comment(char *line)
+{
+	int quoted = 0;
+	char *p;
+
+	for (p = line; *p; p++) {
+		if (quoted && *p == '\\' && p[1])
+			p++;
+		else if (*p == '"')
+			quoted = !quoted;
+		else if (!quoted && *p == '#')
+			break;
+	}
+
+	*p = '\0';
+}
+
+static void event_free(struct sisa_stimulus_event *event)
+{
+	if (event->trigger == SISA_STIMULUS_WHEN)
+		sisa_cond_free(&event->cond);
+	free(event->vga_text);
+	free(event->text);
+}
+
+int sisa_stimulus_load_file(struct sisa_stimulus *stimulus, const char *file)
+{
+	FILE *fp;
+	char line[MAX_LINE];
+	unsigned int line_num = 0;
+	struct sisa_stimulus_event *events, *event;
+
+	memset(stimulus, 0, sizeof(*stimulus));
+	stimulus->watch_id = -1;
+	stimulus->next_cycle = UINT64_MAX;
+
+	if (!(fp = fopen(file, "r"))) {
+		printf("Error opening '%s': %s\n", file, strerror(errno));
+		return 0;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		line_num++;
+
+		strip_comment(line);
+		if (*skip_spaces(line) == '\0')
+			continue;
+
+		events = realloc(stimulus->events, (stimulus->num_events + 1) * sizeof(*events));
+		if (!events)
+			goto error;
+		stimulus->events = events;
+
+		event = &stimulus->events[stimulus->num_events];
+		memset(event, 0, sizeof(*event));
+
+		if (!parse_event(event, line)) {
+			event_free(event);
+			goto error;
+		}
+
+		stimulus->num_events++;
+	}
+
+	fclose(fp);
+
+	return 1;
+
+error:
+	printf("%s:%u: invalid event\n", file, line_num);
+	fclose(fp);
+	sisa_stimulus_free(stimulus);
+
+	return 0;
+}
+
+void sisa_stimulus_free(struct sisa_stimulus *stimulus)
+{
+	unsigned int i;
+
+	for (i = 0; i < stimulus->num_events; i++)
+		event_free(&stimulus->events[i]);
+
+	free(stimulus->events);
+	stimulus->events = NULL;
+	stimulus->num_events = 0;
+}
+
+static int vga_row_contains(const struct sisa_context *sisa, unsigned int row, const char *text)
+{
+	char line[SISA_VGA_COLS + 1];
+	unsigned int i;
+	char c;
+
+	/* Like sisa_print_vga_dump(), anything unprintable reads as a space */
+	for (i = 0; i < SISA_VGA_COLS; i++) {
+		c = sisa->memory[VGA_ROW_ADDR(row) + i * 2];
+		line[i] = isgraph((unsigned char)c) ? c : ' ';
+	}
+	line[i] = '\0';
+
+	return strstr(line, text) != NULL;
+}
+
+static void stimulus_update_next_cycle(struct sisa_stimulus *stimulus)
+{
+	unsigned int i;
+
+	stimulus->next_cycle = UINT64_MAX;
+
+	for (i = 0; i < stimulus->num_events; i++) {
+		const struct sisa_stimulus_event *event = &stimulus->events[i];
+
+		if (event->trigger == SISA_STIMULUS_AT && !event->fired &&
+		    event->cycle < stimulus->next_cycle)
+			stimulus->next_cycle = event->cycle;
+	}
+}
+
+static void stimulus_watch(struct sisa_context *sisa, uint16_t paddr, unsigned int size, void *arg)
+{
+	struct sisa_stimulus *stimulus = arg;
+	uint16_t pages = 1 << (paddr >> SISA_PAGE_SHIFT) |
+			 1 << (((paddr + size - 1) >> SISA_PAGE_SHIFT) & 0xF);
+	unsigned int i, row_addr;
+	int due = 0;
+
+	for (i = 0; i < stimulus->num_events; i++) {
+		struct sisa_stimulus_event *event = &stimulus->events[i];
+
+		if (event->fired || event->due)
+			continue;
+
+		if (event->trigger == SISA_STIMULUS_WHEN) {
+			if (!(event->cond.pages & pages) || !sisa_cond_eval(&event->cond, sisa))
+				continue;
+		} else if (event->trigger == SISA_STIMULUS_WHEN_VGA) {
+			row_addr = VGA_ROW_ADDR(event->vga_row);
+			if (paddr + size <= row_addr || paddr >= row_addr + SISA_VGA_COLS * 2 ||
+			    !vga_row_contains(sisa, event->vga_row, event->vga_text))
+				continue;
+		} else {
+			continue;
+		}
+
+		event->due = 1;
+		due = 1;
+	}
+
+	if (due) {
+		stimulus->pending = 1;
+		sisa_request_stop(sisa);
+	}
+}
+
+int sisa_stimulus_arm(struct sisa_stimulus *stimulus, struct sisa_context *sisa)
+{
+	uint16_t pages = 0;
+	unsigned int i, first, last;
+
+	stimulus->sisa = sisa;
+	stimulus->pending = 0;
+	stimulus->typing = NULL;
+	stimulus->stopped = 0;
+
+	for (i = 0; i < stimulus->num_events; i++) {
+		struct sisa_stimulus_event *event = &stimulus->events[i];
+
+		event->typed = 0;
+		event->due = 0;
+		event->fired = 0;
+
+		if (event->trigger == SISA_STIMULUS_WHEN) {
+			event->cond.hits = 0;
+			if (event->cond.has_pc)
+				sisa_add_breakpoint(sisa, event->cond.pc);
+			pages |= event->cond.pages;
+		} else if (event->trigger == SISA_STIMULUS_WHEN_VGA) {
+			first = VGA_ROW_ADDR(event->vga_row);
+			last = first + SISA_VGA_COLS * 2 - 1;
+			pages |= 1 << (first >> SISA_PAGE_SHIFT) | 1 << (last >> SISA_PAGE_SHIFT);
+		}
+	}
+
+	/*
+	 * Rearming after a reset, sisa_init() already dropped the watch of the
+	 * last run: forget its id rather than removing it, by now it may be the
+	 * state hash's or the --break-if one.
+	 */
+	stimulus->watch_id = -1;
+	if (pages && (stimulus->watch_id = sisa_write_watch_add(sisa, pages, stimulus_watch,
+								stimulus)) < 0)
+		return 0;
+
+	stimulus_update_next_cycle(stimulus);
+
+	return 1;
+}
+
+void sisa_stimulus_disarm(struct sisa_stimulus *stimulus)
+{
+	unsigned int i;
+
+	if (!stimulus->sisa)
+		return;
+
+	for (i = 0; i < stimulus->num_events; i++) {
+		const struct sisa_stimulus_event *event = &stimulus->events[i];
+
+		if (event->trigger == SISA_STIMULUS_WHEN && event->cond.has_pc)
+			sisa_remove_breakpoint(stimulus->sisa, event->cond.pc);
+	}
+
+	if (stimulus->watch_id >= 0)
+		sisa_write_watch_remove(stimulus->sisa, stimulus->watch_id);
+
+	stimulus->watch_id = -1;
+	stimulus->sisa = NULL;
+}
+
+int sisa_stimulus_breakpoint(struct sisa_context *sisa, uint16_t pc, void *arg)
+{
+	struct sisa_stimulus *stimulus = arg;
+	unsigned int i;
+	int due = 0;
+
+	for (i = 0; i < stimulus->num_events; i++) {
+		struct sisa_stimulus_event *event = &stimulus->events[i];
+
+		if (event->trigger == SISA_STIMULUS_WHEN && !event->fired && !event->due &&
+		    event->cond.has_pc && event->cond.pc == pc && sisa_cond_eval(&event->cond, sisa)) {
+			event->due = 1;
+			due = 1;
+		}
+	}
+
+	if (due)
+		stimulus->pending = 1;
+
+	return due;
+}
+
+void sisa_stimulus_out(struct sisa_context *sisa, uint8_t port, uint16_t value, void *arg)
+{
+	struct sisa_stimulus *stimulus = arg;
+	unsigned int i;
+	int due = 0;
+
+	for (i = 0; i < stimulus->num_events; i++) {
+		struct sisa_stimulus_event *event = &stimulus->events[i];
+
+		if (event->trigger == SISA_STIMULUS_WHEN && !event->fired && !event->due &&
+		    sisa_cond_watches_port(&event->cond, port) && sisa_cond_eval(&event->cond, sisa)) {
+			event->due = 1;
+			due = 1;
+		}
+	}
+
+	/* The guest took a key, there's room for the next one */
+	if (stimulus->typing && port == SISA_IO_PORT_KB_CLEAR_CHAR)
+		due = 1;
+
+	if (due) {
+		stimulus->pending = 1;
+		sisa_request_stop(sisa);
+	}
+}
+
+static void stimulus_input(struct sisa_stimulus *stimulus, enum sisa_stimulus_action action,
+			   uint8_t value)
+{
+	if (stimulus->input) {
+		stimulus->input(stimulus->sisa, action, value, stimulus->input_arg);
+		return;
+	}
+
+	switch (action) {
+	case SISA_STIMULUS_KEY:
+		sisa_key_toggle(stimulus->sisa, value);
+		break;
+	case SISA_STIMULUS_SWITCH:
+		sisa_switch_toggle(stimulus->sisa, value);
+		break;
+	case SISA_STIMULUS_KEYBOARD:
+		sisa_keyboard_press(stimulus->sisa, value);
+		break;
+	default:
+		break;
+	}
+}
+
+/* Types while the keyboard can take keys without losing one, in script order */
+static void stimulus_type(struct sisa_stimulus *stimulus)
+{
+	struct sisa_stimulus_event *event;
+	unsigned int i;
+
+	while (1) {
+		if (!stimulus->typing) {
+			for (i = 0; i < stimulus->num_events; i++) {
+				event = &stimulus->events[i];
+				if (event->action == SISA_STIMULUS_TYPE && event->fired &&
+				    event->text[event->typed]) {
+					stimulus->typing = event;
+					break;
+				}
+			}
+
+			if (!stimulus->typing)
+				return;
+		}
+
+		if (stimulus->sisa->cpu.kb_key_buffer)
+			return;
+
+		event = stimulus->typing;
+		stimulus_input(stimulus, SISA_STIMULUS_KEYBOARD, event->text[event->typed++]);
+		if (!event->text[event->typed])
+			stimulus->typing = NULL;
+	}
+}
+
+void sisa_stimulus_apply(struct sisa_stimulus *stimulus)
+{
+	unsigned int i;
+
+	if (!stimulus->pending && stimulus->sisa->cpu.cycles < stimulus->next_cycle)
+		return;
+
+	stimulus->pending = 0;
+
+	for (i = 0; i < stimulus->num_events; i++) {
+		struct sisa_stimulus_event *event = &stimulus->events[i];
+
+		if (event->fired)
+			continue;
+
+		if (!event->due && (event->trigger != SISA_STIMULUS_AT ||
+				    event->cycle > stimulus->sisa->cpu.cycles))
+			continue;
+
+		event->due = 0;
+		event->fired = 1;
+
+		if (event->action == SISA_STIMULUS_STOP)
+			stimulus->stopped = 1;
+		else if (event->action != SISA_STIMULUS_TYPE)
+			stimulus_input(stimulus, event->action, event->value);
+	}
+
+	stimulus_update_next_cycle(stimulus);
+	stimulus_type(stimulus);
+}
+
+enum sisa_stop_reason sisa_stimulus_run(struct sisa_stimulus *stimulus, uint64_t max_cycles)
+{
+	struct sisa_context *sisa = stimulus->sisa;
+	const uint64_t end = sisa->cpu.cycles + max_cycles;
+	struct sisa_callbacks callbacks = { 0 };
+	uint64_t until;
+
+	callbacks.breakpoint = sisa_stimulus_breakpoint;
+	callbacks.out = sisa_stimulus_out;
+	callbacks.arg = stimulus;
+	sisa_set_callbacks(sisa, &callbacks);
+
+	sisa_stimulus_apply(stimulus);
+
+	while (!sisa->cpu.halted && !stimulus->stopped && sisa->cpu.cycles < end) {
+		until = stimulus->next_cycle < end ? stimulus->next_cycle : end;
+		sisa_run(sisa, until - sisa->cpu.cycles);
+		sisa_stimulus_apply(stimulus);
+	}
+
+	if (stimulus->stopped)
+		return SISA_STOP_CALLBACK;
+
+	return sisa->cpu.halted ? SISA_STOP_HALT : SISA_STOP_CYCLES;
+}
@@ -0,0 +1,110 @@
+#ifndef STIMULUS_H
+#define STIMULUS_H
+
+#include <stdint.h>
+#include "sisa.h"
+#include "cond.h"
+
+/*
+ * Stimulus scripts drive the board inputs from events, one per line,
+ * '#' starts a comment:
+ *
+ *   at CYCLE ACTION                         when CYCLE is reached
+ *   when EXPR do ACTION                     when the condition EXPR is true
+ *                                           (see cond.h)
+ *   when vga ROW contains "TEXT" do ACTION  when VGA row ROW (0-29) shows TEXT
+ *
+ * and ACTION one of:
+ *
+ *   key N          toggles key N
+ *   switch N       toggles switch N
+ *   keyboard HEX   presses the keyboard key HEX
+ *   type "TEXT"    types TEXT, one key each time the guest reads the
+ *                  keyboard, with \n, \t, \\, \" and \xHH escapes
+ *   stop           ends the run
+ *
+ * CYCLE, N and ROW are decimal. Each event fires once, in script order
+ * when several are due together. Conditions are only checked at their
+ * checkpoints: their breakpoint, writes to the pages and OUTs to the
+ * ports they read, and writes to the VGA row for the text ones. Actions
+ * are applied between cycles by sisa_stimulus_apply().
+ */
+enum sisa_stimulus_trigger {
+	SISA_STIMULUS_AT,
+	SISA_STIMULUS_WHEN,
+	SISA_STIMULUS_WHEN_VGA,
+};
+
+enum sisa_stimulus_action {
+	SISA_STIMULUS_KEY,
+	SISA_STIMULUS_SWITCH,
+	SISA_STIMULUS_KEYBOARD,
+	SISA_STIMULUS_TYPE,
+	SISA_STIMULUS_STOP,
+};
+
+struct sisa_stimulus_event {
+	enum sisa_stimulus_trigger trigger;
+	uint64_t cycle;
+	struct sisa_cond cond;
+	unsigned int vga_row;
+	char *vga_text;
+	enum sisa_stimulus_action action;
+	uint8_t value;
+	char *text;
+	/* Keys of text already typed */
+	unsigned int typed;
+	int due;
+	int fired;
+};
+
+/*
+ * Inputs go through input when set, for callers that record them like
+ * reverse execution does, and straight to the context otherwise.
+ */
+typedef void (*sisa_stimulus_input_cb)(struct sisa_context *sisa, enum sisa_stimulus_action action,
+				       uint8_t value, void *arg);
+
+struct sisa_stimulus {
+	struct sisa_context *sisa;
+	struct sisa_stimulus_event *events;
+	unsigned int num_events;
+	int watch_id;
+	sisa_stimulus_input_cb input;
+	void *input_arg;
+	/* Set by the checkpoints for sisa_stimulus_apply() */
+	int pending;
+	/* Earliest at event left */
+	uint64_t next_cycle;
+	/* The type action in progress */
+	struct sisa_stimulus_event *typing;
+	/* A stop action ran */
+	int stopped;
+};
+
+/* Initializes stimulus from file, returns 0 and prints the offending line on errors */
+int sisa_stimulus_load_file(struct sisa_stimulus *stimulus, const char *file);
+void sisa_stimulus_free(struct sisa_stimulus *stimulus);
+
+/*
+ * Starts the script over on sisa, again after sisa_init(), which drops
+ * its breakpoints and write watch. Fails if there's no write watch left.
+ */
+int sisa_stimulus_arm(struct sisa_stimulus *stimulus, struct sisa_context *sisa);
+void sisa_stimulus_disarm(struct sisa_stimulus *stimulus);
+
+/* Checkpoints, usable as the breakpoint and out callbacks with the script as the argument */
+int sisa_stimulus_breakpoint(struct sisa_context *sisa, uint16_t pc, void *arg);
+void sisa_stimulus_out(struct sisa_context *sisa, uint8_t port, uint16_t value, void *arg);
+
+/* Fires the due events, cheap to call after every cycle */
+void sisa_stimulus_apply(struct sisa_stimulus *stimulus);
+
+/*
+ * Runs up to max_cycles with the script driving the inputs, like
+ * sisa_run() but replacing the context's callbacks. Returns
+ * SISA_STOP_CALLBACK after a stop action.
+ */
+enum sisa_stop_reason sisa_stimulus_run(struct sisa_stimulus *stimulus, uint64_t max_cycles);
+
+#endif
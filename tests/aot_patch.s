@@ -0,0 +1,29 @@
+; The loop is translated, patch is only reached through a jump to an
+; address loaded from memory and runs in the interpreter. Its store turns
+; MOVI R1, 1 into MOVI R1, 2, which the translated loop must pick up:
+; R5 ends as 1 + 2 + 2
+_start:
+	LI R2, target
+	MOVI R5, 0
+	MOVI R6, 3
+loop:
+	MOVI R1, 1
+	ADD R5, R5, R1
+	ADDI R6, R6, -1
+	BZ R6, done
+	LD R4, 0(R2)
+	JAL R7, R4
+	LI R3, loop
+	JMP R3
+
+patch:
+	LI R3, loop
+	; MOVI R1, 2
+	LI R1, 0x5202
+	ST 0(R3), R1
+	JMP R7
+
+done:
+	HALT
+
+target:	.word patch
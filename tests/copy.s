@@ -0,0 +1,18 @@
+; Copies four words from src to dst
+	.data
+src:	.word 0x1111, 0x2222, 0x3333, 0x4444
+dst:	.space 8
+
+	.text
+_start:
+	LI R1, src
+	LI R2, dst
+	MOVI R3, 4
+loop:
+	LD R4, 0(R1)
+	ST 0(R2), R4
+	ADDI R1, R1, 2
+	ADDI R2, R2, 2
+	ADDI R3, R3, -1
+	BNZ R3, loop
+	HALT
@@ -0,0 +1,14 @@
+; Runs a MOVI+MOVHI pair from its start, then jumps into the middle of it:
+; the word fetched from the odd address is a different instruction, not
+; the pair that starts at the even one
+_start:
+	LI R3, pair + 1
+	MOVI R5, 0
+pair:
+	MOVI R1, 0x34
+	MOVHI R1, 0x12
+	BNZ R5, done
+	MOVI R5, 1
+	JMP R3
+done:
+	HALT
@@ -0,0 +1,20 @@
+; Runs a CMPEQ+BZ pair, then a word store to the odd address before it
+; turns the CMPEQ into an illegal compare, which must raise an exception
+; rather than run as the pair it was
+_start:
+	LI R4, cmp - 1
+	; 0x56 keeps the MOVI R3, 1 before cmp, 0xD1 is CMPEQ with function 010
+	LI R6, 0xD156
+	MOVI R5, 0
+	MOVI R2, 1
+	MOVI R3, 1
+cmp:
+	CMPEQ R1, R2, R3
+	BZ R1, done
+	BNZ R5, done
+	MOVI R5, 1
+	ST 0(R4), R6
+	MOVI R7, 0
+	BZ R7, cmp
+done:
+	HALT
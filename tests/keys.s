@@ -0,0 +1,10 @@
+; Waits for a key and shows the pressed ones on the green LEDs,
+; the keys port reads 0 for the pressed keys
+_start:
+	IN R1, 7
+	NOT R1, R1
+	MOVI R2, 0x0F
+	AND R1, R1, R2
+	BZ R1, _start
+	OUT 5, R1
+	HALT
@@ -0,0 +1,9 @@
+; Adds up 1 to 100 into R1
+_start:
+	MOVI R1, 0
+	MOVI R2, 100
+loop:
+	ADD R1, R1, R2
+	ADDI R2, R2, -1
+	BNZ R2, loop
+	HALT
@@ -0,0 +1,928 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <getopt.h>
+#include <errno.h>
+#include "../sisa.h"
+#include "../loader.h"
+#include "../image.h"
+
+#define MAX_SEGMENTS  64
+#define MAX_ENTRIES   256
+#define MAX_BLOCK_LEN 64
+#define NUM_WORDS     (SISA_MEMORY_SIZE / 2)
+
+#define FIELD(instr, x, y) (((instr) >> (y)) & ((1 << ((x) - (y) + 1)) - 1))
+#define OPCODE(instr)      FIELD(instr, 15, 12)
+#define RD(instr)          FIELD(instr, 11, 9)
+#define RA(instr)          FIELD(instr, 8, 6)
+#define RB0(instr)         FIELD(instr, 2, 0)
+#define IMM6(instr)        ((int)(FIELD(instr, 5, 0) ^ 0x20) - 0x20)
+#define IMM8(instr)        FIELD(instr, 7, 0)
+
+static void usage(char *argv[])
+{
+	printf("Usage: %s [OPTIONS] -o <program.c> [code.bin] [data.bin]\n"
+		"       %s [OPTIONS] -o <program.c> <program.simg>\n\n"
+		"Translates a SISA program into C for sisa_aot_run() (see aot.h).\n\n"
+		"  -o, --output=FILE       C file to write\n"
+		"  -n, --name=NAME         name of the struct sisa_aot_program\n"
+		"                            (defaults to sisa_aot_program)\n"
+		"  -l, --load addr=ADDR,file=FILE loads FILE at ADDR\n"
+		"  -p, --pc-addr=ADDR      entry point (defaults to C000)\n"
+		"  -e, --entry=ADDR        also translates the code reachable from ADDR\n"
+		"  -t, --enable-tlb        enables the TLB when the program is loaded\n"
+		"  -h, --help              displays this help and exit\n"
+		"\nThe code and data files are loaded to C000 and 8000, like in sisa-emu.\n"
+		"Code is discovered from the entry points, following branches and the jump\n"
+		"targets built with MOVI/MOVHI/ADDI; anything else runs in the interpreter.\n"
+		"Build the output with -O2 against libsisa, -DSISA_AOT_MAIN adds a main()\n"
+		"that runs the program for the number of cycles given as argument, in the\n"
+		"interpreter alone with -i after them, and dumps the final state.\n"
+		, argv[0], argv[0]);
+}
+
+enum instr_kind {
+	KIND_SIMPLE,
+	KIND_BRANCH,
+	KIND_COND_JUMP,
+	KIND_JUMP,
+	KIND_CALL,
+	/* Left to the interpreter, ends the block before it */
+	KIND_FALLBACK,
+};
+
+/* Registers known to hold a constant, tracked within a block */
+struct consts {
+	uint8_t known;
+	uint16_t value[8];
+};
+
+struct translator {
+	const uint8_t *memory;
+	uint8_t loaded[NUM_WORDS];
+	uint8_t reached[NUM_WORDS];
+	uint8_t leader[NUM_WORDS];
+	uint8_t block[NUM_WORDS];
+	uint16_t worklist[NUM_WORDS];
+	unsigned int num_work;
+	uint8_t code_map[SISA_MEMORY_SIZE / 8];
+	unsigned int num_blocks;
+};
+
+static uint16_t fetch(const struct translator *t, uint16_t addr)
+{
+	return t->memory[addr + 1] << 8 | t->memory[addr];
+}
+
+static int in_image(const struct translator *t, uint32_t addr)
+{
+	return !(addr & 1) && addr < SISA_MEMORY_SIZE && t->loaded[addr / 2];
+}
+
+static enum instr_kind classify(uint16_t instr)
+{
+	switch (OPCODE(instr)) {
+	case SISA_OPCODE_COMPARE:
+		switch (FIELD(instr, 5, 3)) {
+		case SISA_INSTR_COMPARE_F_CMPLT:
+		case SISA_INSTR_COMPARE_F_CMPLE:
+		case SISA_INSTR_COMPARE_F_CMPEQ:
+		case SISA_INSTR_COMPARE_F_CMPLTU:
+		case SISA_INSTR_COMPARE_F_CMPLEU:
+			return KIND_SIMPLE;
+		}
+		return KIND_FALLBACK;
+	case SISA_OPCODE_MULT_DIV:
+		switch (FIELD(instr, 5, 3)) {
+		case SISA_INSTR_MULT_DIV_F_MUL:
+		case SISA_INSTR_MULT_DIV_F_MULH:
+		case SISA_INSTR_MULT_DIV_F_MULHU:
+		case SISA_INSTR_MULT_DIV_F_DIV:
+		case SISA_INSTR_MULT_DIV_F_DIVU:
+			return KIND_SIMPLE;
+		}
+		return KIND_FALLBACK;
+	case SISA_OPCODE_RELATIVE_JUMP:
+		return KIND_BRANCH;
+	case SISA_OPCODE_ABSOLUTE_JUMP:
+		switch (FIELD(instr, 2, 0)) {
+		case SISA_INSTR_ABSOLUTE_JUMP_F_JZ:
+		case SISA_INSTR_ABSOLUTE_JUMP_F_JNZ:
+			return KIND_COND_JUMP;
+		case SISA_INSTR_ABSOLUTE_JUMP_F_JMP:
+			return KIND_JUMP;
+		case SISA_INSTR_ABSOLUTE_JUMP_F_JAL:
+			return KIND_CALL;
+		}
+		/* CALLS included, it always raises an exception */
+		return KIND_FALLBACK;
+	case SISA_OPCODE_SPECIAL:
+		switch (FIELD(instr, 5, 0)) {
+		case SISA_INSTR_SPECIAL_F_EI:
+		case SISA_INSTR_SPECIAL_F_DI:
+		case SISA_INSTR_SPECIAL_F_GETIID:
+		case SISA_INSTR_SPECIAL_F_RDS:
+		case SISA_INSTR_SPECIAL_F_FLUSH:
+			return KIND_SIMPLE;
+		}
+		/* Mode, PC, TLB and halt changes */
+		return KIND_FALLBACK;
+	case SISA_OPCODE_FLOAT_OP:
+	case SISA_OPCODE_LOAD_F:
+	case SISA_OPCODE_STORE_F:
+		return KIND_FALLBACK;
+	}
+
+	return KIND_SIMPLE;
+}
+
+static int writes_rd(uint16_t instr)
+{
+	switch (OPCODE(instr)) {
+	case SISA_OPCODE_STORE:
+	case SISA_OPCODE_STORE_BYTE:
+	case SISA_OPCODE_RELATIVE_JUMP:
+		return 0;
+	case SISA_OPCODE_IN_OUT:
+		return FIELD(instr, 8, 8) == SISA_INSTR_IN_OUT_F_IN;
+	case SISA_OPCODE_ABSOLUTE_JUMP:
+		return FIELD(instr, 2, 0) == SISA_INSTR_ABSOLUTE_JUMP_F_JAL;
+	case SISA_OPCODE_SPECIAL:
+		return FIELD(instr, 5, 0) == SISA_INSTR_SPECIAL_F_GETIID ||
+		       FIELD(instr, 5, 0) == SISA_INSTR_SPECIAL_F_RDS;
+	}
+
+	return 1;
+}
+
+static void consts_update(struct consts *c, uint16_t instr)
+{
+	int d = RD(instr), a = RA(instr);
+
+	switch (OPCODE(instr)) {
+	case SISA_OPCODE_MOV:
+		if (FIELD(instr, 8, 8) == SISA_INSTR_MOV_F_MOVI) {
+			c->known |= 1 << d;
+			c->value[d] = (int8_t)IMM8(instr);
+		} else {
+			c->value[d] = IMM8(instr) << 8 | (c->value[d] & 0xFF);
+		}
+		return;
+	case SISA_OPCODE_ADDI:
+		if (c->known & (1 << a)) {
+			c->known |= 1 << d;
+			c->value[d] = c->value[a] + IMM6(instr);
+		} else {
+			c->known &= ~(1 << d);
+		}
+		return;
+	}
+
+	if (writes_rd(instr))
+		c->known &= ~(1 << d);
+}
+
+static void add_leader(struct translator *t, uint32_t addr)
+{
+	if (!in_image(t, addr) || t->leader[addr / 2])
+		return;
+
+	t->leader[addr / 2] = 1;
+	t->worklist[t->num_work++] = addr;
+}
+
+/* Marks every instruction reachable from the leaders and finds the block leaders */
+static void discover(struct translator *t)
+{
+	struct consts c;
+	uint16_t addr, instr;
+	enum instr_kind kind;
+
+	while (t->num_work) {
+		addr = t->worklist[--t->num_work];
+		c.known = 0;
+
+		while (in_image(t, addr) && !t->reached[addr / 2]) {
+			t->reached[addr / 2] = 1;
+			instr = fetch(t, addr);
+			kind = classify(instr);
+
+			/* Exception handler addresses go to S5 through WRS */
+			if (kind == KIND_FALLBACK && OPCODE(instr) == SISA_OPCODE_SPECIAL &&
+			    FIELD(instr, 5, 0) == SISA_INSTR_SPECIAL_F_WRS && (c.known & (1 << RA(instr))))
+				add_leader(t, c.value[RA(instr)]);
+
+			if (kind == KIND_BRANCH)
+				add_leader(t, (uint16_t)(addr + 2 + ((int8_t)IMM8(instr) << 1)));
+			else if (kind != KIND_SIMPLE && kind != KIND_FALLBACK &&
+				 (c.known & (1 << RA(instr))))
+				add_leader(t, c.value[RA(instr)]);
+
+			if (kind != KIND_SIMPLE) {
+				if (kind != KIND_JUMP)
+					add_leader(t, addr + 2);
+				break;
+			}
+
+			consts_update(&c, instr);
+			addr += 2;
+		}
+	}
+}
+
+/* Number of instructions in the block at addr */
+static unsigned int block_length(const struct translator *t, uint16_t addr)
+{
+	unsigned int n = 0;
+	uint32_t a = addr;
+	enum instr_kind kind;
+
+	for (;;) {
+		kind = classify(fetch(t, a));
+		if (kind == KIND_FALLBACK)
+			break;
+
+		n++;
+		if (kind != KIND_SIMPLE || n == MAX_BLOCK_LEN)
+			break;
+
+		a += 2;
+		if (!in_image(t, a) || !t->reached[a / 2] || t->leader[a / 2])
+			break;
+	}
+
+	return n;
+}
+
+/* Leaders that start with a translatable instruction get a block */
+static void find_blocks(struct translator *t)
+{
+	uint32_t addr, next;
+	unsigned int len;
+
+	for (addr = 0; addr < SISA_MEMORY_SIZE; addr += 2) {
+		if (!t->leader[addr / 2] || !t->reached[addr / 2] ||
+		    classify(fetch(t, addr)) == KIND_FALLBACK)
+			continue;
+
+		t->block[addr / 2] = 1;
+		t->num_blocks++;
+
+		/* Blocks cut at the maximum length go on in a new one */
+		len = block_length(t, addr);
+		next = addr + 2 * len;
+		if (len == MAX_BLOCK_LEN && classify(fetch(t, next - 2)) == KIND_SIMPLE &&
+		    in_image(t, next) && t->reached[next / 2])
+			t->leader[next / 2] = 1;
+	}
+}
+
+static void emit_goto(const struct translator *t, FILE *fp, const char *indent, uint32_t target)
+{
+	target &= 0xFFFF;
+
+	if (!(target & 1) && t->block[target / 2])
+		fprintf(fp, "%sgoto b_%04X;\n", indent, target);
+	else
+		fprintf(fp, "%scpu->pc = 0x%04X;\n%sgoto out;\n", indent, target, indent);
+}
+
+/* Indirect jumps to constant targets are direct, the rest go through dispatch */
+static void emit_jump(const struct translator *t, FILE *fp, const char *indent,
+		      const struct consts *c, int reg)
+{
+	if (c->known & (1 << reg)) {
+		emit_goto(t, fp, indent, c->value[reg]);
+	} else {
+		fprintf(fp, "%scpu->pc = r%d;\n%sgoto dispatch;\n", indent, reg, indent);
+	}
+}
+
+static const char *const alu_ops[] = { "&", "|", "^", NULL, "+", "-" };
+
+/* Emits instruction n of a block, returns 0 if it ended the block */
+static int emit_instr(const struct translator *t, FILE *fp, uint16_t addr, unsigned int n,
+		      unsigned int len, const struct consts *c)
+{
+	const uint16_t instr = fetch(t, addr);
+	const int d = RD(instr), a = RA(instr), b = RB0(instr);
+	const unsigned int cycles = 2 * (n + 1), total = 2 * len;
+	const uint16_t next = addr + 2;
+
+	/* Dead stores to ir are removed by the compiler between calls */
+	fprintf(fp, "\t/* %04X */\n\tcpu->ir = 0x%04X;\n", addr, instr);
+
+	switch (OPCODE(instr)) {
+	case SISA_OPCODE_ARIT_LOGIC:
+		switch (FIELD(instr, 5, 3)) {
+		case SISA_INSTR_ARIT_LOGIC_F_NOT:
+			fprintf(fp, "\tr%d = ~r%d;\n", d, a);
+			break;
+		case SISA_INSTR_ARIT_LOGIC_F_SHA:
+			fprintf(fp, "\tr%d = sisa_aot_sha(r%d, r%d);\n", d, a, b);
+			break;
+		case SISA_INSTR_ARIT_LOGIC_F_SHL:
+			fprintf(fp, "\tr%d = sisa_aot_shl(r%d, r%d);\n", d, a, b);
+			break;
+		default:
+			fprintf(fp, "\tr%d = r%d %s r%d;\n", d, a, alu_ops[FIELD(instr, 5, 3)], b);
+			break;
+		}
+		break;
+	case SISA_OPCODE_COMPARE:
+		switch (FIELD(instr, 5, 3)) {
+		case SISA_INSTR_COMPARE_F_CMPLT:
+			fprintf(fp, "\tr%d = (int16_t)r%d < (int16_t)r%d;\n", d, a, b);
+			break;
+		case SISA_INSTR_COMPARE_F_CMPLE:
+			fprintf(fp, "\tr%d = (int16_t)r%d <= (int16_t)r%d;\n", d, a, b);
+			break;
+		case SISA_INSTR_COMPARE_F_CMPEQ:
+			fprintf(fp, "\tr%d = r%d == r%d;\n", d, a, b);
+			break;
+		case SISA_INSTR_COMPARE_F_CMPLTU:
+			fprintf(fp, "\tr%d = r%d < r%d;\n", d, a, b);
+			break;
+		case SISA_INSTR_COMPARE_F_CMPLEU:
+			fprintf(fp, "\tr%d = r%d <= r%d;\n", d, a, b);
+			break;
+		}
+		break;
+	case SISA_OPCODE_ADDI:
+		fprintf(fp, "\tr%d = r%d + %d;\n", d, a, IMM6(instr));
+		break;
+	case SISA_OPCODE_LOAD:
+	case SISA_OPCODE_LOAD_BYTE: {
+		int word = OPCODE(instr) == SISA_OPCODE_LOAD;
+
+		fprintf(fp, "\tif (!sisa_aot_dtlb(sisa, r%d + %d, &paddr, %d, 0))\n"
+			"\t\tEXCEPTION_EXIT(0x%04X, %u);\n", a, IMM6(instr) * (word ? 2 : 1), word,
+			next, cycles);
+		if (word)
+			fprintf(fp, "\tr%d = sisa->memory[paddr + 1] << 8 | sisa->memory[paddr];\n", d);
+		else
+			fprintf(fp, "\tr%d = (int8_t)sisa->memory[paddr];\n", d);
+		break;
+	}
+	case SISA_OPCODE_STORE:
+	case SISA_OPCODE_STORE_BYTE: {
+		int word = OPCODE(instr) == SISA_OPCODE_STORE;
+
+		/* The value register is in the Rd field */
+		fprintf(fp, "\tif (!sisa_aot_dtlb(sisa, r%d + %d, &paddr, %d, 1))\n"
+			"\t\tEXCEPTION_EXIT(0x%04X, %u);\n", a, IMM6(instr) * (word ? 2 : 1), word,
+			next, cycles);
+		fprintf(fp, "\tsisa->memory[paddr] = r%d & 0xFF;\n", d);
+		if (word)
+			fprintf(fp, "\tsisa->memory[paddr + 1] = r%d >> 8;\n", d);
+		fprintf(fp, "\tsisa_fuse_forget(sisa, paddr, %d);\n", word ? 2 : 1);
+		fprintf(fp, "\tif (CODE_WRITTEN(paddr)%s)\n"
+			"\t\tCODE_WRITTEN_EXIT(0x%04X, %u);\n",
+			word ? " || CODE_WRITTEN((uint16_t)(paddr + 1))" : "", next, cycles);
+		break;
+	}
+	case SISA_OPCODE_MOV:
+		if (FIELD(instr, 8, 8) == SISA_INSTR_MOV_F_MOVI)
+			fprintf(fp, "\tr%d = 0x%04X;\n", d, (uint16_t)(int8_t)IMM8(instr));
+		else
+			fprintf(fp, "\tr%d = 0x%02X00 | (r%d & 0xFF);\n", d, IMM8(instr), d);
+		break;
+	case SISA_OPCODE_RELATIVE_JUMP:
+		fprintf(fp, "\tcpu->cycles += %u;\n", total);
+		fprintf(fp, "\tif (r%d %s 0) {\n", d,
+			FIELD(instr, 8, 8) == SISA_INSTR_RELATIVE_JUMP_F_BZ ? "==" : "!=");
+		emit_goto(t, fp, "\t\t", next + ((int8_t)IMM8(instr) << 1));
+		fprintf(fp, "\t}\n");
+		emit_goto(t, fp, "\t", next);
+		return 0;
+	case SISA_OPCODE_IN_OUT:
+		if (FIELD(instr, 8, 8) == SISA_INSTR_IN_OUT_F_IN) {
+			/* The cycles port follows the counter, it is read after the fetch cycle */
+			if (IMM8(instr) == SISA_IO_PORT_CYCLES)
+				fprintf(fp, "\tr%d = cpu->cycles + %u;\n", d, cycles - 1);
+			else
+				fprintf(fp, "\tr%d = sisa->io_ports[%d];\n", d, IMM8(instr));
+		} else {
+			fprintf(fp, "\tsisa_cpu_out(sisa, %d, r%d);\n", IMM8(instr), d);
+			fprintf(fp, "\tINTERRUPT_CHECK(0x%04X, %u);\n", next, cycles);
+			fprintf(fp, "\tSTOP_CHECK(0x%04X, %u);\n", next, cycles);
+		}
+		break;
+	case SISA_OPCODE_MULT_DIV:
+		switch (FIELD(instr, 5, 3)) {
+		case SISA_INSTR_MULT_DIV_F_MUL:
+			fprintf(fp, "\tr%d = r%d * r%d;\n", d, a, b);
+			break;
+		case SISA_INSTR_MULT_DIV_F_MULH:
+			fprintf(fp, "\tr%d = ((int32_t)r%d * (int32_t)r%d) >> 16;\n", d, a, b);
+			break;
+		case SISA_INSTR_MULT_DIV_F_MULHU:
+			fprintf(fp, "\tr%d = ((uint32_t)r%d * (uint32_t)r%d) >> 16;\n", d, a, b);
+			break;
+		case SISA_INSTR_MULT_DIV_F_DIV:
+		case SISA_INSTR_MULT_DIV_F_DIVU:
+			fprintf(fp, "\tif (r%d == 0) {\n"
+				"\t\tcpu->exception = SISA_EXCEPTION_DIVISION_BY_ZERO;\n"
+				"\t\tcpu->exc_happened = 1;\n"
+				"\t\tEXCEPTION_EXIT(0x%04X, %u);\n"
+				"\t}\n", b, next, cycles);
+			if (FIELD(instr, 5, 3) == SISA_INSTR_MULT_DIV_F_DIV)
+				fprintf(fp, "\tr%d = (int16_t)r%d / (int16_t)r%d;\n", d, a, b);
+			else
+				fprintf(fp, "\tr%d = r%d / r%d;\n", d, a, b);
+			break;
+		}
+		break;
+	case SISA_OPCODE_ABSOLUTE_JUMP:
+		fprintf(fp, "\tcpu->cycles += %u;\n", total);
+		switch (FIELD(instr, 2, 0)) {
+		case SISA_INSTR_ABSOLUTE_JUMP_F_JZ:
+		case SISA_INSTR_ABSOLUTE_JUMP_F_JNZ:
+			fprintf(fp, "\tif (r%d %s 0) {\n", d,
+				FIELD(instr, 2, 0) == SISA_INSTR_ABSOLUTE_JUMP_F_JZ ? "==" : "!=");
+			emit_jump(t, fp, "\t\t", c, a);
+			fprintf(fp, "\t}\n");
+			emit_goto(t, fp, "\t", next);
+			break;
+		case SISA_INSTR_ABSOLUTE_JUMP_F_JMP:
+			emit_jump(t, fp, "\t", c, a);
+			break;
+		case SISA_INSTR_ABSOLUTE_JUMP_F_JAL:
+			/* The target is read before the link register is written */
+			if (c->known & (1 << a)) {
+				fprintf(fp, "\tr%d = 0x%04X;\n", d, next);
+				emit_goto(t, fp, "\t", c->value[a]);
+			} else {
+				fprintf(fp, "\tcpu->pc = r%d;\n\tr%d = 0x%04X;\n\tgoto dispatch;\n",
+					a, d, next);
+			}
+			break;
+		}
+		return 0;
+	case SISA_OPCODE_SPECIAL:
+		switch (FIELD(instr, 5, 0)) {
+		case SISA_INSTR_SPECIAL_F_EI:
+			fprintf(fp, "\tcpu->regfile.system.psw.i = 1;\n");
+			fprintf(fp, "\tINTERRUPT_CHECK(0x%04X, %u);\n", next, cycles);
+			break;
+		case SISA_INSTR_SPECIAL_F_DI:
+			fprintf(fp, "\tcpu->regfile.system.psw.i = 0;\n");
+			break;
+		case SISA_INSTR_SPECIAL_F_GETIID:
+			fprintf(fp, "\tif ((lsb = ffs(cpu->ints_pending))) {\n"
+				"\t\tcpu->ints_pending &= ~(1 << (lsb - 1));\n"
+				"\t\tr%d = lsb - 1;\n"
+				"\t} else {\n"
+				"\t\tr%d = 0;\n"
+				"\t}\n", d, d);
+			break;
+		case SISA_INSTR_SPECIAL_F_RDS:
+			fprintf(fp, "\tr%d = cpu->regfile.system.regs[%d];\n", d, a);
+			break;
+		case SISA_INSTR_SPECIAL_F_FLUSH:
+			break;
+		}
+		break;
+	}
+
+	return 1;
+}
+
+static void emit_block(struct translator *t, FILE *fp, uint16_t start)
+{
+	unsigned int i, len = block_length(t, start);
+	uint16_t addr = start, last = start + 2 * (len - 1);
+	struct consts c;
+
+	c.known = 0;
+
+	fprintf(fp, "b_%04X:\n\tENTER(0x%04X, 0x%04X, %u);\n", start, start, last, 2 * len);
+
+	for (i = 0; i < len; i++, addr += 2) {
+		t->code_map[addr >> 3] |= 3 << (addr & 7);
+
+		if (!emit_instr(t, fp, addr, i, len, &c))
+			return;
+
+		consts_update(&c, fetch(t, addr));
+	}
+
+	/* Fell through into the next block or an instruction left to the interpreter */
+	fprintf(fp, "\tcpu->cycles += %u;\n", 2 * len);
+	emit_goto(t, fp, "\t", addr);
+}
+
+static void emit_bytes(FILE *fp, const char *name, const uint8_t *data, size_t size)
+{
+	size_t i;
+
+	fprintf(fp, "static const uint8_t %s[] = {", name);
+	for (i = 0; i < size; i++)
+		fprintf(fp, "%s0x%02X,", i % 12 ? " " : "\n\t", data[i]);
+	fprintf(fp, "\n};\n\n");
+}
+
+static void emit_prologue(FILE *fp)
+{
+	fprintf(fp, "/* Generated by sisa-aot, do not edit */\n"
+		"#include <stdio.h>\n"
+		"#include <stdlib.h>\n"
+		"#include <string.h>\n"
+		"#include <strings.h>\n"
+		"#include \"aot.h\"\n\n"
+		"#define ENTER(start, last, n) \\\n"
+		"\tdo { \\\n"
+		"\t\tif (cpu->cycles + (n) > limit || \\\n"
+		"\t\t    (cpu->regfile.system.psw.i && cpu->ints_pending) || \\\n"
+		"\t\t    !sisa_aot_itlb_identity(sisa, start, last)) { \\\n"
+		"\t\t\tcpu->pc = (start); \\\n"
+		"\t\t\tgoto out; \\\n"
+		"\t\t} \\\n"
+		"\t} while (0)\n\n"
+		"/* Like the interpreter after a DEMW cycle that raised an exception */\n"
+		"#define EXCEPTION_EXIT(next_pc, n) \\\n"
+		"\tdo { \\\n"
+		"\t\tcpu->pc = (next_pc); \\\n"
+		"\t\tcpu->cycles += (n); \\\n"
+		"\t\tcpu->status = SISA_CPU_STATUS_SYSTEM; \\\n"
+		"\t\tgoto out; \\\n"
+		"\t} while (0)\n\n"
+		"#define INTERRUPT_CHECK(next_pc, n) \\\n"
+		"\tdo { \\\n"
+		"\t\tif (cpu->regfile.system.psw.i && cpu->ints_pending) { \\\n"
+		"\t\t\tcpu->exception = SISA_EXCEPTION_INTERRUPT; \\\n"
+		"\t\t\tcpu->exc_happened = 1; \\\n"
+		"\t\t\tEXCEPTION_EXIT(next_pc, n); \\\n"
+		"\t\t} \\\n"
+		"\t} while (0)\n\n"
+		"/* The OUT callback may have asked to stop after the cycle it ran in */\n"
+		"#define STOP_CHECK(next_pc, n) \\\n"
+		"\tdo { \\\n"
+		"\t\tif (sisa->stop_requested) { \\\n"
+		"\t\t\tcpu->pc = (next_pc); \\\n"
+		"\t\t\tcpu->cycles += (n); \\\n"
+		"\t\t\tgoto out; \\\n"
+		"\t\t} \\\n"
+		"\t} while (0)\n\n"
+		"#define CODE_WRITTEN(paddr) (code_map[(paddr) >> 3] & (1 << ((paddr) & 7)))\n\n"
+		"#define CODE_WRITTEN_EXIT(next_pc, n) \\\n"
+		"\tdo { \\\n"
+		"\t\tcpu->pc = (next_pc); \\\n"
+		"\t\tcpu->cycles += (n); \\\n"
+		"\t\tret = SISA_AOT_EXIT_CODE_WRITTEN; \\\n"
+		"\t\tgoto out; \\\n"
+		"\t} while (0)\n\n");
+}
+
+static void emit_run(struct translator *t, FILE *fp)
+{
+	uint32_t addr;
+	int i;
+
+	fprintf(fp, "static enum sisa_aot_exit run(struct sisa_context *sisa, uint64_t limit)\n"
+		"{\n"
+		"\tstruct sisa_cpu *cpu = &sisa->cpu;\n"
+		"\tenum sisa_aot_exit ret = SISA_AOT_EXIT_FALLBACK;\n"
+		"\tuint16_t paddr;\n"
+		"\tint lsb;\n");
+	for (i = 0; i < 8; i++)
+		fprintf(fp, "\tuint16_t r%d = cpu->regfile.general.r%d;\n", i, i);
+
+	fprintf(fp, "\n\t(void)paddr;\n\t(void)lsb;\n\n"
+		"dispatch: __attribute__((unused));\n"
+		"\tswitch (cpu->pc) {\n");
+	for (addr = 0; addr < SISA_MEMORY_SIZE; addr += 2) {
+		if (t->block[addr / 2])
+			fprintf(fp, "\tcase 0x%04X: goto b_%04X;\n", addr, addr);
+	}
+	fprintf(fp, "\t}\n\tgoto out;\n\n");
+
+	for (addr = 0; addr < SISA_MEMORY_SIZE; addr += 2) {
+		if (t->block[addr / 2]) {
+			emit_block(t, fp, addr);
+			fprintf(fp, "\n");
+		}
+	}
+
+	fprintf(fp, "out:\n");
+	for (i = 0; i < 8; i++)
+		fprintf(fp, "\tcpu->regfile.general.r%d = r%d;\n", i, i);
+	fprintf(fp, "\tsisa->io_ports[SISA_IO_PORT_CYCLES] = cpu->cycles;\n"
+		"\n\treturn ret;\n}\n\n");
+}
+
+/* Contiguous runs of translated bytes, checked against memory before running */
+static unsigned int emit_code_ranges(const struct translator *t, FILE *fp)
+{
+	uint32_t addr, start;
+	unsigned int num = 0;
+	char name[32];
+
+	for (addr = 0; addr < SISA_MEMORY_SIZE; ) {
+		if (!(t->code_map[addr >> 3] & (1 << (addr & 7)))) {
+			addr++;
+			continue;
+		}
+
+		for (start = addr; addr < SISA_MEMORY_SIZE &&
+		     (t->code_map[addr >> 3] & (1 << (addr & 7))); addr++)
+			;
+
+		snprintf(name, sizeof(name), "code_%04X", start);
+		emit_bytes(fp, name, t->memory + start, addr - start);
+		num++;
+	}
+
+	fprintf(fp, "static const struct sisa_aot_range code[] = {\n");
+	for (addr = 0; addr < SISA_MEMORY_SIZE; ) {
+		if (!(t->code_map[addr >> 3] & (1 << (addr & 7)))) {
+			addr++;
+			continue;
+		}
+
+		for (start = addr; addr < SISA_MEMORY_SIZE &&
+		     (t->code_map[addr >> 3] & (1 << (addr & 7))); addr++)
+			;
+
+		fprintf(fp, "\t{ 0x%04X, %u, code_%04X },\n", start, addr - start, start);
+	}
+	fprintf(fp, "};\n\n");
+
+	return num;
+}
+
+static void emit_program(struct translator *t, FILE *fp, const char *prog_name,
+			 const struct sisa_image_segment *segs, unsigned int num_segs,
+			 uint16_t entry_pc, int tlb_enabled)
+{
+	unsigned int i, num_code;
+	char name[32];
+
+	emit_prologue(fp);
+
+	/* Filled in while emitting the blocks, but needed by them */
+	fprintf(fp, "static const uint8_t code_map[%d] __attribute__((unused));\n\n",
+		SISA_MEMORY_SIZE / 8);
+	emit_run(t, fp);
+
+	fprintf(fp, "static const uint8_t code_map[%d] = {", SISA_MEMORY_SIZE / 8);
+	for (i = 0; i < SISA_MEMORY_SIZE / 8; i++) {
+		if (t->code_map[i])
+			fprintf(fp, "\n\t[0x%04X] = 0x%02X,", i, t->code_map[i]);
+	}
+	fprintf(fp, "\n};\n\n");
+
+	num_code = emit_code_ranges(t, fp);
+
+	for (i = 0; i < num_segs; i++) {
+		snprintf(name, sizeof(name), "segment_%u", i);
+		emit_bytes(fp, name, segs[i].data, segs[i].size);
+	}
+
+	fprintf(fp, "static const struct sisa_image_segment segments[] = {\n");
+	for (i = 0; i < num_segs; i++)
+		fprintf(fp, "\t{ 0x%04X, segment_%u, %zu },\n", segs[i].addr, i, segs[i].size);
+	fprintf(fp, "};\n\n");
+
+	fprintf(fp, "const struct sisa_aot_program %s = {\n"
+		"\t.run = run,\n"
+		"\t.code = code,\n"
+		"\t.num_code = %u,\n"
+		"\t.segments = segments,\n"
+		"\t.num_segments = %u,\n"
+		"\t.entry_pc = 0x%04X,\n"
+		"\t.tlb_enabled = %d,\n"
+		"\t.num_blocks = %u,\n"
+		"};\n\n", prog_name, num_code, num_segs, entry_pc, tlb_enabled, t->num_blocks);
+
+	fprintf(fp, "#ifdef SISA_AOT_MAIN\n"
+		"int main(int argc, char *argv[])\n"
+		"{\n"
+		"\tstatic struct sisa_context sisa;\n"
+		"\tuint64_t cycles = argc > 1 ? strtoull(argv[1], NULL, 0) : 100000000;\n"
+		"\tenum sisa_stop_reason reason;\n\n"
+		"\tsisa_init(&sisa);\n"
+		"\tsisa_aot_load(&sisa, &%s);\n"
+		"\t/* The interpreted run to compare the translated one against */\n"
+		"\tif (argc > 2 && strcmp(argv[2], \"-i\") == 0)\n"
+		"\t\treason = sisa_run(&sisa, cycles);\n"
+		"\telse\n"
+		"\t\treason = sisa_aot_run(&sisa, &%s, cycles);\n\n"
+		"\tprintf(\"%%s after %%llu cycles\\n\", reason == SISA_STOP_HALT ? \"Halted\" : \"Stopped\",\n"
+		"\t       (unsigned long long)sisa_get_cycles(&sisa));\n"
+		"\tsisa_print_dump(&sisa);\n"
+		"\tsisa_destroy(&sisa);\n\n"
+		"\treturn 0;\n"
+		"}\n"
+		"#endif\n", prog_name, prog_name);
+}
+
+struct aot_segment {
+	uint16_t addr;
+	const char *file;
+};
+
+enum load_subopt {
+	ADDR_OPT = 0,
+	FILE_OPT
+};
+
+static char *const load_subopt_token[] = {
+	[ADDR_OPT] = "addr",
+	[FILE_OPT] = "file",
+	NULL
+};
+
+static int parse_load_subopt(struct aot_segment *seg, char *optarg)
+{
+	char *value;
+	char *subopts = optarg;
+
+	seg->addr = 0;
+	seg->file = NULL;
+
+	while (*subopts != '\0') {
+		switch (getsubopt(&subopts, load_subopt_token, &value)) {
+		case ADDR_OPT:
+			if (!value)
+				return 0;
+
+			seg->addr = strtol(value, NULL, 16);
+			break;
+		case FILE_OPT:
+			if (!value)
+				return 0;
+
+			seg->file = value;
+			break;
+		default:
+			return 0;
+		}
+	}
+
+	return seg->file != NULL;
+}
+
+static int valid_name(const char *name)
+{
+	if (!isalpha((unsigned char)*name) && *name != '_')
+		return 0;
+
+	while (*++name) {
+		if (!isalnum((unsigned char)*name) && *name != '_')
+			return 0;
+	}
+
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	unsigned int i, num = 0, num_segs = 0, num_entries = 0;
+	long size;
+	const char *output = NULL, *name = "sisa_aot_program";
+	struct aot_segment segs[MAX_SEGMENTS];
+	struct sisa_image_segment image_segs[MAX_SEGMENTS];
+	uint16_t entries[MAX_ENTRIES];
+	uint16_t entry_pc = SISA_CODE_LOAD_ADDR;
+	int pc_set = 0, tlb_enabled = 0;
+	static struct sisa_context sisa;
+	static struct translator t;
+	struct sisa_image image;
+	FILE *fp;
+	uint32_t addr;
+
+	struct option long_options[] = {
+		{"output", required_argument, NULL, 'o'},
+		{"name", required_argument, NULL, 'n'},
+		{"load", required_argument, NULL, 'l'},
+		{"pc-addr", required_argument, NULL, 'p'},
+		{"entry", required_argument, NULL, 'e'},
+		{"enable-tlb", no_argument, NULL, 't'},
+		{"help", no_argument, NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+
+	sisa_init(&sisa);
+
+	while ((opt = getopt_long(argc, argv, "o:n:l:p:e:th", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'o':
+			output = optarg;
+			break;
+		case 'n':
+			if (!valid_name(optarg)) {
+				printf("Invalid name '%s'\n", optarg);
+				return -1;
+			}
+			name = optarg;
+			break;
+		case 'l':
+			if (num == MAX_SEGMENTS || !parse_load_subopt(&segs[num], optarg)) {
+				printf("Invalid segment '%s'\n", optarg);
+				return -1;
+			}
+			num++;
+			break;
+		case 'p':
+			entry_pc = strtol(optarg, NULL, 16);
+			pc_set = 1;
+			break;
+		case 'e':
+			if (num_entries == MAX_ENTRIES) {
+				printf("Too many entry points\n");
+				return -1;
+			}
+			entries[num_entries++] = strtol(optarg, NULL, 16);
+			break;
+		case 't':
+			tlb_enabled = 1;
+			break;
+		case 'h':
+		default:
+			usage(argv);
+			return -1;
+		}
+	}
+
+	if (!output || argc - optind > 2) {
+		usage(argv);
+		return -1;
+	}
+
+	/* An image brings its own segments, entry point and TLB enable */
+	if (optind < argc && strlen(argv[optind]) > 5 &&
+	    strcmp(argv[optind] + strlen(argv[optind]) - 5, ".simg") == 0) {
+		if (sisa_image_load(&sisa, argv[optind], &image) < 0) {
+			printf("Error loading '%s': %s\n", argv[optind], strerror(errno));
+			return -1;
+		}
+
+		for (i = 0; i < image.num_segments && num_segs < MAX_SEGMENTS; i++, num_segs++) {
+			image_segs[num_segs].addr = image.segments[i].addr;
+			image_segs[num_segs].size = image.segments[i].size;
+		}
+
+		if (!pc_set)
+			entry_pc = image.entry_pc;
+		tlb_enabled |= image.tlb_enabled;
+
+		sisa_image_free(&image);
+		optind++;
+	}
+
+	for (i = 0; optind < argc && num < MAX_SEGMENTS; optind++, i++) {
+		segs[num].addr = i == 0 ? SISA_CODE_LOAD_ADDR : SISA_DATA_LOAD_ADDR;
+		segs[num].file = argv[optind];
+		num++;
+	}
+
+	for (i = 0; i < num && num_segs < MAX_SEGMENTS; i++, num_segs++) {
+		if ((size = sisa_load_file(&sisa, segs[i].file, segs[i].addr)) < 0) {
+			printf("Error loading '%s': %s\n", segs[i].file, strerror(errno));
+			return -1;
+		}
+
+		image_segs[num_segs].addr = segs[i].addr;
+		image_segs[num_segs].size = size;
+	}
+
+	/* Overlapping segments all get the final contents */
+	for (i = 0; i < num_segs; i++) {
+		image_segs[i].data = sisa.memory + image_segs[i].addr;
+		for (addr = image_segs[i].addr & ~1; addr < image_segs[i].addr + image_segs[i].size;
+		     addr += 2)
+			t.loaded[addr / 2] = 1;
+	}
+
+	t.memory = sisa.memory;
+
+	add_leader(&t, entry_pc);
+	for (i = 0; i < num_entries; i++)
+		add_leader(&t, entries[i]);
+
+	discover(&t);
+	find_blocks(&t);
+
+	if (!(fp = fopen(output, "w"))) {
+		printf("Error opening '%s': %s\n", output, strerror(errno));
+		return -1;
+	}
+
+	emit_program(&t, fp, name, image_segs, num_segs, entry_pc, tlb_enabled);
+
+	if (fclose(fp) != 0) {
+		printf("Error writing '%s': %s\n", output, strerror(errno));
+		return -1;
+	}
+
+	printf("%u blocks translated\n", t.num_blocks);
+
+	sisa_destroy(&sisa);
+
+	return 0;
+}
@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <getopt.h>
+#include <errno.h>
+#include "../sisa.h"
+#include "../asm.h"
+#include "../image.h"
+
+static void usage(char *argv[])
+{
+	printf("Usage: %s [OPTIONS] -o <output> <source.s>\n\n"
+		"Assembles a SISA source file.\n\n"
+		"  -o, --output=FILE       file to write, the format depends on the extension:\n"
+		"                            .simg  image with both sections and the symbols\n"
+		"                            .bin   raw text section\n"
+		"                            other  text section as hex words, one per line\n"
+		"  -d, --data-output=FILE  writes the data section to FILE (.bin or hex)\n"
+		"  -T, --text-addr=ADDR    origin of the text section (defaults to C000)\n"
+		"  -D, --data-addr=ADDR    origin of the data section (defaults to 8000)\n"
+		"  -m, --map=FILE          writes the symbols as 'ADDR NAME' lines\n"
+		"  -h, --help              displays this help and exit\n"
+		"\nThe .simg entry point is the _start symbol if defined, the text origin otherwise.\n"
+		, argv[0]);
+}
+
+static int has_ext(const char *file, const char *ext)
+{
+	const char *dot = strrchr(file, '.');
+
+	return dot && strcasecmp(dot + 1, ext) == 0;
+}
+
+/* Sections are written from their origin, like the loaders expect them */
+static int write_section(const char *file, const uint8_t *memory,
+			 const struct sisa_asm_section *sec)
+{
+	FILE *fp;
+	uint32_t addr, end = sec->end > sec->origin ? sec->end : sec->origin;
+	int ok;
+
+	if (sec->start < sec->origin && sec->end > sec->start) {
+		printf("Error: '%s' would start below the section origin %04X\n", file,
+		       sec->origin);
+		return 0;
+	}
+
+	if (!(fp = fopen(file, "wb"))) {
+		printf("Error opening '%s': %s\n", file, strerror(errno));
+		return 0;
+	}
+
+	if (has_ext(file, "bin")) {
+		fwrite(memory + sec->origin, 1, end - sec->origin, fp);
+	} else {
+		for (addr = sec->origin; addr < end; addr += 2)
+			fprintf(fp, "%04X\n", memory[addr] | (addr + 1 < end ? memory[addr + 1] << 8 : 0));
+	}
+
+	ok = !ferror(fp);
+	ok = fclose(fp) == 0 && ok;
+	if (!ok)
+		printf("Error writing '%s': %s\n", file, strerror(errno));
+
+	return ok;
+}
+
+static int write_image(const char *file, const uint8_t *memory, const struct sisa_asm *as)
+{
+	struct sisa_image_segment segments[SISA_ASM_NUM_SECTIONS];
+	struct sisa_symbol *symbols;
+	static struct sisa_context sisa;
+	struct sisa_image image;
+	uint16_t entry;
+	unsigned int i;
+	int ok;
+
+	/* The image starts from the reset TLB, like sisa-pack */
+	sisa_init(&sisa);
+
+	memset(&image, 0, sizeof(image));
+	image.itlb = sisa.itlb;
+	image.dtlb = sisa.dtlb;
+
+	if (!sisa_asm_lookup(as, "_start", &entry))
+		entry = as->sections[SISA_ASM_SECTION_TEXT].origin;
+	image.entry_pc = entry;
+
+	for (i = 0; i < SISA_ASM_NUM_SECTIONS; i++) {
+		const struct sisa_asm_section *sec = &as->sections[i];
+
+		if (sec->end <= sec->start)
+			continue;
+
+		segments[image.num_segments].addr = sec->start;
+		segments[image.num_segments].data = memory + sec->start;
+		segments[image.num_segments].size = sec->end - sec->start;
+		image.num_segments++;
+	}
+	image.segments = segments;
+
+	if (!(symbols = calloc(as->num_symbols + 1, sizeof(*symbols)))) {
+		sisa_destroy(&sisa);
+		return 0;
+	}
+
+	for (i = 0; i < as->num_symbols; i++) {
+		symbols[i].addr = as->symbols[i].value;
+		symbols[i].name = as->symbols[i].name;
+	}
+	image.symbols = symbols;
+	image.num_symbols = as->num_symbols;
+
+	if (!(ok = sisa_image_write(file, &image)))
+		printf("Error writing '%s': %s\n", file, strerror(errno));
+
+	free(symbols);
+	sisa_destroy(&sisa);
+
+	return ok;
+}
+
+static int write_map(const char *file, const struct sisa_asm *as)
+{
+	FILE *fp;
+	unsigned int i;
+
+	if (!(fp = fopen(file, "w"))) {
+		printf("Error opening '%s': %s\n", file, strerror(errno));
+		return 0;
+	}
+
+	for (i = 0; i < as->num_symbols; i++)
+		fprintf(fp, "%04X %s\n", as->symbols[i].value, as->symbols[i].name);
+
+	return fclose(fp) == 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	const char *output = NULL, *data_output = NULL, *map = NULL;
+	uint16_t text_addr = SISA_CODE_LOAD_ADDR, data_addr = SISA_DATA_LOAD_ADDR;
+	static uint8_t memory[SISA_MEMORY_SIZE];
+	struct sisa_asm as;
+	int ret = 0;
+
+	struct option long_options[] = {
+		{"output", required_argument, NULL, 'o'},
+		{"data-output", required_argument, NULL, 'd'},
+		{"text-addr", required_argument, NULL, 'T'},
+		{"data-addr", required_argument, NULL, 'D'},
+		{"map", required_argument, NULL, 'm'},
+		{"help", no_argument, NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+
+	while ((opt = getopt_long(argc, argv, "o:d:T:D:m:h", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'o':
+			output = optarg;
+			break;
+		case 'd':
+			data_output = optarg;
+			break;
+		case 'T':
+			text_addr = strtol(optarg, NULL, 16);
+			break;
+		case 'D':
+			data_addr = strtol(optarg, NULL, 16);
+			break;
+		case 'm':
+			map = optarg;
+			break;
+		case 'h':
+		default:
+			usage(argv);
+			return -1;
+		}
+	}
+
+	if (!output || argc - optind != 1) {
+		usage(argv);
+		return -1;
+	}
+
+	sisa_asm_init(&as, text_addr, data_addr);
+
+	if (!sisa_asm_assemble_file(&as, argv[optind], memory)) {
+		if (as.line)
+			printf("%s:%u: %s\n", argv[optind], as.line, as.error);
+		else
+			printf("Error assembling '%s': %s\n", argv[optind], as.error);
+		sisa_asm_destroy(&as);
+		return -1;
+	}
+
+	if (has_ext(output, "simg")) {
+		if (!write_image(output, memory, &as))
+			ret = -1;
+	} else if (!write_section(output, memory, &as.sections[SISA_ASM_SECTION_TEXT])) {
+		ret = -1;
+	}
+
+	if (ret == 0 && data_output &&
+	    !write_section(data_output, memory, &as.sections[SISA_ASM_SECTION_DATA]))
+		ret = -1;
+
+	if (ret == 0 && map && !write_map(map, &as)) {
+		printf("Error writing '%s': %s\n", map, strerror(errno));
+		ret = -1;
+	}
+
+	sisa_asm_destroy(&as);
+
+	return ret;
+}
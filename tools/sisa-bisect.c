@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include <stdint.h>
+
+#define MAX_LINE 256
+
+struct hash_log {
+	const char *file;
+	FILE *fp;
+	unsigned int line_num;
+	unsigned int records;
+	uint64_t cycle;
+	uint64_t hash;
+	int restarted;
+};
+
+static void usage(char *argv[])
+{
+	printf("Usage: %s [OPTIONS] <a.log> <b.log>\n\n"
+		"Compares two state hash logs written by sisa-emu --hash-log and prints\n"
+		"the cycle window where the runs first diverge. Only the cycles present\n"
+		"in both logs are compared.\n\n"
+		"  -h, --help              displays this help and exit\n"
+		"\nExit status: 0 if the logs agree, 1 if they diverge, 2 on errors.\n"
+		"\nExample:\n"
+		"\t%s good.log bad.log\n"
+		"\nThe window can then be logged cycle by cycle on both sides with\n"
+		"--hash-log file=FILE,interval=1,from=START,to=END and compared again.\n"
+		, argv[0], argv[0]);
+}
+
+/* Returns 1 with the next record, 0 at the end and -1 on malformed lines */
+static int log_next(struct hash_log *log)
+{
+	char line[MAX_LINE];
+	char *p, *end;
+	uint64_t cycle;
+
+	if (log->restarted)
+		return 0;
+
+	while (fgets(line, sizeof(line), log->fp)) {
+		log->line_num++;
+
+		if ((p = strchr(line, '#')))
+			*p = '\0';
+
+		p = line + strspn(line, " \t\r\n");
+		if (*p == '\0')
+			continue;
+
+		cycle = strtoull(p, &end, 10);
+		if (end == p)
+			return -1;
+
+		p = end;
+		log->hash = strtoull(p, &end, 16);
+		if (end == p || end[strspn(end, " \t\r\n")] != '\0')
+			return -1;
+
+		/* A reset in sisa-emu starts the cycles over, only the first run is compared */
+		if (log->records && cycle < log->cycle) {
+			log->restarted = 1;
+			return 0;
+		}
+
+		log->cycle = cycle;
+		log->records++;
+
+		return 1;
+	}
+
+	return 0;
+}
+
+static int log_open(struct hash_log *log, const char *file)
+{
+	memset(log, 0, sizeof(*log));
+	log->file = file;
+
+	if (!(log->fp = fopen(file, "r"))) {
+		printf("Error opening '%s': %s\n", file, strerror(errno));
+		return 0;
+	}
+
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	struct hash_log a, b;
+	int ret_a, ret_b;
+	int matched = 0, status = 2;
+	uint64_t last_match = 0;
+	unsigned int common = 0;
+
+	struct option long_options[] = {
+		{"help", no_argument, NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+
+	while ((opt = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'h':
+		default:
+			usage(argv);
+			return 2;
+		}
+	}
+
+	if (argc - optind != 2) {
+		usage(argv);
+		return 2;
+	}
+
+	if (!log_open(&a, argv[optind]))
+		return 2;
+
+	if (!log_open(&b, argv[optind + 1])) {
+		fclose(a.fp);
+		return 2;
+	}
+
+	ret_a = log_next(&a);
+	ret_b = log_next(&b);
+
+	while (ret_a > 0 && ret_b > 0) {
+		if (a.cycle < b.cycle) {
+			ret_a = log_next(&a);
+		} else if (a.cycle > b.cycle) {
+			ret_b = log_next(&b);
+		} else if (a.hash == b.hash) {
+			last_match = a.cycle;
+			matched = 1;
+			common++;
+			ret_a = log_next(&a);
+			ret_b = log_next(&b);
+		} else {
+			break;
+		}
+	}
+
+	if (ret_a < 0 || ret_b < 0) {
+		printf("%s:%u: invalid record\n", ret_a < 0 ? a.file : b.file,
+		       ret_a < 0 ? a.line_num : b.line_num);
+	} else if (ret_a > 0 && ret_b > 0) {
+		if (matched)
+			printf("Runs diverge between cycle %llu and cycle %llu\n",
+			       (unsigned long long)last_match, (unsigned long long)a.cycle);
+		else
+			printf("Runs diverge before cycle %llu\n", (unsigned long long)a.cycle);
+		printf("  %s: %016llx\n  %s: %016llx\n", a.file, (unsigned long long)a.hash,
+		       b.file, (unsigned long long)b.hash);
+		status = 1;
+	} else if (common == 0) {
+		printf("No cycle in common between the logs\n");
+	} else {
+		printf("No divergence in %u common records, up to cycle %llu\n", common,
+		       (unsigned long long)last_match);
+		if (a.restarted || b.restarted)
+			printf("Note: records after a reset were not compared\n");
+		status = 0;
+	}
+
+	fclose(a.fp);
+	fclose(b.fp);
+
+	return status;
+}
@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include "../sisa.h"
+#include "../loader.h"
+#include "../coverage.h"
+
+#define MAX_IMAGES 16
+
+enum report_format {
+	REPORT_FORMAT_LISTING,
+	REPORT_FORMAT_LCOV,
+};
+
+struct image {
+	char *file;
+	uint16_t addr;
+	size_t size;
+};
+
+static void usage(char *argv[])
+{
+	printf("Usage: %s [OPTIONS] <coverage file>...\n\n"
+		"Merges the coverage files saved by sisa-emu --coverage and reports\n"
+		"the coverage of the given images.\n\n"
+		"  -l, --load addr=ADDR,file=FILE  image loaded at ADDR to report on\n"
+		"                                    (can be given up to %d times)\n"
+		"  -f, --format=FORMAT     'listing' (default) or 'lcov'\n"
+		"  -o, --output=FILE       writes the report to FILE instead of stdout\n"
+		"  -m, --merge=FILE        also saves the merged coverage to FILE\n"
+		"  -h, --help              displays this help and exit\n"
+		"\nExample:\n"
+		"\t%s -f lcov -l addr=C000,file=kernel.hex run1.cov run2.cov > kernel.info\n"
+		, argv[0], MAX_IMAGES, argv[0]);
+}
+
+enum load_subopt {
+	ADDR_OPT = 0,
+	FILE_OPT
+};
+
+static char *const load_subopt_token[] = {
+	[ADDR_OPT] = "addr",
+	[FILE_OPT] = "file",
+	NULL
+};
+
+static int parse_load_subopt(struct image *image, char *optarg)
+{
+	char *value;
+	char *subopts = optarg;
+
+	image->file = NULL;
+	image->addr = 0;
+
+	while (*subopts != '\0') {
+		switch (getsubopt(&subopts, load_subopt_token, &value)) {
+		case ADDR_OPT:
+			if (!value)
+				return 0;
+
+			image->addr = strtol(value, NULL, 16);
+			break;
+		case FILE_OPT:
+			if (!value)
+				return 0;
+
+			image->file = value;
+			break;
+		default:
+			return 0;
+		}
+	}
+
+	return image->file != NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	int i;
+	unsigned int num_images = 0;
+	long size;
+	enum report_format format = REPORT_FORMAT_LISTING;
+	const char *output = NULL;
+	const char *merge = NULL;
+	FILE *fp = stdout;
+	static struct sisa_context sisa;
+	static struct sisa_coverage coverage;
+	struct image images[MAX_IMAGES];
+
+	struct option long_options[] = {
+		{"load", required_argument, NULL, 'l'},
+		{"format", required_argument, NULL, 'f'},
+		{"output", required_argument, NULL, 'o'},
+		{"merge", required_argument, NULL, 'm'},
+		{"help", no_argument, NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+
+	while ((opt = getopt_long(argc, argv, "l:f:o:m:h", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'l':
+			if (num_images == MAX_IMAGES) {
+				printf("Too many images\n");
+				return -1;
+			}
+			if (!parse_load_subopt(&images[num_images], optarg)) {
+				printf("Invalid image '%s'\n", optarg);
+				return -1;
+			}
+			num_images++;
+			break;
+		case 'f':
+			if (strcmp(optarg, "lcov") == 0) {
+				format = REPORT_FORMAT_LCOV;
+			} else if (strcmp(optarg, "listing") == 0) {
+				format = REPORT_FORMAT_LISTING;
+			} else {
+				printf("Unknown format '%s'\n", optarg);
+				return -1;
+			}
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'm':
+			merge = optarg;
+			break;
+		case 'h':
+		default:
+			usage(argv);
+			return -1;
+		}
+	}
+
+	if (optind == argc) {
+		usage(argv);
+		return -1;
+	}
+
+	for (i = optind; i < argc; i++) {
+		if (!sisa_coverage_merge_file(&coverage, argv[i]))
+			return -1;
+	}
+
+	if (merge && !sisa_coverage_save(&coverage, merge))
+		return -1;
+
+	if (num_images == 0)
+		return 0;
+
+	sisa_init(&sisa);
+
+	for (i = 0; i < num_images; i++) {
+		if ((size = sisa_load_file(&sisa, images[i].file, images[i].addr)) < 0) {
+			printf("Error loading '%s': %s\n", images[i].file, strerror(errno));
+			return -1;
+		}
+		images[i].size = size;
+	}
+
+	if (output && !(fp = fopen(output, "w"))) {
+		printf("Error opening '%s': %s\n", output, strerror(errno));
+		return -1;
+	}
+
+	/* Later images overwrite earlier ones, like in sisa-emu */
+	for (i = 0; i < num_images; i++) {
+		if (format == REPORT_FORMAT_LCOV)
+			sisa_coverage_report_lcov(&coverage, sisa.memory, images[i].addr,
+						  images[i].size, images[i].file, fp);
+		else
+			sisa_coverage_report_listing(&coverage, sisa.memory, images[i].addr,
+						     images[i].size, images[i].file, fp);
+	}
+
+	if (fp != stdout)
+		fclose(fp);
+
+	sisa_destroy(&sisa);
+
+	return 0;
+}
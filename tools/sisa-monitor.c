@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include "../shm.h"
+
+#define DEFAULT_PERIOD_MS 500
+
+/* What a status line needs, copied out under the seqlock */
+struct snapshot {
+	uint64_t publishes;
+	uint64_t cycles;
+	uint16_t pc;
+	uint16_t green_leds;
+	uint16_t red_leds;
+	uint16_t seg_value;
+	uint8_t halted;
+	uint8_t vga[SISA_VGA_ROWS * SISA_VGA_COLS * 2];
+};
+
+static void usage(char *argv[])
+{
+	printf("Usage: %s [OPTIONS] <name>\n\n"
+		"Attaches read-only to the state a sisa-emu --shm exports under <name>\n"
+		"and prints a status line every period.\n\n"
+		"  -p, --period=MS         milliseconds between lines (defaults to "
+		"%d)\n"
+		"  -n, --count=N           exits after N lines (defaults to 0, forever)\n"
+		"  -v, --show-vga          prints the VGA text screen with each line\n"
+		"  -h, --help              displays this help and exit\n"
+		"\nExample:\n"
+		"\t./sisa-emu --shm name=/sisa prog.simg\n"
+		"\t%s -v /sisa\n"
+		, argv[0], DEFAULT_PERIOD_MS, argv[0]);
+}
+
+static void snapshot_take(const struct sisa_shm_state *state, struct snapshot *snap, int vga)
+{
+	uint32_t seq;
+
+	do {
+		seq = sisa_shm_read_begin(state);
+		snap->publishes = state->publishes;
+		snap->cycles = state->cycles;
+		snap->pc = state->pc;
+		snap->green_leds = state->io_ports[SISA_IO_PORT_LEDS_GREEN];
+		snap->red_leds = state->io_ports[SISA_IO_PORT_LEDS_RED];
+		snap->seg_value = state->io_ports[SISA_IO_PORT_7SEG_VALUE];
+		snap->halted = state->halted;
+		if (vga)
+			memcpy(snap->vga, state->memory + SISA_VGA_START_ADDR, sizeof(snap->vga));
+	} while (sisa_shm_read_retry(state, seq));
+}
+
+static void print_vga(const struct snapshot *snap)
+{
+	char line[SISA_VGA_COLS + 1];
+	unsigned int i, j;
+	char c;
+
+	for (i = 0; i < SISA_VGA_ROWS; i++) {
+		for (j = 0; j < SISA_VGA_COLS; j++) {
+			c = snap->vga[(i * SISA_VGA_COLS + j) * 2];
+			line[j] = isgraph((unsigned char)c) ? c : ' ';
+		}
+		line[j] = '\0';
+		printf("|%s|\n", line);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	unsigned int period = DEFAULT_PERIOD_MS;
+	unsigned long count = 0, lines;
+	int show_vga = 0;
+	const struct sisa_shm_state *state;
+	struct snapshot snap, prev;
+	struct timespec delay;
+
+	struct option long_options[] = {
+		{"period", required_argument, NULL, 'p'},
+		{"count", required_argument, NULL, 'n'},
+		{"show-vga", no_argument, NULL, 'v'},
+		{"help", no_argument, NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+
+	while ((opt = getopt_long(argc, argv, "p:n:vh", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'p':
+			period = strtoul(optarg, NULL, 10);
+			break;
+		case 'n':
+			count = strtoul(optarg, NULL, 10);
+			break;
+		case 'v':
+			show_vga = 1;
+			break;
+		case 'h':
+		default:
+			usage(argv);
+			return 1;
+		}
+	}
+
+	if (argc - optind != 1) {
+		usage(argv);
+		return 1;
+	}
+
+	if (!(state = sisa_shm_attach(argv[optind]))) {
+		printf("Error attaching to '%s': %s\n", argv[optind],
+		       errno == EINVAL ? "not a sisa-emu state segment" : strerror(errno));
+		return 1;
+	}
+
+	delay.tv_sec = period / 1000;
+	delay.tv_nsec = (period % 1000) * 1000000L;
+
+	snapshot_take(state, &prev, 0);
+
+	for (lines = 0; !count || lines < count; lines++) {
+		nanosleep(&delay, NULL);
+		snapshot_take(state, &snap, show_vga);
+
+		printf("cycles %llu (%.0f/s) pc 0x%04X leds %04X/%04X 7seg %04X%s\n",
+		       (unsigned long long)snap.cycles,
+		       period ? ((double)snap.cycles - prev.cycles) * 1000 / period : 0,
+		       snap.pc, snap.green_leds, snap.red_leds, snap.seg_value,
+		       snap.halted ? " halted" : snap.publishes == prev.publishes ? " idle" : "");
+		if (show_vga)
+			print_vga(&snap);
+		fflush(stdout);
+
+		prev = snap;
+	}
+
+	sisa_shm_detach(state);
+
+	return 0;
+}
@@ -0,0 +1,244 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include "../sisa.h"
+#include "../loader.h"
+#include "../image.h"
+
+#define MAX_SEGMENTS 64
+
+static void usage(char *argv[])
+{
+	printf("Usage: %s [OPTIONS] -o <program.simg> [code.bin] [data.bin]\n\n"
+		"Packs program files into a single .simg image for sisa-emu and sisa-test.\n\n"
+		"  -o, --output=FILE       image to write\n"
+		"  -l, --load addr=ADDR,file=FILE adds FILE as a segment at ADDR\n"
+		"  -p, --pc-addr=ADDR      initial address of the PC\n"
+		"                            (defaults to C000)\n"
+		"  -t, --enable-tlb        enables the TLB\n"
+		"  -i, --itlb=N:VPN:PFN:FLAGS  presets instruction TLB entry N\n"
+		"  -D, --dtlb=N:VPN:PFN:FLAGS  presets data TLB entry N\n"
+		"                            FLAGS is any of 'v', 'r' and 'p', or '-'\n"
+		"  -y, --symbols=FILE      adds the 'ADDR NAME' lines of FILE as symbols\n"
+		"  -h, --help              displays this help and exit\n"
+		"\nThe code and data files are loaded to C000 and 8000, like in sisa-emu.\n"
+		"Entries not preset keep the sisa-emu reset values.\n"
+		, argv[0]);
+}
+
+struct pack_segment {
+	uint16_t addr;
+	const char *file;
+};
+
+enum load_subopt {
+	ADDR_OPT = 0,
+	FILE_OPT
+};
+
+static char *const load_subopt_token[] = {
+	[ADDR_OPT] = "addr",
+	[FILE_OPT] = "file",
+	NULL
+};
+
+static int parse_load_subopt(struct pack_segment *seg, char *optarg)
+{
+	char *value;
+	char *subopts = optarg;
+
+	seg->addr = 0;
+	seg->file = NULL;
+
+	while (*subopts != '\0') {
+		switch (getsubopt(&subopts, load_subopt_token, &value)) {
+		case ADDR_OPT:
+			if (!value)
+				return 0;
+
+			seg->addr = strtol(value, NULL, 16);
+			break;
+		case FILE_OPT:
+			if (!value)
+				return 0;
+
+			seg->file = value;
+			break;
+		default:
+			return 0;
+		}
+	}
+
+	return seg->file != NULL;
+}
+
+static int parse_tlb(const char *arg, struct sisa_tlb *tlb)
+{
+	unsigned int n, vpn, pfn;
+	char flags[4] = "";
+	const char *f;
+
+	if (sscanf(arg, "%x:%x:%x:%3s", &n, &vpn, &pfn, flags) != 4 ||
+	    n >= SISA_NUM_TLB_ENTRIES || vpn > 0xF || pfn > 0xF)
+		return 0;
+
+	tlb->entries[n].vpn = vpn;
+	tlb->entries[n].pfn = pfn;
+	tlb->entries[n].v = 0;
+	tlb->entries[n].r = 0;
+	tlb->entries[n].p = 0;
+
+	for (f = flags; *f; f++) {
+		if (*f == 'v')
+			tlb->entries[n].v = 1;
+		else if (*f == 'r')
+			tlb->entries[n].r = 1;
+		else if (*f == 'p')
+			tlb->entries[n].p = 1;
+		else if (*f != '-')
+			return 0;
+	}
+
+	return 1;
+}
+
+static int parse_symbols(const char *file, struct sisa_image *image)
+{
+	FILE *fp;
+	char line[256], name[200];
+	unsigned int addr;
+
+	if (!(fp = fopen(file, "r"))) {
+		printf("Error opening '%s': %s\n", file, strerror(errno));
+		return 0;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "%x %199s", &addr, name) != 2)
+			continue;
+
+		image->symbols = realloc(image->symbols,
+					 (image->num_symbols + 1) * sizeof(*image->symbols));
+		image->symbols[image->num_symbols].addr = addr;
+		image->symbols[image->num_symbols].name = strdup(name);
+		image->num_symbols++;
+	}
+
+	fclose(fp);
+
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	unsigned int i, num = 0;
+	long size;
+	const char *output = NULL;
+	struct pack_segment segs[MAX_SEGMENTS];
+	struct sisa_image_segment image_segs[MAX_SEGMENTS];
+	static struct sisa_context sisa;
+	struct sisa_image image;
+	int ret = 0;
+
+	struct option long_options[] = {
+		{"output", required_argument, NULL, 'o'},
+		{"load", required_argument, NULL, 'l'},
+		{"pc-addr", required_argument, NULL, 'p'},
+		{"enable-tlb", no_argument, NULL, 't'},
+		{"itlb", required_argument, NULL, 'i'},
+		{"dtlb", required_argument, NULL, 'D'},
+		{"symbols", required_argument, NULL, 'y'},
+		{"help", no_argument, NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+
+	/* The TLB presets start from the reset values */
+	sisa_init(&sisa);
+
+	memset(&image, 0, sizeof(image));
+	image.entry_pc = SISA_CODE_LOAD_ADDR;
+	image.itlb = sisa.itlb;
+	image.dtlb = sisa.dtlb;
+
+	while ((opt = getopt_long(argc, argv, "o:l:p:ti:D:y:h", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'o':
+			output = optarg;
+			break;
+		case 'l':
+			if (num == MAX_SEGMENTS || !parse_load_subopt(&segs[num], optarg)) {
+				printf("Invalid segment '%s'\n", optarg);
+				return -1;
+			}
+			num++;
+			break;
+		case 'p':
+			image.entry_pc = strtol(optarg, NULL, 16);
+			break;
+		case 't':
+			image.tlb_enabled = 1;
+			break;
+		case 'i':
+		case 'D':
+			if (!parse_tlb(optarg, opt == 'i' ? &image.itlb : &image.dtlb)) {
+				printf("Invalid TLB entry '%s'\n", optarg);
+				return -1;
+			}
+			image.has_tlb_presets = 1;
+			break;
+		case 'y':
+			if (!parse_symbols(optarg, &image))
+				return -1;
+			break;
+		case 'h':
+		default:
+			usage(argv);
+			return -1;
+		}
+	}
+
+	if (!output || argc - optind > 2) {
+		usage(argv);
+		return -1;
+	}
+
+	for (i = 0; optind < argc && num < MAX_SEGMENTS; optind++, i++) {
+		segs[num].addr = i == 0 ? SISA_CODE_LOAD_ADDR : SISA_DATA_LOAD_ADDR;
+		segs[num].file = argv[optind];
+		num++;
+	}
+
+	/* Go through the emulator loaders so every input format is accepted */
+	for (i = 0; i < num; i++) {
+		if ((size = sisa_load_file(&sisa, segs[i].file, segs[i].addr)) < 0) {
+			printf("Error loading '%s': %s\n", segs[i].file, strerror(errno));
+			return -1;
+		}
+
+		image_segs[i].addr = segs[i].addr;
+		image_segs[i].size = size;
+	}
+
+	/* Overlapping segments all get the final contents */
+	for (i = 0; i < num; i++)
+		image_segs[i].data = sisa.memory + image_segs[i].addr;
+
+	image.segments = image_segs;
+	image.num_segments = num;
+
+	if (!sisa_image_write(output, &image)) {
+		printf("Error writing '%s': %s\n", output, strerror(errno));
+		ret = -1;
+	}
+
+	for (i = 0; i < image.num_symbols; i++)
+		free((char *)image.symbols[i].name);
+	free(image.symbols);
+
+	sisa_destroy(&sisa);
+
+	return ret;
+}
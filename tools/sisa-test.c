@@ -0,0 +1,926 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "../sisa.h"
+#include "../loader.h"
+#include "../image.h"
+#include "../stimulus.h"
+
+#define DEFAULT_CYCLES 10000000ULL
+#define MAX_TOKENS     64
+#define MESSAGE_SIZE   256
+
+/*
+ * Manifest format, one directive per line, '#' starts a comment.
+ * Addresses and values are hex, cycles and port numbers decimal.
+ *
+ *   [name]                   starts a new test case
+ *   image FILE               loads a .simg image (relative to the manifest),
+ *                            which also sets the PC and TLB
+ *   load ADDR FILE           loads FILE (relative to the manifest) to ADDR
+ *   tlb 0|1                  enables the TLB (default 0, or the image's)
+ *   pc ADDR                  initial PC (default C000, or the image's)
+ *   cycles N                 cycle budget (default 10000000)
+ *   halt yes|no              whether the CPU must halt within the budget
+ *                            (default yes)
+ *   at CYCLE key N           toggles key N when CYCLE is reached
+ *   at CYCLE switch N        toggles switch N
+ *   at CYCLE keyboard CHAR   presses the keyboard key CHAR (hex)
+ *   stimulus FILE            drives the inputs from a stimulus script
+ *                            (relative to the manifest, see stimulus.h)
+ *   compare step             also runs the case cycle by cycle with
+ *                            sisa_step_cycle(), which never fuses, and
+ *                            requires the same final state as sisa_run()
+ *                            (not with a stimulus script)
+ *   expect pc ADDR           address of the HALT instruction, or the PC
+ *                            at the end of the budget if not halting
+ *   expect rN VALUE          general purpose register N
+ *   expect sN VALUE          system register N
+ *   expect mem ADDR WORD...  consecutive memory words starting at ADDR
+ *   expect port N VALUE      I/O port N, e.g. 5 for the green LEDs
+ *   expect load error        loading the image or a file must fail, for
+ *                            malformed files; nothing runs
+ */
+
+enum stimulus_type {
+	STIMULUS_KEY,
+	STIMULUS_SWITCH,
+	STIMULUS_KEYBOARD,
+};
+
+struct test_stimulus {
+	uint64_t cycle;
+	enum stimulus_type type;
+	uint8_t value;
+};
+
+enum expect_type {
+	EXPECT_PC,
+	EXPECT_REG,
+	EXPECT_SREG,
+	EXPECT_MEM,
+	EXPECT_PORT,
+};
+
+struct test_expect {
+	enum expect_type type;
+	uint16_t addr;
+	uint16_t *values;
+	unsigned int num_values;
+};
+
+struct test_load {
+	uint16_t addr;
+	char *file;
+};
+
+struct test_case {
+	char *name;
+	char *image;
+	struct test_load *loads;
+	unsigned int num_loads;
+	int tlb_enabled;
+	int tlb_set;
+	uint16_t pc;
+	int pc_set;
+	uint64_t cycles;
+	int must_halt;
+	struct test_stimulus *stimuli;
+	unsigned int num_stimuli;
+	struct sisa_stimulus script;
+	int has_script;
+	int compare_step;
+	struct test_expect *expects;
+	unsigned int num_expects;
+	int expect_load_error;
+	int load_failed;
+	/* Results */
+	int passed;
+	char message[MESSAGE_SIZE];
+	uint64_t cycles_run;
+	double seconds;
+};
+
+struct test_suite {
+	struct test_case *tests;
+	unsigned int num_tests;
+	unsigned int next_test;
+	pthread_mutex_t lock;
+};
+
+static void usage(char *argv[])
+{
+	printf("Usage: %s [OPTIONS] <manifest>\n\n"
+		"Runs the test cases of a manifest headless and in parallel.\n\n"
+		"  -j, --jobs=N            number of tests to run at once\n"
+		"                            (defaults to the number of CPUs)\n"
+		"  -J, --json=FILE         writes the results as JSON to FILE\n"
+		"  -x, --junit=FILE        writes the results as JUnit XML to FILE\n"
+		"  -h, --help              displays this help and exit\n"
+		"\nManifest example:\n"
+		"\t[leds]\n"
+		"\tload C000 leds.hex\n"
+		"\tcycles 500000\n"
+		"\tat 1000 key 0\n"
+		"\texpect port 5 00FF\n"
+		"\texpect r1 0003\n"
+		, argv[0]);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *xrealloc_array(void *ptr, size_t num, size_t size)
+{
+	void *p = realloc(ptr, num * size);
+
+	if (!p) {
+		printf("Out of memory\n");
+		exit(-1);
+	}
+
+	return p;
+}
+
+static int parse_hex(const char *str, uint16_t *value)
+{
+	char *end;
+	unsigned long v = strtoul(str, &end, 16);
+
+	if (*str == '\0' || *end != '\0' || v > 0xFFFF)
+		return 0;
+
+	*value = v;
+
+	return 1;
+}
+
+static int parse_dec(const char *str, uint64_t *value)
+{
+	char *end;
+
+	*value = strtoull(str, &end, 10);
+
+	return *str != '\0' && *end == '\0';
+}
+
+static char *path_join(const char *dir, const char *file)
+{
+	char *path;
+
+	if (file[0] == '/' || !dir)
+		return strdup(file);
+
+	path = malloc(strlen(dir) + strlen(file) + 2);
+	if (path)
+		sprintf(path, "%s/%s", dir, file);
+
+	return path;
+}
+
+static int parse_at(struct test_case *test, char **tok, int num)
+{
+	struct test_stimulus *s;
+	uint64_t cycle, value;
+	uint16_t hex;
+
+	if (num != 4 || !parse_dec(tok[1], &cycle))
+		return 0;
+
+	test->stimuli = xrealloc_array(test->stimuli, test->num_stimuli + 1, sizeof(*s));
+	s = &test->stimuli[test->num_stimuli];
+	s->cycle = cycle;
+
+	if (strcmp(tok[2], "key") == 0 && parse_dec(tok[3], &value) && value < SISA_NUM_KEYS) {
+		s->type = STIMULUS_KEY;
+		s->value = value;
+	} else if (strcmp(tok[2], "switch") == 0 && parse_dec(tok[3], &value) &&
+		   value < SISA_NUM_SWITCHES) {
+		s->type = STIMULUS_SWITCH;
+		s->value = value;
+	} else if (strcmp(tok[2], "keyboard") == 0 && parse_hex(tok[3], &hex) && hex <= 0xFF) {
+		s->type = STIMULUS_KEYBOARD;
+		s->value = hex;
+	} else {
+		return 0;
+	}
+
+	test->num_stimuli++;
+
+	return 1;
+}
+
+static int parse_expect(struct test_case *test, char **tok, int num)
+{
+	struct test_expect e = { 0 };
+	uint64_t index;
+	int i, first_value;
+
+	if (num < 3)
+		return 0;
+
+	if (num == 3 && strcmp(tok[1], "load") == 0 && strcmp(tok[2], "error") == 0) {
+		test->expect_load_error = 1;
+		return 1;
+	}
+
+	if (strcmp(tok[1], "pc") == 0) {
+		e.type = EXPECT_PC;
+		first_value = 2;
+	} else if ((tok[1][0] == 'r' || tok[1][0] == 's') &&
+		   parse_dec(tok[1] + 1, &index) && index < 8) {
+		e.type = tok[1][0] == 'r' ? EXPECT_REG : EXPECT_SREG;
+		e.addr = index;
+		first_value = 2;
+	} else if (strcmp(tok[1], "mem") == 0) {
+		if (num < 4 || !parse_hex(tok[2], &e.addr) || (e.addr & 1))
+			return 0;
+		e.type = EXPECT_MEM;
+		first_value = 3;
+	} else if (strcmp(tok[1], "port") == 0) {
+		if (num < 4 || !parse_dec(tok[2], &index) || index >= SISA_NUM_IO_PORTS)
+			return 0;
+		e.type = EXPECT_PORT;
+		e.addr = index;
+		first_value = 3;
+	} else {
+		return 0;
+	}
+
+	e.num_values = num - first_value;
+	if (e.type != EXPECT_MEM && e.num_values != 1)
+		return 0;
+
+	e.values = xrealloc_array(NULL, e.num_values, sizeof(uint16_t));
+	for (i = 0; i < e.num_values; i++) {
+		if (!parse_hex(tok[first_value + i], &e.values[i])) {
+			free(e.values);
+			return 0;
+		}
+	}
+
+	test->expects = xrealloc_array(test->expects, test->num_expects + 1, sizeof(e));
+	test->expects[test->num_expects++] = e;
+
+	return 1;
+}
+
+static int parse_directive(struct test_case *test, const char *dir, char **tok, int num)
+{
+	uint16_t hex;
+	uint64_t value;
+
+	if (strcmp(tok[0], "image") == 0) {
+		if (num != 2 || test->image)
+			return 0;
+		if (!(test->image = path_join(dir, tok[1])))
+			return 0;
+	} else if (strcmp(tok[0], "load") == 0) {
+		if (num != 3 || !parse_hex(tok[1], &hex))
+			return 0;
+		test->loads = xrealloc_array(test->loads, test->num_loads + 1,
+					     sizeof(*test->loads));
+		test->loads[test->num_loads].addr = hex;
+		if (!(test->loads[test->num_loads].file = path_join(dir, tok[2])))
+			return 0;
+		test->num_loads++;
+	} else if (strcmp(tok[0], "tlb") == 0) {
+		if (num != 2 || !parse_dec(tok[1], &value))
+			return 0;
+		test->tlb_enabled = !!value;
+		test->tlb_set = 1;
+	} else if (strcmp(tok[0], "pc") == 0) {
+		if (num != 2 || !parse_hex(tok[1], &test->pc))
+			return 0;
+		test->pc_set = 1;
+	} else if (strcmp(tok[0], "cycles") == 0) {
+		if (num != 2 || !parse_dec(tok[1], &test->cycles))
+			return 0;
+	} else if (strcmp(tok[0], "halt") == 0) {
+		if (num != 2 || (strcmp(tok[1], "yes") != 0 && strcmp(tok[1], "no") != 0))
+			return 0;
+		test->must_halt = strcmp(tok[1], "yes") == 0;
+	} else if (strcmp(tok[0], "at") == 0) {
+		return parse_at(test, tok, num);
+	} else if (strcmp(tok[0], "stimulus") == 0) {
+		char *path;
+
+		if (num != 2 || test->has_script || !(path = path_join(dir, tok[1])))
+			return 0;
+		test->has_script = sisa_stimulus_load_file(&test->script, path);
+		free(path);
+		return test->has_script;
+	} else if (strcmp(tok[0], "compare") == 0) {
+		if (num != 2 || strcmp(tok[1], "step") != 0)
+			return 0;
+		test->compare_step = 1;
+	} else if (strcmp(tok[0], "expect") == 0) {
+		return parse_expect(test, tok, num);
+	} else {
+		return 0;
+	}
+
+	return 1;
+}
+
+static int compare_stimuli(const void *a, const void *b)
+{
+	const struct test_stimulus *x = a;
+	const struct test_stimulus *y = b;
+
+	return (x->cycle > y->cycle) - (x->cycle < y->cycle);
+}
+
+static int manifest_parse(struct test_suite *suite, const char *file)
+{
+	FILE *fp;
+	char line[1024];
+	char *tok[MAX_TOKENS];
+	char *p, *save, *name, *dir = NULL;
+	const char *slash;
+	struct test_case *test = NULL;
+	unsigned int i, line_num = 0;
+	int num;
+
+	if (!(fp = fopen(file, "r"))) {
+		printf("Error opening '%s': %s\n", file, strerror(errno));
+		return 0;
+	}
+
+	/* Load paths are relative to the manifest */
+	if ((slash = strrchr(file, '/')))
+		dir = strndup(file, slash - file);
+
+	while (fgets(line, sizeof(line), fp)) {
+		line_num++;
+
+		if ((p = strchr(line, '#')))
+			*p = '\0';
+
+		p = line + strspn(line, " \t");
+
+		/* Test names can have spaces, so they aren't tokenized */
+		if (*p == '[') {
+			name = p + 1;
+			if (!(p = strchr(name, ']')) || p[1 + strspn(p + 1, " \t\r\n")] != '\0')
+				goto error;
+			*p = '\0';
+
+			suite->tests = xrealloc_array(suite->tests, suite->num_tests + 1,
+						      sizeof(*suite->tests));
+			test = &suite->tests[suite->num_tests++];
+			memset(test, 0, sizeof(*test));
+			test->name = strdup(name);
+			test->pc = SISA_CODE_LOAD_ADDR;
+			test->cycles = DEFAULT_CYCLES;
+			test->must_halt = 1;
+			continue;
+		}
+
+		num = 0;
+		for (p = strtok_r(line, " \t\r\n", &save); p && num < MAX_TOKENS;
+		     p = strtok_r(NULL, " \t\r\n", &save))
+			tok[num++] = p;
+
+		if (num == 0)
+			continue;
+
+		if (!test || !parse_directive(test, dir, tok, num))
+			goto error;
+	}
+
+	fclose(fp);
+	free(dir);
+
+	for (i = 0; i < suite->num_tests; i++) {
+		qsort(suite->tests[i].stimuli, suite->tests[i].num_stimuli,
+		      sizeof(struct test_stimulus), compare_stimuli);
+	}
+
+	return 1;
+
+error:
+	printf("%s:%u: invalid %s\n", file, line_num, test ? "directive" : "test case");
+	fclose(fp);
+	free(dir);
+
+	return 0;
+}
+
+static void test_free(struct test_case *test)
+{
+	unsigned int i;
+
+	for (i = 0; i < test->num_loads; i++)
+		free(test->loads[i].file);
+	for (i = 0; i < test->num_expects; i++)
+		free(test->expects[i].values);
+
+	free(test->name);
+	free(test->image);
+	free(test->loads);
+	free(test->stimuli);
+	free(test->expects);
+
+	if (test->has_script)
+		sisa_stimulus_free(&test->script);
+}
+
+static void stimulus_apply(struct sisa_context *sisa, const struct test_stimulus *s)
+{
+	switch (s->type) {
+	case STIMULUS_KEY:
+		sisa_key_toggle(sisa, s->value);
+		break;
+	case STIMULUS_SWITCH:
+		sisa_switch_toggle(sisa, s->value);
+		break;
+	case STIMULUS_KEYBOARD:
+		sisa_keyboard_press(sisa, s->value);
+		break;
+	}
+}
+
+/* Returns 1 if the expectation holds, otherwise fills in the message */
+static int expect_check(const struct sisa_context *sisa, const struct test_expect *e,
+			char *message)
+{
+	unsigned int i;
+	uint16_t actual, addr;
+
+	for (i = 0; i < e->num_values; i++) {
+		switch (e->type) {
+		case EXPECT_PC:
+			actual = sisa->cpu.halted ? sisa->cpu.pc - 2 : sisa->cpu.pc;
+			if (actual != e->values[0]) {
+				snprintf(message, MESSAGE_SIZE, "pc is 0x%04X, expected 0x%04X",
+					 actual, e->values[0]);
+				return 0;
+			}
+			break;
+		case EXPECT_REG:
+		case EXPECT_SREG:
+			actual = e->type == EXPECT_REG ? sisa_reg_get(sisa, e->addr) :
+				 sisa_sreg_get(sisa, e->addr);
+			if (actual != e->values[0]) {
+				snprintf(message, MESSAGE_SIZE, "%c%d is 0x%04X, expected 0x%04X",
+					 e->type == EXPECT_REG ? 'r' : 's', e->addr, actual,
+					 e->values[0]);
+				return 0;
+			}
+			break;
+		case EXPECT_MEM:
+			addr = e->addr + 2 * i;
+			actual = sisa->memory[(uint16_t)(addr + 1)] << 8 | sisa->memory[addr];
+			if (actual != e->values[i]) {
+				snprintf(message, MESSAGE_SIZE,
+					 "memory at 0x%04X is 0x%04X, expected 0x%04X",
+					 addr, actual, e->values[i]);
+				return 0;
+			}
+			break;
+		case EXPECT_PORT:
+			actual = sisa_io_port_get(sisa, e->addr);
+			if (actual != e->values[0]) {
+				snprintf(message, MESSAGE_SIZE, "port %d is 0x%04X, expected 0x%04X",
+					 e->addr, actual, e->values[0]);
+				return 0;
+			}
+			break;
+		}
+	}
+
+	return 1;
+}
+
+/* Loads the program and applies the settings, returns 0 and fills in the message on errors */
+static int test_setup(struct test_case *test, struct sisa_context *sisa)
+{
+	unsigned int i;
+
+	sisa_init(sisa);
+	sisa_tlb_set_enabled(sisa, test->tlb_enabled);
+	sisa_set_pc(sisa, test->pc);
+
+	if (test->image) {
+		struct sisa_image image;
+
+		if (sisa_image_load(sisa, test->image, &image) < 0) {
+			test->load_failed = 1;
+			snprintf(test->message, MESSAGE_SIZE, "error loading '%s': %s",
+				 test->image, errno == EINVAL ? "invalid or corrupted image" :
+				 strerror(errno));
+			return 0;
+		}
+		sisa_image_free(&image);
+	}
+
+	for (i = 0; i < test->num_loads; i++) {
+		if (sisa_load_file(sisa, test->loads[i].file, test->loads[i].addr) < 0) {
+			test->load_failed = 1;
+			snprintf(test->message, MESSAGE_SIZE, "error loading '%s': %s",
+				 test->loads[i].file, strerror(errno));
+			return 0;
+		}
+	}
+
+	/* Explicit settings override the image */
+	if (test->tlb_set)
+		sisa_tlb_set_enabled(sisa, test->tlb_enabled);
+	if (test->pc_set)
+		sisa_set_pc(sisa, test->pc);
+
+	return 1;
+}
+
+/* Like sisa_run() without a breakpoint or callback to stop it, but a cycle at a time */
+static void step_cycles(struct sisa_context *sisa, uint64_t cycles)
+{
+	const uint64_t end = sisa->cpu.cycles + cycles;
+
+	while (sisa->cpu.cycles < end && !sisa->cpu.halted)
+		sisa_step_cycle(sisa);
+}
+
+static void test_execute(struct test_case *test, struct sisa_context *sisa, int step)
+{
+	unsigned int i;
+	uint64_t until;
+
+	for (i = 0; i <= test->num_stimuli && !sisa->cpu.halted; i++) {
+		until = i < test->num_stimuli && test->stimuli[i].cycle < test->cycles ?
+			test->stimuli[i].cycle : test->cycles;
+
+		/* A stop action ends the run */
+		if (until > sisa->cpu.cycles && test->has_script) {
+			if (sisa_stimulus_run(&test->script, until - sisa->cpu.cycles) ==
+			    SISA_STOP_CALLBACK)
+				break;
+		} else if (until > sisa->cpu.cycles && step) {
+			step_cycles(sisa, until - sisa->cpu.cycles);
+		} else if (until > sisa->cpu.cycles) {
+			sisa_run(sisa, until - sisa->cpu.cycles);
+		}
+
+		if (sisa->cpu.cycles >= test->cycles)
+			break;
+
+		if (i < test->num_stimuli && !sisa->cpu.halted)
+			stimulus_apply(sisa, &test->stimuli[i]);
+	}
+}
+
+/* Returns 1 if both runs ended in the same state, otherwise fills in the message */
+static int state_compare(const struct sisa_context *run, const struct sisa_context *step,
+			 char *message)
+{
+	unsigned int i;
+
+	if (run->cpu.cycles != step->cpu.cycles) {
+		snprintf(message, MESSAGE_SIZE, "sisa_run() ran %llu cycles, stepping %llu",
+			 (unsigned long long)run->cpu.cycles, (unsigned long long)step->cpu.cycles);
+		return 0;
+	}
+
+	if (run->cpu.pc != step->cpu.pc || run->cpu.ir != step->cpu.ir ||
+	    run->cpu.status != step->cpu.status || run->cpu.halted != step->cpu.halted) {
+		snprintf(message, MESSAGE_SIZE,
+			 "sisa_run() ended at pc 0x%04X ir 0x%04X, stepping at pc 0x%04X ir 0x%04X",
+			 run->cpu.pc, run->cpu.ir, step->cpu.pc, step->cpu.ir);
+		return 0;
+	}
+
+	for (i = 0; i < 8; i++) {
+		if (run->cpu.regfile.general.regs[i] != step->cpu.regfile.general.regs[i] ||
+		    run->cpu.regfile.system.regs[i] != step->cpu.regfile.system.regs[i]) {
+			snprintf(message, MESSAGE_SIZE,
+				 "sisa_run() ended with r%u 0x%04X s%u 0x%04X, stepping with "
+				 "r%u 0x%04X s%u 0x%04X", i, run->cpu.regfile.general.regs[i],
+				 i, run->cpu.regfile.system.regs[i], i,
+				 step->cpu.regfile.general.regs[i], i,
+				 step->cpu.regfile.system.regs[i]);
+			return 0;
+		}
+	}
+
+	for (i = 0; i < SISA_NUM_IO_PORTS; i++) {
+		if (run->io_ports[i] != step->io_ports[i]) {
+			snprintf(message, MESSAGE_SIZE,
+				 "sisa_run() ended with port %u 0x%04X, stepping with 0x%04X",
+				 i, run->io_ports[i], step->io_ports[i]);
+			return 0;
+		}
+	}
+
+	for (i = 0; i < SISA_MEMORY_SIZE; i++) {
+		if (run->memory[i] != step->memory[i]) {
+			snprintf(message, MESSAGE_SIZE,
+				 "sisa_run() ended with byte 0x%02X at 0x%04X, stepping with 0x%02X",
+				 run->memory[i], i, step->memory[i]);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static void test_run(struct test_case *test)
+{
+	struct sisa_context *sisa, *stepped = NULL;
+	unsigned int i;
+	double start = now();
+
+	test->passed = 0;
+
+	/* sisa_init() leaves memory alone, zeroed it's the same for every run */
+	if (!(sisa = calloc(1, sizeof(*sisa)))) {
+		snprintf(test->message, MESSAGE_SIZE, "out of memory");
+		return;
+	}
+
+	if (!test_setup(test, sisa)) {
+		test->passed = test->expect_load_error && test->load_failed;
+		goto out;
+	}
+
+	if (test->expect_load_error) {
+		snprintf(test->message, MESSAGE_SIZE, "loading didn't fail");
+		goto out;
+	}
+
+	if (test->has_script && !sisa_stimulus_arm(&test->script, sisa)) {
+		snprintf(test->message, MESSAGE_SIZE, "no write watch left for the stimulus script");
+		goto out;
+	}
+
+	test_execute(test, sisa, 0);
+
+	test->cycles_run = sisa->cpu.cycles;
+
+	if (test->must_halt && !sisa->cpu.halted) {
+		snprintf(test->message, MESSAGE_SIZE, "didn't halt within %llu cycles",
+			 (unsigned long long)test->cycles);
+		goto out;
+	}
+
+	for (i = 0; i < test->num_expects; i++) {
+		if (!expect_check(sisa, &test->expects[i], test->message))
+			goto out;
+	}
+
+	if (test->compare_step) {
+		if (test->has_script) {
+			snprintf(test->message, MESSAGE_SIZE,
+				 "compare step can't replay a stimulus script");
+			goto out;
+		}
+
+		if (!(stepped = calloc(1, sizeof(*stepped)))) {
+			snprintf(test->message, MESSAGE_SIZE, "out of memory");
+			goto out;
+		}
+
+		if (!test_setup(test, stepped))
+			goto out;
+
+		test_execute(test, stepped, 1);
+
+		if (!state_compare(sisa, stepped, test->message))
+			goto out;
+	}
+
+	test->passed = 1;
+
+out:
+	if (test->has_script)
+		sisa_stimulus_disarm(&test->script);
+	if (stepped) {
+		sisa_destroy(stepped);
+		free(stepped);
+	}
+	sisa_destroy(sisa);
+	free(sisa);
+	test->seconds = now() - start;
+}
+
+static void *worker(void *arg)
+{
+	struct test_suite *suite = arg;
+	unsigned int i;
+
+	while (1) {
+		pthread_mutex_lock(&suite->lock);
+		i = suite->next_test++;
+		pthread_mutex_unlock(&suite->lock);
+
+		if (i >= suite->num_tests)
+			break;
+
+		test_run(&suite->tests[i]);
+	}
+
+	return NULL;
+}
+
+static void fprint_escaped(FILE *fp, const char *str, int xml)
+{
+	for (; *str; str++) {
+		if (xml && *str == '<')
+			fputs("&lt;", fp);
+		else if (xml && *str == '>')
+			fputs("&gt;", fp);
+		else if (xml && *str == '&')
+			fputs("&amp;", fp);
+		else if (xml && *str == '"')
+			fputs("&quot;", fp);
+		else if (!xml && (*str == '"' || *str == '\\'))
+			fprintf(fp, "\\%c", *str);
+		else
+			fputc(*str, fp);
+	}
+}
+
+static int write_json(const char *file, const struct test_suite *suite)
+{
+	FILE *fp;
+	unsigned int i;
+	const struct test_case *test;
+
+	if (!(fp = fopen(file, "w"))) {
+		printf("Error opening '%s': %s\n", file, strerror(errno));
+		return 0;
+	}
+
+	/* One result per line, like the benchmark results */
+	fprintf(fp, "{\n  \"results\": [\n");
+
+	for (i = 0; i < suite->num_tests; i++) {
+		test = &suite->tests[i];
+
+		fprintf(fp, "    {\"name\": \"");
+		fprint_escaped(fp, test->name, 0);
+		fprintf(fp, "\", \"passed\": %s, \"cycles\": %llu, \"seconds\": %.6f, "
+			"\"message\": \"", test->passed ? "true" : "false",
+			(unsigned long long)test->cycles_run, test->seconds);
+		fprint_escaped(fp, test->passed ? "" : test->message, 0);
+		fprintf(fp, "\"}%s\n", i + 1 < suite->num_tests ? "," : "");
+	}
+
+	fprintf(fp, "  ]\n}\n");
+	fclose(fp);
+
+	return 1;
+}
+
+static int write_junit(const char *file, const char *name, const struct test_suite *suite,
+		       unsigned int failures, double seconds)
+{
+	FILE *fp;
+	unsigned int i;
+	const struct test_case *test;
+
+	if (!(fp = fopen(file, "w"))) {
+		printf("Error opening '%s': %s\n", file, strerror(errno));
+		return 0;
+	}
+
+	fprintf(fp, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<testsuite name=\"");
+	fprint_escaped(fp, name, 1);
+	fprintf(fp, "\" tests=\"%u\" failures=\"%u\" time=\"%.6f\">\n", suite->num_tests,
+		failures, seconds);
+
+	for (i = 0; i < suite->num_tests; i++) {
+		test = &suite->tests[i];
+
+		fprintf(fp, "  <testcase classname=\"sisa\" name=\"");
+		fprint_escaped(fp, test->name, 1);
+		fprintf(fp, "\" time=\"%.6f\"", test->seconds);
+
+		if (test->passed) {
+			fprintf(fp, "/>\n");
+		} else {
+			fprintf(fp, ">\n    <failure message=\"");
+			fprint_escaped(fp, test->message, 1);
+			fprintf(fp, "\"/>\n  </testcase>\n");
+		}
+	}
+
+	fprintf(fp, "</testsuite>\n");
+	fclose(fp);
+
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	unsigned int i;
+	unsigned int jobs = 0;
+	unsigned int failures = 0;
+	const char *json = NULL;
+	const char *junit = NULL;
+	struct test_suite suite = { 0 };
+	pthread_t *threads;
+	double start;
+	int ret = 0;
+
+	struct option long_options[] = {
+		{"jobs", required_argument, NULL, 'j'},
+		{"json", required_argument, NULL, 'J'},
+		{"junit", required_argument, NULL, 'x'},
+		{"help", no_argument, NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+
+	while ((opt = getopt_long(argc, argv, "j:J:x:h", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'j':
+			jobs = strtoul(optarg, NULL, 10);
+			break;
+		case 'J':
+			json = optarg;
+			break;
+		case 'x':
+			junit = optarg;
+			break;
+		case 'h':
+		default:
+			usage(argv);
+			return -1;
+		}
+	}
+
+	if (optind != argc - 1) {
+		usage(argv);
+		return -1;
+	}
+
+	if (!manifest_parse(&suite, argv[optind]))
+		return -1;
+
+	if (jobs == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		jobs = cpus > 0 ? cpus : 1;
+	}
+
+	if (jobs > suite.num_tests)
+		jobs = suite.num_tests ? suite.num_tests : 1;
+
+	threads = calloc(jobs, sizeof(*threads));
+	pthread_mutex_init(&suite.lock, NULL);
+
+	start = now();
+
+	for (i = 0; i < jobs; i++) {
+		if ((ret = pthread_create(&threads[i], NULL, worker, &suite)) != 0) {
+			printf("Error creating thread: %s\n", strerror(ret));
+			return -1;
+		}
+	}
+
+	for (i = 0; i < jobs; i++)
+		pthread_join(threads[i], NULL);
+
+	/* Reported in manifest order, whatever order they finished in */
+	for (i = 0; i < suite.num_tests; i++) {
+		if (suite.tests[i].passed) {
+			printf("PASS %s (%llu cycles)\n", suite.tests[i].name,
+			       (unsigned long long)suite.tests[i].cycles_run);
+		} else {
+			printf("FAIL %s: %s\n", suite.tests[i].name, suite.tests[i].message);
+			failures++;
+		}
+	}
+
+	printf("\n%u/%u tests passed in %.3f seconds\n", suite.num_tests - failures,
+	       suite.num_tests, now() - start);
+
+	if (json && !write_json(json, &suite))
+		ret = -1;
+
+	if (junit && !write_junit(junit, argv[optind], &suite, failures, now() - start))
+		ret = -1;
+
+	if (failures)
+		ret = 1;
+
+	for (i = 0; i < suite.num_tests; i++)
+		test_free(&suite.tests[i]);
+
+	pthread_mutex_destroy(&suite.lock);
+	free(suite.tests);
+	free(threads);
+
+	return ret;
+}
@@ -0,0 +1,22 @@
+#ifndef UTIL_H
+#define UTIL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Helpers shared by the libsisa sources, not part of its API */
+
+/* 64 bit FNV-1a */
+#define SISA_FNV_OFFSET_BASIS 0xCBF29CE484222325ULL
+#define SISA_FNV_PRIME        0x100000001B3ULL
+
+uint64_t sisa_fnv_bytes(uint64_t h, const uint8_t *data, size_t size);
+/* The zlib and PNG CRC-32, start from 0 */
+uint32_t sisa_crc32_update(uint32_t crc, const uint8_t *data, size_t size);
+
+static inline double sisa_percent(uint64_t part, uint64_t total)
+{
+	return total ? 100.0 * part / total : 0.0;
+}
+
+#endif
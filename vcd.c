@@ -0,0 +1,378 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "vcd.h"
+
+#define ID_FIRST '!'
+#define ID_LAST  '~'
+#define ID_BASE  (ID_LAST - ID_FIRST + 1)
+
+enum cpu_signal {
+	SIGNAL_PC,
+	SIGNAL_IR,
+	SIGNAL_STATUS,
+	SIGNAL_EXCEPTION,
+	SIGNAL_INTS_PENDING,
+	SIGNAL_HALTED,
+	SIGNAL_R0,
+	SIGNAL_S0 = SIGNAL_R0 + 8,
+	NUM_CPU_SIGNALS = SIGNAL_S0 + 8,
+};
+
+static const struct {
+	const char *name;
+	unsigned int width;
+} cpu_signals[NUM_CPU_SIGNALS] = {
+	[SIGNAL_PC] = { "pc", 16 },
+	[SIGNAL_IR] = { "ir", 16 },
+	[SIGNAL_STATUS] = { "status", 3 },
+	[SIGNAL_EXCEPTION] = { "exception", 4 },
+	[SIGNAL_INTS_PENDING] = { "ints_pending", 4 },
+	[SIGNAL_HALTED] = { "halted", 1 },
+	[SIGNAL_R0 + 0] = { "r0", 16 },
+	[SIGNAL_R0 + 1] = { "r1", 16 },
+	[SIGNAL_R0 + 2] = { "r2", 16 },
+	[SIGNAL_R0 + 3] = { "r3", 16 },
+	[SIGNAL_R0 + 4] = { "r4", 16 },
+	[SIGNAL_R0 + 5] = { "r5", 16 },
+	[SIGNAL_R0 + 6] = { "r6", 16 },
+	[SIGNAL_R0 + 7] = { "r7", 16 },
+	[SIGNAL_S0 + 0] = { "s0", 16 },
+	[SIGNAL_S0 + 1] = { "s1", 16 },
+	[SIGNAL_S0 + 2] = { "s2", 16 },
+	[SIGNAL_S0 + 3] = { "s3", 16 },
+	[SIGNAL_S0 + 4] = { "s4", 16 },
+	[SIGNAL_S0 + 5] = { "s5", 16 },
+	[SIGNAL_S0 + 6] = { "s6", 16 },
+	[SIGNAL_S0 + 7] = { "psw", 16 },
+};
+
+/* A value change is at most 'b', 16 bits, a space, the identifier and a newline */
+#define MAX_CHANGE_LEN (1 + 16 + 1 + 2 + 1)
+/* The timestamp and the $dumpvars around the first sample */
+#define MAX_SAMPLE_EXTRA 96
+
+static unsigned int signal_width(unsigned int i)
+{
+	return i < NUM_CPU_SIGNALS ? cpu_signals[i].width : 16;
+}
+
+/* Identifiers out of the printable characters, a single one for the first 94 signals */
+static char *put_id(char *p, unsigned int i)
+{
+	do {
+		*p++ = ID_FIRST + i % ID_BASE;
+		i /= ID_BASE;
+	} while (i);
+
+	return p;
+}
+
+/* Leading zeros left out, VCD extends the value with them */
+static char *put_change(char *p, unsigned int width, uint16_t value, unsigned int id)
+{
+	int bit;
+
+	if (width == 1) {
+		*p++ = '0' + (value & 1);
+	} else {
+		*p++ = 'b';
+		for (bit = width - 1; bit > 0 && !(value >> bit); bit--)
+			;
+		for (; bit >= 0; bit--)
+			*p++ = '0' + ((value >> bit) & 1);
+		*p++ = ' ';
+	}
+
+	p = put_id(p, id);
+	*p++ = '\n';
+
+	return p;
+}
+
+static void collect(const struct sisa_vcd *vcd, const struct sisa_context *sisa, uint16_t *values)
+{
+	const struct sisa_cpu *cpu = &sisa->cpu;
+	unsigned int i;
+
+	values[SIGNAL_PC] = cpu->pc;
+	values[SIGNAL_IR] = cpu->ir;
+	values[SIGNAL_STATUS] = cpu->status;
+	values[SIGNAL_EXCEPTION] = cpu->exception;
+	values[SIGNAL_INTS_PENDING] = cpu->ints_pending;
+	values[SIGNAL_HALTED] = cpu->halted != 0;
+	memcpy(values + SIGNAL_R0, cpu->regfile.general.regs, sizeof(cpu->regfile.general.regs));
+	memcpy(values + SIGNAL_S0, cpu->regfile.system.regs, sizeof(cpu->regfile.system.regs));
+
+	for (i = 0; i < vcd->config.num_ports; i++)
+		values[NUM_CPU_SIGNALS + i] = sisa->io_ports[vcd->config.ports[i]];
+}
+
+static void *writer_thread(void *arg)
+{
+	struct sisa_vcd *vcd = arg;
+	unsigned int i;
+
+	pthread_mutex_lock(&vcd->lock);
+
+	while (1) {
+		while (!vcd->count && !vcd->done)
+			pthread_cond_wait(&vcd->not_empty, &vcd->lock);
+
+		if (!vcd->count)
+			break;
+
+		/* The buffer stays counted until written, so it isn't reused meanwhile */
+		i = vcd->head;
+		pthread_mutex_unlock(&vcd->lock);
+
+		if (fwrite(vcd->buffers[i], 1, vcd->lengths[i], vcd->fp) != vcd->lengths[i])
+			vcd->error = 1;
+
+		pthread_mutex_lock(&vcd->lock);
+		vcd->head = (vcd->head + 1) % SISA_VCD_NUM_BUFFERS;
+		vcd->count--;
+		pthread_cond_signal(&vcd->not_full);
+	}
+
+	pthread_mutex_unlock(&vcd->lock);
+
+	return NULL;
+}
+
+/* Hands the current buffer to the writer thread, waits for a free one if there's none */
+static void submit(struct sisa_vcd *vcd)
+{
+	pthread_mutex_lock(&vcd->lock);
+	vcd->count++;
+	pthread_cond_signal(&vcd->not_empty);
+
+	while (vcd->count == SISA_VCD_NUM_BUFFERS)
+		pthread_cond_wait(&vcd->not_full, &vcd->lock);
+
+	vcd->cur = (vcd->head + vcd->count) % SISA_VCD_NUM_BUFFERS;
+	pthread_mutex_unlock(&vcd->lock);
+
+	vcd->lengths[vcd->cur] = 0;
+}
+
+static void write_header(struct sisa_vcd *vcd)
+{
+	char id[4];
+	unsigned int i;
+
+	fprintf(vcd->fp,
+		"$version\n\tsisa-emu\n$end\n"
+		"$comment\n\tcycle N at N * %u ns\n$end\n"
+		"$timescale 1 ns $end\n"
+		"$scope module sisa $end\n", SISA_VCD_CYCLE_NS);
+
+	for (i = 0; i < vcd->num_signals; i++) {
+		*put_id(id, i) = '\0';
+		if (i < NUM_CPU_SIGNALS)
+			fprintf(vcd->fp, "$var wire %u %s %s $end\n", cpu_signals[i].width, id,
+				cpu_signals[i].name);
+		else
+			fprintf(vcd->fp, "$var wire 16 %s port_%u $end\n", id,
+				vcd->config.ports[i - NUM_CPU_SIGNALS]);
+	}
+
+	fprintf(vcd->fp, "$upscope $end\n$enddefinitions $end\n");
+}
+
+void sisa_vcd_config_default(struct sisa_vcd_config *config)
+{
+	memset(config, 0, sizeof(*config));
+	sisa_vcd_parse_ports(config, SISA_VCD_DEFAULT_PORTS);
+}
+
+int sisa_vcd_parse_ports(struct sisa_vcd_config *config, const char *list)
+{
+	const char *p = list;
+	char *end;
+	unsigned long port;
+
+	config->num_ports = 0;
+
+	while (*p != '\0') {
+		port = strtoul(p, &end, 0);
+		if (end == p || (*end != ':' && *end != '\0') || port >= SISA_NUM_IO_PORTS ||
+		    config->num_ports == SISA_NUM_IO_PORTS) {
+			printf("Error: invalid port list '%s'\n", list);
+			return 0;
+		}
+
+		config->ports[config->num_ports++] = port;
+		p = *end == ':' ? end + 1 : end;
+	}
+
+	return 1;
+}
+
+int sisa_vcd_open(struct sisa_vcd *vcd, const char *file, const struct sisa_vcd_config *config)
+{
+	unsigned int i;
+	int err;
+
+	memset(vcd, 0, sizeof(*vcd));
+	vcd->config = *config;
+	vcd->config.trigger = NULL;
+	vcd->num_signals = NUM_CPU_SIGNALS + config->num_ports;
+
+	if (config->trigger) {
+		if (!sisa_cond_compile_polled(&vcd->trigger, config->trigger))
+			return 0;
+		vcd->has_trigger = 1;
+	}
+
+	vcd->file = strdup(file);
+	vcd->values = malloc(vcd->num_signals * sizeof(*vcd->values));
+	for (i = 0; i < SISA_VCD_NUM_BUFFERS; i++) {
+		if (!(vcd->buffers[i] = malloc(SISA_VCD_BUFFER_SIZE)))
+			break;
+	}
+
+	if (!vcd->file || !vcd->values || i < SISA_VCD_NUM_BUFFERS) {
+		printf("Error allocating the VCD buffers\n");
+		goto error;
+	}
+
+	if (!(vcd->fp = fopen(file, "w"))) {
+		printf("Error opening '%s': %s\n", file, strerror(errno));
+		goto error;
+	}
+
+	write_header(vcd);
+
+	pthread_mutex_init(&vcd->lock, NULL);
+	pthread_cond_init(&vcd->not_empty, NULL);
+	pthread_cond_init(&vcd->not_full, NULL);
+
+	if ((err = pthread_create(&vcd->thread, NULL, writer_thread, vcd))) {
+		printf("Error starting the VCD writer: %s\n", strerror(err));
+		pthread_mutex_destroy(&vcd->lock);
+		pthread_cond_destroy(&vcd->not_empty);
+		pthread_cond_destroy(&vcd->not_full);
+		fclose(vcd->fp);
+		goto error;
+	}
+
+	return 1;
+
+error:
+	for (i = 0; i < SISA_VCD_NUM_BUFFERS; i++)
+		free(vcd->buffers[i]);
+	free(vcd->values);
+	free(vcd->file);
+	if (vcd->has_trigger)
+		sisa_cond_free(&vcd->trigger);
+	vcd->fp = NULL;
+	return 0;
+}
+
+/* The last values last until the end of the last cycle recorded */
+static void finish(struct sisa_vcd *vcd)
+{
+	char *buf = vcd->buffers[vcd->cur];
+
+	if (vcd->state == SISA_VCD_RECORDING)
+		vcd->lengths[vcd->cur] += sprintf(buf + vcd->lengths[vcd->cur], "#%llu\n",
+						  (unsigned long long)(vcd->last_cycle + 1) *
+						  SISA_VCD_CYCLE_NS);
+
+	vcd->state = SISA_VCD_DONE;
+}
+
+void sisa_vcd_sample(struct sisa_vcd *vcd, const struct sisa_context *sisa)
+{
+	uint64_t cycles = sisa->cpu.cycles;
+	uint16_t values[NUM_CPU_SIGNALS + SISA_NUM_IO_PORTS];
+	char *buf, *p;
+	int first = 0, changed = 0;
+	unsigned int i;
+
+	if (vcd->state == SISA_VCD_RECORDING && cycles <= vcd->last_cycle)
+		return;
+
+	if (vcd->state == SISA_VCD_WAITING) {
+		if (vcd->has_trigger && !sisa_cond_eval(&vcd->trigger, sisa))
+			return;
+		vcd->state = SISA_VCD_RECORDING;
+		vcd->start = cycles;
+		first = 1;
+	}
+
+	if (vcd->config.cycles && cycles - vcd->start >= vcd->config.cycles) {
+		finish(vcd);
+		return;
+	}
+
+	if (SISA_VCD_BUFFER_SIZE - vcd->lengths[vcd->cur] <
+	    vcd->num_signals * MAX_CHANGE_LEN + MAX_SAMPLE_EXTRA)
+		submit(vcd);
+
+	collect(vcd, sisa, values);
+
+	buf = vcd->buffers[vcd->cur];
+	p = buf + vcd->lengths[vcd->cur];
+
+	for (i = 0; i < vcd->num_signals; i++) {
+		if (!first && values[i] == vcd->values[i])
+			continue;
+
+		if (!changed) {
+			p += sprintf(p, "#%llu\n", (unsigned long long)cycles * SISA_VCD_CYCLE_NS);
+			if (first)
+				p += sprintf(p, "$dumpvars\n");
+			changed = 1;
+		}
+
+		p = put_change(p, signal_width(i), values[i], i);
+		vcd->values[i] = values[i];
+	}
+
+	if (first)
+		p += sprintf(p, "$end\n");
+
+	vcd->lengths[vcd->cur] = p - buf;
+	vcd->last_cycle = cycles;
+}
+
+int sisa_vcd_close(struct sisa_vcd *vcd)
+{
+	unsigned int i;
+	int ok;
+
+	if (!vcd->fp)
+		return 0;
+
+	finish(vcd);
+
+	pthread_mutex_lock(&vcd->lock);
+	if (vcd->lengths[vcd->cur])
+		vcd->count++;
+	vcd->done = 1;
+	pthread_cond_signal(&vcd->not_empty);
+	pthread_mutex_unlock(&vcd->lock);
+
+	pthread_join(vcd->thread, NULL);
+
+	ok = !vcd->error;
+	if (fclose(vcd->fp))
+		ok = 0;
+	if (!ok)
+		printf("Error writing '%s'\n", vcd->file);
+
+	pthread_mutex_destroy(&vcd->lock);
+	pthread_cond_destroy(&vcd->not_empty);
+	pthread_cond_destroy(&vcd->not_full);
+	for (i = 0; i < SISA_VCD_NUM_BUFFERS; i++)
+		free(vcd->buffers[i]);
+	free(vcd->values);
+	free(vcd->file);
+	if (vcd->has_trigger)
+		sisa_cond_free(&vcd->trigger);
+	vcd->fp = NULL;
+
+	return ok;
+}
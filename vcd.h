@@ -0,0 +1,99 @@
+#ifndef VCD_H
+#define VCD_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "sisa.h"
+#include "cond.h"
+
+/* Nanoseconds per cycle, the VCD timescale is 1 ns */
+#define SISA_VCD_CYCLE_NS     (1000000000 / SISA_CPU_CLK_FREQ)
+#define SISA_VCD_DEFAULT_PORTS "5:6:7:8:9:10"
+#define SISA_VCD_NUM_BUFFERS  4
+#define SISA_VCD_BUFFER_SIZE  (256 * 1024)
+
+/*
+ * Signals, sampled after every cycle under the 'sisa' scope:
+ *
+ *   pc[15:0] ir[15:0]                   the CPU registers
+ *   status[2:0]                         0 fetch, 1 demw, 2 system, 3 nop,
+ *                                       4 stall (see enum sisa_cpu_status)
+ *   exception[3:0] ints_pending[3:0]    the last exception code and the
+ *                                       pending interrupts
+ *   halted
+ *   r0-r7[15:0] s0-s6[15:0] psw[15:0]   the register files, psw is s7
+ *   port_N[15:0]                        each selected I/O port
+ */
+enum sisa_vcd_state {
+	SISA_VCD_WAITING,
+	SISA_VCD_RECORDING,
+	SISA_VCD_DONE,
+};
+
+struct sisa_vcd_config {
+	/* First cycle to record, or to check the trigger at */
+	uint64_t from;
+	/* Cycles to record once started, 0 until the end */
+	uint64_t cycles;
+	/* Condition (see cond.h) that starts the recording, checked every cycle from 'from' on */
+	const char *trigger;
+	unsigned int num_ports;
+	uint8_t ports[SISA_NUM_IO_PORTS];
+};
+
+struct sisa_vcd {
+	char *file;
+	FILE *fp;
+	struct sisa_vcd_config config;
+	struct sisa_cond trigger;
+	int has_trigger;
+	enum sisa_vcd_state state;
+	unsigned int num_signals;
+	uint16_t *values;
+	uint64_t start;
+	uint64_t last_cycle;
+	/* Buffers go round: count of them from head are full, waiting for the writer thread */
+	char *buffers[SISA_VCD_NUM_BUFFERS];
+	size_t lengths[SISA_VCD_NUM_BUFFERS];
+	unsigned int cur;
+	unsigned int head;
+	unsigned int count;
+	int done;
+	/* Set by the writer thread */
+	int error;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+};
+
+/* Records from cycle 0 on, the default ports, no trigger */
+void sisa_vcd_config_default(struct sisa_vcd_config *config);
+
+/* Parses a ':' separated list of ports over the config's. Returns 0 and prints why on errors */
+int sisa_vcd_parse_ports(struct sisa_vcd_config *config, const char *list);
+
+/*
+ * Creates file, writes the header and starts the writer thread. Returns
+ * 0 and prints why on errors, a bad trigger included.
+ */
+int sisa_vcd_open(struct sisa_vcd *vcd, const char *file, const struct sisa_vcd_config *config);
+/* Writes what's left and closes the file. Returns 0 and prints why if any write failed */
+int sisa_vcd_close(struct sisa_vcd *vcd);
+
+/*
+ * Writes the signals that changed since the last sample, when recording.
+ * Time only moves forward in the file: cycles at or before the last one
+ * sampled, after stepping back or a reset, are left out.
+ */
+void sisa_vcd_sample(struct sisa_vcd *vcd, const struct sisa_context *sisa);
+
+/* Cheap to call after every cycle */
+static inline void sisa_vcd_update(struct sisa_vcd *vcd, const struct sisa_context *sisa)
+{
+	if (vcd->state != SISA_VCD_DONE && sisa->cpu.cycles >= vcd->config.from)
+		sisa_vcd_sample(vcd, sisa);
+}
+
+#endif